@@ -0,0 +1,829 @@
+/**
+ * @file      bench.c
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Benchmark of the walk, the ignore matcher and the writer, each
+ *            on its own and all together, on a generated tree that is the
+ *            same for the same options. Results are printed as JSON, so that
+ *            runs of different versions can be compared.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include "common.h"
+#include "ignore.h"
+#include "ingestify.h"
+#include "pwalk.h"
+#include "writer.h"
+#include "bench_common.h"
+
+#define BENCH_TREE       "bench_tree"       /**< Default tree, made in the working directory */
+#define BENCH_OUTPUT     "bench_output.txt" /**< Output of the write phases */
+#define BENCH_PATTERN    (64 * 1024)        /**< Bytes of generated text that files are cut from */
+#define BENCH_RULE_KINDS 7
+
+/**
+ * @brief Shape of the generated tree, and how the benchmark is run.
+ */
+typedef struct
+{
+    const char *dir;
+    unsigned int depth;    /**< Levels of directories under the root */
+    unsigned int fanout;   /**< Directories in every directory above the last level */
+    unsigned int files;    /**< Files in every directory */
+    size_t min_size;       /**< Sizes are spread evenly over the powers of two between these */
+    size_t max_size;
+    unsigned int binary;   /**< Percent of files that are binary */
+    unsigned int rules;    /**< Ignore rules, of every kind in turn */
+    unsigned long long seed;
+    unsigned int runs;     /**< Of every phase, the one of median time is reported */
+    unsigned int threads;  /**< Of the walk that writes, as with -j */
+    bool keep;             /**< Keep the tree afterwards */
+} bench_options_t;
+
+/**
+ * @brief Entry found by the walk phase, matched and written by the others.
+ */
+typedef struct
+{
+    char *path;
+    entry_type_t type;
+    bool ignored;
+} bench_entry_t;
+
+/**
+ * @brief The entries of the tree.
+ */
+typedef struct
+{
+    bench_entry_t *entries;
+    size_t count;
+    size_t capacity;
+} bench_entries_t;
+
+/**
+ * @brief Result of one run of a phase.
+ */
+typedef struct
+{
+    const char *name;
+    double seconds;
+    size_t files;
+    uint64_t bytes;
+    uint64_t syscalls;    /**< UINT64_MAX where they cannot be counted */
+    uint64_t io_syscalls; /**< Reads and writes, UINT64_MAX where they cannot be counted */
+    uint64_t *latencies;  /**< Of every file in nanoseconds, NULL if not timed one by one */
+    size_t latency_count;
+} bench_result_t;
+
+/**
+ * @brief Makes an ignore rule of every kind the README lists, in turn, the
+ * first rules of each kind matching files of the generated tree.
+ * 
+ * @param[out] rule  Buffer for the rule.
+ * @param[in]  size  Size of the buffer.
+ * @param[in]  index Of the rule.
+ */
+static void make_rule(char *rule, size_t size, unsigned int index)
+{
+    unsigned int n = index / BENCH_RULE_KINDS;
+    switch (index % BENCH_RULE_KINDS)
+    {
+        case 0:  snprintf(rule, size, "*.o%u", n);             break;
+        case 1:  snprintf(rule, size, "**/cache%u", n);        break;
+        case 2:  snprintf(rule, size, "ge?%u_*.txt", n);       break;
+        case 3:  snprintf(rule, size, "log%u_[0-9]*.txt", n);  break;
+        case 4:  snprintf(rule, size, "build%u/", n);          break;
+        case 5:  snprintf(rule, size, "!keep%u_*.o0", n);      break;
+        default: snprintf(rule, size, "docs/%u/**/*.md", n);   break;
+    }
+}
+
+/**
+ * @brief Name of a generated file, some of them named for the rules above.
+ */
+static void make_file_name(char *name, size_t size, unsigned int index, bool binary, uint64_t *random)
+{
+    static const char *const extensions[] = { "c", "h", "md", "txt", "json", "py", "o0" };
+    if (binary)
+    {
+        snprintf(name, size, "blob%u.bin", index);
+        return;
+    }
+
+    uint64_t pick = next_random(random) % 16;
+    if (pick == 0)
+        snprintf(name, size, "gen0_%u.txt", index);
+    else if (pick == 1)
+        snprintf(name, size, "log0_%u.txt", index);
+    else if (pick == 2)
+        snprintf(name, size, "keep0_%u.o0", index);
+    else
+        snprintf(name, size, "f%u.%s", index, extensions[pick % 7]);
+}
+
+/**
+ * @brief Writes a generated file, text cut from the pattern, or binary with
+ * NUL bytes in it.
+ */
+static bool write_generated_file(const char *path, size_t size, bool binary, const char *pattern, uint64_t *random)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    bool written = true;
+    size_t start = (size_t)(next_random(random) % (BENCH_PATTERN / 2));
+    for (size_t done = 0; written && (done < size);)
+    {
+        size_t n = ((size - done) < (BENCH_PATTERN - start)) ? (size - done) : (BENCH_PATTERN - start);
+        if (binary)
+        {
+            char chunk[4096];
+            n = (n < sizeof(chunk)) ? n : sizeof(chunk);
+            for (size_t i = 0; i < n; i++)
+                chunk[i] = (char)(((i % 5) == 0) ? 0 : next_random(random));
+            written = (write(fd, chunk, n) == (ssize_t)n);
+        }
+        else
+        {
+            written = (write(fd, &pattern[start], n) == (ssize_t)n);
+        }
+        done += n;
+        start = 0;
+    }
+    return (close(fd) == 0) && written;
+}
+
+/**
+ * @brief Makes one directory of the tree and everything under it.
+ */
+static bool make_dir(const bench_options_t *options, char *path, size_t path_len, unsigned int level,
+                     const char *pattern, uint64_t *random, size_t *entries_out, uint64_t *bytes_out)
+{
+    if (mkdir(path, 0755) != 0)
+        return false;
+    (*entries_out)++;
+
+    unsigned int span = 0;
+    while ((span < 40) && ((options->min_size << (span + 1)) <= options->max_size))
+        span++;
+
+    for (unsigned int i = 0; i < options->files; i++)
+    {
+        bool binary = (next_random(random) % 100) < options->binary;
+        size_t low = options->min_size << (next_random(random) % (span + 1));
+        size_t size = low + (size_t)(next_random(random) % low);
+        size = (size > options->max_size) ? options->max_size : size;
+
+        path[path_len] = '/';
+        make_file_name(&path[path_len + 1], __PATH_MAX - path_len - 1, i, binary, random);
+        if (!write_generated_file(path, size, binary, pattern, random))
+            return false;
+        (*entries_out)++;
+        *bytes_out += size;
+    }
+
+    for (unsigned int i = 0; (level < options->depth) && (i < options->fanout); i++)
+    {
+        int len = snprintf(&path[path_len], __PATH_MAX - path_len, "/d%u", i);
+        if ((len < 0) || ((size_t)len >= __PATH_MAX - path_len) ||
+            !make_dir(options, path, path_len + (size_t)len, level + 1, pattern, random, entries_out, bytes_out))
+            return false;
+    }
+
+    // And at the root, folders of files only, for the directory rules
+    static const char *const ignored_dirs[] = { "/cache0", "/build0" };
+    for (size_t i = 0; (level == 0) && (options->depth > 0) && (i < 2); i++)
+    {
+        snprintf(&path[path_len], __PATH_MAX - path_len, "%s", ignored_dirs[i]);
+        if (!make_dir(options, path, path_len + strlen(ignored_dirs[i]), options->depth, pattern, random, entries_out, bytes_out))
+            return false;
+    }
+    path[path_len] = '\0';
+    return true;
+}
+
+/**
+ * @brief Makes the tree that the options describe.
+ * 
+ * @param[in]  options     Shape of the tree.
+ * @param[out] entries_out Files and directories made, with the root.
+ * @param[out] bytes_out   Size of the files.
+ * 
+ * @return false if it could not be made.
+ */
+static bool make_tree(const bench_options_t *options, size_t *entries_out, uint64_t *bytes_out)
+{
+    uint64_t random = options->seed | 1;
+    char *pattern = malloc(BENCH_PATTERN);
+    if (IS_NULL(pattern))
+        return false;
+
+    // Words and lines of text, like source code as far as the program can tell
+    for (size_t i = 0; i < BENCH_PATTERN; i++)
+    {
+        uint64_t pick = next_random(&random) % 64;
+        pattern[i] = (pick < 8) ? ' ' : (pick < 10) ? '\n' : (char)('a' + (pick % 26));
+    }
+
+    char path[__PATH_MAX];
+    snprintf(path, sizeof(path), "%s", options->dir);
+    *entries_out = 0;
+    *bytes_out = 0;
+    bool made = make_dir(options, path, strlen(path), 0, pattern, &random, entries_out, bytes_out);
+    free(pattern);
+    return made;
+}
+
+/**
+ * @brief Removes what was found in the tree, deepest first, then its root.
+ */
+static void remove_tree(const bench_options_t *options, const bench_entries_t *entries)
+{
+    for (size_t i = entries->count; i > 0; i--)
+    {
+        const bench_entry_t *entry = &entries->entries[i - 1];
+        if (entry->type == ENTRY_TYPE_DIR)
+            rmdir(entry->path);
+        else
+            remove(entry->path);
+    }
+    rmdir(options->dir);
+}
+
+#if defined(__linux__)
+/**
+ * @brief Opens a counter of the system calls of this process and the
+ * threads it starts, where the kernel lets the raw_syscalls tracepoint be
+ * read.
+ * 
+ * @return int The counter, -1 if there is none.
+ */
+static int open_syscall_counter(void)
+{
+    static const char *const paths[] = {
+        "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+        "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id",
+    };
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++)
+    {
+        FILE *file = fopen(paths[i], "r");
+        unsigned long long id;
+        bool found = EXISTS(file) && (fscanf(file, "%llu", &id) == 1);
+        if (EXISTS(file))
+            fclose(file);
+        if (!found)
+            continue;
+
+        struct perf_event_attr attr = { 0 };
+        attr.type = PERF_TYPE_TRACEPOINT;
+        attr.size = sizeof(attr);
+        attr.config = id;
+        attr.inherit = 1;
+        return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    }
+    return -1;
+}
+#else
+static int open_syscall_counter(void)
+{
+    return -1;
+}
+#endif
+
+/**
+ * @brief Reads the system calls counted so far.
+ * 
+ * @return uint64_t The count, UINT64_MAX if there is no counter.
+ */
+static uint64_t count_syscalls(int counter)
+{
+    uint64_t count;
+    if ((counter < 0) || (read(counter, &count, sizeof(count)) != (ssize_t)sizeof(count)))
+        return UINT64_MAX;
+    return count;
+}
+
+/**
+ * @brief Reads the read and write system calls of the process so far, from
+ * /proc/self/io, which the kernel keeps without any permission.
+ * 
+ * @return uint64_t The count, UINT64_MAX where there is no such file.
+ */
+static uint64_t count_io_syscalls(void)
+{
+    FILE *file = fopen("/proc/self/io", "r");
+    if (IS_NULL(file))
+        return UINT64_MAX;
+
+    uint64_t total = 0;
+    int found = 0;
+    char line[128];
+    while (EXISTS(fgets(line, sizeof(line), file)))
+    {
+        unsigned long long value;
+        if ((sscanf(line, "syscr: %llu", &value) == 1) || (sscanf(line, "syscw: %llu", &value) == 1))
+        {
+            total += value;
+            found++;
+        }
+    }
+    fclose(file);
+    return (found == 2) ? total : UINT64_MAX;
+}
+
+/**
+ * @brief Starts timing and counting a run of a phase.
+ */
+static void begin_run(bench_result_t *result, const char *name, int counter)
+{
+    memset(result, 0, sizeof(*result));
+    result->name = name;
+    result->syscalls = count_syscalls(counter);
+    result->io_syscalls = count_io_syscalls();
+    result->seconds = (double)now_ns();
+}
+
+/**
+ * @brief Ends timing and counting a run of a phase.
+ */
+static void end_run(bench_result_t *result, int counter)
+{
+    result->seconds = ((double)now_ns() - result->seconds) / 1e9;
+    uint64_t syscalls = count_syscalls(counter);
+    result->syscalls = ((syscalls == UINT64_MAX) || (result->syscalls == UINT64_MAX)) ? UINT64_MAX : (syscalls - result->syscalls);
+    uint64_t io_syscalls = count_io_syscalls();
+    result->io_syscalls = ((io_syscalls == UINT64_MAX) || (result->io_syscalls == UINT64_MAX)) ? UINT64_MAX : (io_syscalls - result->io_syscalls);
+}
+
+/**
+ * @brief Adds an entry found by the walk.
+ */
+static bool add_entry(bench_entries_t *entries, const char *path, entry_type_t type)
+{
+    if (entries->count == entries->capacity)
+    {
+        size_t capacity = (entries->capacity == 0) ? 1024 : entries->capacity * 2;
+        bench_entry_t *grown = realloc(entries->entries, capacity * sizeof(bench_entry_t));
+        if (IS_NULL(grown))
+            return false;
+        entries->entries = grown;
+        entries->capacity = capacity;
+    }
+
+    char *copy = strdup(path);
+    if (IS_NULL(copy))
+        return false;
+    entries->entries[entries->count++] = (bench_entry_t){ .path = copy, .type = type };
+    return true;
+}
+
+/**
+ * @brief Walks a directory the way the program does, relative to its
+ * parent, timing every entry.
+ */
+static bool walk_dir(DIR *dir, path_buffer_t *path, bench_entries_t *entries, bench_result_t *result)
+{
+    const size_t dir_len = path->len;
+    bool walked = true;
+    for (;;)
+    {
+        uint64_t started = now_ns();
+        struct dirent *entry = readdir(dir);
+        if (IS_NULL(entry))
+            break;
+        if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0))
+            continue;
+        if (!path_append(path, dir_len, entry->d_name))
+            return false;
+
+        entry_type_t type = dir_entry_type(dir, entry, path->buf);
+        result->latencies[result->latency_count++] = now_ns() - started;
+        walked = walked && add_entry(entries, path->buf, type);
+        result->files++;
+        if (type != ENTRY_TYPE_DIR)
+            continue;
+
+        DIR *child = dir_open_child(dir, entry->d_name, path->buf);
+        if (EXISTS(child))
+        {
+            walked = walk_dir(child, path, entries, result) && walked;
+            closedir(child);
+        }
+    }
+    path->buf[dir_len] = '\0';
+    path->len = dir_len;
+    return walked;
+}
+
+/**
+ * @brief Walks the tree without matching or writing anything.
+ */
+static bool run_walk(const bench_options_t *options, size_t entry_count, bench_entries_t *entries, bench_result_t *result, int counter)
+{
+    for (size_t i = 0; i < entries->count; i++)
+        free(entries->entries[i].path);
+    entries->count = 0;
+
+    // The directory path is the root of every entry path, as in the walk of the program
+    size_t dir_len = strlen(options->dir);
+    path_buffer_t path = { .len = dir_len, .capacity = dir_len + __PATH_MAX };
+    path.buf = malloc(path.capacity);
+    uint64_t *latencies = malloc((entry_count + 1) * sizeof(uint64_t));
+    DIR *dir = dir_open(options->dir);
+    if (IS_NULL(path.buf) || IS_NULL(latencies) || IS_NULL(dir))
+    {
+        free(latencies);
+        if (EXISTS(dir))
+            closedir(dir);
+        path_free(&path);
+        return false;
+    }
+    memcpy(path.buf, options->dir, dir_len + 1);
+
+    begin_run(result, "walk", counter);
+    result->latencies = latencies;
+    bool walked = walk_dir(dir, &path, entries, result);
+    end_run(result, counter);
+
+    closedir(dir);
+    path_free(&path);
+    return walked;
+}
+
+/**
+ * @brief Matches every entry of the tree against the rules.
+ */
+static bool run_match(ignore_set_t *ignore, bench_entries_t *entries, bench_result_t *result, int counter)
+{
+    uint64_t *latencies = malloc((entries->count + 1) * sizeof(uint64_t));
+    if (IS_NULL(latencies))
+        return false;
+
+    begin_run(result, "match", counter);
+    result->latencies = latencies;
+    const char *ignored_dir = NULL;
+    size_t ignored_len = 0;
+    for (size_t i = 0; i < entries->count; i++)
+    {
+        // Nothing under an ignored directory is matched, the walk never opens it
+        bench_entry_t *entry = &entries->entries[i];
+        if (EXISTS(ignored_dir) && (strncmp(entry->path, ignored_dir, ignored_len) == 0) && (entry->path[ignored_len] == '/'))
+        {
+            entry->ignored = true;
+            continue;
+        }
+
+        // As the walk does, a directory is also left out if nothing under it could be written
+        uint64_t started = now_ns();
+        entry->ignored = ignore_set_is_entry_match(ignore, entry->path, entry->type);
+        bool pruned = entry->ignored || ((entry->type == ENTRY_TYPE_DIR) && ignore_set_is_dir_match(ignore, entry->path));
+        result->latencies[result->latency_count++] = now_ns() - started;
+        result->files++;
+        if (pruned && (entry->type == ENTRY_TYPE_DIR))
+        {
+            ignored_dir = entry->path;
+            ignored_len = strlen(ignored_dir);
+        }
+    }
+    end_run(result, counter);
+    return true;
+}
+
+/**
+ * @brief Writes every file that is not ignored, in the order the walk found
+ * them, without walking.
+ */
+static bool run_write(const bench_entries_t *entries, bench_result_t *result, int counter)
+{
+    uint64_t *latencies = malloc((entries->count + 1) * sizeof(uint64_t));
+    ingestify_t *ingestify = ingestify_create();
+    writer_t *output = writer_open(BENCH_OUTPUT, WRITER_BUFFER_DEFAULT);
+    if (IS_NULL(latencies) || IS_NULL(ingestify) || IS_NULL(output))
+    {
+        free(latencies);
+        ingestify_destroy(ingestify);
+        if (EXISTS(output))
+            writer_close(output);
+        return false;
+    }
+
+    begin_run(result, "write", counter);
+    result->latencies = latencies;
+    for (size_t i = 0; i < entries->count; i++)
+    {
+        const bench_entry_t *entry = &entries->entries[i];
+        if ((entry->type != ENTRY_TYPE_FILE) || entry->ignored)
+            continue;
+        uint64_t started = now_ns();
+        ingestify_write_file(ingestify, entry->path, NULL, output, INGESTIFY_MAX_SIZE_NONE); // The write phase has no walk for the automatic limit
+        result->latencies[result->latency_count++] = now_ns() - started;
+        result->files++;
+    }
+    ingestify_finish_output(ingestify, output);
+    bool written = writer_close(output);
+    end_run(result, counter);
+    ingestify_destroy(ingestify);
+
+    struct stat output_stat;
+    result->bytes = (stat(BENCH_OUTPUT, &output_stat) == 0) ? (uint64_t)output_stat.st_size : 0;
+    return written;
+}
+
+/**
+ * @brief Walks, matches and writes the tree as the program does.
+ */
+static bool run_all(const bench_options_t *options, ignore_set_t *ignore, size_t files, bench_result_t *result, int counter)
+{
+    ingestify_t *ingestify = ingestify_create();
+    writer_t *output = writer_open(BENCH_OUTPUT, WRITER_BUFFER_DEFAULT);
+    if (IS_NULL(ingestify) || IS_NULL(output))
+    {
+        ingestify_destroy(ingestify);
+        if (EXISTS(output))
+            writer_close(output);
+        return false;
+    }
+
+    begin_run(result, "all", counter);
+    bool opened = (options->threads > 1) ? pwalk_traverse_and_write(ingestify, options->dir, ignore, output, BENCH_OUTPUT, INGESTIFY_MAX_SIZE_AUTO, options->threads)
+                                         : ingestify_traverse_and_write(ingestify, options->dir, ignore, output, BENCH_OUTPUT, INGESTIFY_MAX_SIZE_AUTO);
+    ingestify_finish_output(ingestify, output);
+    bool written = writer_close(output);
+    end_run(result, counter);
+    ingestify_destroy(ingestify);
+
+    struct stat output_stat;
+    result->bytes = (stat(BENCH_OUTPUT, &output_stat) == 0) ? (uint64_t)output_stat.st_size : 0;
+    result->files = files;
+    return opened && written;
+}
+
+/**
+ * @brief Orders latencies for their percentiles.
+ */
+static int compare_latencies(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Orders runs by their time, for the median one.
+ */
+static int compare_runs(const void *a, const void *b)
+{
+    double x = ((const bench_result_t *)a)->seconds;
+    double y = ((const bench_result_t *)b)->seconds;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Prints a count per file, null where it could not be counted.
+ */
+static void print_per_file(const char *name, uint64_t count, size_t files)
+{
+    if ((count == UINT64_MAX) || (files == 0))
+        printf(", \"%s\": null", name);
+    else
+        printf(", \"%s\": %.2f", name, (double)count / (double)files);
+}
+
+/**
+ * @brief Prints the median run of a phase as a JSON object, and frees the runs.
+ */
+static void print_phase(bench_result_t *runs, unsigned int run_count, bool last)
+{
+    qsort(runs, run_count, sizeof(bench_result_t), compare_runs);
+    bench_result_t *result = &runs[run_count / 2];
+
+    double seconds = (result->seconds > 0) ? result->seconds : 1e-9;
+    printf("    { \"phase\": \"%s\", \"files\": %zu, \"seconds\": %.6f, \"files_per_s\": %.1f",
+           result->name, result->files, result->seconds, (double)result->files / seconds);
+    if (result->bytes > 0)
+        printf(", \"bytes\": %llu, \"mb_per_s\": %.2f", (unsigned long long)result->bytes, (double)result->bytes / seconds / 1e6);
+    print_per_file("syscalls_per_file", result->syscalls, result->files);
+    print_per_file("io_syscalls_per_file", result->io_syscalls, result->files);
+
+    if (EXISTS(result->latencies) && (result->latency_count > 0))
+    {
+        qsort(result->latencies, result->latency_count, sizeof(uint64_t), compare_latencies);
+        size_t p99 = (result->latency_count * 99) / 100;
+        printf(", \"p50_us\": %.3f, \"p99_us\": %.3f", (double)result->latencies[result->latency_count / 2] / 1e3,
+               (double)result->latencies[(p99 < result->latency_count) ? p99 : result->latency_count - 1] / 1e3);
+    }
+    else
+    {
+        printf(", \"p50_us\": null, \"p99_us\": null");
+    }
+    printf(" }%s\n", last ? "" : ",");
+
+    for (unsigned int i = 0; i < run_count; i++)
+        free(runs[i].latencies);
+}
+
+/**
+ * @brief Prints how the benchmark is used.
+ */
+static void print_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [options]\n", program);
+    fprintf(stderr, "  --dir <path>         Where the tree is made, it must not exist, " BENCH_TREE " by default\n");
+    fprintf(stderr, "  --depth <levels>     Levels of folders under it, 3 by default\n");
+    fprintf(stderr, "  --fanout <count>     Folders in every folder, 4 by default\n");
+    fprintf(stderr, "  --files <count>      Files in every folder, 20 by default\n");
+    fprintf(stderr, "  --min-size <bytes>   Sizes are spread over the powers of two between these,\n");
+    fprintf(stderr, "  --max-size <bytes>   64 and 65536 by default\n");
+    fprintf(stderr, "  --binary <percent>   Files that are binary, 5 by default\n");
+    fprintf(stderr, "  --rules <count>      Ignore rules, 14 by default\n");
+    fprintf(stderr, "  --seed <number>      Seed of the tree, 1 by default\n");
+    fprintf(stderr, "  --runs <count>       Runs of every phase, the median is reported, 5 by default\n");
+    fprintf(stderr, "  -j <threads>         Threads of the walk that writes, 1 by default\n");
+    fprintf(stderr, "  --keep               Keep the tree afterwards\n");
+}
+
+/**
+ * @brief Parses the options into a bench_options_t.
+ * 
+ * @return false on a bad option, the usage is printed then.
+ */
+static bool parse_options(int argc, char *argv[], bench_options_t *options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--keep") == 0)
+        {
+            options->keep = true;
+            continue;
+        }
+        if ((strcmp(argv[i], "--dir") == 0) && (i + 1 < argc))
+        {
+            options->dir = argv[++i];
+            continue;
+        }
+
+        if ((i + 1 >= argc) || (argv[i + 1][0] == '-'))
+        {
+            print_usage(argv[0]);
+            return false;
+        }
+        char *end = NULL;
+        unsigned long long value = strtoull(argv[i + 1], &end, 10);
+        if ((*end != '\0') || (end == argv[i + 1]))
+        {
+            print_usage(argv[0]);
+            return false;
+        }
+
+        const char *name = argv[i++];
+        if      (strcmp(name, "--depth") == 0    && value <= 16)   options->depth = (unsigned int)value;
+        else if (strcmp(name, "--fanout") == 0   && value <= 1000) options->fanout = (unsigned int)value;
+        else if (strcmp(name, "--files") == 0    && value <= 100000) options->files = (unsigned int)value;
+        else if (strcmp(name, "--min-size") == 0 && value >= 1)    options->min_size = (size_t)value;
+        else if (strcmp(name, "--max-size") == 0 && value >= 1)    options->max_size = (size_t)value;
+        else if (strcmp(name, "--binary") == 0   && value <= 100)  options->binary = (unsigned int)value;
+        else if (strcmp(name, "--rules") == 0    && value <= 100000) options->rules = (unsigned int)value;
+        else if (strcmp(name, "--seed") == 0)                      options->seed = value;
+        else if (strcmp(name, "--runs") == 0     && value >= 1 && value <= 1000) options->runs = (unsigned int)value;
+        else if (strcmp(name, "-j") == 0         && value >= 1 && value <= 1024) options->threads = (unsigned int)value;
+        else
+        {
+            print_usage(argv[0]);
+            return false;
+        }
+    }
+    if (options->min_size > options->max_size)
+    {
+        fprintf(stderr, "--min-size is larger than --max-size\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Makes the tree, runs every phase and prints the results.
+ * 
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * 
+ * @return int Exit status.
+ */
+int main(int argc, char *argv[])
+{
+    bench_options_t options = {
+        .dir = BENCH_TREE,
+        .depth = 3,
+        .fanout = 4,
+        .files = 20,
+        .min_size = 64,
+        .max_size = 65536,
+        .binary = 5,
+        .rules = 14,
+        .seed = 1,
+        .runs = 5,
+        .threads = 1,
+    };
+    if (!parse_options(argc, argv, &options))
+        return EXIT_FAILURE;
+
+    size_t entry_count;
+    uint64_t bytes;
+    if (!make_tree(&options, &entry_count, &bytes))
+    {
+        perror("Error making the tree");
+        return EXIT_FAILURE;
+    }
+
+    // The rules, compiled once like the program does
+    char **rules = calloc(options.rules + 1, sizeof(char *));
+    for (unsigned int i = 0; EXISTS(rules) && (i < options.rules); i++)
+    {
+        char rule[64];
+        make_rule(rule, sizeof(rule), i);
+        rules[i] = strdup(rule);
+    }
+    ignore_list_t ignore_list = { .entries = rules, .count = options.rules };
+    ignore_set_t *ignore = (EXISTS(rules) && ignore_compile(&ignore_list)) ? ignore_set_create(&ignore_list, NULL) : NULL;
+    if (IS_NULL(ignore))
+    {
+        perror("Error compiling the rules");
+        return EXIT_FAILURE;
+    }
+
+    int counter = open_syscall_counter();
+    bench_entries_t entries = { 0 };
+    bench_result_t *runs = calloc(options.runs * 4, sizeof(bench_result_t));
+    bool ran = EXISTS(runs);
+
+    // One of each phase first, so that every run finds the tree in the cache
+    bench_result_t warm = { 0 };
+    ran = ran && run_walk(&options, entry_count, &entries, &warm, counter);
+    free(warm.latencies);
+    for (unsigned int run = 0; ran && (run < options.runs); run++)
+    {
+        bench_result_t *results = &runs[run * 4];
+        ran = run_walk(&options, entry_count, &entries, &results[0], counter) &&
+              run_match(ignore, &entries, &results[1], counter) &&
+              run_write(&entries, &results[2], counter) &&
+              run_all(&options, ignore, results[2].files, &results[3], counter);
+    }
+
+    if (ran)
+    {
+        size_t dirs = 0;
+        for (size_t i = 0; i < entries.count; i++)
+            dirs += (entries.entries[i].type == ENTRY_TYPE_DIR);
+        size_t files = entries.count - dirs;
+
+        printf("{\n  \"tree\": { \"seed\": %llu, \"depth\": %u, \"fanout\": %u, \"files_per_dir\": %u, "
+               "\"min_size\": %zu, \"max_size\": %zu, \"binary_percent\": %u, \"rules\": %u, "
+               "\"files\": %zu, \"dirs\": %zu, \"bytes\": %llu },\n",
+               options.seed, options.depth, options.fanout, options.files, options.min_size, options.max_size,
+               options.binary, options.rules, files, dirs, (unsigned long long)bytes);
+        printf("  \"runs\": %u,\n  \"threads\": %u,\n  \"phases\": [\n", options.runs, options.threads);
+
+        bench_result_t *phase_runs = malloc(options.runs * sizeof(bench_result_t));
+        for (unsigned int phase = 0; EXISTS(phase_runs) && (phase < 4); phase++)
+        {
+            for (unsigned int run = 0; run < options.runs; run++)
+                phase_runs[run] = runs[(run * 4) + phase];
+            print_phase(phase_runs, options.runs, phase == 3);
+        }
+        free(phase_runs);
+        printf("  ]\n}\n");
+    }
+    else
+    {
+        perror("Error running the benchmark");
+    }
+
+    if (!options.keep)
+        remove_tree(&options, &entries);
+    remove(BENCH_OUTPUT);
+    for (size_t i = 0; i < entries.count; i++)
+        free(entries.entries[i].path);
+    free(entries.entries);
+    free(runs);
+    if (counter >= 0)
+        close(counter);
+    ignore_set_release(ignore);
+    ignore_free_rules(&ignore_list);
+    for (unsigned int i = 0; EXISTS(rules) && (i < options.rules); i++)
+        free(rules[i]);
+    free(rules);
+    return ran ? EXIT_SUCCESS : EXIT_FAILURE;
+}
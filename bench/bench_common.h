@@ -0,0 +1,43 @@
+/**
+ * @file      bench_common.h
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Clock and random numbers of the benchmarks.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#ifndef BENCH_COMMON_H_
+#define BENCH_COMMON_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @brief xorshift64*, the same numbers for the same seed everywhere.
+ * 
+ * @param[in, out] state Seed to start from, never 0.
+ * 
+ * @return uint64_t The next number.
+ */
+static inline uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+/**
+ * @brief Monotonic time in nanoseconds.
+ * 
+ * @return uint64_t The time.
+ */
+static inline uint64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000ULL) + (uint64_t)now.tv_nsec;
+}
+
+#endif // BENCH_COMMON_H_
@@ -0,0 +1,449 @@
+/**
+ * @file      bench_ignore.c
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Benchmark of the ignore matcher alone, in nanoseconds per path,
+ *            for every kind of pattern the README lists, and for ignore
+ *            files as they are and scaled up, with the cost of each of their
+ *            rules, against a generated list of paths. Results are printed
+ *            as JSON.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "ignore.h"
+#include "bench_common.h"
+
+#define BENCH_FILES_MAX 8  /**< --ignore-file given at most this many times */
+#define BENCH_RULE_MAX  256
+
+/**
+ * @brief A kind of pattern, with a rule of it that matches some of the
+ * paths, and variants of it for many rules of the same kind.
+ */
+typedef struct
+{
+    const char *name;
+    const char *base;   /**< Rule before it, for exceptions that need something to undo, or NULL */
+    const char *rule;
+    const char *scaled; /**< With %u for the number of the variant */
+} bench_class_t;
+
+static const bench_class_t classes[] = {
+    { "file.type",                NULL,  "main.c",               "main%u.c"               },
+    { "path",                     NULL,  "src/lib/util.c",       "src/lib%u/util.c"       },
+    { "folder/",                  NULL,  "build/",               "build%u/"               },
+    { "folder/file.type",         NULL,  "docs/index.md",        "docs%u/index.md"        },
+    { "*.type",                   NULL,  "*.o",                  "*.o%u"                  },
+    { "**/folder",                NULL,  "**/node_modules",      "**/node_modules%u"      },
+    { "**/folder/file.type",      NULL,  "**/test/fixture.json", "**/test%u/fixture.json" },
+    { "!file.type",               "*.o", "!keep.o",              "!keep%u.o"              },
+    { "file?.type",               NULL,  "file?.c",              "file?%u.c"              },
+    { "file[num].type",           NULL,  "file[3].c",            "file[3]%u.c"            },
+    { "file[num_range].type",     NULL,  "file[0-9].c",          "file[0-9]%u.c"          },
+    { "file[!num_range].type",    NULL,  "file[!0-4].c",         "file[!0-4]%u.c"         },
+    { "file[letter_range].type",  NULL,  "file[a-f].c",          "file[a-f]%u.c"          },
+    { "folder/**/file.type",      NULL,  "src/**/util.c",        "src%u/**/util.c"        },
+    { "folder/*folder/file.type", NULL,  "src/*lib/util.c",      "src%u/*lib/util.c"      },
+};
+
+/**
+ * @brief Generated paths, each a file or a directory.
+ */
+typedef struct
+{
+    char **paths;
+    entry_type_t *types;
+    size_t count;
+} bench_corpus_t;
+
+/**
+ * @brief Cost of one rule of an ignore file.
+ */
+typedef struct
+{
+    const char *rule;
+    double ns_per_path;
+    size_t hits;
+} bench_rule_cost_t;
+
+/**
+ * @brief Makes the paths to match, from names that the rules above and
+ * ignore files like the one of this repository match now and then, some
+ * of them with a number after them like the variants of the rules.
+ */
+static bool make_corpus(bench_corpus_t *corpus, size_t count, uint64_t seed)
+{
+    static const char *const dirs[] = { "src", "lib", "test", "docs", "build", "include", "vendor",
+                                        "node_modules", "components", "tools", ".git", "cache" };
+    static const char *const files[] = { "main.c", "util.c", "index.md", "fixture.json", "file3.c", "filea.c",
+                                         "file7.c", "keep.o", "module.o", "README.md", "LICENSE", "data.hex",
+                                         "CMakeLists.txt", "file_b.txt", "notes.txt", "setup.py" };
+    const size_t dir_count = sizeof(dirs) / sizeof(dirs[0]);
+    const size_t file_count = sizeof(files) / sizeof(files[0]);
+
+    corpus->paths = calloc(count, sizeof(char *));
+    corpus->types = calloc(count, sizeof(entry_type_t));
+    corpus->count = 0;
+    if (IS_NULL(corpus->paths) || IS_NULL(corpus->types))
+        return false;
+
+    uint64_t random = seed | 1;
+    for (size_t i = 0; i < count; i++)
+    {
+        char path[__PATH_MAX];
+        size_t len = 0;
+        size_t depth = (size_t)(next_random(&random) % 7);
+        for (size_t d = 0; d < depth; d++)
+        {
+            const char *name = dirs[next_random(&random) % dir_count];
+            if ((next_random(&random) % 4) == 0)
+                len += (size_t)snprintf(&path[len], sizeof(path) - len, "%s%u/", name, (unsigned int)(next_random(&random) % 10));
+            else
+                len += (size_t)snprintf(&path[len], sizeof(path) - len, "%s/", name);
+        }
+
+        // One in five is a directory, named like the others
+        bool is_dir = (next_random(&random) % 5) == 0;
+        const char *name = is_dir ? dirs[next_random(&random) % dir_count] : files[next_random(&random) % file_count];
+        const char *dot = strrchr(name, '.');
+        size_t stem = (EXISTS(dot) && (dot != name)) ? (size_t)(dot - name) : strlen(name);
+        if ((next_random(&random) % 4) == 0)
+            snprintf(&path[len], sizeof(path) - len, "%.*s%u%s", (int)stem, name, (unsigned int)(next_random(&random) % 10), &name[stem]);
+        else
+            snprintf(&path[len], sizeof(path) - len, "%s", name);
+
+        corpus->paths[i] = strdup(path);
+        if (IS_NULL(corpus->paths[i]))
+            return false;
+        corpus->types[i] = is_dir ? ENTRY_TYPE_DIR : ENTRY_TYPE_FILE;
+        corpus->count++;
+    }
+    return true;
+}
+
+/**
+ * @brief Frees the paths.
+ */
+static void free_corpus(bench_corpus_t *corpus)
+{
+    for (size_t i = 0; i < corpus->count; i++)
+        free(corpus->paths[i]);
+    free(corpus->paths);
+    free(corpus->types);
+}
+
+/**
+ * @brief Matches every path against a compiled list, as many times as asked.
+ * 
+ * @param[in]  list     The rules, compiled.
+ * @param[in]  corpus   The paths.
+ * @param[in]  runs     Times to match them all, the fastest is kept.
+ * @param[out] hits_out Paths that matched.
+ * 
+ * @return double Nanoseconds per path of the fastest run.
+ */
+static double measure(const ignore_list_t *list, const bench_corpus_t *corpus, unsigned int runs, size_t *hits_out)
+{
+    uint64_t best = UINT64_MAX;
+    for (unsigned int run = 0; run < runs; run++)
+    {
+        size_t hits = 0;
+        uint64_t started = now_ns();
+        for (size_t i = 0; i < corpus->count; i++)
+            hits += ignore_is_entry_match(list, corpus->paths[i], corpus->types[i]);
+        uint64_t elapsed = now_ns() - started;
+        best = (elapsed < best) ? elapsed : best;
+        *hits_out = hits;
+    }
+    return (double)best / (double)corpus->count;
+}
+
+/**
+ * @brief Compiles some rules and measures them.
+ * 
+ * @return double Nanoseconds per path, negative if they could not be compiled.
+ */
+static double measure_rules(char **rules, size_t count, const bench_corpus_t *corpus, unsigned int runs, size_t *hits_out, size_t *compiled_out)
+{
+    ignore_list_t list = { .entries = rules, .count = count };
+    if (!ignore_compile(&list))
+        return -1.0;
+
+    double ns = measure(&list, corpus, runs, hits_out);
+    if (EXISTS(compiled_out))
+        *compiled_out = list.rule_count;
+    ignore_free_rules(&list);
+    return ns;
+}
+
+/**
+ * @brief Makes a variant of a rule with a number after its last name, before
+ * the extension, so that a scaled up file has as many different rules.
+ * 
+ * @return char* The variant, to be freed, NULL if memory ran out.
+ */
+static char *make_variant(const char *rule, unsigned int number)
+{
+    size_t len = strlen(rule);
+    size_t end = ((len > 0) && (rule[len - 1] == '/')) ? len - 1 : len;
+    const char *name = rule;
+    for (size_t i = 0; i < end; i++)
+        name = (rule[i] == '/') ? &rule[i + 1] : name;
+    const char *dot = NULL;
+    for (const char *c = name; c < &rule[end]; c++)
+        dot = (*c == '.') ? c : dot;
+    size_t at = (EXISTS(dot) && (dot != name)) ? (size_t)(dot - rule) : end;
+
+    char *variant = malloc(len + 12);
+    if (EXISTS(variant))
+        snprintf(variant, len + 12, "%.*s%u%s", (int)at, rule, number, &rule[at]);
+    return variant;
+}
+
+/**
+ * @brief Measures one kind of pattern, alone and as many rules of the kind.
+ */
+static void bench_class(const bench_class_t *class, const bench_corpus_t *corpus, unsigned int runs, unsigned int scale, double baseline, bool last)
+{
+    char *rules[BENCH_RULE_MAX + 1];
+    size_t count = 0;
+    if (EXISTS(class->base))
+        rules[count++] = (char *)class->base;
+    rules[count++] = (char *)class->rule;
+
+    size_t hits = 0;
+    double single = measure_rules(rules, count, corpus, runs, &hits, NULL);
+    printf("    { \"class\": \"%s\", \"rule\": \"%s\", \"rules\": %zu, \"ns_per_path\": %.2f, \"rule_ns_per_path\": %.2f, \"hits\": %zu",
+           class->name, class->rule, count, single, single - baseline, hits);
+
+    // Many different rules of the same kind, the way large ignore files have them
+    size_t scaled_count = EXISTS(class->base) ? 1 : 0;
+    for (unsigned int i = 0; i < scale; i++)
+    {
+        char rule[64];
+        snprintf(rule, sizeof(rule), class->scaled, i);
+        rules[scaled_count] = strdup(rule);
+        if (IS_NULL(rules[scaled_count]))
+            break;
+        scaled_count++;
+    }
+    size_t scaled_hits = 0;
+    double scaled = measure_rules(rules, scaled_count, corpus, runs, &scaled_hits, NULL);
+    printf(", \"scaled_rules\": %zu, \"scaled_ns_per_path\": %.2f, \"scaled_hits\": %zu }%s\n",
+           scaled_count, scaled, scaled_hits, last ? "" : ",");
+    for (size_t i = EXISTS(class->base) ? 1 : 0; i < scaled_count; i++)
+        free(rules[i]);
+}
+
+/**
+ * @brief Orders rules by their cost, the most costly first.
+ */
+static int compare_costs(const void *a, const void *b)
+{
+    double x = ((const bench_rule_cost_t *)a)->ns_per_path;
+    double y = ((const bench_rule_cost_t *)b)->ns_per_path;
+    return (x < y) - (x > y);
+}
+
+/**
+ * @brief Prints a string as JSON, with quotes and backslashes escaped.
+ */
+static void print_json_string(const char *str)
+{
+    putchar('"');
+    for (; *str != '\0'; str++)
+    {
+        if ((*str == '"') || (*str == '\\'))
+            putchar('\\');
+        if ((unsigned char)*str >= 0x20)
+            putchar(*str);
+    }
+    putchar('"');
+}
+
+/**
+ * @brief Measures an ignore file whole, scaled up, and each of its rules
+ * alone, for which of them cost the most.
+ * 
+ * @return false if it could not be read.
+ */
+static bool bench_file(const char *path, const bench_corpus_t *corpus, unsigned int runs, unsigned int scale, unsigned int top, double baseline, bool last)
+{
+    ignore_list_t *list = ignore_read_list(path);
+    if (IS_NULL(list))
+        return false;
+
+    size_t hits = 0;
+    double whole = measure(list, corpus, runs, &hits);
+
+    // Every rule, then again with a number after each, as many times as the scale
+    size_t scaled_count = 0;
+    char **scaled = calloc((list->count * scale) + 1, sizeof(char *));
+    for (unsigned int k = 0; EXISTS(scaled) && (k < scale); k++)
+    {
+        for (size_t i = 0; i < list->count; i++)
+        {
+            char *variant = (k == 0) ? strdup(list->entries[i]) : make_variant(list->entries[i], k);
+            if (EXISTS(variant))
+                scaled[scaled_count++] = variant;
+        }
+    }
+    size_t scaled_hits = 0;
+    size_t scaled_rules = 0;
+    double scaled_ns = EXISTS(scaled) ? measure_rules(scaled, scaled_count, corpus, runs, &scaled_hits, &scaled_rules) : -1.0;
+    for (size_t i = 0; i < scaled_count; i++)
+        free(scaled[i]);
+    free(scaled);
+
+    // Alone, less the cost of matching with no rules at all
+    bench_rule_cost_t *costs = calloc(list->count + 1, sizeof(bench_rule_cost_t));
+    size_t cost_count = 0;
+    for (size_t i = 0; EXISTS(costs) && (i < list->count); i++)
+    {
+        size_t compiled = 0;
+        size_t rule_hits = 0;
+        double ns = measure_rules(&list->entries[i], 1, corpus, runs, &rule_hits, &compiled);
+        if (compiled == 0)
+            continue; // Blank or a comment
+        costs[cost_count++] = (bench_rule_cost_t){ .rule = list->entries[i], .ns_per_path = ns - baseline, .hits = rule_hits };
+    }
+    if (EXISTS(costs))
+        qsort(costs, cost_count, sizeof(bench_rule_cost_t), compare_costs);
+
+    printf("    { \"file\": ");
+    print_json_string(path);
+    printf(", \"rules\": %zu, \"ns_per_path\": %.2f, \"hits\": %zu, \"scale\": %u, \"scaled_rules\": %zu, \"scaled_ns_per_path\": %.2f, \"scaled_hits\": %zu,\n",
+           list->rule_count, whole, hits, scale, scaled_rules, scaled_ns, scaled_hits);
+    printf("      \"rule_costs\": [\n");
+    size_t shown = (cost_count < top) ? cost_count : top;
+    for (size_t i = 0; i < shown; i++)
+    {
+        printf("        { \"rule\": ");
+        print_json_string(costs[i].rule);
+        printf(", \"ns_per_path\": %.2f, \"hits\": %zu }%s\n", costs[i].ns_per_path, costs[i].hits, (i + 1 < shown) ? "," : "");
+    }
+    printf("      ] }%s\n", last ? "" : ",");
+
+    free(costs);
+    ignore_free_list(list);
+    return true;
+}
+
+/**
+ * @brief Prints how the benchmark is used.
+ */
+static void print_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [options]\n", program);
+    fprintf(stderr, "  --paths <count>        Paths to match, 20000 by default\n");
+    fprintf(stderr, "  --seed <number>        Seed of the paths, 1 by default\n");
+    fprintf(stderr, "  --runs <count>         Times every measure is repeated, the fastest is kept, 3 by default\n");
+    fprintf(stderr, "  --scale <count>        Rules of every kind, and copies of every ignore file, 100 by default\n");
+    fprintf(stderr, "  --top <count>          Rules of an ignore file to list by cost, 20 by default\n");
+    fprintf(stderr, "  --ignore-file <path>   Also measure this ignore file, up to 8 of them,\n");
+    fprintf(stderr, "                         ingestify_ignore.txt if there is one and none is given\n");
+}
+
+/**
+ * @brief Measures the matcher and prints the results.
+ * 
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * 
+ * @return int Exit status.
+ */
+int main(int argc, char *argv[])
+{
+    unsigned long long paths = 20000;
+    unsigned long long seed = 1;
+    unsigned long long runs = 3;
+    unsigned long long scale = 100;
+    unsigned long long top = 20;
+    const char *files[BENCH_FILES_MAX];
+    size_t file_count = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+        {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (strcmp(argv[i], "--ignore-file") == 0)
+        {
+            if (file_count == BENCH_FILES_MAX)
+            {
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            files[file_count++] = argv[++i];
+            continue;
+        }
+
+        char *end = NULL;
+        unsigned long long value = strtoull(argv[i + 1], &end, 10);
+        bool valid = (end != argv[i + 1]) && (*end == '\0') && (argv[i + 1][0] != '-');
+        const char *name = argv[i++];
+        if      (valid && (strcmp(name, "--paths") == 0) && (value >= 1) && (value <= 100000000)) paths = value;
+        else if (valid && (strcmp(name, "--seed") == 0))                                           seed = value;
+        else if (valid && (strcmp(name, "--runs") == 0) && (value >= 1) && (value <= 1000))        runs = value;
+        else if (valid && (strcmp(name, "--scale") == 0) && (value >= 1) && (value <= BENCH_RULE_MAX)) scale = value;
+        else if (valid && (strcmp(name, "--top") == 0))                                            top = value;
+        else
+        {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Checked before anything is printed, so that the output is whole
+    FILE *repo_file = (file_count == 0) ? fopen("ingestify_ignore.txt", "r") : NULL;
+    if (EXISTS(repo_file))
+    {
+        fclose(repo_file);
+        files[file_count++] = "ingestify_ignore.txt";
+    }
+    for (size_t i = 0; i < file_count; i++)
+    {
+        FILE *file = fopen(files[i], "r");
+        if (IS_NULL(file))
+        {
+            perror("Error opening ignore file");
+            return EXIT_FAILURE;
+        }
+        fclose(file);
+    }
+
+    bench_corpus_t corpus = { 0 };
+    if (!make_corpus(&corpus, (size_t)paths, seed))
+    {
+        perror("Memory allocation failed");
+        free_corpus(&corpus);
+        return EXIT_FAILURE;
+    }
+
+    // Matching with no rules at all, what every rule costs on top of
+    size_t hits = 0;
+    double baseline = measure_rules(NULL, 0, &corpus, (unsigned int)runs, &hits, NULL);
+
+    printf("{\n  \"paths\": %zu,\n  \"seed\": %llu,\n  \"runs\": %llu,\n  \"baseline_ns_per_path\": %.2f,\n  \"classes\": [\n",
+           corpus.count, seed, runs, baseline);
+    size_t class_count = sizeof(classes) / sizeof(classes[0]);
+    for (size_t i = 0; i < class_count; i++)
+        bench_class(&classes[i], &corpus, (unsigned int)runs, (unsigned int)scale, baseline, i + 1 == class_count);
+
+    printf("  ],\n  \"files\": [\n");
+    bool read = true;
+    for (size_t i = 0; i < file_count; i++)
+        read = bench_file(files[i], &corpus, (unsigned int)runs, (unsigned int)scale, (unsigned int)top, baseline, i + 1 == file_count) && read;
+    printf("  ]\n}\n");
+
+    free_corpus(&corpus);
+    return read ? EXIT_SUCCESS : EXIT_FAILURE;
+}
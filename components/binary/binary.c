@@ -0,0 +1,156 @@
+/**
+ * @file      binary.c
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Tells binary files from text by their first block, which has
+ *            to be UTF-8 without NUL bytes. The block is scanned 16 bytes
+ *            at a time, so that text costs about as much as reading it.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#include "binary.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/**
+ * @brief Tells whether 16 bytes are all ASCII without a NUL, the only case
+ * that does not need a closer look.
+ */
+static inline bool is_plain_ascii(const uint8_t *p)
+{
+#if defined(__SSE2__)
+    __m128i block = _mm_loadu_si128((const __m128i *)p);
+    __m128i nul = _mm_cmpeq_epi8(block, _mm_setzero_si128());
+    return _mm_movemask_epi8(_mm_or_si128(block, nul)) == 0; // High bit of a non-ASCII byte, or of a NUL
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    uint8x16_t block = vld1q_u8(p);
+    return (vmaxvq_u8(block) < 0x80) && (vminvq_u8(block) > 0);
+#else
+    uint64_t low, high;
+    memcpy(&low, p, sizeof(low));
+    memcpy(&high, &p[8], sizeof(high));
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+    uint64_t nul = ((low - ones) & ~low) | ((high - ones) & ~high);
+    return ((low | high | nul) & highs) == 0;
+#endif
+}
+
+/**
+ * @brief Checks the UTF-8 sequence that starts with a non-ASCII byte, or the NUL.
+ * 
+ * @param[in] p    Start of the sequence.
+ * @param[in] left Bytes left in the data, at least 1.
+ * 
+ * @return size_t Length of the sequence, or what is left of it if it is cut
+ * off at the end. 0 if it is invalid.
+ */
+static size_t check_sequence(const uint8_t *p, size_t left)
+{
+    uint8_t lead = p[0];
+    if (lead == 0)
+        return 0;
+    if (lead < 0x80)
+        return 1;
+
+    // Overlong forms, surrogates and code points past U+10FFFF are invalid
+    size_t length;
+    uint8_t second_min = 0x80, second_max = 0xBF;
+    if ((lead >= 0xC2) && (lead <= 0xDF))
+        length = 2;
+    else if ((lead >= 0xE0) && (lead <= 0xEF))
+    {
+        length = 3;
+        if (lead == 0xE0) second_min = 0xA0;
+        if (lead == 0xED) second_max = 0x9F;
+    }
+    else if ((lead >= 0xF0) && (lead <= 0xF4))
+    {
+        length = 4;
+        if (lead == 0xF0) second_min = 0x90;
+        if (lead == 0xF4) second_max = 0x8F;
+    }
+    else
+        return 0;
+
+    if ((left > 1) && ((p[1] < second_min) || (p[1] > second_max)))
+        return 0;
+    for (size_t i = 2; (i < length) && (i < left); i++)
+    {
+        if ((p[i] & 0xC0) != 0x80)
+            return 0;
+    }
+    return (length < left) ? length : left;
+}
+
+/**
+ * @brief Tells whether the start of a file is binary, it has a NUL byte or
+ * is not valid UTF-8. A character cut off at the end of the data is not held
+ * against it, since the data is usually only the first block.
+ * 
+ * @param[in] data Start of the file, at most BINARY_CHECK_SIZE bytes are looked at.
+ * @param[in] size Size of the data.
+ * 
+ * @return true if it is binary.
+ */
+bool binary_detect(const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    if (size > BINARY_CHECK_SIZE)
+        size = BINARY_CHECK_SIZE;
+
+    size_t i = 0;
+    while (i < size)
+    {
+        // Whole blocks of ASCII go by 16 bytes at a time
+        while (((size - i) >= 16) && is_plain_ascii(&p[i]))
+            i += 16;
+
+        // Anything else byte by byte, to the end of the block
+        size_t block_end = ((size - i) >= 16) ? (i + 16) : size;
+        while (i < block_end)
+        {
+            size_t length = check_sequence(&p[i], size - i);
+            if (length == 0)
+                return true;
+            i += length;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Tells whether an open file is binary, by its first block, without
+ * moving the file offset.
+ * 
+ * @param[in] fd Open file.
+ * 
+ * @return true if it is binary, false if it is text or could not be read.
+ */
+bool binary_detect_fd(int fd)
+{
+    uint8_t block[BINARY_CHECK_SIZE];
+    size_t size = 0;
+    while (size < sizeof(block))
+    {
+        ssize_t n = pread(fd, &block[size], sizeof(block) - size, (off_t)size);
+        if ((n < 0) && (errno == EINTR))
+            continue;
+        if (n <= 0)
+            break; // Errors included, the read of the contents reports them
+        size += (size_t)n;
+    }
+    return binary_detect(block, size);
+}
+
+// end of file binary.c
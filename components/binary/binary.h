@@ -0,0 +1,42 @@
+/**
+ * @file      binary.h
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Tells binary files from text by their first block, which has
+ *            to be UTF-8 without NUL bytes. The block is scanned 16 bytes
+ *            at a time, so that text costs about as much as reading it.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#ifndef BINARY_H_
+#define BINARY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define BINARY_CHECK_SIZE 8192 /**< Bytes at the start of a file that decide */
+
+/**
+ * @brief Tells whether the start of a file is binary, it has a NUL byte or
+ * is not valid UTF-8. A character cut off at the end of the data is not held
+ * against it, since the data is usually only the first block.
+ * 
+ * @param[in] data Start of the file, at most BINARY_CHECK_SIZE bytes are looked at.
+ * @param[in] size Size of the data.
+ * 
+ * @return true if it is binary.
+ */
+bool binary_detect(const void *data, size_t size);
+
+/**
+ * @brief Tells whether an open file is binary, by its first block, without
+ * moving the file offset.
+ * 
+ * @param[in] fd Open file.
+ * 
+ * @return true if it is binary, false if it is text or could not be read.
+ */
+bool binary_detect_fd(int fd);
+
+#endif // BINARY_H_
@@ -0,0 +1,130 @@
+/**
+ * @file      arena.c
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Bump allocator. Memory is handed out from large blocks and
+ *            only given back all at once, when the arena is freed.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#include "arena.h"
+#include "common.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct arena_block
+{
+    arena_block_t *next;
+    size_t used;
+    size_t capacity;
+    max_align_t data[];   /**< capacity bytes, aligned for any type */
+};
+
+/**
+ * @brief Allocates memory that lives until arena_free(), aligned for any type.
+ * 
+ * @param[in, out] arena The arena.
+ * @param[in]      size  Number of bytes.
+ * 
+ * @return void* The memory, NULL if memory ran out.
+ */
+void *arena_alloc(arena_t *arena, size_t size)
+{
+    const size_t align = sizeof(max_align_t);
+    size = (size + align - 1) & ~(align - 1);
+    if (size == 0) size = align;
+
+    arena_block_t *head = arena->head;
+    if (EXISTS(head) && (size <= (head->capacity - head->used)))
+    {
+        void *memory = (char *)head->data + head->used;
+        head->used += size;
+        return memory;
+    }
+
+    // Something large gets a block of its own, behind the one being filled
+    size_t block_size = (arena->block_size > 0) ? arena->block_size : ARENA_BLOCK_DEFAULT;
+    bool own_block = (size > (block_size / 2));
+    size_t capacity = own_block ? size : block_size;
+
+    arena_block_t *block = malloc(sizeof(arena_block_t) + capacity);
+    if (IS_NULL(block))
+        return NULL;
+    block->capacity = capacity;
+    block->used = size;
+
+    if (own_block && EXISTS(head))
+    {
+        block->next = head->next;
+        head->next = block;
+    }
+    else
+    {
+        block->next = head;
+        arena->head = block;
+    }
+    return block->data;
+}
+
+/**
+ * @brief Allocates zeroed memory for an array, like calloc().
+ * 
+ * @param[in, out] arena The arena.
+ * @param[in]      count Number of elements.
+ * @param[in]      size  Size of an element.
+ * 
+ * @return void* The memory, NULL if memory ran out.
+ */
+void *arena_calloc(arena_t *arena, size_t count, size_t size)
+{
+    if ((size > 0) && (count > (SIZE_MAX / size)))
+        return NULL;
+
+    void *memory = arena_alloc(arena, count * size);
+    if (EXISTS(memory))
+        memset(memory, 0, count * size);
+    return memory;
+}
+
+/**
+ * @brief Copies a string into the arena.
+ * 
+ * @param[in, out] arena The arena.
+ * @param[in]      str   The string.
+ * @param[in]      len   Number of characters to copy, a '\0' is added.
+ * 
+ * @return char* The copy, NULL if memory ran out.
+ */
+char *arena_strndup(arena_t *arena, const char *str, size_t len)
+{
+    char *copy = arena_alloc(arena, len + 1);
+    if (EXISTS(copy))
+    {
+        memcpy(copy, str, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+/**
+ * @brief Frees everything allocated from the arena. It is empty afterwards,
+ * and can be used again.
+ * 
+ * @param[in, out] arena The arena.
+ */
+void arena_free(arena_t *arena)
+{
+    arena_block_t *block = arena->head;
+    while (EXISTS(block))
+    {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+}
+
+// end of file arena.c
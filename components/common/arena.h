@@ -0,0 +1,69 @@
+/**
+ * @file      arena.h
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Bump allocator. Memory is handed out from large blocks and
+ *            only given back all at once, when the arena is freed.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_DEFAULT (64 * 1024) /**< Block size of an arena with block_size 0 */
+
+typedef struct arena_block arena_block_t;
+
+/**
+ * @brief An arena. One that is zeroed is empty and ready to use.
+ */
+typedef struct
+{
+    arena_block_t *head;  /**< Block being filled, the full ones hang off it */
+    size_t block_size;    /**< Size of a new block, 0 for ARENA_BLOCK_DEFAULT */
+} arena_t;
+
+/**
+ * @brief Allocates memory that lives until arena_free(), aligned for any type.
+ * 
+ * @param[in, out] arena The arena.
+ * @param[in]      size  Number of bytes.
+ * 
+ * @return void* The memory, NULL if memory ran out.
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/**
+ * @brief Allocates zeroed memory for an array, like calloc().
+ * 
+ * @param[in, out] arena The arena.
+ * @param[in]      count Number of elements.
+ * @param[in]      size  Size of an element.
+ * 
+ * @return void* The memory, NULL if memory ran out.
+ */
+void *arena_calloc(arena_t *arena, size_t count, size_t size);
+
+/**
+ * @brief Copies a string into the arena.
+ * 
+ * @param[in, out] arena The arena.
+ * @param[in]      str   The string.
+ * @param[in]      len   Number of characters to copy, a '\0' is added.
+ * 
+ * @return char* The copy, NULL if memory ran out.
+ */
+char *arena_strndup(arena_t *arena, const char *str, size_t len);
+
+/**
+ * @brief Frees everything allocated from the arena. It is empty afterwards,
+ * and can be used again.
+ * 
+ * @param[in, out] arena The arena.
+ */
+void arena_free(arena_t *arena);
+
+#endif // ARENA_H_
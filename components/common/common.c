@@ -8,7 +8,18 @@
  */
 
 #include "common.h"
+#include "stats.h"
+#include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
 
 /**
  * @brief Retrieves the file extension from a filename.
@@ -43,4 +54,429 @@ char *sanitize_path(char *path)
     return path;
 }
 
+/**
+ * @brief Returns the path without its leading "./", without modifying it.
+ * 
+ * @param[in] path The path.
+ * 
+ * @return const char* The path after "./".
+ */
+const char *skip_dot_slash(const char *path)
+{
+    return (strncmp(path, "./", 2U) == 0) ? (path + 2) : path;
+}
+
+/**
+ * @brief Replaces everything after the first dir_len characters of a path
+ * with "/name".
+ * 
+ * @param[in, out] path    The path.
+ * @param[in]      dir_len Length of the directory part to keep.
+ * @param[in]      name    Name to append.
+ * 
+ * @return true on success, false if memory ran out.
+ */
+bool path_append(path_buffer_t *path, size_t dir_len, const char *name)
+{
+    size_t name_len = strlen(name);
+    size_t needed = dir_len + 1 + name_len + 1;
+    if (needed > path->capacity)
+    {
+        size_t capacity = (path->capacity > 0) ? path->capacity : __PATH_MAX;
+        while (capacity < needed) capacity *= 2;
+        char *buf = realloc(path->buf, capacity);
+        if (IS_NULL(buf)) return false;
+        path->buf = buf;
+        path->capacity = capacity;
+    }
+
+    path->buf[dir_len] = '/';
+    memcpy(&path->buf[dir_len + 1], name, name_len + 1);
+    path->len = dir_len + 1 + name_len;
+    return true;
+}
+
+/**
+ * @brief Frees a path buffer.
+ * 
+ * @param[in, out] path The path.
+ */
+void path_free(path_buffer_t *path)
+{
+    free(path->buf);
+    path->buf = NULL;
+    path->len = 0;
+    path->capacity = 0;
+}
+
+/**
+ * @brief Reads until the buffer is full or the file ends.
+ * 
+ * @param[in]  fd   File to read.
+ * @param[out] buf  Buffer to read into.
+ * @param[in]  size Size of the buffer.
+ * 
+ * @return size_t Bytes read, less than size only at the end of the file or on errors.
+ */
+size_t read_full(int fd, void *buf, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = read(fd, (char *)buf + done, size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    return done;
+}
+
+/**
+ * @brief Decides how fd_transfer() moves bytes into an output, once for all
+ * that go into it.
+ * 
+ * @param[in] out_fd Output file or pipe.
+ * 
+ * @return transfer_method_t The method to start with.
+ */
+transfer_method_t fd_transfer_method(int out_fd)
+{
+#if defined(__linux__)
+    // copy_file_range() only works between files, splice() needs a pipe on one side
+    struct stat out_stat;
+    if (fstat(out_fd, &out_stat) != 0)
+        return TRANSFER_NONE;
+    return S_ISFIFO(out_stat.st_mode) ? TRANSFER_SPLICE : TRANSFER_COPY_FILE_RANGE;
+#else
+    (void)out_fd;
+    return TRANSFER_NONE;
+#endif
+}
+
+#if defined(__linux__)
+
+/**
+ * @brief Moves up to size bytes with one system call.
+ */
+static ssize_t transfer_once(transfer_method_t method, int out_fd, int in_fd, size_t size)
+{
+    switch (method)
+    {
+        case TRANSFER_COPY_FILE_RANGE: return copy_file_range(in_fd, NULL, out_fd, NULL, size, 0);
+        case TRANSFER_SENDFILE:        return sendfile(out_fd, in_fd, NULL, size);
+        case TRANSFER_SPLICE:          return splice(in_fd, NULL, out_fd, NULL, size, SPLICE_F_MOVE);
+        default:                       errno = ENOSYS; return -1;
+    }
+}
+
+/**
+ * @brief Moves bytes from a file into another file or a pipe inside the
+ * kernel, with copy_file_range(), sendfile() or splice(), whichever the
+ * kernel accepts for the pair. Both file offsets move, like read and write.
+ * 
+ * @param[in]  out_fd  Output file or pipe.
+ * @param[in]  in_fd   Input file.
+ * @param[in]  size    Bytes to move.
+ * @param[in]  method  From fd_transfer_method() for the output.
+ * @param[out] refused Set if nothing was moved because of an error, the
+ *                     caller has to copy the bytes itself then.
+ * @param[out] error   errno of what stopped it, 0 at the end of the input.
+ * 
+ * @return size_t Bytes moved, less than size at the end of the input or on errors.
+ */
+size_t fd_transfer(int out_fd, int in_fd, size_t size, transfer_method_t method, bool *refused, int *error)
+{
+    *error = 0;
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = transfer_once(method, out_fd, in_fd, size - done);
+        if (n > 0)
+        {
+            done += (size_t)n;
+            continue;
+        }
+        if (n == 0) break;
+        if (errno == EINTR) continue;
+
+        // Refused before anything moved, for example across file systems on
+        // older kernels, so try the next method
+        *error = errno;
+        bool unsupported = (errno == EXDEV) || (errno == EINVAL) || (errno == ENOSYS) || (errno == EOPNOTSUPP);
+        if ((done > 0) || !unsupported) break;
+
+        method = (method == TRANSFER_COPY_FILE_RANGE) ? TRANSFER_SENDFILE :
+                 (method == TRANSFER_SENDFILE)        ? TRANSFER_SPLICE   : TRANSFER_NONE;
+        if (method == TRANSFER_NONE) break;
+        *error = 0;
+    }
+
+    // Whatever stopped it before anything moved, reading may still get through
+    *refused = (done == 0) && (*error != 0);
+    return done;
+}
+
+#else
+
+size_t fd_transfer(int out_fd, int in_fd, size_t size, transfer_method_t method, bool *refused, int *error)
+{
+    (void)out_fd, (void)in_fd, (void)size, (void)method;
+    *refused = true;
+    *error = ENOSYS;
+    return 0;
+}
+
+#endif
+
+/**
+ * @brief Copies bytes from where a file is to another file or pipe, inside
+ * the kernel where it can, with read and write where it cannot.
+ * 
+ * @param[in] out_fd Output file or pipe.
+ * @param[in] in_fd  Input file.
+ * @param[in] size   Bytes to copy.
+ * 
+ * @return false if not all of them could be copied.
+ */
+bool fd_copy(int out_fd, int in_fd, uint64_t size)
+{
+    bool refused;
+    int error;
+    uint64_t done = fd_transfer(out_fd, in_fd, (size_t)size, fd_transfer_method(out_fd), &refused, &error);
+    while (refused && (done < size))
+    {
+        char chunk[BUFSIZ];
+        size_t n = ((size - done) < sizeof(chunk)) ? (size_t)(size - done) : sizeof(chunk);
+        n = read_full(in_fd, chunk, n);
+        if (n == 0)
+            break;
+        for (size_t written = 0; written < n;)
+        {
+            ssize_t w = write(out_fd, &chunk[written], n - written);
+            if ((w < 0) && (errno == EINTR))
+                continue;
+            if (w <= 0)
+                return false;
+            written += (size_t)w;
+        }
+        done += n;
+    }
+    return (done == size);
+}
+
+#if defined(_WIN32)
+
+// No openat() and friends, everything goes through the full path
+
+int open_long_path(const char *path, int flags)
+{
+    return open(path, flags | O_BINARY);
+}
+
+DIR *dir_open(const char *path)
+{
+    return opendir(path);
+}
+
+DIR *dir_open_child(DIR *parent, const char *name, const char *path)
+{
+    (void)parent, (void)name;
+    return opendir(path);
+}
+
+int dir_open_file(DIR *parent, const char *name, const char *path)
+{
+    (void)parent, (void)name;
+    return open(path, O_RDONLY | O_BINARY);
+}
+
+entry_type_t dir_entry_type(DIR *parent, const struct dirent *entry, const char *path)
+{
+    (void)parent, (void)entry;
+
+    struct stat path_stat;
+    if (stat(path, &path_stat) != 0) return ENTRY_TYPE_NO_STATUS;
+    if (S_ISDIR(path_stat.st_mode))  return ENTRY_TYPE_DIR;
+    if (S_ISREG(path_stat.st_mode))  return ENTRY_TYPE_FILE;
+    return ENTRY_TYPE_OTHER;
+}
+
+bool dir_stat_file(DIR *parent, const char *name, const char *path, struct stat *stat_out)
+{
+    (void)parent, (void)name;
+    return (stat(path, stat_out) == 0);
+}
+
+bool dir_get_id(DIR *dir, dir_id_t *id_out)
+{
+    (void)dir, (void)id_out;
+    return false;
+}
+
+#else
+
+/**
+ * @brief Opens a file or directory, even if the path is longer than the
+ * system allows, by opening it a few components at a time.
+ * 
+ * @param[in] path  Path to open.
+ * @param[in] flags Flags for open().
+ * 
+ * @return int File descriptor, -1 on failure.
+ */
+int open_long_path(const char *path, int flags)
+{
+    int dir_fd = AT_FDCWD;
+    char chunk[PATH_MAX];
+
+    while (strlen(path) >= PATH_MAX)
+    {
+        // Open the longest leading directory that fits, and continue from there
+        size_t cut = PATH_MAX - 1;
+        while ((cut > 0) && (path[cut] != '/')) cut--;
+        if (cut == 0)
+        {
+            if (dir_fd != AT_FDCWD) close(dir_fd);
+            return -1;
+        }
+
+        memcpy(chunk, path, cut);
+        chunk[cut] = '\0';
+        int next_fd = openat(dir_fd, chunk, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd != AT_FDCWD) close(dir_fd);
+        if (next_fd < 0) return -1;
+
+        dir_fd = next_fd;
+        path += cut + 1;
+    }
+
+    int fd = openat(dir_fd, path, flags | O_CLOEXEC);
+    if (dir_fd != AT_FDCWD) close(dir_fd);
+    return fd;
+}
+
+/**
+ * @brief Opens a directory by its path, see open_long_path().
+ * 
+ * @param[in] path Path to the directory.
+ * 
+ * @return DIR* The directory stream, NULL on failure.
+ */
+DIR *dir_open(const char *path)
+{
+    int fd = open_long_path(path, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return NULL;
+
+    DIR *dir = fdopendir(fd);
+    if (IS_NULL(dir)) close(fd);
+    return dir;
+}
+
+/**
+ * @brief Opens a subdirectory relative to its parent, so that the path is
+ * not resolved again.
+ * 
+ * @param[in] parent Open parent directory.
+ * @param[in] name   Name of the subdirectory.
+ * @param[in] path   Full path, used where there is no openat().
+ * 
+ * @return DIR* The directory stream, NULL on failure.
+ */
+DIR *dir_open_child(DIR *parent, const char *name, const char *path)
+{
+    (void)path;
+    int fd = openat(dirfd(parent), name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    DIR *dir = fdopendir(fd);
+    if (IS_NULL(dir)) close(fd);
+    return dir;
+}
+
+/**
+ * @brief Opens a file relative to its directory, read only.
+ * 
+ * @param[in] parent Open parent directory.
+ * @param[in] name   Name of the file.
+ * @param[in] path   Full path, used where there is no openat().
+ * 
+ * @return int File descriptor, -1 on failure.
+ */
+int dir_open_file(DIR *parent, const char *name, const char *path)
+{
+    (void)path;
+    return openat(dirfd(parent), name, O_RDONLY | O_CLOEXEC);
+}
+
+/**
+ * @brief Finds the type of a directory entry. d_type is used when readdir
+ * knows it, fstatat() relative to the parent otherwise, symbolic links are
+ * followed like stat() does.
+ * 
+ * @param[in] parent Open parent directory.
+ * @param[in] entry  Entry returned by readdir.
+ * @param[in] path   Full path, used where there is no fstatat().
+ * 
+ * @return entry_type_t Type of the entry.
+ */
+entry_type_t dir_entry_type(DIR *parent, const struct dirent *entry, const char *path)
+{
+    (void)path;
+
+#if defined(_DIRENT_HAVE_D_TYPE) || defined(DT_UNKNOWN)
+    switch (entry->d_type)
+    {
+        case DT_DIR:     return ENTRY_TYPE_DIR;
+        case DT_REG:     return ENTRY_TYPE_FILE;
+        case DT_LNK:     break;
+        case DT_UNKNOWN: break;
+        default:         return ENTRY_TYPE_OTHER;
+    }
+#endif
+
+    struct stat path_stat;
+    uint64_t started = stats_begin();
+    bool has_status = (fstatat(dirfd(parent), entry->d_name, &path_stat, 0) == 0);
+    stats_end(STATS_STAT, started, 0);
+    if (!has_status) return ENTRY_TYPE_NO_STATUS;
+    if (S_ISDIR(path_stat.st_mode))  return ENTRY_TYPE_DIR;
+    if (S_ISREG(path_stat.st_mode))  return ENTRY_TYPE_FILE;
+    return ENTRY_TYPE_OTHER;
+}
+
+/**
+ * @brief Stats a file relative to its directory, following symbolic links.
+ * 
+ * @param[in]  parent   Open parent directory.
+ * @param[in]  name     Name of the file.
+ * @param[in]  path     Full path, used where there is no fstatat().
+ * @param[out] stat_out Status of the file.
+ * 
+ * @return true on success.
+ */
+bool dir_stat_file(DIR *parent, const char *name, const char *path, struct stat *stat_out)
+{
+    (void)path;
+    return (fstatat(dirfd(parent), name, stat_out, 0) == 0);
+}
+
+/**
+ * @brief Gets the identity of an open directory.
+ * 
+ * @param[in]  dir    Open directory.
+ * @param[out] id_out Its identity.
+ * 
+ * @return true on success, false where directories have no identity.
+ */
+bool dir_get_id(DIR *dir, dir_id_t *id_out)
+{
+    struct stat dir_stat;
+    if (fstat(dirfd(dir), &dir_stat) != 0) return false;
+    id_out->dev = dir_stat.st_dev;
+    id_out->ino = dir_stat.st_ino;
+    return true;
+}
+
+#endif
+
 // end of file common.c
@@ -10,12 +10,40 @@
 #ifndef COMMON_H_
 #define COMMON_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
 #define __PATH_MAX 260
 
 #define IS_NULL(ptr)     (ptr == NULL)
 #define IS_NOT_NULL(ptr) (ptr != NULL)
 #define EXISTS(ptr)      IS_NOT_NULL(ptr)
 
+#define HASH_SEED 2166136261U /**< Start of a hash_bytes() chain */
+
+/**
+ * @brief FNV-1a, continued from a previous hash.
+ * 
+ * @param[in] hash HASH_SEED, or the hash of the bytes before these.
+ * @param[in] data Bytes to hash.
+ * @param[in] len  Number of bytes.
+ * 
+ * @return uint32_t The hash.
+ */
+static inline uint32_t hash_bytes(uint32_t hash, const char *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
 /**
  * @brief Retrieves the file extension from a filename.
  * 
@@ -34,4 +62,201 @@ const char *get_filename_ext(const char *filename);
  */
 char *sanitize_path(char *path);
 
+/**
+ * @brief Returns the path without its leading "./", without modifying it.
+ * 
+ * @param[in] path The path.
+ * 
+ * @return const char* The path after "./".
+ */
+const char *skip_dot_slash(const char *path);
+
+/**
+ * @brief Growable path, so that deep trees are not cut off at __PATH_MAX.
+ */
+typedef struct
+{
+    char *buf;       /**< NULL terminated path */
+    size_t len;      /**< Length of the path */
+    size_t capacity; /**< Size of buf */
+} path_buffer_t;
+
+/**
+ * @brief Replaces everything after the first dir_len characters of a path
+ * with "/name".
+ * 
+ * @param[in, out] path    The path.
+ * @param[in]      dir_len Length of the directory part to keep.
+ * @param[in]      name    Name to append.
+ * 
+ * @return true on success, false if memory ran out.
+ */
+bool path_append(path_buffer_t *path, size_t dir_len, const char *name);
+
+/**
+ * @brief Frees a path buffer.
+ * 
+ * @param[in, out] path The path.
+ */
+void path_free(path_buffer_t *path);
+
+/**
+ * @brief Kinds of directory entries the walks care about.
+ */
+typedef enum
+{
+    ENTRY_TYPE_OTHER,     /**< Neither a file nor a directory, skipped silently */
+    ENTRY_TYPE_FILE,      /**< Regular file */
+    ENTRY_TYPE_DIR,       /**< Directory */
+    ENTRY_TYPE_NO_STATUS, /**< The entry could not be stat-ed */
+} entry_type_t;
+
+/**
+ * @brief System call that fd_transfer() starts with.
+ */
+typedef enum
+{
+    TRANSFER_COPY_FILE_RANGE, /**< Between files */
+    TRANSFER_SENDFILE,        /**< From a file, where copy_file_range() is refused */
+    TRANSFER_SPLICE,          /**< With a pipe on one side */
+    TRANSFER_NONE,            /**< Nothing, the caller copies */
+} transfer_method_t;
+
+/**
+ * @brief Opens a file or directory, even if the path is longer than the
+ * system allows, by opening it a few components at a time.
+ * 
+ * @param[in] path  Path to open.
+ * @param[in] flags Flags for open().
+ * 
+ * @return int File descriptor, -1 on failure.
+ */
+int open_long_path(const char *path, int flags);
+
+/**
+ * @brief Opens a directory by its path, see open_long_path().
+ * 
+ * @param[in] path Path to the directory.
+ * 
+ * @return DIR* The directory stream, NULL on failure.
+ */
+DIR *dir_open(const char *path);
+
+/**
+ * @brief Opens a subdirectory relative to its parent, so that the path is
+ * not resolved again.
+ * 
+ * @param[in] parent Open parent directory.
+ * @param[in] name   Name of the subdirectory.
+ * @param[in] path   Full path, used where there is no openat().
+ * 
+ * @return DIR* The directory stream, NULL on failure.
+ */
+DIR *dir_open_child(DIR *parent, const char *name, const char *path);
+
+/**
+ * @brief Opens a file relative to its directory, read only.
+ * 
+ * @param[in] parent Open parent directory.
+ * @param[in] name   Name of the file.
+ * @param[in] path   Full path, used where there is no openat().
+ * 
+ * @return int File descriptor, -1 on failure.
+ */
+int dir_open_file(DIR *parent, const char *name, const char *path);
+
+/**
+ * @brief Finds the type of a directory entry. d_type is used when readdir
+ * knows it, fstatat() relative to the parent otherwise, symbolic links are
+ * followed like stat() does.
+ * 
+ * @param[in] parent Open parent directory.
+ * @param[in] entry  Entry returned by readdir.
+ * @param[in] path   Full path, used where there is no fstatat().
+ * 
+ * @return entry_type_t Type of the entry.
+ */
+entry_type_t dir_entry_type(DIR *parent, const struct dirent *entry, const char *path);
+
+/**
+ * @brief Stats a file relative to its directory, following symbolic links.
+ * 
+ * @param[in]  parent   Open parent directory.
+ * @param[in]  name     Name of the file.
+ * @param[in]  path     Full path, used where there is no fstatat().
+ * @param[out] stat_out Status of the file.
+ * 
+ * @return true on success.
+ */
+bool dir_stat_file(DIR *parent, const char *name, const char *path, struct stat *stat_out);
+
+/**
+ * @brief Reads until the buffer is full or the file ends.
+ * 
+ * @param[in]  fd   File to read.
+ * @param[out] buf  Buffer to read into.
+ * @param[in]  size Size of the buffer.
+ * 
+ * @return size_t Bytes read, less than size only at the end of the file or on errors.
+ */
+size_t read_full(int fd, void *buf, size_t size);
+
+/**
+ * @brief Decides how fd_transfer() moves bytes into an output, once for all
+ * that go into it.
+ * 
+ * @param[in] out_fd Output file or pipe.
+ * 
+ * @return transfer_method_t The method to start with.
+ */
+transfer_method_t fd_transfer_method(int out_fd);
+
+/**
+ * @brief Moves bytes from a file into another file or a pipe inside the
+ * kernel, with copy_file_range(), sendfile() or splice(), whichever the
+ * kernel accepts for the pair. Both file offsets move, like read and write.
+ * 
+ * @param[in]  out_fd  Output file or pipe.
+ * @param[in]  in_fd   Input file.
+ * @param[in]  size    Bytes to move.
+ * @param[in]  method  From fd_transfer_method() for the output.
+ * @param[out] refused Set if nothing was moved because of an error, the
+ *                     caller has to copy the bytes itself then.
+ * @param[out] error   errno of what stopped it, 0 at the end of the input.
+ * 
+ * @return size_t Bytes moved, less than size at the end of the input or on errors.
+ */
+size_t fd_transfer(int out_fd, int in_fd, size_t size, transfer_method_t method, bool *refused, int *error);
+
+/**
+ * @brief Copies bytes from where a file is to another file or pipe, with
+ * fd_transfer() or read and write where the kernel refuses.
+ * 
+ * @param[in] out_fd Output file or pipe.
+ * @param[in] in_fd  Input file.
+ * @param[in] size   Bytes to copy.
+ * 
+ * @return false if not all of them could be copied.
+ */
+bool fd_copy(int out_fd, int in_fd, uint64_t size);
+
+/**
+ * @brief Identity of an open directory, to notice symbolic link loops.
+ */
+typedef struct
+{
+    dev_t dev;
+    ino_t ino;
+} dir_id_t;
+
+/**
+ * @brief Gets the identity of an open directory.
+ * 
+ * @param[in]  dir    Open directory.
+ * @param[out] id_out Its identity.
+ * 
+ * @return true on success, false where directories have no identity.
+ */
+bool dir_get_id(DIR *dir, dir_id_t *id_out);
+
 #endif // COMMON_H_
@@ -0,0 +1,507 @@
+/**
+ * @file      compress.c
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Compresses the output as it is written. The output is cut into
+ *            blocks that are compressed on their own by a pool of threads,
+ *            each into a complete gzip member or zstd frame, and written in
+ *            order, which the usual tools read as one stream.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#include "compress.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#if defined(INGESTIFY_ZLIB)
+#include <zlib.h>
+#endif
+
+#if defined(INGESTIFY_ZSTD)
+#include <zstd.h>
+#endif
+
+#if defined(_WIN32)
+#define OUTPUT_FLAGS (O_WRONLY | O_CREAT | O_TRUNC | O_BINARY)
+#else
+#define OUTPUT_FLAGS (O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC)
+#endif
+
+/**
+ * @brief A block of the output, in its slot of the ring.
+ */
+typedef struct
+{
+    char *input;        /**< NULL until the slot is first used, output is in the same allocation */
+    size_t input_size;
+    char *output;
+    size_t output_size;
+    bool done;          /**< Compressed, waiting to be written */
+    bool ok;
+} block_t;
+
+typedef struct compress compress_t;
+
+/**
+ * @brief A compressing thread, with the compressor it keeps from block to block.
+ */
+typedef struct
+{
+    compress_t *compress;
+    pthread_t thread;
+#if defined(INGESTIFY_ZLIB)
+    z_stream stream;
+#endif
+#if defined(INGESTIFY_ZSTD)
+    ZSTD_CCtx *context;
+#endif
+} worker_t;
+
+struct compress
+{
+    int fd;
+    compress_format_t format;
+    size_t bound;              /**< Largest a compressed block can be */
+    block_t *blocks;           /**< Ring, block n of the output is in blocks[n % block_count] */
+    size_t block_count;
+    size_t filled;             /**< Blocks handed to the threads, the next one is being filled */
+    size_t taken;              /**< Blocks a thread took */
+    size_t flushed;            /**< Blocks written */
+    bool stopping;
+    bool failed;
+
+    worker_t workers[COMPRESS_THREADS_MAX];
+    unsigned int worker_count;
+    pthread_mutex_t lock;
+    pthread_cond_t filled_cond; /**< Signalled when a block is filled, or the threads stop */
+    pthread_cond_t done_cond;   /**< Signalled when a block is compressed */
+};
+
+/**
+ * @brief Finds a format by its name.
+ * 
+ * @param[in]  name       "gzip" or "zstd".
+ * @param[out] format_out The format.
+ * 
+ * @return false if there is no such format, or it was not built in, which
+ * is printed.
+ */
+bool compress_parse(const char *name, compress_format_t *format_out)
+{
+#if defined(INGESTIFY_ZLIB)
+    if (strcmp(name, "gzip") == 0)
+    {
+        *format_out = COMPRESS_GZIP;
+        return true;
+    }
+#endif
+#if defined(INGESTIFY_ZSTD)
+    if (strcmp(name, "zstd") == 0)
+    {
+        *format_out = COMPRESS_ZSTD;
+        return true;
+    }
+#endif
+    (void)format_out;
+    if ((strcmp(name, "gzip") == 0) || (strcmp(name, "zstd") == 0))
+        fprintf(stderr, "--compress %s is not available, %s was not found when this program was built\n", name,
+                (name[0] == 'g') ? "zlib" : "libzstd");
+    else
+        fprintf(stderr, "--compress needs gzip or zstd, not %s\n", name);
+    return false;
+}
+
+/**
+ * @brief Largest a block of a size can be once compressed.
+ */
+static size_t block_bound(compress_format_t format, size_t size)
+{
+#if defined(INGESTIFY_ZLIB)
+    if (format == COMPRESS_GZIP)
+        return compressBound((uLong)size) + 12; // The gzip wrapper is 12 bytes longer than the zlib one
+#endif
+#if defined(INGESTIFY_ZSTD)
+    if (format == COMPRESS_ZSTD)
+        return ZSTD_compressBound(size);
+#endif
+    (void)format;
+    return size;
+}
+
+/**
+ * @brief Sets up the compressor of a thread.
+ * 
+ * @return false if memory ran out.
+ */
+static bool worker_init(worker_t *worker, compress_format_t format)
+{
+#if defined(INGESTIFY_ZLIB)
+    if (format == COMPRESS_GZIP)
+    {
+        memset(&worker->stream, 0, sizeof(worker->stream));
+        return deflateInit2(&worker->stream, COMPRESS_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK; // 16 for gzip
+    }
+#endif
+#if defined(INGESTIFY_ZSTD)
+    if (format == COMPRESS_ZSTD)
+    {
+        worker->context = ZSTD_createCCtx();
+        return EXISTS(worker->context);
+    }
+#endif
+    (void)worker, (void)format;
+    return false;
+}
+
+/**
+ * @brief Frees the compressor of a thread.
+ */
+static void worker_end(worker_t *worker, compress_format_t format)
+{
+#if defined(INGESTIFY_ZLIB)
+    if (format == COMPRESS_GZIP)
+        deflateEnd(&worker->stream);
+#endif
+#if defined(INGESTIFY_ZSTD)
+    if (format == COMPRESS_ZSTD)
+        ZSTD_freeCCtx(worker->context);
+#endif
+    (void)worker, (void)format;
+}
+
+/**
+ * @brief Compresses a block into a complete member or frame of its own.
+ * 
+ * @return false if the compressor failed.
+ */
+static bool compress_block(worker_t *worker, block_t *block)
+{
+    compress_t *compress = worker->compress;
+#if defined(INGESTIFY_ZLIB)
+    if (compress->format == COMPRESS_GZIP)
+    {
+        worker->stream.next_in = (Bytef *)block->input;
+        worker->stream.avail_in = (uInt)block->input_size;
+        worker->stream.next_out = (Bytef *)block->output;
+        worker->stream.avail_out = (uInt)compress->bound;
+        bool finished = (deflate(&worker->stream, Z_FINISH) == Z_STREAM_END);
+        block->output_size = compress->bound - worker->stream.avail_out;
+        deflateReset(&worker->stream);
+        return finished;
+    }
+#endif
+#if defined(INGESTIFY_ZSTD)
+    if (compress->format == COMPRESS_ZSTD)
+    {
+        size_t size = ZSTD_compressCCtx(worker->context, block->output, compress->bound, block->input, block->input_size, COMPRESS_ZSTD_LEVEL);
+        block->output_size = ZSTD_isError(size) ? 0 : size;
+        return !ZSTD_isError(size);
+    }
+#endif
+    (void)compress, (void)block;
+    return false;
+}
+
+/**
+ * @brief Compresses blocks in the order they were filled, until told to stop
+ * and none are left.
+ */
+static void *worker_main(void *arg)
+{
+    worker_t *worker = arg;
+    compress_t *compress = worker->compress;
+
+    pthread_mutex_lock(&compress->lock);
+    while (true)
+    {
+        while (!compress->stopping && (compress->taken == compress->filled))
+            pthread_cond_wait(&compress->filled_cond, &compress->lock);
+        if (compress->taken == compress->filled)
+            break;
+
+        block_t *block = &compress->blocks[compress->taken % compress->block_count];
+        compress->taken++;
+        pthread_mutex_unlock(&compress->lock);
+
+        bool ok = compress_block(worker, block);
+
+        pthread_mutex_lock(&compress->lock);
+        block->ok = ok;
+        block->done = true;
+        pthread_cond_broadcast(&compress->done_cond);
+    }
+    pthread_mutex_unlock(&compress->lock);
+    return NULL;
+}
+
+/**
+ * @brief Writes a compressed block, continuing after short writes.
+ * 
+ * @return false if the file did not take it.
+ */
+static bool write_block(int fd, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = write(fd, data, size);
+        if ((n < 0) && (errno == EINTR))
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+/**
+ * @brief Writes the oldest block that was handed to the threads.
+ * 
+ * @param[in, out] compress The compressor.
+ * @param[in]      wait     Whether to wait until it is compressed.
+ * 
+ * @return false if it was not compressed yet.
+ */
+static bool flush_block(compress_t *compress, bool wait)
+{
+    block_t *block = &compress->blocks[compress->flushed % compress->block_count];
+    pthread_mutex_lock(&compress->lock);
+    while (wait && !block->done)
+        pthread_cond_wait(&compress->done_cond, &compress->lock);
+    bool done = block->done;
+    pthread_mutex_unlock(&compress->lock);
+    if (!done)
+        return false;
+
+    if (!compress->failed && !block->ok)
+    {
+        fprintf(stderr, "Error compressing output file\n");
+        compress->failed = true;
+    }
+    if (!compress->failed && !write_block(compress->fd, block->output, block->output_size))
+    {
+        perror("Error writing output file");
+        compress->failed = true;
+    }
+    block->done = false;
+    block->input_size = 0;
+    compress->flushed++;
+    return true;
+}
+
+/**
+ * @brief Hands the block being filled to the threads, and writes the blocks
+ * that are compressed by now. Once every slot is taken, it waits for the
+ * oldest one, so the output never holds more than the ring.
+ */
+static void submit_block(compress_t *compress)
+{
+    pthread_mutex_lock(&compress->lock);
+    compress->filled++;
+    pthread_cond_signal(&compress->filled_cond);
+    pthread_mutex_unlock(&compress->lock);
+
+    while (compress->flushed < compress->filled)
+    {
+        bool full = ((compress->filled - compress->flushed) == compress->block_count);
+        if (!flush_block(compress, full))
+            break;
+    }
+}
+
+/**
+ * @brief The block being filled, with its buffers allocated the first time
+ * its slot is used.
+ * 
+ * @return block_t* The block, NULL if memory ran out.
+ */
+static block_t *current_block(compress_t *compress)
+{
+    block_t *block = &compress->blocks[compress->filled % compress->block_count];
+    if (IS_NULL(block->input))
+    {
+        block->input = malloc(COMPRESS_BLOCK + compress->bound);
+        if (IS_NULL(block->input))
+        {
+            perror("Memory allocation failed");
+            compress->failed = true;
+            return NULL;
+        }
+        block->output = &block->input[COMPRESS_BLOCK];
+    }
+    return block;
+}
+
+/**
+ * @brief Takes bytes of the output, see writer_sink_t.
+ */
+static bool compress_write(void *context, const void **bases, const size_t *lengths, int count)
+{
+    compress_t *compress = context;
+    for (int i = 0; i < count; i++)
+    {
+        const char *data = bases[i];
+        size_t left = lengths[i];
+        while ((left > 0) && !compress->failed)
+        {
+            block_t *block = current_block(compress);
+            if (IS_NULL(block))
+                break;
+
+            size_t n = COMPRESS_BLOCK - block->input_size;
+            if (n > left) n = left;
+            memcpy(&block->input[block->input_size], data, n);
+            block->input_size += n;
+            data += n;
+            left -= n;
+            if (block->input_size == COMPRESS_BLOCK)
+                submit_block(compress);
+        }
+    }
+    return !compress->failed;
+}
+
+/**
+ * @brief Stops the threads, and frees the compressor with its file.
+ * 
+ * @return false if the file could not be closed.
+ */
+static bool compress_free(compress_t *compress)
+{
+    pthread_mutex_lock(&compress->lock);
+    compress->stopping = true;
+    pthread_cond_broadcast(&compress->filled_cond);
+    pthread_mutex_unlock(&compress->lock);
+    for (unsigned int i = 0; i < compress->worker_count; i++)
+    {
+        pthread_join(compress->workers[i].thread, NULL);
+        worker_end(&compress->workers[i], compress->format);
+    }
+
+    bool ok = true;
+    if ((compress->fd >= 0) && (close(compress->fd) != 0))
+    {
+        perror("Error closing output file");
+        ok = false;
+    }
+
+    for (size_t i = 0; i < compress->block_count; i++)
+        free(compress->blocks[i].input);
+    free(compress->blocks);
+    pthread_mutex_destroy(&compress->lock);
+    pthread_cond_destroy(&compress->filled_cond);
+    pthread_cond_destroy(&compress->done_cond);
+    free(compress);
+    return ok;
+}
+
+/**
+ * @brief Compresses and writes what is left, see writer_sink_t.
+ */
+static bool compress_close(void *context)
+{
+    compress_t *compress = context;
+
+    // An empty output is still one empty member or frame, so that it can be read
+    block_t *block = compress->failed ? NULL : current_block(compress);
+    if (EXISTS(block) && ((block->input_size > 0) || (compress->filled == 0)))
+        submit_block(compress);
+    while (compress->flushed < compress->filled)
+        flush_block(compress, true);
+
+    bool ok = !compress->failed;
+    return compress_free(compress) && ok;
+}
+
+/**
+ * @brief Number of processors online, for the default number of threads.
+ */
+static unsigned int processor_count(void)
+{
+#if defined(_SC_NPROCESSORS_ONLN)
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count > 0) ? (unsigned int)count : 1;
+#else
+    return 4;
+#endif
+}
+
+/**
+ * @brief Creates or truncates an output file, and a sink that compresses
+ * what is written to it.
+ * 
+ * @param[in]  path     Path to the output file.
+ * @param[in]  format   Format to compress to.
+ * @param[in]  threads  Threads compressing, 0 for one per processor.
+ * @param[out] sink_out The sink, for writer_open_sink().
+ * 
+ * @return false if the file could not be created, or memory ran out.
+ */
+bool compress_open(const char *path, compress_format_t format, unsigned int threads, writer_sink_t *sink_out)
+{
+    if (threads == 0)
+        threads = processor_count();
+    if (threads > COMPRESS_THREADS_MAX)
+        threads = COMPRESS_THREADS_MAX;
+
+    // Two blocks a thread, so one can be filled while the other is compressed
+    compress_t *compress = calloc(1, sizeof(compress_t));
+    block_t *blocks = calloc(2 * (size_t)threads, sizeof(block_t));
+    if (IS_NULL(compress) || IS_NULL(blocks))
+    {
+        free(compress);
+        free(blocks);
+        perror("Memory allocation failed");
+        return false;
+    }
+
+    compress->format = format;
+    compress->bound = block_bound(format, COMPRESS_BLOCK);
+    compress->blocks = blocks;
+    compress->block_count = 2 * (size_t)threads;
+    pthread_mutex_init(&compress->lock, NULL);
+    pthread_cond_init(&compress->filled_cond, NULL);
+    pthread_cond_init(&compress->done_cond, NULL);
+
+    compress->fd = open(path, OUTPUT_FLAGS, 0666);
+    if (compress->fd < 0)
+    {
+        compress_free(compress);
+        return false;
+    }
+
+    for (unsigned int i = 0; i < threads; i++)
+    {
+        worker_t *worker = &compress->workers[compress->worker_count];
+        worker->compress = compress;
+        if (!worker_init(worker, format))
+            break;
+        if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0)
+        {
+            worker_end(worker, format);
+            break;
+        }
+        compress->worker_count++;
+    }
+    if (compress->worker_count == 0)
+    {
+        fprintf(stderr, "Could not start the compressing threads.\n");
+        compress_free(compress);
+        return false;
+    }
+
+    sink_out->write = compress_write;
+    sink_out->close = compress_close;
+    sink_out->context = compress;
+    return true;
+}
+
+// end of file compress.c
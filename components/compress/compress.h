@@ -0,0 +1,54 @@
+/**
+ * @file      compress.h
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Compresses the output as it is written. The output is cut into
+ *            blocks that are compressed on their own by a pool of threads,
+ *            each into a complete gzip member or zstd frame, and written in
+ *            order, which the usual tools read as one stream.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#ifndef COMPRESS_H_
+#define COMPRESS_H_
+
+#include <stdbool.h>
+#include "writer.h"
+
+#define COMPRESS_BLOCK       (1024 * 1024) /**< Bytes of output compressed on their own */
+#define COMPRESS_THREADS_MAX 16            /**< Most threads compressing at once */
+#define COMPRESS_GZIP_LEVEL  6             /**< Levels the gzip and zstd tools use by default */
+#define COMPRESS_ZSTD_LEVEL  3
+
+typedef enum
+{
+    COMPRESS_GZIP,
+    COMPRESS_ZSTD,
+} compress_format_t;
+
+/**
+ * @brief Finds a format by its name.
+ * 
+ * @param[in]  name       "gzip" or "zstd".
+ * @param[out] format_out The format.
+ * 
+ * @return false if there is no such format, or it was not built in, which
+ * is printed.
+ */
+bool compress_parse(const char *name, compress_format_t *format_out);
+
+/**
+ * @brief Creates or truncates an output file, and a sink that compresses
+ * what is written to it.
+ * 
+ * @param[in]  path     Path to the output file.
+ * @param[in]  format   Format to compress to.
+ * @param[in]  threads  Threads compressing, 0 for one per processor.
+ * @param[out] sink_out The sink, for writer_open_sink().
+ * 
+ * @return false if the file could not be created, or memory ran out.
+ */
+bool compress_open(const char *path, compress_format_t format, unsigned int threads, writer_sink_t *sink_out);
+
+#endif // COMPRESS_H_
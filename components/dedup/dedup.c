@@ -0,0 +1,300 @@
+/**
+ * @file      dedup.c
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Finds files whose contents were already written, by a fast
+ *            hash of the contents, so that they can be written as a
+ *            reference to the first one instead.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#include "dedup.h"
+#include "common.h"
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Constants of wyhash, whose structure the hash follows
+#define P0 0xa0761d6478bd642fULL
+#define P1 0xe7037ed1a0b428dbULL
+#define P2 0x8ebc6af09c88c6e3ULL
+#define P3 0x589965cc75374cc3ULL
+
+/**
+ * @brief A file whose contents were written.
+ */
+typedef struct
+{
+    dedup_digest_t digest;
+    const char *path; /**< NULL for a free slot */
+} dedup_slot_t;
+
+struct dedup
+{
+    dedup_slot_t *slots;
+    size_t mask;
+    size_t count;
+    arena_t arena;    /**< The paths */
+};
+
+/**
+ * @brief Multiplies to 128 bits and folds the halves together.
+ */
+static inline uint64_t mix(uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+#else
+    uint64_t ha = a >> 32, la = (uint32_t)a, hb = b >> 32, lb = (uint32_t)b;
+    uint64_t high = ha * hb, mid0 = ha * lb, mid1 = la * hb, low = la * lb;
+    uint64_t t = low + (mid0 << 32);
+    uint64_t carry = (t < low);
+    uint64_t lo = t + (mid1 << 32);
+    carry += (lo < t);
+    uint64_t hi = high + (mid0 >> 32) + (mid1 >> 32) + carry;
+    return lo ^ hi;
+#endif
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t read32(const uint8_t *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief Hashes one chunk, continuing from the hash of the chunks before it.
+ * Three independent lanes take 48 bytes a round, so the multiplies overlap.
+ */
+static uint64_t hash_chunk(const uint8_t *p, size_t len, uint64_t seed)
+{
+    uint64_t a = 0;
+    uint64_t b = 0;
+    seed ^= mix(seed ^ P0, P1);
+
+    if (len <= 16)
+    {
+        if (len >= 4)
+        {
+            size_t middle = (len >> 3) << 2;
+            a = (read32(p) << 32) | read32(&p[middle]);
+            b = (read32(&p[len - 4]) << 32) | read32(&p[len - 4 - middle]);
+        }
+        else if (len > 0)
+        {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+        }
+    }
+    else
+    {
+        size_t left = len;
+        if (left > 48)
+        {
+            uint64_t lane1 = seed;
+            uint64_t lane2 = seed;
+            do
+            {
+                seed  = mix(read64(p) ^ P1, read64(&p[8]) ^ seed);
+                lane1 = mix(read64(&p[16]) ^ P2, read64(&p[24]) ^ lane1);
+                lane2 = mix(read64(&p[32]) ^ P3, read64(&p[40]) ^ lane2);
+                p += 48;
+                left -= 48;
+            } while (left > 48);
+            seed ^= lane1 ^ lane2;
+        }
+        while (left > 16)
+        {
+            seed = mix(read64(p) ^ P1, read64(&p[8]) ^ seed);
+            p += 16;
+            left -= 16;
+        }
+        a = read64(&p[left - 16]);
+        b = read64(&p[left - 8]);
+    }
+
+    return mix(P1 ^ len, mix(a ^ P1, b ^ seed));
+}
+
+/**
+ * @brief Hashes the contents of a file. Not cryptographic, a file is only
+ * taken for another one with the same size and the same 64 bit hash.
+ * 
+ * @param[in] data Contents.
+ * @param[in] size Size of the contents.
+ * 
+ * @return uint64_t The hash.
+ */
+uint64_t dedup_hash(const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    uint64_t hash = hash_chunk(p, (size < DEDUP_CHUNK) ? size : DEDUP_CHUNK, P0);
+    for (size_t offset = DEDUP_CHUNK; offset < size; offset += DEDUP_CHUNK)
+    {
+        size_t n = ((size - offset) < DEDUP_CHUNK) ? (size - offset) : DEDUP_CHUNK;
+        hash = hash_chunk(&p[offset], n, hash);
+    }
+    return hash;
+}
+
+/**
+ * @brief Hashes an open file from where it is, the same as dedup_hash() of
+ * its contents, and goes back there.
+ * 
+ * @param[in]  fd       Open file.
+ * @param[in]  size     Bytes to hash.
+ * @param[out] hash_out The hash.
+ * 
+ * @return false if it could not be read, or was shorter than size.
+ */
+bool dedup_hash_fd(int fd, off_t size, uint64_t *hash_out)
+{
+    off_t start = lseek(fd, 0, SEEK_CUR);
+    size_t chunk = (size < DEDUP_CHUNK) ? (size_t)size : DEDUP_CHUNK;
+    uint8_t *buffer = malloc((chunk > 0) ? chunk : 1);
+    if ((start < 0) || IS_NULL(buffer))
+    {
+        free(buffer);
+        return false;
+    }
+
+    bool complete = true;
+    uint64_t hash = P0;
+    off_t offset = 0;
+    do
+    {
+        size_t n = ((size - offset) < (off_t)chunk) ? (size_t)(size - offset) : chunk;
+        complete = (read_full(fd, buffer, n) == n);
+        hash = hash_chunk(buffer, n, hash);
+        offset += (off_t)n;
+    } while (complete && (offset < size));
+
+    free(buffer);
+    *hash_out = hash;
+    return (lseek(fd, start, SEEK_SET) == start) && complete;
+}
+
+/**
+ * @brief Creates an empty table of the contents written.
+ * 
+ * @return dedup_t* The table, NULL if memory ran out.
+ */
+dedup_t *dedup_create(void)
+{
+    dedup_t *dedup = calloc(1, sizeof(dedup_t));
+    if (EXISTS(dedup))
+    {
+        dedup->mask = 1023;
+        dedup->slots = calloc(dedup->mask + 1, sizeof(dedup_slot_t));
+    }
+    if (IS_NULL(dedup) || IS_NULL(dedup->slots))
+    {
+        free(dedup);
+        return NULL;
+    }
+    return dedup;
+}
+
+/**
+ * @brief Finds the slot of some contents, the free slot they would go in if
+ * they are not there.
+ */
+static dedup_slot_t *find_slot(dedup_slot_t *slots, size_t mask, const dedup_digest_t *digest)
+{
+    size_t index = (size_t)(digest->hash ^ (digest->hash >> 32)) & mask;
+    while (EXISTS(slots[index].path) && ((slots[index].digest.hash != digest->hash) || (slots[index].digest.size != digest->size)))
+        index = (index + 1) & mask;
+    return &slots[index];
+}
+
+/**
+ * @brief Finds a file with the same contents that was written before.
+ * 
+ * @param[in] dedup  The table.
+ * @param[in] digest Hash and size of the contents.
+ * 
+ * @return const char* Path of the earlier file, NULL if there is none and
+ * the contents have to be written.
+ */
+const char *dedup_find(const dedup_t *dedup, const dedup_digest_t *digest)
+{
+    return find_slot(dedup->slots, dedup->mask, digest)->path;
+}
+
+/**
+ * @brief Remembers a file whose contents are written whole.
+ * 
+ * @param[in, out] dedup  The table.
+ * @param[in]      digest Hash and size of the contents.
+ * @param[in]      path   Path of the file, as written in its header.
+ */
+void dedup_add(dedup_t *dedup, const dedup_digest_t *digest, const char *path)
+{
+    if (((dedup->count + 1) * 2) > (dedup->mask + 1))
+    {
+        size_t mask = (dedup->mask * 2) + 1;
+        dedup_slot_t *slots = calloc(mask + 1, sizeof(dedup_slot_t));
+        if (IS_NULL(slots))
+            return; // Left out, later copies are written whole
+        for (size_t i = 0; i <= dedup->mask; i++)
+        {
+            if (EXISTS(dedup->slots[i].path))
+                *find_slot(slots, mask, &dedup->slots[i].digest) = dedup->slots[i];
+        }
+        free(dedup->slots);
+        dedup->slots = slots;
+        dedup->mask = mask;
+    }
+
+    dedup_slot_t *slot = find_slot(dedup->slots, dedup->mask, digest);
+    if (EXISTS(slot->path))
+        return; // The first file with the contents stays
+
+    slot->path = arena_strndup(&dedup->arena, path, strlen(path));
+    if (EXISTS(slot->path))
+    {
+        slot->digest = *digest;
+        dedup->count++;
+    }
+}
+
+/**
+ * @brief Forgets every file, for a new output.
+ * 
+ * @param[in, out] dedup The table.
+ */
+void dedup_clear(dedup_t *dedup)
+{
+    memset(dedup->slots, 0, (dedup->mask + 1) * sizeof(dedup_slot_t));
+    dedup->count = 0;
+    arena_free(&dedup->arena);
+}
+
+/**
+ * @brief Frees a table.
+ * 
+ * @param[in] dedup The table, may be NULL.
+ */
+void dedup_free(dedup_t *dedup)
+{
+    if (IS_NULL(dedup))
+        return;
+
+    free(dedup->slots);
+    arena_free(&dedup->arena);
+    free(dedup);
+}
+
+// end of file dedup.c
@@ -0,0 +1,98 @@
+/**
+ * @file      dedup.h
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Finds files whose contents were already written, by a fast
+ *            hash of the contents, so that they can be written as a
+ *            reference to the first one instead.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#ifndef DEDUP_H_
+#define DEDUP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define DEDUP_MIN_SIZE 128               /**< Smaller files cost less than a reference to them */
+#define DEDUP_CHUNK    (1024 * 1024)     /**< Large files are hashed this much at a time */
+
+typedef struct dedup dedup_t;
+
+/**
+ * @brief Hash of the contents of a file, and how much of it was hashed.
+ */
+typedef struct
+{
+    uint64_t hash;
+    uint64_t size;
+} dedup_digest_t;
+
+/**
+ * @brief Hashes the contents of a file. Not cryptographic, a file is only
+ * taken for another one with the same size and the same 64 bit hash.
+ * 
+ * @param[in] data Contents.
+ * @param[in] size Size of the contents.
+ * 
+ * @return uint64_t The hash.
+ */
+uint64_t dedup_hash(const void *data, size_t size);
+
+/**
+ * @brief Hashes an open file from where it is, the same as dedup_hash() of
+ * its contents, and goes back there.
+ * 
+ * @param[in]  fd       Open file.
+ * @param[in]  size     Bytes to hash.
+ * @param[out] hash_out The hash.
+ * 
+ * @return false if it could not be read, or was shorter than size.
+ */
+bool dedup_hash_fd(int fd, off_t size, uint64_t *hash_out);
+
+/**
+ * @brief Creates an empty table of the contents written.
+ * 
+ * @return dedup_t* The table, NULL if memory ran out.
+ */
+dedup_t *dedup_create(void);
+
+/**
+ * @brief Finds a file with the same contents that was written before.
+ * 
+ * @param[in] dedup  The table.
+ * @param[in] digest Hash and size of the contents.
+ * 
+ * @return const char* Path of the earlier file, NULL if there is none and
+ * the contents have to be written.
+ */
+const char *dedup_find(const dedup_t *dedup, const dedup_digest_t *digest);
+
+/**
+ * @brief Remembers a file whose contents are written whole.
+ * 
+ * @param[in, out] dedup  The table.
+ * @param[in]      digest Hash and size of the contents.
+ * @param[in]      path   Path of the file, as written in its header.
+ */
+void dedup_add(dedup_t *dedup, const dedup_digest_t *digest, const char *path);
+
+/**
+ * @brief Forgets every file, for a new output.
+ * 
+ * @param[in, out] dedup The table.
+ */
+void dedup_clear(dedup_t *dedup);
+
+/**
+ * @brief Frees a table.
+ * 
+ * @param[in] dedup The table, may be NULL.
+ */
+void dedup_free(dedup_t *dedup);
+
+#endif // DEDUP_H_
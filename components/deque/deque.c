@@ -0,0 +1,147 @@
+/**
+ * @file      deque.c
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Double ended work queue for work stealing. The owning thread
+ *            pushes and pops at the tail, other threads steal from the head.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#include "deque.h"
+#include "common.h"
+
+#include <stdlib.h>
+
+/**
+ * @brief Initializes an empty deque.
+ * 
+ * @param[out] deque    Deque to initialize.
+ * @param[in]  capacity Initial number of slots, rounded up to a power of two.
+ * 
+ * @return true on success.
+ */
+bool deque_init(deque_t *deque, size_t capacity)
+{
+    size_t slots = 1;
+    while (slots < capacity) slots <<= 1;
+
+    deque->items = malloc(slots * sizeof(void *));
+    if (IS_NULL(deque->items))
+    {
+        return false;
+    }
+    deque->capacity = slots;
+    deque->head = 0;
+    deque->tail = 0;
+    pthread_mutex_init(&deque->lock, NULL);
+    return true;
+}
+
+/**
+ * @brief Frees the slots of a deque, the items are not freed.
+ * 
+ * @param[in, out] deque Deque to free.
+ */
+void deque_free(deque_t *deque)
+{
+    if (EXISTS(deque->items))
+    {
+        free(deque->items);
+        deque->items = NULL;
+        pthread_mutex_destroy(&deque->lock);
+    }
+}
+
+/**
+ * @brief Doubles the slots of a full deque, keeping the order of the items.
+ * Must be called with the lock held.
+ */
+static bool deque_grow(deque_t *deque)
+{
+    size_t capacity = deque->capacity * 2;
+    void **items = malloc(capacity * sizeof(void *));
+    if (IS_NULL(items))
+    {
+        return false;
+    }
+
+    size_t count = deque->tail - deque->head;
+    for (size_t i = 0; i < count; i++)
+    {
+        items[i] = deque->items[(deque->head + i) & (deque->capacity - 1)];
+    }
+    free(deque->items);
+    deque->items = items;
+    deque->capacity = capacity;
+    deque->head = 0;
+    deque->tail = count;
+    return true;
+}
+
+/**
+ * @brief Pushes an item at the tail, growing the deque if it is full.
+ * 
+ * @param[in, out] deque Deque to push to.
+ * @param[in]      item  Item to push, must not be NULL.
+ * 
+ * @return true on success.
+ */
+bool deque_push(deque_t *deque, void *item)
+{
+    bool pushed = true;
+    pthread_mutex_lock(&deque->lock);
+    if ((deque->tail - deque->head) == deque->capacity)
+    {
+        pushed = deque_grow(deque);
+    }
+    if (pushed)
+    {
+        deque->items[deque->tail & (deque->capacity - 1)] = item;
+        deque->tail++;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return pushed;
+}
+
+/**
+ * @brief Pops the newest item, used by the owner of the deque.
+ * 
+ * @param[in, out] deque Deque to pop from.
+ * 
+ * @return void* The item, NULL if the deque is empty.
+ */
+void *deque_pop(deque_t *deque)
+{
+    void *item = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail != deque->head)
+    {
+        deque->tail--;
+        item = deque->items[deque->tail & (deque->capacity - 1)];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return item;
+}
+
+/**
+ * @brief Steals the oldest item, used by threads that ran out of work.
+ * 
+ * @param[in, out] deque Deque to steal from.
+ * 
+ * @return void* The item, NULL if the deque is empty.
+ */
+void *deque_steal(deque_t *deque)
+{
+    void *item = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail != deque->head)
+    {
+        item = deque->items[deque->head & (deque->capacity - 1)];
+        deque->head++;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return item;
+}
+
+// end of file deque.c
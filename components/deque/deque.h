@@ -0,0 +1,76 @@
+/**
+ * @file      deque.h
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Double ended work queue for work stealing. The owning thread
+ *            pushes and pops at the tail, other threads steal from the head.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#ifndef DEQUE_H_
+#define DEQUE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/**
+ * @brief Growable ring buffer of pointers, guarded by its own lock so that
+ * contention is only between the owner and a thief of the same deque.
+ */
+typedef struct
+{
+    void **items;         /**< Ring buffer of items */
+    size_t capacity;      /**< Number of slots, always a power of two */
+    size_t head;          /**< Oldest item, taken by thieves */
+    size_t tail;          /**< One past the newest item, taken by the owner */
+    pthread_mutex_t lock; /**< Guards everything above */
+} deque_t;
+
+/**
+ * @brief Initializes an empty deque.
+ * 
+ * @param[out] deque    Deque to initialize.
+ * @param[in]  capacity Initial number of slots, rounded up to a power of two.
+ * 
+ * @return true on success.
+ */
+bool deque_init(deque_t *deque, size_t capacity);
+
+/**
+ * @brief Frees the slots of a deque, the items are not freed.
+ * 
+ * @param[in, out] deque Deque to free.
+ */
+void deque_free(deque_t *deque);
+
+/**
+ * @brief Pushes an item at the tail, growing the deque if it is full.
+ * 
+ * @param[in, out] deque Deque to push to.
+ * @param[in]      item  Item to push, must not be NULL.
+ * 
+ * @return true on success.
+ */
+bool deque_push(deque_t *deque, void *item);
+
+/**
+ * @brief Pops the newest item, used by the owner of the deque.
+ * 
+ * @param[in, out] deque Deque to pop from.
+ * 
+ * @return void* The item, NULL if the deque is empty.
+ */
+void *deque_pop(deque_t *deque);
+
+/**
+ * @brief Steals the oldest item, used by threads that ran out of work.
+ * 
+ * @param[in, out] deque Deque to steal from.
+ * 
+ * @return void* The item, NULL if the deque is empty.
+ */
+void *deque_steal(deque_t *deque);
+
+#endif // DEQUE_H_
@@ -10,77 +10,115 @@
 
 #include "ignore.h"
 #include "common.h"
+#include "stats.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdatomic.h>
+#include <unistd.h>
 
-static inline int match_exact_path(const char *pattern, const char *path)
+/**
+ * @brief Glob patterns are matched with one bit per token in a uint64_t, and
+ * the last bit is the accepting state.
+ */
+#define IGNORE_GLOB_MAX_TOKENS 63
+
+#define IGNORE_RULE_NEGATE   0x01U /**< Pattern started with "!" */
+#define IGNORE_RULE_DIR_ONLY 0x02U /**< Pattern ended with "/" */
+#define IGNORE_RULE_ANCHORED 0x04U /**< Pattern is matched from the root only */
+
+/**
+ * @brief What is known about the last component of a path being matched.
+ */
+typedef enum
 {
-    return strncmp(pattern, path, __PATH_MAX);
-}
+    IGNORE_TYPE_UNKNOWN,
+    IGNORE_TYPE_FILE,
+    IGNORE_TYPE_DIR,
+} ignore_type_t;
 
-static inline int unsafe_char_to_digit(const char _char)
+/**
+ * @brief What the rules of one list say about a path.
+ */
+typedef enum
 {
-    return ('0' <= _char && _char <= '9') ? ((int)_char - '0') : -1;
-}
+    IGNORE_NO_MATCH,     /**< No rule matches */
+    IGNORE_KEEP,         /**< An exception matches last */
+    IGNORE_SKIP,         /**< Ignored, but an exception comes after the rule */
+    IGNORE_SKIP_SUBTREE, /**< Ignored, and so is everything under it */
+} ignore_decision_t;
 
 /**
- * @brief Converts string representing a number into an int.
- * 
- * @param[in]      str         String to convert.
- * @param[in, out] ptr_int_out Buffer to put converted number in.
- * 
- * @return true on success.
+ * @brief The kinds of compiled patterns, cheapest first.
  */
-static bool str_to_int(char *str, int *ptr_int_out)
+typedef enum
 {
-    int int_out = 0;
-    const char *_str_max = str + __PATH_MAX;
-    for (char *rp = str; *rp && (rp != _str_max); rp++)
-    {
-        int char_digit = unsafe_char_to_digit(*rp);
-        if (char_digit >= 0)
-        {
-            int_out *= 10;
-            int_out += char_digit;
-        }
-        else
-        {
-            return false; // error
-        }
-    }
-    *ptr_int_out = int_out;
-    return true;
-}
+    IGNORE_RULE_NAME,   /**< "logs", a plain name */
+    IGNORE_RULE_PATH,   /**< "logs/debug.log", a literal path from the root */
+    IGNORE_RULE_SUFFIX, /**< "*.log", a star followed by a literal */
+    IGNORE_RULE_GLOB,   /**< Everything else, matched by the NFA */
+} ignore_rule_type_t;
+
+struct ignore_rule
+{
+    ignore_rule_type_t type;
+    uint8_t flags;
+    const char *entry;     /**< The line it was compiled from, for --stats */
+    const char *literal;   /**< NAME and PATH: the pattern, SUFFIX: the part after "*" */
+    size_t literal_len;
+    uint8_t token_count;   /**< GLOB: number of tokens, bit token_count accepts */
+    uint64_t star;         /**< GLOB: "*" tokens, loop on anything but '/' */
+    uint64_t globstar;     /**< GLOB: "**" tokens, loop on anything */
+    uint64_t skip_one;     /**< GLOB: tokens that may match nothing */
+    uint64_t skip_two;     /**< GLOB: "**" followed by '/', the pair may match nothing */
+    uint64_t *char_mask;   /**< GLOB: 256 masks, bit i is set if token i accepts the char */
+};
 
 /**
- * @brief Converts string representing a number into an int.
- * 
- * @param[in]      str         String to convert.
- * @param[in]      len         String length
- * @param[in, out] ptr_int_out Buffer to put converted number in.
+ * @brief Rules by what they can match. Rule numbers are stored plus one, so
+ * that 0 ends a chain.
+ */
+struct ignore_index
+{
+    uint32_t *buckets;         /**< NAME and PATH rules by the hash of their literal */
+    uint32_t *next;            /**< Next rule in the same chain, one per rule */
+    size_t bucket_mask;        /**< Number of buckets minus one, a power of two minus one */
+    uint32_t suffix_head[256]; /**< SUFFIX rules by the last character of their literal */
+    uint32_t *globs;           /**< GLOB rules, last one first */
+    size_t glob_count;
+    size_t negate_end;         /**< One past the last "!" rule, 0 if there is none */
+};
+
+/**
+ * @brief The rules of a directory, as a layer on the rules of its parent.
+ * Sets never change once made, so threads can share them.
+ */
+struct ignore_set
+{
+    atomic_size_t refs;
+    ignore_set_t *parent;        /**< Set of the directory above, NULL at the root */
+    const ignore_list_t *list;   /**< Rules of this layer, NULL if there are none */
+    ignore_list_t *owned;        /**< The list, if it was read for this layer */
+    const char *base;            /**< Directory of the layer's ignore file, its rules are relative to it */
+    size_t base_len;             /**< 0 for the root, whose rules see the paths of the walk */
+    char *nested_name;           /**< Name of the ignore files, owned by the root */
+};
+
+/**
+ * @brief Frees the compiled patterns of an ignore list, but not its entries.
  * 
- * @return true on success.
+ * @param ignore_list Pointer to the ignore list structure.
  */
-static bool strn_to_int(const char *str, size_t len, int *ptr_int_out)
+void ignore_free_rules(ignore_list_t *ignore_list)
 {
-    int int_out = 0;
-    for (size_t i = 0; i < len; i++)
+    if (ignore_list)
     {
-        int char_digit = unsafe_char_to_digit(str[i]);
-        if (char_digit >= 0)
-        {
-            int_out *= 10;
-            int_out += char_digit;
-        }
-        else
-        {
-            return false; // error
-        }
+        arena_free(&ignore_list->arena);
+        ignore_list->rules = NULL;
+        ignore_list->rule_count = 0;
+        ignore_list->index = NULL;
     }
-    *ptr_int_out = int_out;
-    return true;
 }
 
 /**
@@ -92,298 +130,998 @@ void ignore_free_list(ignore_list_t *ignore_list)
 {
     if (ignore_list)
     {
-        for (size_t i = 0; i < ignore_list->count; i++)
-        {
-            free(ignore_list->entries[i]);
-        }
-        free(ignore_list->entries);
+        arena_free(&ignore_list->arena); // The entries are in it too
         free(ignore_list);
     }
 }
 
 /**
- * @brief Reads the ignore list from a file.
+ * @brief Reads the lines of an open ignore file into a list, and compiles it.
  * 
- * @param[in] ignore_file Path to the ignore file.
+ * @param[in] file Open ignore file, it is closed.
  * 
- * @return ignore_list_t* Pointer to the ignore list structure.
+ * @return ignore_list_t* Pointer to the ignore list structure, NULL on failure.
  */
-ignore_list_t *ignore_read_list(const char *ignore_file)
+static ignore_list_t *read_list(FILE *file)
 {
-    FILE *file = fopen(ignore_file, "r");
-    if (IS_NULL(file))
-    {
-        perror("Error opening ignore file");
-        return NULL;
-    }
-
-    ignore_list_t *ignore_list = malloc(sizeof(ignore_list_t));
+    ignore_list_t *ignore_list = calloc(1, sizeof(ignore_list_t));
     if (IS_NULL(ignore_list))
     {
         perror("Memory allocation failed");
         fclose(file);
         return NULL;
     }
-    ignore_list->count = 0;
-    ignore_list->entries = NULL;
 
     char line[__PATH_MAX];
+    size_t capacity = 0;
     while (fgets(line, sizeof(line), file))
     {
-        line[strcspn(line, "\n")] = '\0'; // Remove the newline character
-        ignore_list->entries = realloc(ignore_list->entries, (ignore_list->count + 1) * sizeof(char *));
-        if (IS_NULL(ignore_list->entries))
+        size_t len = strcspn(line, "\n"); // Leave out the newline character
+        if (ignore_list->count == capacity)
         {
-            perror("Memory allocation failed");
-            fclose(file);
-            return NULL;
+            // The old array stays in the arena, at most as large as the new one
+            capacity = (capacity > 0) ? (capacity * 2) : 32;
+            char **entries = arena_alloc(&ignore_list->arena, capacity * sizeof(char *));
+            if (IS_NULL(entries))
+            {
+                perror("Memory allocation failed");
+                fclose(file);
+                ignore_free_list(ignore_list);
+                return NULL;
+            }
+            if (ignore_list->count > 0)
+                memcpy(entries, ignore_list->entries, ignore_list->count * sizeof(char *));
+            ignore_list->entries = entries;
         }
-        ignore_list->entries[ignore_list->count] = strdup(line);
+        ignore_list->entries[ignore_list->count] = arena_strndup(&ignore_list->arena, line, len);
         if (IS_NULL(ignore_list->entries[ignore_list->count]))
         {
             perror("Memory allocation failed");
             fclose(file);
+            ignore_free_list(ignore_list);
             return NULL;
         }
         ignore_list->count++;
     }
 
     fclose(file);
+
+    if (!ignore_compile(ignore_list))
+    {
+        ignore_free_list(ignore_list);
+        return NULL;
+    }
+
     return ignore_list;
 }
 
 /**
- * @brief A slash needs to be added to ignore item so that it appears as a subfolder,
- * and not a substring of a larger filename.
- * 
- * - "test" -> "test/some_file.c" -> true
+ * @brief Reads the ignore list from a file, and compiles it.
  * 
- * - "test" -> "test_some"        -> false
+ * @param[in] ignore_file Path to the ignore file.
  * 
- * So "test" has to become "test/"
+ * @return ignore_list_t* Pointer to the ignore list structure.
+ */
+ignore_list_t *ignore_read_list(const char *ignore_file)
+{
+    FILE *file = fopen(ignore_file, "r");
+    if (IS_NULL(file))
+    {
+        perror("Error opening ignore file");
+        return NULL;
+    }
+
+    return read_list(file);
+}
+
+/**
+ * @brief Adds the characters accepted by a bracket expression like "[a-z]" or
+ * "[!01]" to a token of the glob.
  * 
- * @param[in] ignore_item Ignore list entry to check against
- * @param[in] path        Path to the file or directory.
+ * @param[in]      pattern   Pattern, pointing at the '['.
+ * @param[in]      len       Remaining length of the pattern.
+ * @param[in]      bit       Bit of the token in the char masks.
+ * @param[in, out] char_mask Char masks of the rule.
  * 
- * @return 0 if match, some other value otherwise.
+ * @return size_t Length of the bracket expression, 0 if it is not closed.
  */
-static int match_directory(const char *ignore_item, const char *path)
+static size_t glob_add_bracket(const char *pattern, size_t len, uint64_t bit, uint64_t *char_mask)
 {
-    int exact_match = -1;
-    int len_ignore_item = strnlen(ignore_item, __PATH_MAX);
+    bool accepts[256] = { false };
+    size_t i = 1;
+    bool negate = (i < len) && (pattern[i] == '!' || pattern[i] == '^');
+    if (negate) i++;
 
-    char *ignore_item_slash = malloc(len_ignore_item + 2);
+    size_t first = i;
+    while (i < len && (pattern[i] != ']' || i == first))
     {
-        snprintf(ignore_item_slash, len_ignore_item + 2, "%s/", ignore_item);
-        char *possible_ignore_subfolder = strstr(path, ignore_item_slash);
-        if (EXISTS(possible_ignore_subfolder))
+        unsigned char from = (unsigned char)pattern[i];
+        if ((i + 2 < len) && (pattern[i + 1] == '-') && (pattern[i + 2] != ']'))
         {
-            int len_possible_ignore_subfolder = strnlen(path, __PATH_MAX);
-            exact_match = strncmp(possible_ignore_subfolder, path, len_possible_ignore_subfolder);
+            unsigned char to = (unsigned char)pattern[i + 2];
+            for (unsigned int c = from; c <= to; c++) accepts[c] = true;
+            i += 3;
+        }
+        else
+        {
+            accepts[from] = true;
+            i++;
         }
     }
-    free(ignore_item_slash);
+    if (i >= len) return 0; // "[" without a "]" is a literal
 
-    return exact_match;
+    for (unsigned int c = 0; c < 256; c++)
+    {
+        if ((accepts[c] != negate) && (c != '/')) char_mask[c] |= bit;
+    }
+    return i + 1;
 }
 
 /**
- * @brief Checks if a file or directory should be ignored based on the ignore list.
- *
- * @param[in] ignore_list Pointer to the ignore list structure.
- * @param[in] path        Path to the file or directory.
- *
- * @return true If the file or directory should be ignored.
- * @return false If the file or directory should not be ignored.
+ * @brief Turns a glob into tokens, one bit each in the masks of the rule.
+ * 
+ * @param[in]      pattern   Pattern without "!", leading "**" "/" and trailing "/".
+ * @param[in]      len       Length of the pattern.
+ * @param[in, out] rule      Rule to fill.
+ * @param[in, out] char_mask 256 zeroed masks for the rule.
+ * 
+ * @return true on success, false if the pattern has too many tokens.
  */
-bool ignore_is_match(const ignore_list_t *ignore_list, const char *path)
+static bool glob_tokenize(const char *pattern, size_t len, ignore_rule_t *rule, uint64_t *char_mask)
 {
-    if (IS_NULL(ignore_list) || IS_NULL(path))
+    size_t token = 0;
+    size_t i = 0;
+    while (i < len)
+    {
+        if (token >= IGNORE_GLOB_MAX_TOKENS) return false;
+        uint64_t bit = 1ULL << token;
+        char c = pattern[i];
+
+        if (c == '*')
+        {
+            size_t run = 0;
+            while ((i + run < len) && (pattern[i + run] == '*')) run++;
+            bool at_start = (i == 0) || (pattern[i - 1] == '/');
+            bool at_end   = (i + run == len) || (pattern[i + run] == '/');
+            i += run;
+
+            if ((run >= 2) && at_start && at_end)
+            {
+                // "**/**/" is the same as "**/"
+                while ((i + 3 <= len) && (strncmp(&pattern[i], "/**", 3) == 0) && ((i + 3 == len) || (pattern[i + 3] == '/')))
+                {
+                    i += 3;
+                }
+                rule->globstar |= bit;
+                if (i < len) rule->skip_two |= bit;
+                else         rule->skip_one |= bit;
+            }
+            else
+            {
+                rule->star     |= bit;
+                rule->skip_one |= bit;
+            }
+        }
+        else if (c == '?')
+        {
+            for (unsigned int ch = 0; ch < 256; ch++)
+            {
+                if (ch != '/') char_mask[ch] |= bit;
+            }
+            i++;
+        }
+        else if ((c == '[') && (glob_add_bracket(&pattern[i], len - i, bit, char_mask) > 0))
+        {
+            i += glob_add_bracket(&pattern[i], len - i, bit, char_mask);
+        }
+        else
+        {
+            if ((c == '\\') && (i + 1 < len)) c = pattern[++i];
+            char_mask[(unsigned char)c] |= bit;
+            i++;
+        }
+        token++;
+    }
+
+    rule->token_count = (uint8_t)token;
+    return true;
+}
+
+/**
+ * @brief Checks for glob characters in the first len characters of a pattern.
+ */
+static inline bool has_wildcard(const char *pattern, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (strchr("*?[\\", pattern[i]) != NULL) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Compiles one ignore entry.
+ * 
+ * @param[in]  entry     Ignore list entry, it is not modified.
+ * @param[out] rule      Compiled rule, it points into the entry.
+ * @param[out] char_mask 256 masks, used if the entry is a glob.
+ * 
+ * @return true if the entry is a pattern, false for blank lines, comments and
+ * patterns that cannot be compiled.
+ */
+static bool compile_rule(const char *entry, ignore_rule_t *rule, uint64_t *char_mask)
+{
+    memset(rule, 0, sizeof(*rule));
+    rule->entry = entry;
+
+    const char *pattern = entry;
+    size_t len = strlen(entry);
+    while ((len > 0) && (strchr(" \t\r\n", pattern[len - 1]) != NULL)) len--;
+    if ((len == 0) || (pattern[0] == '#')) return false;
+
+    if (pattern[0] == '!')
+    {
+        rule->flags |= IGNORE_RULE_NEGATE;
+        pattern++, len--;
+    }
+    else if ((pattern[0] == '\\') && (len > 1) && (pattern[1] == '!' || pattern[1] == '#'))
+    {
+        pattern++, len--;
+    }
+
+    while ((len >= 2) && (strncmp(pattern, "./", 2U) == 0)) pattern += 2, len -= 2;
+    while ((len > 0) && (pattern[len - 1] == '/'))
+    {
+        rule->flags |= IGNORE_RULE_DIR_ONLY;
+        len--;
+    }
+
+    bool anchored  = false;
+    bool any_depth = false;
+    while ((len > 0) && (pattern[0] == '/'))
     {
+        anchored = true;
+        pattern++, len--;
+    }
+    while ((len > 3) && (strncmp(pattern, "**/", 3U) == 0))
+    {
+        any_depth = true;
+        pattern += 3, len -= 3;
+    }
+    if (len == 0) return false;
+
+    bool has_slash = (memchr(pattern, '/', len) != NULL);
+    bool has_wild  = has_wildcard(pattern, len);
+    if ((has_slash || anchored) && !any_depth) rule->flags |= IGNORE_RULE_ANCHORED;
+
+    bool is_anchored = (rule->flags & IGNORE_RULE_ANCHORED);
+    rule->literal     = pattern;
+    rule->literal_len = len;
+
+    if (!has_wild && !has_slash && !any_depth && !anchored)
+    {
+        rule->type = IGNORE_RULE_NAME;
+        return true;
+    }
+    if (!has_wild && is_anchored)
+    {
+        rule->type = IGNORE_RULE_PATH;
+        return true;
+    }
+    if ((pattern[0] == '*') && (len > 1) && !has_slash && !is_anchored && !has_wildcard(&pattern[1], len - 1))
+    {
+        rule->type = IGNORE_RULE_SUFFIX;
+        rule->literal++;
+        rule->literal_len--;
+        return true;
+    }
+
+    rule->type = IGNORE_RULE_GLOB;
+    rule->char_mask = char_mask;
+    memset(char_mask, 0, 256 * sizeof(uint64_t));
+    if (!glob_tokenize(pattern, len, rule, char_mask))
+    {
+        fprintf(stderr, "Ignore pattern has too many tokens, skipping: %s\n", entry);
         return false;
     }
+    return true;
+}
+
+/**
+ * @brief Files the compiled rules of a list by what they can match.
+ * 
+ * @param[in, out] arena      Arena of the list, the index goes in it.
+ * @param[in]      rules      Compiled rules.
+ * @param[in]      rule_count Number of rules.
+ * 
+ * @return ignore_index_t* The index, NULL if memory ran out.
+ */
+static ignore_index_t *build_index(arena_t *arena, const ignore_rule_t *rules, size_t rule_count)
+{
+    size_t bucket_count = 16;
+    while (bucket_count < (rule_count * 2)) bucket_count *= 2;
+
+    ignore_index_t *index = arena_calloc(arena, 1, sizeof(ignore_index_t));
+    if (IS_NULL(index)) return NULL;
+    index->buckets     = arena_calloc(arena, bucket_count, sizeof(uint32_t));
+    index->next        = arena_calloc(arena, rule_count + 1, sizeof(uint32_t));
+    index->globs       = arena_calloc(arena, rule_count + 1, sizeof(uint32_t));
+    index->bucket_mask = bucket_count - 1;
+    if (IS_NULL(index->buckets) || IS_NULL(index->next) || IS_NULL(index->globs))
+        return NULL;
+
+    for (size_t i = rule_count; i-- > 0;)
+    {
+        const ignore_rule_t *rule = &rules[i];
+        uint32_t *head = NULL;
+        if ((rule->flags & IGNORE_RULE_NEGATE) && (index->negate_end == 0))
+            index->negate_end = i + 1;
+
+        switch (rule->type)
+        {
+            case IGNORE_RULE_NAME:
+            case IGNORE_RULE_PATH:
+                head = &index->buckets[hash_bytes(HASH_SEED, rule->literal, rule->literal_len) & index->bucket_mask];
+                break;
+            case IGNORE_RULE_SUFFIX:
+                head = &index->suffix_head[(unsigned char)rule->literal[rule->literal_len - 1]];
+                break;
+            case IGNORE_RULE_GLOB:
+                index->globs[index->glob_count++] = (uint32_t)(i + 1);
+                break;
+        }
+        if (EXISTS(head))
+        {
+            index->next[i] = *head;
+            *head = (uint32_t)(i + 1);
+        }
+    }
+    return index;
+}
 
-    bool is_match = false;
-    int exact_match;
+/**
+ * @brief Compiles the entries of an ignore list into matchers, so that
+ * ignore_is_match() does not have to parse the patterns for every path.
+ * 
+ * @param[in, out] ignore_list Pointer to the ignore list structure.
+ * 
+ * @return true on success.
+ */
+bool ignore_compile(ignore_list_t *ignore_list)
+{
+    if (IS_NULL(ignore_list)) return false;
+    if (EXISTS(ignore_list->rules)) return true;
+    if (ignore_list->count == 0) return true;
 
+    ignore_list->rules = arena_calloc(&ignore_list->arena, ignore_list->count, sizeof(ignore_rule_t));
+    if (IS_NULL(ignore_list->rules))
+    {
+        perror("Memory allocation failed");
+        return false;
+    }
+
+    uint64_t char_mask[256];
     for (size_t entry = 0; entry < ignore_list->count; entry++)
     {
-        char *ignore_item = sanitize_path(ignore_list->entries[entry]);
-        if (IS_NULL(ignore_item)) // TODO: add length check here for __PATH_MAX?
+        ignore_rule_t *rule = &ignore_list->rules[ignore_list->rule_count];
+        if (!compile_rule(ignore_list->entries[entry], rule, char_mask))
             continue;
 
-        char *path_has_pattern = strstr(path, ignore_item);
-        char *pattern_has_wc   = strstr(ignore_item, "*");  // wc = wildcard
-        char *pattern_has_dwc  = strstr(ignore_item, "**"); // dwc = double wildcard
-        char *pattern_has_ques = strstr(ignore_item, "?");
-        char *pattern_has_neg  = (ignore_item[0] == '!') ? ignore_item : NULL;
-        char *pattern_has_brk_s = strchr(ignore_item, '[');
-        char *pattern_has_brk_e = strchr(ignore_item, ']');
-
-        if (EXISTS(pattern_has_brk_s) && EXISTS(pattern_has_brk_e))
+        if (rule->type == IGNORE_RULE_GLOB)
         {
-            int bracket_length = pattern_has_brk_e - pattern_has_brk_s - 1;
-            char *pattern_has_range = memchr(pattern_has_brk_s, '-', bracket_length);
-            if (EXISTS(pattern_has_range))
+            rule->char_mask = arena_alloc(&ignore_list->arena, sizeof(char_mask));
+            if (IS_NULL(rule->char_mask))
             {
-                int to, from;
-                char *_to_s   = pattern_has_brk_s + 1;
-                char *_to_e   = pattern_has_range - 1;
-                char *_from_s = pattern_has_range + 1;
-                char *_from_e = pattern_has_brk_e - 1;
-                bool to_parsed   = strn_to_int(_to_s, ((_to_e - _to_s) + 1), &to);
-                bool from_parsed = strn_to_int(_from_s, ((_from_e - _from_s) + 1), &from);
-                if(to_parsed && from_parsed)
-                {
-                    printf("\rto: %d, from %d\n", to, from);
-                    // to and from have been parsed here
-                    // although this is not how to will work
-                }
+                perror("Memory allocation failed");
+                return false;
             }
+            memcpy(rule->char_mask, char_mask, sizeof(char_mask));
         }
+        ignore_list->rule_count++;
+    }
+
+    ignore_list->index = build_index(&ignore_list->arena, ignore_list->rules, ignore_list->rule_count);
+    if (IS_NULL(ignore_list->index))
+    {
+        perror("Memory allocation failed");
+        return false;
+    }
+    return true;
+}
 
-        // Question mark was found in the entry
-        // example:- pattern: [ "log", "!log/important.txt" ]
-        // ignores: "log/some_log.txt", doesn't ignore: "log/important.txt"
-        if (EXISTS(pattern_has_neg) && EXISTS(pattern_has_neg + 1) && (*(char *)(pattern_has_neg + 1) != 0)) // checking for p and p+1 and *p+1 guarantees length < 1
+/**
+ * @brief Checks whether a match on the last component of the path counts.
+ * 
+ * @param[in] rule Compiled rule.
+ * @param[in] type What is known about the last component.
+ * 
+ * @return true if it counts.
+ */
+static inline bool last_component_matches(const ignore_rule_t *rule, ignore_type_t type)
+{
+    return !(rule->flags & IGNORE_RULE_DIR_ONLY) || (type != IGNORE_TYPE_FILE);
+}
+
+/**
+ * @brief Applies the epsilon moves of the glob NFA, "*" and "**" matching nothing.
+ */
+static inline uint64_t glob_closure(const ignore_rule_t *rule, uint64_t state)
+{
+    state |= (state & rule->skip_two) << 2;
+    state |= (state & rule->skip_one) << 1;
+    return state;
+}
+
+/**
+ * @brief Runs the glob NFA over the path. Unanchored globs restart at every
+ * component, and a match that ends before a '/' is a leading directory.
+ * 
+ * @param[in] rule Compiled glob rule.
+ * @param[in] path Sanitized path.
+ * @param[in] len  Length of the path.
+ * @param[in] type What is known about the last component.
+ * 
+ * @return true if the glob matches the path or one of its leading directories.
+ */
+static bool glob_matches(const ignore_rule_t *rule, const char *path, size_t len, ignore_type_t type)
+{
+    const uint64_t accept   = 1ULL << rule->token_count;
+    const bool     anchored = (rule->flags & IGNORE_RULE_ANCHORED);
+    const uint64_t *char_mask = rule->char_mask;
+
+    uint64_t state = glob_closure(rule, 1);
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = (unsigned char)path[i];
+        uint64_t loop = rule->globstar;
+        if (c == '/')
         {
-            pattern_has_neg++; // Skip the "!"
-            const char *path_subdir_has_pattern = strstr(path, pattern_has_neg);
-            if (path_subdir_has_pattern)
-            {
-                exact_match = match_exact_path(pattern_has_neg, path_subdir_has_pattern);
-                if (exact_match == 0)
-                {
-                    is_match = false;
-                    break;
-                }
-            }
+            if (state & accept) return true;
         }
+        else
+        {
+            loop |= rule->star;
+        }
+
+        state = ((state & char_mask[c]) << 1) | (state & loop);
+        if ((c == '/') && !anchored) state |= 1;
+        state = glob_closure(rule, state);
 
-        // Double wildcard was found in the entry
-        // example:- pattern: "**/logs", path: "repo/logs/file.txt"
-        if (EXISTS(pattern_has_dwc))
+        if ((state == 0) && anchored) return false;
+    }
+
+    return (state & accept) && last_component_matches(rule, type);
+}
+
+/**
+ * @brief Checks a single compiled rule against a path.
+ * 
+ * @param[in] rule Compiled rule.
+ * @param[in] path Sanitized path.
+ * @param[in] len  Length of the path.
+ * @param[in] type What is known about the last component.
+ * 
+ * @return true if the rule matches the path or one of its leading directories.
+ */
+static bool rule_matches(const ignore_rule_t *rule, const char *path, size_t len, ignore_type_t type)
+{
+    const char *lit = rule->literal;
+    size_t lit_len  = rule->literal_len;
+
+    switch (rule->type)
+    {
+        case IGNORE_RULE_NAME:
         {
-            int pattern_len = strnlen(pattern_has_dwc, __PATH_MAX);
-            if (pattern_len < 4)
-            {
-                is_match = false;
-                continue;
-            }
+            if ((len == lit_len) && (memcmp(path, lit, lit_len) == 0))
+                return last_component_matches(rule, type);
 
-            const char *pattern_after_dwc_slash = &pattern_has_dwc[3]; // "**/some_path" -> "some_path"
-            const char *path_subdir_has_pattern = strstr(path, pattern_after_dwc_slash);
-            if (EXISTS(path_subdir_has_pattern))
+            bool any_file = (rule->flags & IGNORE_RULE_NEGATE);
+            size_t start = 0;
+            while (start < len)
             {
-                exact_match = match_exact_path(path_subdir_has_pattern, pattern_after_dwc_slash);
-                if (exact_match == 0)
+                const char *slash = memchr(&path[start], '/', len - start);
+                size_t end = EXISTS(slash) ? (size_t)(slash - path) : len;
+                if ((end - start == lit_len) && (memcmp(&path[start], lit, lit_len) == 0))
                 {
-                    is_match = true;
-                    continue;
-                }
-
-                exact_match = match_directory(pattern_after_dwc_slash, path_subdir_has_pattern);
-                if (exact_match == 0)
-                {
-                    is_match = true;
-                    continue;
+                    if (end < len) return true;
+                    if (any_file || (type == IGNORE_TYPE_DIR)) return last_component_matches(rule, type);
                 }
+                start = end + 1;
             }
-            else
-            {
-                is_match = false;
-                break;
-            }
+            return false;
         }
 
-        // Wildcard was found in the entry
-        // example:- pattern: "*.exe", path: "file.exe"
-        if (EXISTS(pattern_has_wc))
+        case IGNORE_RULE_PATH:
         {
-            char *after_wildcard = pattern_has_wc + 1;
+            if ((len < lit_len) || (memcmp(path, lit, lit_len) != 0)) return false;
+            if (len == lit_len) return last_component_matches(rule, type);
+            return (path[lit_len] == '/');
+        }
 
-            // If wildcard is right before extension "*.", then only the the extension is matched
-            if (*after_wildcard == '.')
+        case IGNORE_RULE_SUFFIX:
+        {
+            size_t start = 0;
+            while (start < len)
             {
-                exact_match = match_exact_path(get_filename_ext(ignore_item), get_filename_ext(path));
-                if (exact_match == 0)
+                const char *slash = memchr(&path[start], '/', len - start);
+                size_t end = EXISTS(slash) ? (size_t)(slash - path) : len;
+                if ((end - start >= lit_len) && (memcmp(&path[end - lit_len], lit, lit_len) == 0))
                 {
-                    is_match = true;
-                    continue;
+                    if (end < len) return true;
+                    return last_component_matches(rule, type);
                 }
+                start = end + 1;
             }
+            return false;
+        }
+
+        case IGNORE_RULE_GLOB:
+            return glob_matches(rule, path, len, type);
+    }
+
+    return false;
+}
+
+/**
+ * @brief Finds the last rule that matches, looking only at the rules the
+ * index gives for the names in the path, and at the globs.
+ * 
+ * @param[in] ignore_list Compiled ignore list.
+ * @param[in] path        Sanitized path.
+ * @param[in] len         Length of the path.
+ * @param[in] type        What is known about the last component.
+ * 
+ * @return size_t Number of the rule plus one, 0 if none matches.
+ */
+static size_t find_last_match(const ignore_list_t *ignore_list, const char *path, size_t len, ignore_type_t type)
+{
+    const ignore_index_t *index = ignore_list->index;
+    const ignore_rule_t *rules = ignore_list->rules;
+    size_t found = 0;
+
+    uint32_t path_hash = HASH_SEED;
+    size_t start = 0;
+    while (start < len)
+    {
+        const char *slash = memchr(&path[start], '/', len - start);
+        size_t end = EXISTS(slash) ? (size_t)(slash - path) : len;
+        size_t name_len = end - start;
+
+        // A NAME rule matches a component, a PATH rule the path up to one
+        uint32_t name_hash = hash_bytes(HASH_SEED, &path[start], name_len);
+        path_hash = hash_bytes(path_hash, &path[(start > 0) ? (start - 1) : 0], (start > 0) ? (name_len + 1) : name_len);
+        for (int pass = 0; pass < 2; pass++)
+        {
+            uint32_t hash = (pass == 0) ? name_hash : path_hash;
+            ignore_rule_type_t wanted = (pass == 0) ? IGNORE_RULE_NAME : IGNORE_RULE_PATH;
+            size_t wanted_len = (pass == 0) ? name_len : end;
+            const char *wanted_lit = (pass == 0) ? &path[start] : path;
 
-            // Wildcard was somewhere else in the path
-            char *path_match_after_wildcard = strstr(path, after_wildcard);
-            if (path_match_after_wildcard)
+            for (uint32_t r = index->buckets[hash & index->bucket_mask]; r != 0; r = index->next[r - 1])
             {
-                int wildcard_position = pattern_has_wc - ignore_item;
-                exact_match = strncmp(ignore_item, path, wildcard_position);
-                if (exact_match == 0)
+                const ignore_rule_t *rule = &rules[r - 1];
+                if ((r > found) && (rule->type == wanted) && (rule->literal_len == wanted_len) &&
+                    (memcmp(rule->literal, wanted_lit, wanted_len) == 0) && rule_matches(rule, path, len, type))
                 {
-                    is_match = true;
-                    continue;
+                    found = r;
                 }
             }
         }
 
-        // Question mark was found in the entry
-        // example:- path: "file_1.exe", pattern: "file_?.exe"
-        if (EXISTS(pattern_has_ques))
+        if (name_len > 0)
         {
-            int ques_position = pattern_has_ques - ignore_item;
-            char path_ques[__PATH_MAX] = { 0 };
-            memcpy(path_ques, path, strnlen(path, __PATH_MAX));
-            path_ques[ques_position] = '?';
-
-            // A directory in the path has matched
-            exact_match = match_directory(ignore_item, path_ques);
-            if (exact_match == 0)
+            for (uint32_t r = index->suffix_head[(unsigned char)path[end - 1]]; r != 0; r = index->next[r - 1])
             {
-                is_match = true;
-                continue;
+                if ((r > found) && rule_matches(&rules[r - 1], path, len, type))
+                    found = r;
             }
+        }
+        start = end + 1;
+    }
 
-            // The full path has matched
-            exact_match = match_exact_path(ignore_item, path_ques);
-            if (exact_match == 0)
-            {
-                is_match = true;
-                continue;
-            }
+    // Globs are kept last one first, so the first that matches is the last
+    for (size_t i = 0; (i < index->glob_count) && (index->globs[i] > found); i++)
+    {
+        if (rule_matches(&rules[index->globs[i] - 1], path, len, type))
+        {
+            found = index->globs[i];
+            break;
         }
+    }
+    return found;
+}
+
+/**
+ * @brief Checks a path against every rule of a list, the last match decides.
+ * 
+ * @param[in]  ignore_list Ignore list structure.
+ * @param[in]  path        Sanitized path.
+ * @param[in]  len         Length of the path.
+ * @param[in]  type        What is known about the last component.
+ * @param[out] entry_out   The entry of the rule that decided, untouched if
+ *                         none did, may be NULL.
+ * 
+ * @return ignore_decision_t What the rules say about the path.
+ */
+static ignore_decision_t decide(const ignore_list_t *ignore_list, const char *path, size_t len, ignore_type_t type, const char **entry_out)
+{
+    if (EXISTS(ignore_list->index))
+    {
+        size_t found = find_last_match(ignore_list, path, len, type);
+        if (found == 0)
+            return IGNORE_NO_MATCH;
+        if (EXISTS(entry_out))
+            *entry_out = ignore_list->rules[found - 1].entry;
+        if (ignore_list->rules[found - 1].flags & IGNORE_RULE_NEGATE)
+            return IGNORE_KEEP;
+        return (ignore_list->index->negate_end < found) ? IGNORE_SKIP_SUBTREE : IGNORE_SKIP;
+    }
 
-        // Part of the path matches with the ignore entry
-        // example:- pattern: "some_dir", path: "some_dir/file.txt"
-        if (EXISTS(path_has_pattern))
+    // Not compiled, so the rules are compiled on the stack and checked backwards
+    ignore_rule_t rule;
+    uint64_t char_mask[256];
+    bool negate_after = false;
+    for (size_t entry = ignore_list->count; entry-- > 0;)
+    {
+        if (!compile_rule(ignore_list->entries[entry], &rule, char_mask))
+            continue;
+        if (rule_matches(&rule, path, len, type))
         {
-            // A directory in the path has matched
-            exact_match = match_directory(ignore_item, path);
-            if (exact_match == 0)
-            {
-                is_match = true;
-                continue;
-            }
+            if (EXISTS(entry_out))
+                *entry_out = ignore_list->entries[entry];
+            if (rule.flags & IGNORE_RULE_NEGATE)
+                return IGNORE_KEEP;
+            return negate_after ? IGNORE_SKIP : IGNORE_SKIP_SUBTREE;
+        }
+        if (rule.flags & IGNORE_RULE_NEGATE)
+            negate_after = true;
+    }
 
-            // The full path has matched
-            exact_match = match_exact_path(ignore_item, path);
-            if (exact_match == 0)
-            {
-                is_match = true;
-                continue;
-            }
+    return IGNORE_NO_MATCH;
+}
 
-            int pattern_len = strnlen(ignore_item, __PATH_MAX);
-            char *path_after_pattern = path_has_pattern + pattern_len;
-            if (EXISTS(path_after_pattern) && *path_after_pattern == '/')
-            {
-                is_match = true;
+/**
+ * @brief Checks whether a list has an exception, which could bring back a
+ * path under a directory that another list ignores.
+ */
+static bool has_negation(const ignore_list_t *ignore_list)
+{
+    if (EXISTS(ignore_list->index))
+        return (ignore_list->index->negate_end > 0);
+
+    for (size_t entry = 0; entry < ignore_list->count; entry++)
+    {
+        if (ignore_list->entries[entry][0] == '!') return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Strips what ignore lists do not look at from a path.
+ * 
+ * @param[in, out] path Path, moved past leading "./".
+ * 
+ * @return size_t Length of the path without trailing slashes.
+ */
+static size_t sanitized_length(const char **path)
+{
+    while (strncmp(*path, "./", 2U) == 0) *path += 2;
+    size_t len = strlen(*path);
+    while ((len > 0) && ((*path)[len - 1] == '/')) len--;
+    return len;
+}
+
+/**
+ * @brief What the matcher is told about the last component of a path of an
+ * entry of a walk. Only files are told apart. A directory is matched as
+ * before, and skipped together with everything under it only through
+ * ignore_is_dir_match(), which weighs the exceptions after the pattern.
+ */
+static inline ignore_type_t type_of_entry(entry_type_t type)
+{
+    return (type == ENTRY_TYPE_FILE) ? IGNORE_TYPE_FILE : IGNORE_TYPE_UNKNOWN;
+}
+
+/**
+ * @brief Checks if a file or directory should be ignored based on the ignore list.
+ * 
+ * @param[in] ignore_list Pointer to the ignore list structure.
+ * @param[in] path        Path to the file or directory.
+ * 
+ * @return true If the file or directory should be ignored.
+ * @return false If the file or directory should not be ignored.
+ */
+bool ignore_is_match(const ignore_list_t *ignore_list, const char *path)
+{
+    if (IS_NULL(ignore_list) || IS_NULL(path))
+    {
+        return false;
+    }
+
+    size_t len = sanitized_length(&path);
+    return decide(ignore_list, path, len, IGNORE_TYPE_UNKNOWN, NULL) >= IGNORE_SKIP;
+}
+
+/**
+ * @brief Checks if an entry of a known type should be ignored based on the
+ * ignore list. Unlike ignore_is_match(), a pattern that ends in "/" does not
+ * match a file.
+ * 
+ * @param[in] ignore_list Pointer to the ignore list structure.
+ * @param[in] path        Path to the entry.
+ * @param[in] type        Type of the entry.
+ * 
+ * @return true If the entry should be ignored.
+ */
+bool ignore_is_entry_match(const ignore_list_t *ignore_list, const char *path, entry_type_t type)
+{
+    if (IS_NULL(ignore_list) || IS_NULL(path))
+    {
+        return false;
+    }
+
+    size_t len = sanitized_length(&path);
+    return decide(ignore_list, path, len, type_of_entry(type), NULL) >= IGNORE_SKIP;
+}
+
+/**
+ * @brief Checks if a directory can be skipped together with everything under it.
+ * 
+ * @param[in] ignore_list Pointer to the ignore list structure.
+ * @param[in] path        Path to the directory.
+ * 
+ * @return true If the directory need not be opened.
+ */
+bool ignore_is_dir_match(const ignore_list_t *ignore_list, const char *path)
+{
+    if (IS_NULL(ignore_list) || IS_NULL(path))
+    {
+        return false;
+    }
+
+    size_t len = sanitized_length(&path);
+    return decide(ignore_list, path, len, IGNORE_TYPE_DIR, NULL) == IGNORE_SKIP_SUBTREE;
+}
+
+/**
+ * @brief Creates the rule set of the directory a walk starts at.
+ * 
+ * @param[in] ignore_list Ignore list that applies to the whole walk, may be
+ *                        NULL. It is not copied, and must outlive the set.
+ * @param[in] nested_name Name of the ignore files to look for in every
+ *                        directory, NULL to look for none.
+ * 
+ * @return ignore_set_t* The rule set, NULL if memory ran out.
+ */
+ignore_set_t *ignore_set_create(const ignore_list_t *ignore_list, const char *nested_name)
+{
+    ignore_set_t *set = calloc(1, sizeof(ignore_set_t));
+    if (IS_NULL(set))
+    {
+        perror("Memory allocation failed");
+        return NULL;
+    }
+
+    atomic_init(&set->refs, 1);
+    set->list = ignore_list;
+    set->nested_name = EXISTS(nested_name) ? strdup(nested_name) : NULL;
+    if (EXISTS(nested_name) && IS_NULL(set->nested_name))
+    {
+        perror("Memory allocation failed");
+        free(set);
+        return NULL;
+    }
+    return set;
+}
+
+/**
+ * @brief Shares a rule set, it is freed once every holder has released it.
+ */
+static ignore_set_t *share(ignore_set_t *set)
+{
+    atomic_fetch_add_explicit(&set->refs, 1, memory_order_relaxed);
+    return set;
+}
+
+/**
+ * @brief Finds the rule set of a directory. If the directory has an ignore
+ * file, its rules are read and layered on top of the parent's, otherwise the
+ * parent's set is shared. Either way nothing of the parent is copied.
+ * 
+ * @param[in, out] parent   Rule set of the parent directory, or the one from
+ *                          ignore_set_create() for the directory a walk starts at.
+ * @param[in]      dir      The open directory.
+ * @param[in]      dir_path Path of the directory, as the walk sees it.
+ * 
+ * @return ignore_set_t* The rule set, to be released with ignore_set_release().
+ */
+ignore_set_t *ignore_set_enter(ignore_set_t *parent, DIR *dir, const char *dir_path)
+{
+    if (IS_NULL(parent))
+        return NULL;
+    if (IS_NULL(parent->nested_name))
+        return share(parent);
+
+    // Most directories have no ignore file, so the path is only put together on the stack
+    size_t dir_len  = strlen(dir_path);
+    size_t name_len = strlen(parent->nested_name);
+    size_t path_size = dir_len + 1 + name_len + 1;
+    char stack_path[__PATH_MAX];
+    char *file_path = (path_size <= sizeof(stack_path)) ? stack_path : malloc(path_size);
+    if (IS_NULL(file_path))
+    {
+        perror("Memory allocation failed");
+        return share(parent);
+    }
+    memcpy(file_path, dir_path, dir_len);
+    file_path[dir_len] = '/';
+    memcpy(&file_path[dir_len + 1], parent->nested_name, name_len + 1);
+
+    int fd = dir_open_file(dir, parent->nested_name, file_path);
+    if (file_path != stack_path) free(file_path);
+    FILE *file = (fd >= 0) ? fdopen(fd, "r") : NULL;
+    if (IS_NULL(file))
+    {
+        if (fd >= 0) close(fd);
+        return share(parent);
+    }
+
+    // The set lives in the arena of its own rules, and goes with them
+    ignore_list_t *ignore_list = read_list(file);
+    ignore_set_t *set = (EXISTS(ignore_list) && (ignore_list->rule_count > 0)) ? arena_calloc(&ignore_list->arena, 1, sizeof(ignore_set_t)) : NULL;
+    const char *base = skip_dot_slash(dir_path);
+    size_t base_len = (strcmp(base, ".") == 0) ? 0 : strlen(base);
+    char *base_copy = EXISTS(set) ? arena_strndup(&ignore_list->arena, base, base_len) : NULL;
+    if (IS_NULL(base_copy))
+    {
+        ignore_free_list(ignore_list);
+        return share(parent);
+    }
+
+    atomic_init(&set->refs, 1);
+    set->parent      = share(parent);
+    set->list        = ignore_list;
+    set->owned       = ignore_list;
+    set->base        = base_copy;
+    set->base_len    = base_len;
+    set->nested_name = parent->nested_name;
+    return set;
+}
+
+/**
+ * @brief Releases a rule set, and the sets of the directories above it that
+ * nothing else holds.
+ * 
+ * @param[in] set The rule set, may be NULL.
+ */
+void ignore_set_release(ignore_set_t *set)
+{
+    while (EXISTS(set) && (atomic_fetch_sub_explicit(&set->refs, 1, memory_order_acq_rel) == 1))
+    {
+        ignore_set_t *parent = set->parent;
+        if (EXISTS(set->owned))
+        {
+            ignore_free_list(set->owned); // The set is in its arena
+        }
+        else
+        {
+            free(set->nested_name); // Only the root owns nothing, and the name belongs to it
+            free(set);
+        }
+        set = parent;
+    }
+}
+
+/**
+ * @brief Checks a path against the layers of a set, from the directory's own
+ * ignore file up to the list the walk started with. The first layer with a
+ * matching rule decides.
+ * 
+ * @param[in] set           The rule set.
+ * @param[in] path          Sanitized path, under the directory of the set.
+ * @param[in] len           Length of the path.
+ * @param[in] type          What is known about the last component.
+ * @param[in] whole_subtree Only say it is ignored if no exception could bring
+ *                          back something under it.
+ * 
+ * @return true If the path is ignored.
+ */
+static bool set_decide(const ignore_set_t *set, const char *path, size_t len, ignore_type_t type, bool whole_subtree)
+{
+    bool negation_below = false;
+    for (; EXISTS(set); set = set->parent)
+    {
+        if (IS_NULL(set->list))
+            continue;
+
+        // The rules of a nested file see paths relative to its directory
+        size_t skip = 0;
+        if (set->base_len > 0)
+        {
+            if ((len <= set->base_len) || (memcmp(path, set->base, set->base_len) != 0) || (path[set->base_len] != '/'))
                 continue;
-            }
+            skip = set->base_len + 1;
         }
+
+        const char *entry;
+        ignore_decision_t decision = decide(set->list, &path[skip], len - skip, type, &entry);
+        if (decision != IGNORE_NO_MATCH)
+            stats_rule_hit(set->base, set->base_len, entry);
+        if (decision == IGNORE_KEEP)
+            return false;
+        if (decision != IGNORE_NO_MATCH)
+            return !whole_subtree || ((decision == IGNORE_SKIP_SUBTREE) && !negation_below);
+
+        negation_below = negation_below || has_negation(set->list);
+    }
+    return false;
+}
+
+/**
+ * @brief Checks if a file or directory should be ignored by a rule set.
+ * 
+ * @param[in] set  The rule set of the directory the path is in.
+ * @param[in] path Path to the file or directory.
+ * 
+ * @return true If the file or directory should be ignored.
+ */
+bool ignore_set_is_match(const ignore_set_t *set, const char *path)
+{
+    if (IS_NULL(set) || IS_NULL(path))
+    {
+        return false;
+    }
+
+    size_t len = sanitized_length(&path);
+    return set_decide(set, path, len, IGNORE_TYPE_UNKNOWN, false);
+}
+
+/**
+ * @brief Checks if an entry of a known type should be ignored by a rule set,
+ * see ignore_is_entry_match().
+ * 
+ * @param[in] set  The rule set of the directory the path is in.
+ * @param[in] path Path to the entry.
+ * @param[in] type Type of the entry.
+ * 
+ * @return true If the entry should be ignored.
+ */
+bool ignore_set_is_entry_match(const ignore_set_t *set, const char *path, entry_type_t type)
+{
+    if (IS_NULL(set) || IS_NULL(path))
+    {
+        return false;
+    }
+
+    uint64_t started = stats_begin();
+    size_t len = sanitized_length(&path);
+    bool ignored = set_decide(set, path, len, type_of_entry(type), false);
+    stats_end(STATS_MATCH, started, 0);
+    return ignored;
+}
+
+/**
+ * @brief Checks if a directory can be skipped together with everything under
+ * it, see ignore_is_dir_match(). Ignore files under a skipped directory are
+ * never read, as with git.
+ * 
+ * @param[in] set  The rule set of the directory the path is in.
+ * @param[in] path Path to the directory.
+ * 
+ * @return true If the directory need not be opened.
+ */
+bool ignore_set_is_dir_match(const ignore_set_t *set, const char *path)
+{
+    if (IS_NULL(set) || IS_NULL(path))
+    {
+        return false;
     }
 
-    return is_match;
+    uint64_t started = stats_begin();
+    size_t len = sanitized_length(&path);
+    bool ignored = set_decide(set, path, len, IGNORE_TYPE_DIR, true);
+    stats_end(STATS_MATCH, started, 0);
+    return ignored;
 }
 
 // end of file ignore.c
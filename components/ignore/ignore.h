@@ -14,21 +14,77 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <dirent.h>
+
+#include "arena.h"
+#include "common.h"
+
+/**
+ * @brief A single ignore pattern, compiled by ignore_compile(). The layout is
+ * private to ignore.c.
+ */
+typedef struct ignore_rule ignore_rule_t;
+
+/**
+ * @brief The compiled patterns by the names they can match, built by
+ * ignore_compile(). The layout is private to ignore.c.
+ */
+typedef struct ignore_index ignore_index_t;
+
+/**
+ * @brief The rules that apply in one directory of a walk, see ignore_set_enter().
+ */
+typedef struct ignore_set ignore_set_t;
 
 /**
  * @brief Structure to hold the ignore list
  */
 typedef struct
 {
-    char **entries; /**< Array of strings representing ignore patterns */
-    size_t count;   /**< Number of entries in the ignore list */
+    char **entries;        /**< Array of strings representing ignore patterns */
+    size_t count;          /**< Number of entries in the ignore list */
+    ignore_rule_t *rules;  /**< Compiled patterns, NULL until ignore_compile() is called */
+    size_t rule_count;     /**< Number of compiled patterns, blank lines and comments are dropped */
+    ignore_index_t *index; /**< Patterns by name, NULL until ignore_compile() is called */
+    arena_t arena;         /**< Holds the compiled patterns, and the entries of a list read from a file */
 } ignore_list_t;
 
+/**
+ * @brief Reads the ignore list from a file, and compiles it.
+ * 
+ * @param[in] ignore_file Path to the ignore file.
+ * 
+ * @return ignore_list_t* Pointer to the ignore list structure.
+ */
 ignore_list_t *ignore_read_list(const char *ignore_file);
 
+/**
+ * @brief Compiles the entries of an ignore list into matchers, so that
+ * ignore_is_match() does not have to parse the patterns for every path.
+ * 
+ * Each entry becomes one of a plain name, a literal path, a "*suffix" or a
+ * glob that is matched by a bit-parallel NFA. Names and literal paths are
+ * hashed, and "*suffix" patterns kept by their last character, so a check
+ * only looks at the patterns that could match the names in the path, and at
+ * the globs. Every check is then linear in the length of the path and does
+ * not allocate.
+ * 
+ * @param[in, out] ignore_list Pointer to the ignore list structure.
+ * 
+ * @return true on success.
+ */
+bool ignore_compile(ignore_list_t *ignore_list);
+
 /**
  * @brief Checks if a file or directory should be ignored based on the ignore list.
  * 
+ * Patterns follow gitignore, the last matching pattern decides, and a pattern
+ * that matches a leading directory of the path ignores the whole path. A plain
+ * name without slashes or wildcards matches a directory of that name at any
+ * depth, but a file only at the root (an exception like "!name" matches at any
+ * depth). Lists that were not compiled still work, their entries are compiled
+ * on the stack for every call.
+ * 
  * @param[in] ignore_list Pointer to the ignore list structure.
  * @param[in] path        Path to the file or directory.
  * 
@@ -37,6 +93,42 @@ ignore_list_t *ignore_read_list(const char *ignore_file);
  */
 bool ignore_is_match(const ignore_list_t *ignore_list, const char *path);
 
+/**
+ * @brief Checks if an entry of a known type should be ignored based on the
+ * ignore list. Unlike ignore_is_match(), which does not know whether the path
+ * is a directory, a pattern that ends in "/" does not match a file, as in git.
+ * 
+ * @param[in] ignore_list Pointer to the ignore list structure.
+ * @param[in] path        Path to the entry.
+ * @param[in] type        Type of the entry, as the walk found it.
+ * 
+ * @return true If the entry should be ignored.
+ */
+bool ignore_is_entry_match(const ignore_list_t *ignore_list, const char *path, entry_type_t type);
+
+/**
+ * @brief Checks if a directory can be skipped together with everything under
+ * it. This is the case if the directory itself is ignored and no exception
+ * comes after the pattern that ignores it, so ignore_is_match() would ignore
+ * every path under it as well. Unlike ignore_is_match(), a plain name matches
+ * the directory at any depth.
+ * 
+ * @param[in] ignore_list Pointer to the ignore list structure.
+ * @param[in] path        Path to the directory.
+ * 
+ * @return true If the directory need not be opened.
+ */
+bool ignore_is_dir_match(const ignore_list_t *ignore_list, const char *path);
+
+/**
+ * @brief Frees the compiled patterns of an ignore list, but not its entries.
+ * Used for lists whose entries belong to the caller, a list from
+ * ignore_read_list() has its entries in the same arena.
+ * 
+ * @param ignore_list Pointer to the ignore list structure.
+ */
+void ignore_free_rules(ignore_list_t *ignore_list);
+
 /**
  * @brief Frees the memory allocated for the ignore list.
  * 
@@ -44,4 +136,75 @@ bool ignore_is_match(const ignore_list_t *ignore_list, const char *path);
  */
 void ignore_free_list(ignore_list_t *ignore_list);
 
+/**
+ * @brief Creates the rule set of the directory a walk starts at.
+ * 
+ * @param[in] ignore_list Ignore list that applies to the whole walk, may be
+ *                        NULL. It is not copied, and must outlive the set.
+ * @param[in] nested_name Name of the ignore files to look for in every
+ *                        directory, NULL to look for none.
+ * 
+ * @return ignore_set_t* The rule set, NULL if memory ran out.
+ */
+ignore_set_t *ignore_set_create(const ignore_list_t *ignore_list, const char *nested_name);
+
+/**
+ * @brief Finds the rule set of a directory. If the directory has an ignore
+ * file, its rules are read and layered on top of the parent's, otherwise the
+ * parent's set is shared. Either way nothing of the parent is copied.
+ * 
+ * Like in git, patterns of a nested file are relative to its directory, and
+ * a match in a deeper file wins over the files above it.
+ * 
+ * @param[in, out] parent   Rule set of the parent directory, or the one from
+ *                          ignore_set_create() for the directory a walk starts at.
+ * @param[in]      dir      The open directory.
+ * @param[in]      dir_path Path of the directory, as the walk sees it.
+ * 
+ * @return ignore_set_t* The rule set, to be released with ignore_set_release().
+ */
+ignore_set_t *ignore_set_enter(ignore_set_t *parent, DIR *dir, const char *dir_path);
+
+/**
+ * @brief Releases a rule set, and the sets of the directories above it that
+ * nothing else holds.
+ * 
+ * @param[in] set The rule set, may be NULL.
+ */
+void ignore_set_release(ignore_set_t *set);
+
+/**
+ * @brief Checks if a file or directory should be ignored by a rule set.
+ * 
+ * @param[in] set  The rule set of the directory the path is in.
+ * @param[in] path Path to the file or directory.
+ * 
+ * @return true If the file or directory should be ignored.
+ */
+bool ignore_set_is_match(const ignore_set_t *set, const char *path);
+
+/**
+ * @brief Checks if an entry of a known type should be ignored by a rule set,
+ * see ignore_is_entry_match().
+ * 
+ * @param[in] set  The rule set of the directory the path is in.
+ * @param[in] path Path to the entry.
+ * @param[in] type Type of the entry, as the walk found it.
+ * 
+ * @return true If the entry should be ignored.
+ */
+bool ignore_set_is_entry_match(const ignore_set_t *set, const char *path, entry_type_t type);
+
+/**
+ * @brief Checks if a directory can be skipped together with everything under
+ * it, see ignore_is_dir_match(). Ignore files under a skipped directory are
+ * never read, as with git.
+ * 
+ * @param[in] set  The rule set of the directory the path is in.
+ * @param[in] path Path to the directory.
+ * 
+ * @return true If the directory need not be opened.
+ */
+bool ignore_set_is_dir_match(const ignore_set_t *set, const char *path);
+
 #endif // IGNORE_H_
@@ -10,152 +10,1722 @@
 #include "ingestify.h"
 #include "common.h"
 #include "ignore.h"
+#include "uring.h"
+#include "writer.h"
+#include "progress.h"
+#include "manifest.h"
+#include "dedup.h"
+#include "binary.h"
+#include "tokens.h"
+#include "toc.h"
+#include "shard.h"
+#include "stats.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <dirent.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
+
+/**
+ * @brief Everything a walk keeps between files. Each ingest has one of its
+ * own, so that several can run in one process at once.
+ */
+struct ingestify
+{
+    /**
+     * @brief Maintains the size of data written to output file.
+     */
+    off_t data_written;
+
+    /**
+     * @brief Size of the files found by the walk so far. With the automatic limit,
+     * the output may grow to twice this.
+     */
+    off_t data_found;
+
+    /**
+     * @brief Whether small files are read through io_uring, where the kernel has it.
+     */
+    bool use_io_uring;
+
+    /**
+     * @brief Whether binary files are written as their size only, instead of
+     * their contents.
+     */
+    bool skip_binary;
+
+    /**
+     * @brief Whether the tokens of each file are estimated, and written in its header.
+     */
+    bool count_tokens;
+
+    /**
+     * @brief Most tokens of the output, and of one file, 0 for no limit.
+     */
+    uint64_t max_tokens;
+    uint64_t file_max_tokens;
+
+    /**
+     * @brief Tokens of the contents written to the output so far.
+     */
+    uint64_t tokens_written;
+
+    /**
+     * @brief Manifest of the previous output, whose unchanged files are taken
+     * from it, NULL if there is none.
+     */
+    const manifest_t *previous_manifest;
+
+    /**
+     * @brief Manifest of the output being written, NULL if none is kept.
+     */
+    manifest_t *next_manifest;
+
+    /**
+     * @brief Watch of the directories walked, NULL if not watching.
+     */
+    watch_t *watch;
+
+    /**
+     * @brief Contents written so far, NULL if files are not deduplicated.
+     */
+    dedup_t *dedup;
+
+    /**
+     * @brief Index of where the contents of the files are, NULL if none is written.
+     */
+    toc_t *toc;
+
+    /**
+     * @brief Trace file, written while the walk goes on, NULL if none is.
+     */
+    const char *trace_path;
+
+    /**
+     * @brief Where the files are in the output, to split it into shards, NULL
+     * if it is not split.
+     */
+    shard_t *shards;
+
+    /**
+     * @brief Files at least this large are mapped instead of moved by the kernel,
+     * 0 if only files the kernel refuses to move are mapped.
+     */
+    off_t mmap_min;
+
+    /**
+     * @brief Callbacks told where each file starts and ends in the output,
+     * all NULL if there are none.
+     */
+    ingestify_sink_t sink;
+
+    /**
+     * @brief What the walk prints, and its counters.
+     */
+    progress_t *progress;
+};
+
+
+/**
+ * @brief Files at least this large are moved into the output by the kernel.
+ * Smaller ones are cheaper to copy through the buffer of the output, which
+ * collects many of them into one write.
+ */
+#define INGESTIFY_ZERO_COPY_MIN (64 * 1024)
+
+/**
+ * @brief Mapped files are written this much at a time, and checked for
+ * truncation in between.
+ */
+#define INGESTIFY_MMAP_SLICE (4 * 1024 * 1024)
+
+/**
+ * @brief Files whose tokens are counted before they are written are read
+ * this much at a time for it.
+ */
+#define INGESTIFY_COUNT_CHUNK (64 * 1024)
+
+/**
+ * @brief Limit on data_written for the file being written.
+ */
+static off_t current_limit(const ingestify_t *ingestify, const off_t max_output_size)
+{
+    return (max_output_size == INGESTIFY_MAX_SIZE_AUTO) ? (2 * ingestify->data_found) : max_output_size;
+}
+
+/**
+ * @brief Bytes of a file that can be written at once without checking the
+ * limit chunk by chunk. That is the whole file if it fits, otherwise the
+ * whole BUFSIZ chunks that fit, so that the limit trips at the same chunk as
+ * with write_chunk().
+ */
+static off_t room_for(const ingestify_t *ingestify, off_t remaining, const off_t max_output_size)
+{
+    off_t room = current_limit(ingestify, max_output_size) - ingestify->data_written;
+    if (remaining <= room)
+        return remaining;
+    return (room > 0) ? (room / BUFSIZ) * BUFSIZ : 0;
+}
+
+/**
+ * @brief Accounts for a chunk of file contents.
+ * 
+ * @param[in, out] ingestify       The output being written, and its options.
+ * @param[in]      n               Size of the chunk.
+ * @param[in]      max_output_size Maximum allowed size for the output file.
+ * 
+ * @return false if the limit was exceeded, the chunk must not be written then.
+ */
+static bool account_chunk(ingestify_t *ingestify, size_t n, const off_t max_output_size)
+{
+    ingestify->data_written += n;
+    if (ingestify->data_written > current_limit(ingestify, max_output_size))
+    {
+        fprintf(stderr, "Output file size exceeded the limit. Aborting.\n");
+        return false;
+    }
+    progress_bytes(ingestify->progress, n);
+    return true;
+}
+
+/**
+ * @brief Most tokens the next file may have, within the limits on one file
+ * and on the output.
+ */
+static uint64_t file_token_limit(const ingestify_t *ingestify)
+{
+    uint64_t limit = (ingestify->file_max_tokens > 0) ? ingestify->file_max_tokens : TOKENS_NO_LIMIT;
+    if ((ingestify->max_tokens > 0) && ((ingestify->max_tokens - ingestify->tokens_written) < limit))
+        limit = ingestify->max_tokens - ingestify->tokens_written;
+    return limit;
+}
+
+/**
+ * @brief Accounts for the tokens of a file that was written.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      tokens    Tokens of the contents written.
+ * @param[in]      cut       Whether the file was cut short at its limit.
+ * 
+ * @return false if it was the limit on the output that cut it.
+ */
+static bool account_tokens(ingestify_t *ingestify, uint64_t tokens, bool cut)
+{
+    uint64_t file_limit = (ingestify->file_max_tokens > 0) ? ingestify->file_max_tokens : TOKENS_NO_LIMIT;
+    bool output_cut = cut && (ingestify->max_tokens > 0) && ((ingestify->max_tokens - ingestify->tokens_written) < file_limit);
+    ingestify->tokens_written += tokens;
+    if (output_cut)
+    {
+        fprintf(stderr, "Output token count exceeded the limit. Aborting.\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Counts the tokens of an open file from where it is, a piece at a
+ * time, and goes back there, so that the count can be written before the
+ * contents.
+ * 
+ * @param[in]      fd     The file.
+ * @param[in, out] size   Bytes to count, then the bytes within the limit.
+ * @param[in]      limit  Most tokens the file may have.
+ * @param[in, out] tokens Tokens counted.
+ * 
+ * @return true if the file was cut at the limit.
+ */
+static bool count_fd(int fd, off_t *size, uint64_t limit, tokens_t *tokens)
+{
+    char chunk[INGESTIFY_COUNT_CHUNK];
+    off_t start = lseek(fd, 0, SEEK_CUR);
+    off_t counted = 0;
+    bool cut = false;
+    while (!cut && (counted < *size))
+    {
+        size_t wanted = ((*size - counted) < (off_t)sizeof(chunk)) ? (size_t)(*size - counted) : sizeof(chunk);
+        uint64_t started = stats_begin();
+        size_t n = read_full(fd, chunk, wanted);
+        stats_end(STATS_READ, started, n);
+        size_t kept = tokens_feed(tokens, chunk, n, limit);
+        counted += (off_t)kept;
+        cut = (kept < n);
+        if (n < wanted)
+            break; // Truncated while it was read
+    }
+    *size = counted;
+    if (lseek(fd, start, SEEK_SET) != start)
+        perror("Error seeking file");
+    return cut;
+}
+
+/**
+ * @brief Rule at the end of the header of a file.
+ */
+#define INGESTIFY_HEADER_RULE "============================================================="
+
+/**
+ * @brief Formats the count of tokens of a file to take the place of the
+ * rule in its header, at the same length.
+ */
+static void format_tokens(char field[sizeof(INGESTIFY_HEADER_RULE)], uint64_t tokens)
+{
+    int n = snprintf(field, sizeof(INGESTIFY_HEADER_RULE), "~%llu tokens ", (unsigned long long)tokens);
+    memset(&field[n], '=', sizeof(INGESTIFY_HEADER_RULE) - 1 - (size_t)n);
+    field[sizeof(INGESTIFY_HEADER_RULE) - 1] = '\0';
+}
+
+/**
+ * @brief Writes the header that comes before the contents of a file. While
+ * tokens are counted, the count of the contents starts the rule.
+ */
+static void write_header(const ingestify_t *ingestify, const char *file_path, uint64_t tokens, writer_t *output)
+{
+    if (!ingestify->count_tokens)
+    {
+        writer_printf(output, "\nFILE \"%s\" " INGESTIFY_HEADER_RULE ":\n", file_path);
+        return;
+    }
+
+    char field[sizeof(INGESTIFY_HEADER_RULE)];
+    format_tokens(field, tokens);
+    writer_printf(output, "\nFILE \"%s\" %s:\n", file_path, field);
+}
+
+/**
+ * @brief Writes the count of tokens into the header of a file, once its
+ * contents were written and counted after it.
+ * 
+ * @param[in]      file_path Path to the file, as in the header.
+ * @param[in]      offset    Size of the output before the header.
+ * @param[in]      tokens    Tokens of the contents.
+ * @param[in, out] output    Output file.
+ */
+static void patch_header(const char *file_path, size_t offset, uint64_t tokens, writer_t *output)
+{
+    char field[sizeof(INGESTIFY_HEADER_RULE)];
+    format_tokens(field, tokens);
+    writer_patch(output, offset + strlen("\nFILE \"") + strlen(file_path) + strlen("\" "), field, sizeof(field) - 1);
+}
+
+/**
+ * @brief With deduplication, writes a file whose contents were written
+ * before as a reference to the first file that had them. The manifest does
+ * not keep it, since the first file may change on its own, so it is read
+ * again on the next run.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      file_path Path to the file.
+ * @param[in]      digest    Hash of the contents.
+ * @param[in, out] output    Output file.
+ * 
+ * @return true if it was written as a reference, and nothing else is
+ * written for it. Otherwise it has to be written whole.
+ */
+static bool write_reference(ingestify_t *ingestify, const char *file_path, const dedup_digest_t *digest, writer_t *output)
+{
+    const char *first_path = dedup_find(ingestify->dedup, digest);
+    if (IS_NULL(first_path))
+        return false;
+
+    if (EXISTS(ingestify->shards) && !shard_add(ingestify->shards, file_path, writer_size(output), 0))
+        perror("Memory allocation failed");
+    writer_printf(output, "\nFILE \"%s\" SAME AS \"%s\" ==================================================:\n\n", file_path, first_path);
+
+    // Indexed with the contents of the first file, so they are found under either path
+    const toc_entry_t *first = EXISTS(ingestify->toc) ? toc_find(ingestify->toc, first_path) : NULL;
+    if (EXISTS(first) && !toc_add(ingestify->toc, file_path, first->offset, first->length, first->hashed ? &first->hash : NULL))
+        perror("Memory allocation failed");
+    return true;
+}
+
+/**
+ * @brief Adds where the contents of a file are in the output to the index,
+ * if one is written.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      file_path Path to the file.
+ * @param[in]      offset    Where the contents start in the output.
+ * @param[in]      length    Size of the contents written.
+ * @param[in]      digest    Hash of the file, NULL if it was not hashed. Only
+ *                           indexed if the contents were written whole.
+ */
+static void index_file(ingestify_t *ingestify, const char *file_path, size_t offset, size_t length, const dedup_digest_t *digest)
+{
+    bool whole = EXISTS(digest) && (digest->size == (uint64_t)length);
+    if (EXISTS(ingestify->toc) && !toc_add(ingestify->toc, file_path, offset, length, whole ? &digest->hash : NULL))
+        perror("Memory allocation failed");
+}
+
+/**
+ * @brief Adds a file that was written to the manifest being kept, and to
+ * the files that the output is split by.
+ * 
+ * @param[in, out] ingestify   The output being written, and its options.
+ * @param[in]      file_path   Path to the file.
+ * @param[in]      key         What the file looked like before it was read, NULL
+ *                             if that is not known, it is left out then.
+ * @param[in]      kind        What the file was found to be.
+ * @param[in]      digest      Hash of the contents, NULL if they were not hashed.
+ * @param[in]      tokens      Tokens of the contents, NULL if they were not counted.
+ * @param[in]      offset      Size of the output before the header of the file.
+ * @param[in]      data_before data_written before the contents of the file.
+ * @param[in]      output      Output file.
+ */
+static void record_file(ingestify_t *ingestify, const char *file_path, const manifest_key_t *key, manifest_kind_t kind, const dedup_digest_t *digest, const uint64_t *tokens, size_t offset, off_t data_before, const writer_t *output)
+{
+    if (EXISTS(ingestify->shards) && !shard_add(ingestify->shards, file_path, offset, EXISTS(tokens) ? *tokens : 0))
+        perror("Memory allocation failed");
+
+    if (IS_NULL(ingestify->next_manifest) || IS_NULL(key))
+        return;
+
+    if (!manifest_add(ingestify->next_manifest, file_path, key, (int64_t)offset, (int64_t)(writer_size(output) - offset), (int64_t)(ingestify->data_written - data_before),
+                      kind, EXISTS(digest) ? &digest->hash : NULL, tokens))
+        perror("Memory allocation failed");
+}
+
+/**
+ * @brief Writes a binary file as its header and size only, its contents
+ * would be of no use as text.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      file_path Path to the file.
+ * @param[in]      file_size Size of the file.
+ * @param[in]      key       What the file looked like before it was read, NULL
+ *                           if that is not known.
+ * @param[in, out] output    Output file.
+ */
+static void write_binary(ingestify_t *ingestify, const char *file_path, off_t file_size, const manifest_key_t *key, writer_t *output)
+{
+    size_t offset = writer_size(output);
+    uint64_t no_tokens = 0;
+    writer_printf(output, "\nFILE \"%s\" BINARY, %lld bytes ===================================================:\n\n", file_path, (long long)file_size);
+    record_file(ingestify, file_path, key, MANIFEST_KIND_BINARY, NULL, ingestify->count_tokens ? &no_tokens : NULL, offset, ingestify->data_written, output);
+}
+
+/**
+ * @brief Moves as much of a file as the limit lets through straight into the
+ * output, without copying it through user space.
+ * 
+ * @param[in, out] ingestify       The output being written, and its options.
+ * @param[in]      file_path       Path to the file, for errors.
+ * @param[in]      fd              Open file, at the start of what is left.
+ * @param[in, out] remaining       Bytes of the file left to write, 0 if it
+ *                                 turned out to be shorter.
+ * @param[in, out] output          Output file.
+ * @param[in]      max_output_size Maximum allowed size for the output file.
+ * 
+ * @return false if nothing was moved because of an error, the file is read
+ * instead then.
+ */
+static bool transfer_fd(ingestify_t *ingestify, const char *file_path, int fd, off_t *remaining, writer_t *output, const off_t max_output_size)
+{
+    off_t wanted = room_for(ingestify, *remaining, max_output_size);
+    int output_fd = (wanted > 0) ? writer_fd(output) : -1;
+    if (output_fd < 0)
+        return true;
+
+    bool refused;
+    int error;
+    uint64_t started = stats_begin();
+    size_t moved = fd_transfer(output_fd, fd, (size_t)wanted, writer_transfer_method(output), &refused, &error);
+    stats_end(STATS_WRITE, started, moved);
+    if (refused)
+        return false;
+
+    writer_wrote(output, moved);
+    ingestify->data_written += moved;
+    progress_bytes(ingestify->progress, moved);
+    *remaining -= (off_t)moved;
+    if (error != 0)
+        fprintf(stderr, "Error writing file: %s: %s\n", file_path, strerror(error)); // The rest is read
+    else if ((off_t)moved < wanted)
+        *remaining = 0;
+    return true;
+}
+
+/**
+ * @brief Maps as much of a file as the limit lets through, and writes the
+ * mapping straight to the output. The mapping is handed to write() rather
+ * than touched here, so pages that a truncation took away make the write
+ * come up short instead of raising SIGBUS, and the size is checked again
+ * before every slice so nothing past the new end is written.
+ * 
+ * @param[in, out] ingestify       The output being written, and its options.
+ * @param[in]      fd              Open file, at its start.
+ * @param[in, out] remaining       Bytes of the file left to write, 0 if it
+ *                                 turned out to be shorter.
+ * @param[in, out] output          Output file.
+ * @param[in]      max_output_size Maximum allowed size for the output file.
+ */
+static void map_fd(ingestify_t *ingestify, int fd, off_t *remaining, writer_t *output, const off_t max_output_size)
+{
+#if defined(_WIN32)
+    (void)fd, (void)remaining, (void)output, (void)max_output_size; // The read loop does it
+#else
+    off_t wanted = room_for(ingestify, *remaining, max_output_size);
+    int output_fd = (wanted > 0) ? writer_fd(output) : -1;
+    if (output_fd < 0)
+        return;
+
+    uint64_t started = stats_begin();
+    char *map = mmap(NULL, (size_t)wanted, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        return;
+    madvise(map, (size_t)wanted, MADV_SEQUENTIAL);
+    madvise(map, (size_t)wanted, MADV_WILLNEED);
+
+    off_t done = 0;
+    while (done < wanted)
+    {
+        struct stat file_stat;
+        off_t end = (fstat(fd, &file_stat) == 0) ? file_stat.st_size : 0;
+        if (end <= done)
+            break;
+
+        off_t n = wanted - done;
+        if (n > (end - done)) n = end - done;
+        if (n > INGESTIFY_MMAP_SLICE) n = INGESTIFY_MMAP_SLICE;
+
+        ssize_t written = write(output_fd, &map[done], (size_t)n);
+        if ((written < 0) && (errno == EINTR))
+            continue;
+        if (written <= 0)
+            break;
+        done += written;
+    }
+    munmap(map, (size_t)wanted);
+    stats_end(STATS_WRITE, started, (uint64_t)done);
+
+    lseek(fd, done, SEEK_SET); // The read loop goes on after the mapped part
+    writer_wrote(output, (size_t)done);
+    ingestify->data_written += done;
+    progress_bytes(ingestify->progress, (size_t)done);
+    *remaining = (done < wanted) ? 0 : (*remaining - done);
+#endif
+}
+
+/**
+ * @brief Writes contents that are in memory into the output, with their
+ * header, once they were found to be text and not a copy.
+ * 
+ * @param[in, out] ingestify       The output being written, and its options.
+ * @param[in]      file_path       Path to the file, for the header.
+ * @param[in]      data            Contents of the file.
+ * @param[in]      size            Size of the contents.
+ * @param[in]      key             What the file looked like before it was
+ *                                 read, for the manifest, may be NULL.
+ * @param[in]      digest          Hash of the contents, may be NULL.
+ * @param[in, out] output          Output file.
+ * @param[in]      max_output_size Maximum allowed size for the output file.
+ * 
+ * @return false if the output size limit was exceeded.
+ */
+static bool write_contents(ingestify_t *ingestify, const char *file_path, const char *data, size_t size, const manifest_key_t *key,
+                           const dedup_digest_t *digest, writer_t *output, const off_t max_output_size)
+{
+    size_t output_offset = writer_size(output);
+    off_t data_before = ingestify->data_written;
+    uint64_t tokens = 0;
+    bool cut = false;
+    if (ingestify->count_tokens)
+    {
+        // Counted while the contents are still in the cache from the read, the header needs the count first
+        tokens_t counter = { 0 };
+        size_t kept = tokens_feed(&counter, data, size, file_token_limit(ingestify));
+        cut = (kept < size);
+        size = kept;
+        tokens = counter.count;
+    }
+
+    // Everything the limit lets through goes out in one piece, usually the whole file
+    write_header(ingestify, file_path, tokens, output);
+    size_t content_offset = writer_size(output);
+    size_t offset = (size_t)room_for(ingestify, (off_t)size, max_output_size);
+    writer_write(output, data, offset);
+    ingestify->data_written += offset;
+    progress_bytes(ingestify->progress, offset);
+
+    for (; offset < size; offset += BUFSIZ)
+    {
+        size_t n = ((size - offset) < BUFSIZ) ? (size - offset) : BUFSIZ;
+        if (!account_chunk(ingestify, n, max_output_size))
+            return false;
+        writer_write(output, &data[offset], n);
+    }
+    writer_write(output, "\n", 1);
+    if (ingestify->count_tokens && !account_tokens(ingestify, tokens, cut))
+        return false;
+    index_file(ingestify, file_path, content_offset, size, digest);
+    record_file(ingestify, file_path, key, ingestify->skip_binary ? MANIFEST_KIND_TEXT : MANIFEST_KIND_UNCHECKED, digest, ingestify->count_tokens ? &tokens : NULL,
+                output_offset, data_before, output);
+    return true;
+}
+
+/**
+ * @brief Tells the sink that a file starts in the output, once what came
+ * before it has reached the output.
+ * 
+ * @param[in] ingestify The output being written, and its options.
+ * @param[in] file_path Path to the file.
+ * @param[in] output    Output file.
+ * 
+ * @return false if the sink asked to stop, or the output failed.
+ */
+static bool file_begin(const ingestify_t *ingestify, const char *file_path, writer_t *output)
+{
+    if (IS_NULL(ingestify->sink.on_file_begin))
+        return true;
+    return writer_flush(output) && ingestify->sink.on_file_begin(ingestify->sink.context, file_path);
+}
+
+/**
+ * @brief Tells the sink that a file ended in the output, once all of it has
+ * reached the output.
+ * 
+ * @param[in] ingestify The output being written, and its options.
+ * @param[in] file_path Path to the file.
+ * @param[in] output    Output file.
+ * 
+ * @return false if the sink asked to stop, or the output failed.
+ */
+static bool file_end(const ingestify_t *ingestify, const char *file_path, writer_t *output)
+{
+    if (IS_NULL(ingestify->sink.on_file_end))
+        return true;
+    return writer_flush(output) && ingestify->sink.on_file_end(ingestify->sink.context, file_path);
+}
+
+/**
+ * @brief Writes an open file into the output, with its header. At most the
+ * size the file had when it was opened is read, so a file that keeps growing,
+ * like the output itself, cannot make the output grow without end.
+ * 
+ * @param[in, out] ingestify       The output being written, and its options.
+ * @param[in]      file_path       Path to the file, for the header.
+ * @param[in]      fd              Open file.
+ * @param[in]      digest          Hash of the file made ahead, may be NULL.
+ * @param[in, out] output          Output file.
+ * @param[in]      max_output_size Maximum allowed size for the output file.
+ * 
+ * @return false if the output size limit was exceeded.
+ */
+static bool write_fd(ingestify_t *ingestify, const char *file_path, int fd, const dedup_digest_t *digest, writer_t *output, const off_t max_output_size)
+{
+    struct stat file_stat;
+    uint64_t started = stats_begin();
+    bool has_status = (fstat(fd, &file_stat) == 0);
+    stats_end(STATS_STAT, started, 0);
+    off_t remaining = has_status ? file_stat.st_size : 0;
+    ingestify->data_found += remaining;
+
+    manifest_key_t key;
+    if (has_status)
+        manifest_key_from_stat(&file_stat, &key);
+    if (ingestify->skip_binary && binary_detect_fd(fd))
+    {
+        write_binary(ingestify, file_path, remaining, has_status ? &key : NULL, output);
+        return true;
+    }
+
+    // Unless a worker hashed it, the contents are read once more for the hash, the copy then finds them cached
+    dedup_digest_t own;
+    if (EXISTS(digest) && (digest->size != (uint64_t)remaining))
+        digest = NULL;
+    if (IS_NULL(digest) && ingestify_hash_file(ingestify, fd, remaining, &own))
+        digest = &own;
+    if (EXISTS(ingestify->dedup) && EXISTS(digest) && (digest->size >= DEDUP_MIN_SIZE))
+    {
+        if (write_reference(ingestify, file_path, digest, output))
+            return true;
+        dedup_add(ingestify->dedup, digest, file_path);
+    }
+
+    size_t offset = writer_size(output);
+    off_t data_before = ingestify->data_written;
+    tokens_t tokens = { 0 };
+    uint64_t token_limit = ingestify->count_tokens ? file_token_limit(ingestify) : TOKENS_NO_LIMIT;
+    bool cut = false;
+
+    // Without a way to write the count into the header afterwards, it is counted in a pass before the header
+    bool counted_ahead = ingestify->count_tokens && !writer_can_patch(output);
+    if (counted_ahead)
+        cut = count_fd(fd, &remaining, token_limit, &tokens);
+
+    // Tokens are counted on the copy through the buffer, so the kernel does not move the file then
+    write_header(ingestify, file_path, tokens.count, output);
+    size_t content_offset = writer_size(output);
+    bool map = !ingestify->count_tokens && (ingestify->mmap_min > 0) && (remaining >= ingestify->mmap_min);
+    if (!ingestify->count_tokens && !map && (remaining >= INGESTIFY_ZERO_COPY_MIN))
+        map = !transfer_fd(ingestify, file_path, fd, &remaining, output, max_output_size);
+    if (map)
+        map_fd(ingestify, fd, &remaining, output, max_output_size);
+
+    while (remaining > 0)
+    {
+        // Read straight into the output buffer, it only counts once committed
+        size_t wanted = (remaining < BUFSIZ) ? (size_t)remaining : BUFSIZ;
+        char *chunk = writer_reserve(output, wanted);
+        started = stats_begin();
+        size_t n = read_full(fd, chunk, wanted);
+        stats_end(STATS_READ, started, n);
+        if (n == 0)
+            break;
+
+        size_t kept = (ingestify->count_tokens && !counted_ahead) ? tokens_feed(&tokens, chunk, n, token_limit) : n;
+        if (!account_chunk(ingestify, kept, max_output_size))
+            return false;
+        writer_commit(output, kept);
+
+        remaining -= n;
+        cut = cut || (kept < n);
+        if ((kept < n) || (n < wanted))
+            break; // Cut at the token limit, or the file was truncated while it was read
+    }
+    writer_write(output, "\n", 1);
+    if (ingestify->count_tokens)
+    {
+        if (!counted_ahead)
+            patch_header(file_path, offset, tokens.count, output);
+        if (!account_tokens(ingestify, tokens.count, cut))
+            return false;
+    }
+    index_file(ingestify, file_path, content_offset, (size_t)(ingestify->data_written - data_before), digest);
+    record_file(ingestify, file_path, has_status ? &key : NULL, ingestify->skip_binary ? MANIFEST_KIND_TEXT : MANIFEST_KIND_UNCHECKED, digest,
+                ingestify->count_tokens ? &tokens.count : NULL, offset, data_before, output);
+    return true;
+}
+
+/**
+ * @brief Writes a file into the output, with its header.
+ * 
+ * @param[in, out] ingestify       The output being written, and its options.
+ * @param[in]      file_path       Path to the file.
+ * @param[in]      digest          From ingestify_hash_file(), NULL if it was
+ *                                 not hashed ahead. Only used if the file
+ *                                 still has the size that was hashed.
+ * @param[in, out] output          Output file.
+ * @param[in]      max_output_size Maximum allowed size for the output file.
+ * 
+ * @return false if the output size limit was exceeded.
+ */
+bool ingestify_write_file(ingestify_t *ingestify, const char *file_path, const dedup_digest_t *digest, writer_t *output, const off_t max_output_size)
+{
+    uint64_t started = stats_begin();
+    int fd = open_long_path(file_path, O_RDONLY);
+    stats_end(STATS_OPEN, started, 0);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Could not open file: %s\n", file_path);
+        return true;
+    }
+
+    progress_writing(ingestify->progress, file_path);
+    bool within_limit = file_begin(ingestify, file_path, output) &&
+                        write_fd(ingestify, file_path, fd, digest, output, max_output_size) &&
+                        file_end(ingestify, file_path, output);
+    close(fd);
+    stats_file(file_path, started);
+    return within_limit;
+}
+
+/**
+ * @brief Writes a file that was already read into memory, see
+ * ingestify_write_buffer().
+ */
+static bool write_buffer(ingestify_t *ingestify, const char *file_path, off_t file_size, const char *data, size_t size, const manifest_key_t *key,
+                         const dedup_digest_t *digest, writer_t *output, const off_t max_output_size)
+{
+    ingestify->data_found += file_size;
+    if (ingestify->skip_binary && binary_detect(data, size))
+    {
+        write_binary(ingestify, file_path, file_size, key, output);
+        return true;
+    }
+
+    dedup_digest_t own;
+    if (IS_NULL(digest) && ingestify_hash_buffer(ingestify, data, size, &own))
+        digest = &own;
+    if (EXISTS(ingestify->dedup) && EXISTS(digest) && (digest->size >= DEDUP_MIN_SIZE))
+    {
+        if (write_reference(ingestify, file_path, digest, output))
+            return true;
+        dedup_add(ingestify->dedup, digest, file_path);
+    }
+
+    return write_contents(ingestify, file_path, data, size, key, digest, output, max_output_size);
+}
+
+/**
+ * @brief Writes a file that was already read into memory into the output,
+ * exactly as ingestify_write_file() would have written it. Unlike it, this
+ * leaves progress_writing() to the caller, who has the file already.
+ * 
+ * @param[in, out] ingestify       The output being written, and its options.
+ * @param[in]      file_path       Path to the file, for the header.
+ * @param[in]      file_size       Size of the file when it was opened.
+ * @param[in]      data            Contents of the file.
+ * @param[in]      size            Size of the contents.
+ * @param[in]      key             What the file looked like before it was
+ *                                 read, for the manifest, may be NULL.
+ * @param[in]      digest          From ingestify_hash_buffer(), NULL if it
+ *                                 was not hashed ahead.
+ * @param[in, out] output          Output file.
+ * @param[in]      max_output_size Maximum allowed size for the output file.
+ * 
+ * @return false if the output size limit was exceeded.
+ */
+bool ingestify_write_buffer(ingestify_t *ingestify, const char *file_path, off_t file_size, const char *data, size_t size, const manifest_key_t *key,
+                            const dedup_digest_t *digest, writer_t *output, const off_t max_output_size)
+{
+    uint64_t started = stats_begin();
+    bool within_limit = file_begin(ingestify, file_path, output) &&
+                        write_buffer(ingestify, file_path, file_size, data, size, key, digest, output, max_output_size) &&
+                        file_end(ingestify, file_path, output);
+    stats_file(file_path, started);
+    return within_limit;
+}
+
+/**
+ * @brief Writes a file that has not changed since the previous output by
+ * taking it from there, and adds it to the manifest being kept.
+ * 
+ * @param[in, out] ingestify       The output being written, and its options.
+ * @param[in]      file_path       Path to the file.
+ * @param[in]      key             What the file looks like now.
+ * @param[in, out] output          Output file, from writer_open_over().
+ * @param[in]      max_output_size Maximum allowed size for the output file.
+ * 
+ * @return false if it was not taken from the previous output, because it
+ * changed, would not fit in the limit, or could not be copied. Nothing was
+ * written then, and the file has to be read.
+ */
+bool ingestify_reuse_file(ingestify_t *ingestify, const char *file_path, const manifest_key_t *key, writer_t *output, const off_t max_output_size)
+{
+    if (EXISTS(ingestify->sink.on_file_begin) || EXISTS(ingestify->sink.on_file_end))
+        return false; // Read again, so that the sink is told of it
+
+    const manifest_entry_t *entry = manifest_find(ingestify->previous_manifest, file_path, key);
+    if (IS_NULL(entry))
+        return false;
+
+    off_t limit = (max_output_size == INGESTIFY_MAX_SIZE_AUTO) ? (2 * (ingestify->data_found + key->size)) : max_output_size;
+    if ((ingestify->data_written + entry->content) > limit)
+        return false; // Read again, so it stops where it would have
+    if (ingestify->skip_binary ? (entry->kind == MANIFEST_KIND_UNCHECKED) : (entry->kind == MANIFEST_KIND_BINARY))
+        return false; // Read again, it was written the other way
+    if (ingestify->count_tokens != entry->counted)
+        return false; // Read again, for the count in the header
+    if (ingestify->count_tokens && ((entry->tokens > file_token_limit(ingestify)) || ((entry->kind != MANIFEST_KIND_BINARY) && (entry->content != key->size))))
+        return false; // Read again, so it is cut where the limits cut it now
+    if (EXISTS(ingestify->toc) && (entry->kind != MANIFEST_KIND_BINARY) && !entry->hashed)
+        return false; // Read again, to be hashed for the index
+
+    // With deduplication, it may now come after a file with the same contents
+    dedup_digest_t digest = { .hash = entry->hash, .size = (uint64_t)entry->content };
+    if (EXISTS(ingestify->dedup) && (entry->content >= DEDUP_MIN_SIZE))
+    {
+        if (!entry->hashed)
+            return false; // Read again, to be hashed
+        if (write_reference(ingestify, file_path, &digest, output))
+        {
+            progress_writing(ingestify->progress, file_path);
+            ingestify->data_found += key->size;
+            return true;
+        }
+    }
+
+    size_t offset = writer_size(output);
+    if (!writer_reuse(output, (size_t)entry->offset, (size_t)entry->length))
+        return false;
+
+    progress_writing(ingestify->progress, file_path);
+    off_t data_before = ingestify->data_written;
+    ingestify->data_found += key->size;
+    ingestify->data_written += entry->content;
+    progress_bytes(ingestify->progress, (size_t)entry->content);
+    if (ingestify->count_tokens)
+        ingestify->tokens_written += entry->tokens;
+    if (EXISTS(ingestify->dedup) && entry->hashed && (entry->content >= DEDUP_MIN_SIZE))
+        dedup_add(ingestify->dedup, &digest, file_path);
+    if (entry->kind != MANIFEST_KIND_BINARY)
+        index_file(ingestify, file_path, offset + (size_t)(entry->length - entry->content) - 1, (size_t)entry->content, entry->hashed ? &digest : NULL);
+    record_file(ingestify, file_path, key, entry->kind, entry->hashed ? &digest : NULL, ingestify->count_tokens ? &entry->tokens : NULL, offset, data_before, output);
+    return true;
+}
+
+/**
+ * @brief While watching, takes a directory that did not change since the
+ * previous output from it as a whole, with everything under it, without
+ * opening it.
+ * 
+ * @param[in, out] ingestify       The output being written, and its options.
+ * @param[in]      dir_path        Path to the directory.
+ * @param[in, out] output          Output file, from writer_open_over().
+ * @param[in]      max_output_size Maximum allowed size for the output file.
+ * 
+ * @return false if it was not taken from the previous output. Nothing was
+ * written then, and the directory has to be walked.
+ */
+bool ingestify_reuse_dir(ingestify_t *ingestify, const char *dir_path, writer_t *output, const off_t max_output_size)
+{
+    // With deduplication, an index or a sink, the files under it have to be looked at one by one
+    if (EXISTS(ingestify->sink.on_file_begin) || EXISTS(ingestify->sink.on_file_end))
+        return false;
+    if (IS_NULL(ingestify->watch) || IS_NULL(ingestify->next_manifest) || EXISTS(ingestify->dedup) || EXISTS(ingestify->toc) || !watch_is_clean(ingestify->watch, dir_path))
+        return false;
+
+    const manifest_entry_t *entry = manifest_find_dir(ingestify->previous_manifest, dir_path);
+    if (IS_NULL(entry))
+        return false;
+
+    off_t limit = (max_output_size == INGESTIFY_MAX_SIZE_AUTO) ? (2 * (ingestify->data_found + entry->key.size)) : max_output_size;
+    if ((ingestify->data_written + entry->content) > limit)
+        return false;
+    if (ingestify->count_tokens && (ingestify->max_tokens > 0) && (entry->tokens > (ingestify->max_tokens - ingestify->tokens_written)))
+        return false;
+
+    size_t offset = writer_size(output);
+    if ((entry->length > 0) && !writer_reuse(output, (size_t)entry->offset, (size_t)entry->length))
+        return false;
+
+    ingestify->data_found += entry->key.size;
+    ingestify->data_written += entry->content;
+    progress_bytes(ingestify->progress, (size_t)entry->content);
+    if (ingestify->count_tokens)
+        ingestify->tokens_written += entry->tokens;
+    if (!manifest_add_subtree(ingestify->next_manifest, ingestify->previous_manifest, entry, (int64_t)offset))
+        perror("Memory allocation failed");
+    return true;
+}
+
+/**
+ * @brief With deduplication or an index, hashes a file that was read ahead,
+ * so that ingestify_write_buffer() does not have to. Safe to call from many
+ * threads at once.
+ * 
+ * @param[in]  ingestify  The output being written, and its options.
+ * @param[in]  data       Contents of the file.
+ * @param[in]  size       Size of the contents.
+ * @param[out] digest_out The hash.
+ * 
+ * @return false if files are neither deduplicated nor indexed, or this one
+ * is too small to be deduplicated and there is no index, or only its size is
+ * written since it is binary.
+ */
+bool ingestify_hash_buffer(const ingestify_t *ingestify, const char *data, size_t size, dedup_digest_t *digest_out)
+{
+    bool wanted = EXISTS(ingestify->toc) || (EXISTS(ingestify->dedup) && (size >= DEDUP_MIN_SIZE));
+    if (!wanted || (ingestify->skip_binary && binary_detect(data, size)))
+        return false;
+
+    digest_out->hash = dedup_hash(data, size);
+    digest_out->size = size;
+    return true;
+}
+
+/**
+ * @brief With deduplication or an index, hashes an open file from where it
+ * is, and goes back there. Safe to call from many threads at once.
+ * 
+ * @param[in]  ingestify  The output being written, and its options.
+ * @param[in]  fd         Open file.
+ * @param[in]  size       Size of the file.
+ * @param[out] digest_out The hash.
+ * 
+ * @return false if files are neither deduplicated nor indexed, this one is
+ * too small to be deduplicated and there is no index, only its size is
+ * written since it is binary, or it could not be read whole.
+ */
+bool ingestify_hash_file(const ingestify_t *ingestify, int fd, off_t size, dedup_digest_t *digest_out)
+{
+    bool wanted = EXISTS(ingestify->toc) || (EXISTS(ingestify->dedup) && (size >= DEDUP_MIN_SIZE));
+    if (!wanted || (ingestify->skip_binary && binary_detect_fd(fd)) || !dedup_hash_fd(fd, size, &digest_out->hash))
+        return false;
+
+    digest_out->size = (uint64_t)size;
+    return true;
+}
+
+/**
+ * @brief Notes where the files of a directory start in the output, before
+ * any of them is written.
+ * 
+ * @param[in]  ingestify The output being written, and its options.
+ * @param[out] mark      Where the directory starts.
+ * @param[in]  output    Output file.
+ */
+void ingestify_dir_begin(const ingestify_t *ingestify, ingestify_dir_mark_t *mark, const writer_t *output)
+{
+    mark->offset  = writer_size(output);
+    mark->written = ingestify->data_written;
+    mark->found   = ingestify->data_found;
+    mark->entries = EXISTS(ingestify->next_manifest) ? manifest_count(ingestify->next_manifest) : 0;
+    mark->tokens  = ingestify->tokens_written;
+}
+
+/**
+ * @brief Adds a directory to the manifest being kept, once everything under
+ * it was written. A directory cut short by the size limit is left out.
+ * 
+ * @param[in, out] ingestify       The output being written, and its options.
+ * @param[in]      dir_path        Path to the directory.
+ * @param[in]      mark            From ingestify_dir_begin().
+ * @param[in]      output          Output file.
+ * @param[in]      max_output_size Maximum allowed size for the output file.
+ */
+void ingestify_dir_end(ingestify_t *ingestify, const char *dir_path, const ingestify_dir_mark_t *mark, const writer_t *output, const off_t max_output_size)
+{
+    if (IS_NULL(ingestify->next_manifest) || (ingestify->data_written > current_limit(ingestify, max_output_size)))
+        return;
+
+    if (!manifest_add_dir(ingestify->next_manifest, dir_path, (int64_t)mark->offset, (int64_t)(writer_size(output) - mark->offset),
+                          (int64_t)(ingestify->data_written - mark->written), (int64_t)(ingestify->data_found - mark->found),
+                          (uint64_t)(manifest_count(ingestify->next_manifest) - mark->entries), ingestify->tokens_written - mark->tokens))
+        perror("Memory allocation failed");
+}
 
 /**
- * @brief Maintains the size of data written to output file.
+ * @brief Watches a directory that the walk opened, if a watch is set. Safe to
+ * call from many threads at once.
+ * 
+ * @param[in] ingestify The output being written, and its options.
+ * @param[in] dir       Open directory.
+ * @param[in] dir_path  Path to the directory.
  */
-static off_t data_written = 0;
+void ingestify_watch_dir(const ingestify_t *ingestify, DIR *dir, const char *dir_path)
+{
+    if (EXISTS(ingestify->watch))
+        watch_add(ingestify->watch, dir, dir_path);
+}
 
 /**
- * @brief Calculates the total size of a directory recursively.
+ * @brief Reads the next entry of a directory that the walk opened, timed
+ * for --stats.
  * 
- * @param[in] dir_path Path to the directory.
+ * @param[in] dir Open directory.
  * 
- * @return off_t The total size of the directory.
+ * @return struct dirent* The entry, NULL at the end.
  */
-off_t ingestify_calculate_directory_size(const char *dir_path)
+struct dirent *ingestify_read_dir(DIR *dir)
 {
-    off_t total_size = 0;
-    DIR *dir = opendir(dir_path);
-    if (IS_NULL(dir))
+    uint64_t started = stats_begin();
+    struct dirent *entry = readdir(dir);
+    stats_end(STATS_READDIR, started, 0);
+    return entry;
+}
+
+/**
+ * @brief In incremental mode, stats a file before it is read, for the
+ * manifest and to find out whether it changed.
+ * 
+ * @param[in]  ingestify The output being written, and its options.
+ * @param[in]  dir       Open directory of the file.
+ * @param[in]  name      Name of the file.
+ * @param[in]  path      Full path of the file.
+ * @param[out] key_out   What the file looks like.
+ * 
+ * @return false outside incremental mode, or if the file has no status.
+ */
+bool ingestify_stat_file(const ingestify_t *ingestify, DIR *dir, const char *name, const char *path, manifest_key_t *key_out)
+{
+    if (IS_NULL(ingestify->next_manifest))
+        return false;
+
+    struct stat file_stat;
+    uint64_t started = stats_begin();
+    bool has_status = dir_stat_file(dir, name, path, &file_stat);
+    stats_end(STATS_STAT, started, 0);
+    if (!has_status)
+        return false;
+
+    manifest_key_from_stat(&file_stat, key_out);
+    return true;
+}
+
+/**
+ * @brief Tells whether a file is in the previous output, unchanged. Safe to
+ * call from many threads at once.
+ * 
+ * @param[in] ingestify The output being written, and its options.
+ * @param[in] file_path Path to the file.
+ * @param[in] key       What the file looks like now.
+ * 
+ * @return true if ingestify_reuse_file() can take it from there.
+ */
+bool ingestify_is_unchanged(const ingestify_t *ingestify, const char *file_path, const manifest_key_t *key)
+{
+    return EXISTS(manifest_find(ingestify->previous_manifest, file_path, key));
+}
+
+/**
+ * @brief Tells whether a path is the output, one of the files kept next to
+ * it or its shards, or the trace, which are never written into it.
+ * 
+ * @param[in] ingestify        The output being written, and its options.
+ * @param[in] relative_path    Path of the entry, without a leading "./".
+ * @param[in] output_file_path Path to the output file, NULL if there is none.
+ * 
+ * @return true if it is.
+ */
+bool ingestify_is_output(const ingestify_t *ingestify, const char *relative_path, const char *output_file_path)
+{
+    if (EXISTS(ingestify->trace_path) && (strcmp(relative_path, ingestify->trace_path) == 0))
+        return true;
+    if (IS_NULL(output_file_path)) // Only streamed to a sink
+        return false;
+    if (EXISTS(ingestify->shards) && shard_is_path(relative_path, output_file_path))
+        return true;
+
+    size_t len = strlen(output_file_path);
+    if (strncmp(relative_path, output_file_path, len) != 0)
+        return false;
+
+    const char *suffix = &relative_path[len];
+    return (*suffix == '\0') ||
+           (strcmp(suffix, WRITER_TEMP_SUFFIX) == 0) ||
+           (strcmp(suffix, MANIFEST_SUFFIX) == 0) ||
+           (strcmp(suffix, MANIFEST_TEMP_SUFFIX) == 0);
+}
+
+/**
+ * @brief Keeps a manifest of the output, and takes the files that did not
+ * change from the previous output.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      previous  Manifest of the previous output, NULL if there is none.
+ * @param[in]      next      Manifest to fill for this output, NULL to keep none.
+ */
+void ingestify_set_manifests(ingestify_t *ingestify, const manifest_t *previous, manifest_t *next)
+{
+    ingestify->previous_manifest = previous;
+    ingestify->next_manifest = next;
+}
+
+/**
+ * @brief Watches the directories the walk opens, and takes the ones that did
+ * not change from the previous output.
+ * 
+ * @param[in, out] ingestify    The output being written, and its options.
+ * @param[in]      watch_to_use The watch, NULL to stop watching.
+ */
+void ingestify_set_watch(ingestify_t *ingestify, watch_t *watch_to_use)
+{
+    ingestify->watch = watch_to_use;
+}
+
+/**
+ * @brief Writes files whose contents were written before as a reference to
+ * the first file that had them.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      table     Table of the contents written, NULL to write every file whole.
+ */
+void ingestify_set_dedup(ingestify_t *ingestify, dedup_t *table)
+{
+    ingestify->dedup = table;
+}
+
+/**
+ * @brief Writes an index at the end of the output, of where the contents
+ * of every file are in it.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      table     Index to fill, NULL to write none.
+ */
+void ingestify_set_toc(ingestify_t *ingestify, toc_t *table)
+{
+    ingestify->toc = table;
+}
+
+/**
+ * @brief Notes where every file starts in the output, so that it can be
+ * split into shards once it is written.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      list      Files of the output, NULL to not split it.
+ */
+void ingestify_set_shards(ingestify_t *ingestify, shard_t *list)
+{
+    ingestify->shards = list;
+}
+
+/**
+ * @brief Leaves the trace file out of the output, as it is written while
+ * the walk goes on.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      path      Path of the trace file, NULL if there is none.
+ */
+void ingestify_set_trace(ingestify_t *ingestify, const char *path)
+{
+    ingestify->trace_path = path;
+}
+
+/**
+ * @brief Starts counting the data of a new output from zero, before it is
+ * written again, and forgets the contents written.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ */
+void ingestify_start_output(ingestify_t *ingestify)
+{
+    ingestify->data_written = 0;
+    ingestify->data_found = 0;
+    ingestify->tokens_written = 0;
+    if (EXISTS(ingestify->dedup))
+        dedup_clear(ingestify->dedup);
+    if (EXISTS(ingestify->toc))
+        toc_clear(ingestify->toc);
+    if (EXISTS(ingestify->shards))
+        shard_clear(ingestify->shards);
+}
+
+/**
+ * @brief Ends an output once every file is written, with the index if one
+ * is written.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in, out] output    Output file.
+ */
+void ingestify_finish_output(ingestify_t *ingestify, writer_t *output)
+{
+    if (EXISTS(ingestify->toc))
+        toc_write(ingestify->toc, output);
+}
+
+/**
+ * @brief Makes the state of a new ingest, with the options of the command
+ * line when none is given, except that it prints nothing, see
+ * ingestify_progress().
+ * 
+ * @return ingestify_t* The state, NULL if memory ran out. Free it with
+ * ingestify_destroy().
+ */
+ingestify_t *ingestify_create(void)
+{
+    ingestify_t *ingestify = calloc(1, sizeof(ingestify_t));
+    progress_t *progress = progress_create(PROGRESS_QUIET);
+    if (IS_NULL(ingestify) || IS_NULL(progress))
     {
-        fprintf(stderr, "Could not open directory: %s\n", dir_path);
-        return -1;
+        free(ingestify);
+        progress_free(progress);
+        return NULL;
     }
 
-    struct dirent *entry;
-    while (EXISTS((entry = readdir(dir))))
+    ingestify->progress = progress;
+    ingestify->use_io_uring = true;
+    ingestify->skip_binary = true;
+    return ingestify;
+}
+
+/**
+ * @brief Frees the state of an ingest. What was set on it, such as the
+ * manifests or the watch, is not freed.
+ * 
+ * @param[in] ingestify From ingestify_create(), or NULL.
+ */
+void ingestify_destroy(ingestify_t *ingestify)
+{
+    if (EXISTS(ingestify))
+        progress_free(ingestify->progress);
+    free(ingestify);
+}
+
+/**
+ * @brief Gives what an ingest prints and its counters, to choose the mode
+ * or read the counts.
+ * 
+ * @param[in] ingestify The state of the ingest.
+ * 
+ * @return progress_t* Its progress.
+ */
+progress_t *ingestify_progress(ingestify_t *ingestify)
+{
+    return ingestify->progress;
+}
+
+/**
+ * @brief Tells callbacks where each file starts and ends in the output.
+ * The output is flushed before each, so that everything before them has
+ * reached it.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      sink      Callbacks, NULL for none. Copied.
+ */
+void ingestify_set_sink(ingestify_t *ingestify, const ingestify_sink_t *sink)
+{
+    if (EXISTS(sink))
+        ingestify->sink = *sink;
+    else
+        memset(&ingestify->sink, 0, sizeof(ingestify->sink));
+}
+
+/**
+ * @brief Chooses whether small files are read through io_uring, where the
+ * kernel has it, or with plain system calls.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      enabled   true to use io_uring.
+ */
+void ingestify_use_io_uring(ingestify_t *ingestify, bool enabled)
+{
+    ingestify->use_io_uring = enabled;
+}
+
+/**
+ * @brief Chooses whether binary files, found by a NUL byte or invalid UTF-8
+ * in their first block, are written as their size only or whole.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      enabled   true to write only their size.
+ */
+void ingestify_skip_binary(ingestify_t *ingestify, bool enabled)
+{
+    ingestify->skip_binary = enabled;
+}
+
+/**
+ * @brief Chooses whether the tokens of each file are estimated and written
+ * in its header, and the limits on them.
+ * 
+ * @param[in, out] ingestify    The output being written, and its options.
+ * @param[in]      enabled      true to count tokens.
+ * @param[in]      max_total    Most tokens of the output, it aborts past them, 0
+ *                              for no limit.
+ * @param[in]      max_per_file Most tokens of one file, it is cut there, 0 for no limit.
+ */
+void ingestify_set_tokens(ingestify_t *ingestify, bool enabled, uint64_t max_total, uint64_t max_per_file)
+{
+    ingestify->count_tokens = enabled;
+    ingestify->max_tokens = max_total;
+    ingestify->file_max_tokens = max_per_file;
+}
+
+/**
+ * @brief Maps files from a size on, instead of letting the kernel move them.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      size      Smallest file to map, 0 to map only the large files that the
+ *                           kernel refuses to move.
+ */
+void ingestify_set_mmap_min(ingestify_t *ingestify, off_t size)
+{
+    ingestify->mmap_min = size;
+}
+
+#define WALK_PENDING_MAX (4 * URING_BATCH_MAX) /**< Entries held back for one batch */
+
+typedef enum
+{
+    PENDING_FILE,
+    PENDING_UNCHANGED,         /**< File that is taken from the previous output */
+    PENDING_IGNORED,
+    PENDING_NO_STATUS,
+} pending_type_t;
+
+/**
+ * @brief Entry of a directory that is held back until its batch is read, so
+ * that everything is still printed and written in readdir order.
+ */
+typedef struct
+{
+    pending_type_t type;
+    size_t path;               /**< Offset of the full path in walk_t::paths */
+    bool has_key;              /**< FILE: stat-ed before it was read, in incremental mode */
+    manifest_key_t key;
+} pending_t;
+
+/**
+ * @brief State of a serial walk.
+ */
+typedef struct
+{
+    ingestify_t *ingestify;
+    ignore_set_t *ignore;      /**< Ignore rules of the directory being walked */
+    writer_t *output;
+    const char *output_file_path;
+    off_t max_output_size;
+    path_buffer_t path;        /**< Path of the directory or entry being looked at */
+    dir_id_t *ancestors;       /**< Directories being walked, to notice symbolic link loops */
+    size_t depth;
+    size_t ancestors_capacity;
+    uint64_t subdir_ns;        /**< With --stats, time spent in the subdirectories of the one being walked */
+
+    uring_t *ring;             /**< Reads the files of a batch together */
+    pending_t pending[WALK_PENDING_MAX];
+    size_t pending_count;
+    size_t pending_files;
+    char *paths;               /**< Full paths of the pending entries, one after another */
+    size_t paths_len;
+    size_t paths_capacity;
+    uring_file_t files[URING_BATCH_MAX];
+} walk_t;
+
+/**
+ * @brief Holds back the entry in walk->path.
+ * 
+ * @return false if memory ran out.
+ */
+static bool pending_add(walk_t *walk, pending_type_t type)
+{
+    size_t needed = walk->paths_len + walk->path.len + 1;
+    if (needed > walk->paths_capacity)
     {
-        if (strncmp(entry->d_name, ".", __PATH_MAX) == 0 || strncmp(entry->d_name, "..", __PATH_MAX) == 0)
-            continue;
+        size_t capacity = (walk->paths_capacity > 0) ? walk->paths_capacity : (16 * 1024);
+        while (capacity < needed) capacity *= 2;
+        char *paths = realloc(walk->paths, capacity);
+        if (IS_NULL(paths))
+            return false;
+        walk->paths = paths;
+        walk->paths_capacity = capacity;
+    }
 
-        char full_path[__PATH_MAX];
-        snprintf(full_path, sizeof(full_path), "%s/%s", dir_path, entry->d_name);
+    memcpy(&walk->paths[walk->paths_len], walk->path.buf, walk->path.len + 1);
+    walk->pending[walk->pending_count].type = type;
+    walk->pending[walk->pending_count].path = walk->paths_len;
+    walk->pending[walk->pending_count].has_key = false;
+    walk->pending_count++;
+    walk->paths_len = needed;
+    if (type == PENDING_FILE)
+        walk->pending_files++;
+    return true;
+}
 
-        struct stat path_stat;
-        if (stat(full_path, &path_stat) != 0)
-        {
-            fprintf(stderr, "Could not retrieve status for: %s\n", full_path);
+/**
+ * @brief Holds back the file in walk->path. In incremental mode it is stat-ed
+ * first, and not read at all if the previous output has it unchanged.
+ * 
+ * @return false if memory ran out.
+ */
+static bool pending_add_file(walk_t *walk, DIR *dir, const char *name)
+{
+    manifest_key_t key = { 0 };
+    bool has_key = ingestify_stat_file(walk->ingestify, dir, name, walk->path.buf, &key);
+    bool unchanged = has_key && ingestify_is_unchanged(walk->ingestify, walk->path.buf, &key);
+    if (!pending_add(walk, unchanged ? PENDING_UNCHANGED : PENDING_FILE))
+        return false;
+
+    pending_t *pending = &walk->pending[walk->pending_count - 1];
+    pending->has_key = has_key;
+    pending->key = key;
+    return true;
+}
+
+/**
+ * @brief Reads the held back files of a directory as one batch, then prints
+ * and writes the held back entries in order.
+ * 
+ * @return false if the output size limit was exceeded, the entries after the
+ * one that exceeded it are dropped.
+ */
+static bool pending_flush(walk_t *walk, DIR *dir)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < walk->pending_count; i++)
+    {
+        if (walk->pending[i].type != PENDING_FILE)
             continue;
-        }
 
-        if (S_ISDIR(path_stat.st_mode))
-        {
-            off_t dir_size = ingestify_calculate_directory_size(full_path);
-            if (dir_size == -1)
-            {
-                closedir(dir);
-                return -1;
-            }
-            total_size += dir_size;
-        }
-        else if (S_ISREG(path_stat.st_mode))
+        const char *path = &walk->paths[walk->pending[i].path];
+        walk->files[count].path = path;
+        walk->files[count].name = strrchr(path, '/') + 1;
+        count++;
+    }
+    if (count > 0)
+    {
+        uint64_t started = stats_begin();
+        uring_read_files(walk->ring, dir, walk->files, count);
+        uint64_t bytes = 0;
+        for (size_t i = 0; i < count; i++)
+            bytes += EXISTS(walk->files[i].data) ? walk->files[i].length : 0;
+        stats_end(STATS_READ, started, bytes);
+    }
+
+    bool within_limit = true;
+    size_t file_index = 0;
+    for (size_t i = 0; within_limit && (i < walk->pending_count); i++)
+    {
+        const char *path = &walk->paths[walk->pending[i].path];
+        uring_file_t *file;
+
+        switch (walk->pending[i].type)
         {
-            total_size += path_stat.st_size;
+            case PENDING_IGNORED:
+                progress_ignored(walk->ingestify->progress, path);
+                break;
+
+            case PENDING_NO_STATUS:
+                fprintf(stderr, "Could not retrieve status for: %s\n", path);
+                break;
+
+            case PENDING_UNCHANGED:
+                if (!ingestify_reuse_file(walk->ingestify, path, &walk->pending[i].key, walk->output, walk->max_output_size))
+                    within_limit = ingestify_write_file(walk->ingestify, path, NULL, walk->output, walk->max_output_size);
+                break;
+
+            case PENDING_FILE:
+                file = &walk->files[file_index++];
+                if (!file->opened)
+                {
+                    fprintf(stderr, "Could not open file: %s\n", path);
+                    break;
+                }
+
+                progress_writing(walk->ingestify->progress, path);
+                if (EXISTS(file->data))
+                {
+                    within_limit = ingestify_write_buffer(walk->ingestify, path, file->size, file->data, file->length, walk->pending[i].has_key ? &walk->pending[i].key : NULL, NULL, walk->output, walk->max_output_size);
+                }
+                else
+                {
+                    uint64_t started = stats_begin();
+                    within_limit = file_begin(walk->ingestify, path, walk->output) &&
+                                   write_fd(walk->ingestify, path, file->fd, NULL, walk->output, walk->max_output_size) &&
+                                   file_end(walk->ingestify, path, walk->output);
+                    stats_file(path, started);
+                }
+                break;
         }
     }
 
-    closedir(dir);
-    return total_size;
+    // Large files are left open by the batch
+    for (size_t i = 0; i < count; i++)
+    {
+        if (walk->files[i].fd >= 0)
+            close(walk->files[i].fd);
+    }
+
+    walk->pending_count = 0;
+    walk->pending_files = 0;
+    walk->paths_len = 0;
+    return within_limit;
 }
 
 /**
- * @brief Recursively traverses a directory and writes the contents to an output file.
+ * @brief Remembers a directory as being walked.
  * 
- * @param[in]      dir_path         Path to the directory.
- * @param[in]      ignore_list      Pointer to the ignore list structure.
- * @param[in, out] output_file      Pointer to the output file.
- * @param[in]      output_file_path Path to the output file.
- * @param[in]      max_output_size  Maximum allowed size for the output file.
+ * @return false if it is already being walked, the walk came back to it
+ * through a symbolic link.
  */
-void ingestify_traverse_and_write(const char *dir_path, const ignore_list_t *ignore_list, FILE *output_file, const char *output_file_path, const off_t max_output_size)
+static bool enter_directory(walk_t *walk, DIR *dir)
 {
-    DIR *dir = opendir(dir_path);
-    if (IS_NULL(dir))
+    dir_id_t id;
+    if (!dir_get_id(dir, &id))
+        return true;
+
+    for (size_t i = 0; i < walk->depth; i++)
     {
-        fprintf(stderr, "Could not open directory: %s\n", dir_path);
+        if ((walk->ancestors[i].dev == id.dev) && (walk->ancestors[i].ino == id.ino))
+            return false;
+    }
+
+    if (walk->depth == walk->ancestors_capacity)
+    {
+        size_t capacity = (walk->ancestors_capacity > 0) ? (walk->ancestors_capacity * 2) : 32;
+        dir_id_t *ancestors = realloc(walk->ancestors, capacity * sizeof(dir_id_t));
+        if (IS_NULL(ancestors))
+            return true; // Only loop detection is lost
+        walk->ancestors = ancestors;
+        walk->ancestors_capacity = capacity;
+    }
+    walk->ancestors[walk->depth++] = id;
+    return true;
+}
+
+/**
+ * @brief Walks an open directory, whose path is in walk->path, and closes it.
+ * Entries are typed from d_type where possible, and subdirectories and files
+ * are opened relative to the directory, so no path is resolved twice. Files
+ * are held back and read in batches, a batch ends at a subdirectory.
+ */
+static void walk_directory(walk_t *walk, DIR *dir)
+{
+    size_t depth = walk->depth;
+    if (!enter_directory(walk, dir))
+    {
+        fprintf(stderr, "Skipping symbolic link loop: %s\n", walk->path.buf);
+        closedir(dir);
         return;
     }
 
+    // With --stats, the time of its subdirectories is taken out of its own
+    uint64_t started = stats_begin();
+    uint64_t parent_subdir_ns = walk->subdir_ns;
+    walk->subdir_ns = 0;
+
+    ingestify_watch_dir(walk->ingestify, dir, walk->path.buf);
+    ingestify_dir_mark_t mark;
+    ingestify_dir_begin(walk->ingestify, &mark, walk->output);
+
+    // Its ignore file, if it has one, applies to everything under it
+    ignore_set_t *parent_ignore = walk->ignore;
+    walk->ignore = ignore_set_enter(parent_ignore, dir, walk->path.buf);
+
+    const size_t dir_len = walk->path.len;
+    bool within_limit = true;
     struct dirent *entry;
-    while (EXISTS((entry = readdir(dir))))
+    while (within_limit && EXISTS((entry = ingestify_read_dir(dir))))
     {
-        if (strncmp(entry->d_name, ".", __PATH_MAX) == 0 || strncmp(entry->d_name, "..", __PATH_MAX) == 0)
-            continue;
-
-        char full_path[__PATH_MAX];
-        snprintf(full_path, sizeof(full_path), "%s/%s", dir_path, entry->d_name);
-        if (strncmp(sanitize_path(full_path), output_file_path, __PATH_MAX) == 0)
-        {
-            fprintf(stdout, "Ignoring: \"%s\"\n", full_path);
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
             continue;
-        }
 
-        if (ignore_is_match(ignore_list, sanitize_path(full_path)))
+        progress_seen(walk->ingestify->progress);
+        if (!path_append(&walk->path, dir_len, entry->d_name))
         {
-            fprintf(stdout, "Ignoring: \"%s\"\n", full_path);
-            continue;
+            perror("Memory allocation failed");
+            break;
         }
+        const char *full_path = walk->path.buf;
+        const char *relative_path = skip_dot_slash(full_path);
 
-        struct stat path_stat;
-        if (stat(full_path, &path_stat) != 0)
+        // Typed before it is matched, a pattern like "build/" only ignores a directory
+        entry_type_t type = dir_entry_type(dir, entry, full_path);
+        bool held = true;
+        if (ingestify_is_output(walk->ingestify, relative_path, walk->output_file_path))
         {
-            fprintf(stderr, "Could not retrieve status for: %s\n", full_path);
-            continue;
+            held = pending_add(walk, PENDING_IGNORED);
         }
-
-        if (S_ISDIR(path_stat.st_mode))
+        else if (ignore_set_is_entry_match(walk->ignore, relative_path, type))
         {
-            ingestify_traverse_and_write(full_path, ignore_list, output_file, output_file_path, max_output_size);
+            held = pending_add(walk, PENDING_IGNORED);
         }
-        else if (S_ISREG(path_stat.st_mode))
+        else
         {
-            FILE *input_file = fopen(full_path, "r");
-            if (EXISTS(input_file))
+            if (type == ENTRY_TYPE_NO_STATUS)
+            {
+                held = pending_add(walk, PENDING_NO_STATUS);
+            }
+            else if ((type == ENTRY_TYPE_DIR) && ignore_set_is_dir_match(walk->ignore, relative_path))
             {
-                fprintf(stdout, "Writing:  \"%s\"\n", full_path);
-                fprintf(output_file, "\nFILE \"%s\" =============================================================:\n", full_path);
-                char buffer[BUFSIZ];
-                size_t n;
-                while ((n = fread(buffer, 1, sizeof(buffer), input_file)) > 0)
+                held = pending_add(walk, PENDING_IGNORED); // Nothing under it could be written
+            }
+            else if (type == ENTRY_TYPE_DIR)
+            {
+                // Everything before the subdirectory comes out before it
+                within_limit = pending_flush(walk, dir);
+                if (!within_limit)
+                    break;
+
+                if (!ingestify_reuse_dir(walk->ingestify, full_path, walk->output, walk->max_output_size)) // Or taken from the previous output
                 {
-                    data_written += n;
-                    if (data_written > max_output_size)
-                    {
-                        fprintf(stderr, "Output file size exceeded the limit. Aborting.\n");
-                        fclose(input_file);
-                        closedir(dir);
-                        return;
-                    }
-
-                    fwrite(buffer, 1, n, output_file);
+                    uint64_t open_started = stats_begin();
+                    DIR *child = dir_open_child(dir, entry->d_name, full_path);
+                    stats_end(STATS_OPEN, open_started, 0);
+                    if (IS_NULL(child))
+                        fprintf(stderr, "Could not open directory: %s\n", full_path);
+                    else
+                        walk_directory(walk, child);
                 }
-                fputs("\n", output_file);
-                fclose(input_file);
             }
-            else
+            else if (type == ENTRY_TYPE_FILE)
             {
-                fprintf(stderr, "Could not open file: %s\n", full_path);
+                held = pending_add_file(walk, dir, entry->d_name);
             }
         }
+
+        if (!held)
+        {
+            perror("Memory allocation failed");
+            break;
+        }
+
+        if ((walk->pending_count == WALK_PENDING_MAX) || (walk->pending_files == URING_BATCH_MAX))
+            within_limit = pending_flush(walk, dir);
+    }
+
+    if (within_limit && pending_flush(walk, dir))
+    {
+        walk->path.buf[dir_len] = '\0';
+        ingestify_dir_end(walk->ingestify, walk->path.buf, &mark, walk->output, walk->max_output_size);
     }
 
+    walk->path.len = dir_len;
+    walk->path.buf[dir_len] = '\0';
+    walk->depth = depth;
+    ignore_set_release(walk->ignore);
+    walk->ignore = parent_ignore;
     closedir(dir);
+    walk->subdir_ns = parent_subdir_ns + stats_dir(walk->path.buf, started, walk->subdir_ns);
+}
+
+/**
+ * @brief Recursively traverses a directory and writes the contents to an output file.
+ * Ignored entries are skipped before they are descended into, and every
+ * entry is stat-ed at most once, only where the directory entry does not
+ * give its type. A directory that only holds
+ * ignored paths is not opened at all.
+ * 
+ * @param[in, out] ingestify        The output being written, and its options.
+ * @param[in]      dir_path         Path to the directory.
+ * @param[in]      ignore           Ignore rules of the directory.
+ * @param[in, out] output           Output file.
+ * @param[in]      output_file_path Path to the output file, NULL if the
+ *                                  output only goes to a sink.
+ * @param[in]      max_output_size  Maximum allowed size for the output file,
+ *                                  or INGESTIFY_MAX_SIZE_AUTO.
+ * 
+ * @return false if the directory could not be opened.
+ */
+bool ingestify_traverse_and_write(ingestify_t *ingestify, const char *dir_path, ignore_set_t *ignore, writer_t *output, const char *output_file_path, const off_t max_output_size)
+{
+    uint64_t started = stats_begin();
+    DIR *dir = dir_open(dir_path);
+    stats_end(STATS_OPEN, started, 0);
+    if (IS_NULL(dir))
+    {
+        fprintf(stderr, "Could not open directory: %s\n", dir_path);
+        return false;
+    }
+
+    walk_t *walk = calloc(1, sizeof(walk_t));
+    uring_t *ring = uring_create(INGESTIFY_ZERO_COPY_MIN, ingestify->use_io_uring);
+    if (IS_NULL(walk) || IS_NULL(ring))
+    {
+        perror("Memory allocation failed");
+        free(walk);
+        uring_destroy(ring);
+        closedir(dir);
+        return false;
+    }
+    walk->ingestify        = ingestify;
+    walk->ignore           = ignore;
+    walk->output           = output;
+    walk->output_file_path = output_file_path;
+    walk->max_output_size  = max_output_size;
+    walk->ring             = ring;
+
+    // The directory path is the root of every entry path
+    size_t dir_len = strlen(dir_path);
+    walk->path.capacity = dir_len + __PATH_MAX;
+    walk->path.buf = malloc(walk->path.capacity);
+    if (IS_NULL(walk->path.buf))
+    {
+        perror("Memory allocation failed");
+        closedir(dir);
+    }
+    else
+    {
+        memcpy(walk->path.buf, dir_path, dir_len + 1);
+        walk->path.len = dir_len;
+        walk_directory(walk, dir);
+    }
+
+    bool opened = EXISTS(walk->path.buf);
+    path_free(&walk->path);
+    free(walk->ancestors);
+    free(walk->paths);
+    uring_destroy(walk->ring);
+    free(walk);
+    return opened;
 }
 
 // end of file ingestify.c
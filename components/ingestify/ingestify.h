@@ -11,26 +11,409 @@
 #define INGESTIFY_H_
 
 #include <stdio.h>
+#include <stdbool.h>
+#include <dirent.h>
+#include <sys/types.h>
 #include "ignore.h"
+#include "manifest.h"
+#include "writer.h"
+#include "watch.h"
+#include "dedup.h"
+#include "toc.h"
+#include "shard.h"
+#include "progress.h"
 
 /**
- * @brief Calculates the total size of a directory recursively.
+ * @brief Passed as max_output_size to let the limit follow the walk, the
+ * output may then grow to twice the size of the files found so far.
+ */
+#define INGESTIFY_MAX_SIZE_AUTO ((off_t)0)
+
+/**
+ * @brief Passed as max_output_size for no limit on the output at all.
+ */
+#define INGESTIFY_MAX_SIZE_NONE ((off_t)1 << 62)
+
+/**
+ * @brief Everything a walk keeps between files, and its options. Each ingest
+ * needs one of its own, from ingestify_create(), and several can then run in
+ * one process at once.
+ */
+typedef struct ingestify ingestify_t;
+
+/**
+ * @brief Callbacks told where each file starts and ends in the output, so
+ * that it can be taken apart as it is made. They are called on the thread
+ * that writes the output, in the order of the output, and the header of a
+ * file and its contents come through on_chunk() in between. If any returns
+ * false, the walk stops.
+ */
+typedef struct
+{
+    bool (*on_file_begin)(void *context, const char *path);
+    bool (*on_chunk)(void *context, const void *data, size_t size);
+    bool (*on_file_end)(void *context, const char *path);
+    void *context;
+} ingestify_sink_t;
+
+/**
+ * @brief Where the files of a directory start in the output, so that the
+ * directory can be added to the manifest once they are written.
+ */
+typedef struct
+{
+    size_t offset;
+    off_t written;
+    off_t found;
+    size_t entries;
+    uint64_t tokens;
+} ingestify_dir_mark_t;
+
+/**
+ * @brief Writes a file into the output, with its header.
+ * 
+ * @param[in, out] ingestify       The output being written, and its options.
+ * @param[in]      file_path       Path to the file.
+ * @param[in]      digest          From ingestify_hash_file(), NULL if it was
+ *                                 not hashed ahead. Only used if the file
+ *                                 still has the size that was hashed.
+ * @param[in, out] output          Output file.
+ * @param[in]      max_output_size Maximum allowed size for the output file.
+ * 
+ * @return false if the output size limit was exceeded.
+ */
+bool ingestify_write_file(ingestify_t *ingestify, const char *file_path, const dedup_digest_t *digest, writer_t *output, const off_t max_output_size);
+
+/**
+ * @brief Writes a file that was already read into memory into the output,
+ * exactly as ingestify_write_file() would have written it. Unlike it, this
+ * leaves progress_writing() to the caller, who has the file already.
+ * 
+ * @param[in, out] ingestify       The output being written, and its options.
+ * @param[in]      file_path       Path to the file, for the header.
+ * @param[in]      file_size       Size of the file when it was opened.
+ * @param[in]      data            Contents of the file.
+ * @param[in]      size            Size of the contents.
+ * @param[in]      key             What the file looked like before it was
+ *                                 read, for the manifest, may be NULL.
+ * @param[in]      digest          From ingestify_hash_buffer(), NULL if it
+ *                                 was not hashed ahead.
+ * @param[in, out] output          Output file.
+ * @param[in]      max_output_size Maximum allowed size for the output file.
+ * 
+ * @return false if the output size limit was exceeded.
+ */
+bool ingestify_write_buffer(ingestify_t *ingestify, const char *file_path, off_t file_size, const char *data, size_t size, const manifest_key_t *key,
+                            const dedup_digest_t *digest, writer_t *output, const off_t max_output_size);
+
+/**
+ * @brief With deduplication, hashes a file that was read ahead, so that
+ * ingestify_write_buffer() does not have to. Safe to call from many threads
+ * at once.
+ * 
+ * @param[in]  ingestify  The output being written, and its options.
+ * @param[in]  data       Contents of the file.
+ * @param[in]  size       Size of the contents.
+ * @param[out] digest_out The hash.
+ * 
+ * @return false if files are not deduplicated, or this one is too small to
+ * be, or only its size is written since it is binary.
+ */
+bool ingestify_hash_buffer(const ingestify_t *ingestify, const char *data, size_t size, dedup_digest_t *digest_out);
+
+/**
+ * @brief With deduplication, hashes an open file from where it is, and goes
+ * back there. Safe to call from many threads at once.
+ * 
+ * @param[in]  ingestify  The output being written, and its options.
+ * @param[in]  fd         Open file.
+ * @param[in]  size       Size of the file.
+ * @param[out] digest_out The hash.
+ * 
+ * @return false if files are not deduplicated, this one is too small to be,
+ * only its size is written since it is binary, or it could not be read whole.
+ */
+bool ingestify_hash_file(const ingestify_t *ingestify, int fd, off_t size, dedup_digest_t *digest_out);
+
+/**
+ * @brief Writes a file that has not changed since the previous output by
+ * taking it from there, and adds it to the manifest being kept.
+ * 
+ * @param[in, out] ingestify       The output being written, and its options.
+ * @param[in]      file_path       Path to the file.
+ * @param[in]      key             What the file looks like now.
+ * @param[in, out] output          Output file, from writer_open_over().
+ * @param[in]      max_output_size Maximum allowed size for the output file.
+ * 
+ * @return false if it was not taken from the previous output, because it
+ * changed, would not fit in the limit, or could not be copied. Nothing was
+ * written then, and the file has to be read.
+ */
+bool ingestify_reuse_file(ingestify_t *ingestify, const char *file_path, const manifest_key_t *key, writer_t *output, const off_t max_output_size);
+
+/**
+ * @brief While watching, takes a directory that did not change since the
+ * previous output from it as a whole, with everything under it, without
+ * opening it.
+ * 
+ * @param[in, out] ingestify       The output being written, and its options.
+ * @param[in]      dir_path        Path to the directory.
+ * @param[in, out] output          Output file, from writer_open_over().
+ * @param[in]      max_output_size Maximum allowed size for the output file.
+ * 
+ * @return false if it was not taken from the previous output. Nothing was
+ * written then, and the directory has to be walked.
+ */
+bool ingestify_reuse_dir(ingestify_t *ingestify, const char *dir_path, writer_t *output, const off_t max_output_size);
+
+/**
+ * @brief Notes where the files of a directory start in the output, before
+ * any of them is written.
+ * 
+ * @param[in]  ingestify The output being written, and its options.
+ * @param[out] mark      Where the directory starts.
+ * @param[in]  output    Output file.
+ */
+void ingestify_dir_begin(const ingestify_t *ingestify, ingestify_dir_mark_t *mark, const writer_t *output);
+
+/**
+ * @brief Adds a directory to the manifest being kept, once everything under
+ * it was written. A directory cut short by the size limit is left out.
+ * 
+ * @param[in, out] ingestify       The output being written, and its options.
+ * @param[in]      dir_path        Path to the directory.
+ * @param[in]      mark            From ingestify_dir_begin().
+ * @param[in]      output          Output file.
+ * @param[in]      max_output_size Maximum allowed size for the output file.
+ */
+void ingestify_dir_end(ingestify_t *ingestify, const char *dir_path, const ingestify_dir_mark_t *mark, const writer_t *output, const off_t max_output_size);
+
+/**
+ * @brief Watches a directory that the walk opened, if a watch is set. Safe to
+ * call from many threads at once.
+ * 
+ * @param[in] ingestify The output being written, and its options.
+ * @param[in] dir       Open directory.
+ * @param[in] dir_path  Path to the directory.
+ */
+void ingestify_watch_dir(const ingestify_t *ingestify, DIR *dir, const char *dir_path);
+
+/**
+ * @brief Reads the next entry of a directory that the walk opened, timed
+ * for --stats.
+ * 
+ * @param[in] dir Open directory.
+ * 
+ * @return struct dirent* The entry, NULL at the end.
+ */
+struct dirent *ingestify_read_dir(DIR *dir);
+
+/**
+ * @brief In incremental mode, stats a file before it is read, for the
+ * manifest and to find out whether it changed.
+ * 
+ * @param[in]  ingestify The output being written, and its options.
+ * @param[in]  dir       Open directory of the file.
+ * @param[in]  name      Name of the file.
+ * @param[in]  path      Full path of the file.
+ * @param[out] key_out   What the file looks like.
+ * 
+ * @return false outside incremental mode, or if the file has no status.
+ */
+bool ingestify_stat_file(const ingestify_t *ingestify, DIR *dir, const char *name, const char *path, manifest_key_t *key_out);
+
+/**
+ * @brief Tells whether a file is in the previous output, unchanged. Safe to
+ * call from many threads at once.
+ * 
+ * @param[in] ingestify The output being written, and its options.
+ * @param[in] file_path Path to the file.
+ * @param[in] key       What the file looks like now.
+ * 
+ * @return true if ingestify_reuse_file() can take it from there.
+ */
+bool ingestify_is_unchanged(const ingestify_t *ingestify, const char *file_path, const manifest_key_t *key);
+
+/**
+ * @brief Tells whether a path is the output, one of the files kept next to
+ * it or its shards, or the trace, which are never written into it.
  * 
- * @param[in] dir_path Path to the directory.
+ * @param[in] ingestify        The output being written, and its options.
+ * @param[in] relative_path    Path of the entry, without a leading "./".
+ * @param[in] output_file_path Path to the output file, NULL if there is none.
  * 
- * @return off_t The total size of the directory.
+ * @return true if it is.
  */
-off_t ingestify_calculate_directory_size(const char *dir_path);
+bool ingestify_is_output(const ingestify_t *ingestify, const char *relative_path, const char *output_file_path);
 
 /**
  * @brief Recursively traverses a directory and writes the contents to an output file.
+ * Ignored entries are skipped before they are descended into, and every
+ * entry is stat-ed at most once, only where the directory entry does not
+ * give its type. A directory that only holds ignored paths is not opened
+ * at all.
  * 
+ * @param[in, out] ingestify        The output being written, and its options.
  * @param[in]      dir_path         Path to the directory.
- * @param[in]      ignore_list      Pointer to the ignore list structure.
- * @param[in, out] output_file      Pointer to the output file.
- * @param[in]      output_file_path Path to the output file.
- * @param[in]      max_output_size  Maximum allowed size for the output file.
+ * @param[in]      ignore           Ignore rules of the directory, from
+ *                                  ignore_set_create().
+ * @param[in, out] output           Output file.
+ * @param[in]      output_file_path Path to the output file, NULL if the
+ *                                  output only goes to a sink.
+ * @param[in]      max_output_size  Maximum allowed size for the output file,
+ *                                  or INGESTIFY_MAX_SIZE_AUTO.
+ * 
+ * @return false if the directory could not be opened.
+ */
+bool ingestify_traverse_and_write(ingestify_t *ingestify, const char *dir_path, ignore_set_t *ignore, writer_t *output, const char *output_file_path, const off_t max_output_size);
+
+/**
+ * @brief Makes the state of a new ingest, with the options of the command
+ * line when none is given, except that it prints nothing, see
+ * ingestify_progress().
+ * 
+ * @return ingestify_t* The state, NULL if memory ran out. Free it with
+ * ingestify_destroy().
+ */
+ingestify_t *ingestify_create(void);
+
+/**
+ * @brief Frees the state of an ingest. What was set on it, such as the
+ * manifests or the watch, is not freed.
+ * 
+ * @param[in] ingestify From ingestify_create(), or NULL.
+ */
+void ingestify_destroy(ingestify_t *ingestify);
+
+/**
+ * @brief Gives what an ingest prints and its counters, to choose the mode
+ * or read the counts.
+ * 
+ * @param[in] ingestify The state of the ingest.
+ * 
+ * @return progress_t* Its progress.
+ */
+progress_t *ingestify_progress(ingestify_t *ingestify);
+
+/**
+ * @brief Tells callbacks where each file starts and ends in the output.
+ * The output is flushed before each, so that everything before them has
+ * reached it.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      sink      Callbacks, NULL for none. Copied.
+ */
+void ingestify_set_sink(ingestify_t *ingestify, const ingestify_sink_t *sink);
+
+/**
+ * @brief Chooses whether small files are read through io_uring, where the
+ * kernel has it, or with plain system calls.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      enabled   true to use io_uring.
+ */
+void ingestify_use_io_uring(ingestify_t *ingestify, bool enabled);
+
+/**
+ * @brief Chooses whether binary files, found by a NUL byte or invalid UTF-8
+ * in their first block, are written as their size only or whole.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      enabled   true to write only their size.
+ */
+void ingestify_skip_binary(ingestify_t *ingestify, bool enabled);
+
+/**
+ * @brief Chooses whether the tokens of each file are estimated and written
+ * in its header, and the limits on them.
+ * 
+ * @param[in, out] ingestify    The output being written, and its options.
+ * @param[in]      enabled      true to count tokens.
+ * @param[in]      max_total    Most tokens of the output, it aborts past them, 0
+ *                              for no limit.
+ * @param[in]      max_per_file Most tokens of one file, it is cut there, 0 for no limit.
+ */
+void ingestify_set_tokens(ingestify_t *ingestify, bool enabled, uint64_t max_total, uint64_t max_per_file);
+
+/**
+ * @brief Maps files from a size on, instead of letting the kernel move them.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      size      Smallest file to map, 0 to map only the large files that the
+ *                           kernel refuses to move.
+ */
+void ingestify_set_mmap_min(ingestify_t *ingestify, off_t size);
+
+/**
+ * @brief Keeps a manifest of the output, and takes the files that did not
+ * change from the previous output.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      previous  Manifest of the previous output, NULL if there is none.
+ * @param[in]      next      Manifest to fill for this output, NULL to keep none.
+ */
+void ingestify_set_manifests(ingestify_t *ingestify, const manifest_t *previous, manifest_t *next);
+
+/**
+ * @brief Watches the directories the walk opens, and takes the ones that did
+ * not change from the previous output.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      watch     The watch, NULL to stop watching.
+ */
+void ingestify_set_watch(ingestify_t *ingestify, watch_t *watch);
+
+/**
+ * @brief Writes files whose contents were written before as a reference to
+ * the first file that had them.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      table     Table of the contents written, NULL to write every file whole.
+ */
+void ingestify_set_dedup(ingestify_t *ingestify, dedup_t *table);
+
+/**
+ * @brief Writes an index at the end of the output, of where the contents
+ * of every file are in it.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      table     Index to fill, NULL to write none.
+ */
+void ingestify_set_toc(ingestify_t *ingestify, toc_t *table);
+
+/**
+ * @brief Notes where every file starts in the output, so that it can be
+ * split into shards once it is written.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      list      Files of the output, NULL to not split it.
+ */
+void ingestify_set_shards(ingestify_t *ingestify, shard_t *list);
+
+/**
+ * @brief Leaves the trace file out of the output, as it is written while
+ * the walk goes on.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in]      path      Path of the trace file, NULL if there is none.
+ */
+void ingestify_set_trace(ingestify_t *ingestify, const char *path);
+
+/**
+ * @brief Starts counting the data of a new output from zero, before it is
+ * written again, and forgets the contents written.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ */
+void ingestify_start_output(ingestify_t *ingestify);
+
+/**
+ * @brief Ends an output once every file is written, with the index if one
+ * is written.
+ * 
+ * @param[in, out] ingestify The output being written, and its options.
+ * @param[in, out] output    Output file.
  */
-void ingestify_traverse_and_write(const char *dir_path, const ignore_list_t *ignore_list, FILE *output_file, const char *output_file_path, const off_t max_output_size);
+void ingestify_finish_output(ingestify_t *ingestify, writer_t *output);
 
 #endif // INGESTIFY_H_
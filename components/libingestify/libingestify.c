@@ -0,0 +1,100 @@
+/**
+ * @file      libingestify.c
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Ingests a directory into a program instead of a file. The
+ *            output is handed to callbacks as it is made, file by file, so
+ *            that it can go straight into a pipeline of the program. Each
+ *            ingest has a state of its own from ingestify_create(), so
+ *            several can run in one process at once.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#include "libingestify.h"
+#include "common.h"
+#include "pwalk.h"
+#include "writer.h"
+
+#include <stdio.h>
+
+/**
+ * @brief Hands the buffer of the output to on_chunk(), see writer_sink_t.
+ */
+static bool forward_chunks(void *context, const void **bases, const size_t *lengths, int count)
+{
+    const ingestify_sink_t *sink = context;
+    for (int i = 0; i < count; i++)
+    {
+        if (!sink->on_chunk(sink->context, bases[i], lengths[i]))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Nothing is held back, the program ends its own pipeline, see
+ * writer_sink_t.
+ */
+static bool forward_close(void *context)
+{
+    (void)context;
+    return true;
+}
+
+/**
+ * @brief Walks a directory and hands its output to callbacks, exactly as it
+ * would have been written to a file. The callbacks are called on the calling
+ * thread, chunk by chunk, between on_file_begin() and on_file_end() for the
+ * contents of each file, and without them for what belongs to no file, like
+ * the index. Nothing is printed, unless a mode is chosen for
+ * ingestify_progress() of the ingest.
+ * 
+ * @param[in, out] ingestify    State of the ingest, with its options, from
+ *                              ingestify_create(). One ingest at a time.
+ * @param[in]      dir_path     Path to the directory.
+ * @param[in]      ignore       Ignore rules of the directory, from
+ *                              ignore_set_create().
+ * @param[in]      sink         Callbacks, on_chunk() is needed, the others
+ *                              may be NULL.
+ * @param[in]      max_size     Most bytes of file contents handed over,
+ *                              INGESTIFY_MAX_SIZE_AUTO or
+ *                              INGESTIFY_MAX_SIZE_NONE.
+ * @param[in]      thread_count Number of threads that read the tree.
+ * 
+ * @return false if the directory could not be opened, or a callback failed
+ * a chunk. A walk stopped by on_file_begin() or on_file_end() is not a
+ * failure.
+ */
+bool libingestify_ingest(ingestify_t *ingestify, const char *dir_path, ignore_set_t *ignore, const ingestify_sink_t *sink,
+                         off_t max_size, unsigned int thread_count)
+{
+    if (IS_NULL(sink) || IS_NULL(sink->on_chunk))
+    {
+        fprintf(stderr, "Ingesting into a program needs an on_chunk callback\n");
+        return false;
+    }
+
+    writer_sink_t chunks = { .write = forward_chunks, .close = forward_close, .context = (void *)sink };
+    writer_t *output = writer_open_sink(&chunks, WRITER_BUFFER_DEFAULT);
+    if (IS_NULL(output))
+    {
+        perror("Memory allocation failed");
+        return false;
+    }
+
+    // There is no output file for the walk to leave out
+    ingestify_set_sink(ingestify, sink);
+    ingestify_start_output(ingestify);
+    bool opened;
+    if (thread_count > 1)
+        opened = pwalk_traverse_and_write(ingestify, dir_path, ignore, output, NULL, max_size, thread_count);
+    else
+        opened = ingestify_traverse_and_write(ingestify, dir_path, ignore, output, NULL, max_size);
+    ingestify_finish_output(ingestify, output);
+    bool written = writer_close(output);
+    ingestify_set_sink(ingestify, NULL);
+    return opened && written;
+}
+
+// end of file libingestify.c
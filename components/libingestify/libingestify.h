@@ -0,0 +1,49 @@
+/**
+ * @file      libingestify.h
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Ingests a directory into a program instead of a file. The
+ *            output is handed to callbacks as it is made, file by file, so
+ *            that it can go straight into a pipeline of the program. Each
+ *            ingest has a state of its own from ingestify_create(), so
+ *            several can run in one process at once.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#ifndef LIBINGESTIFY_H_
+#define LIBINGESTIFY_H_
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include "ingestify.h"
+#include "ignore.h"
+
+/**
+ * @brief Walks a directory and hands its output to callbacks, exactly as it
+ * would have been written to a file. The callbacks are called on the calling
+ * thread, chunk by chunk, between on_file_begin() and on_file_end() for the
+ * contents of each file, and without them for what belongs to no file, like
+ * the index. Nothing is printed, unless a mode is chosen for
+ * ingestify_progress() of the ingest.
+ * 
+ * @param[in, out] ingestify    State of the ingest, with its options, from
+ *                              ingestify_create(). One ingest at a time.
+ * @param[in]      dir_path     Path to the directory.
+ * @param[in]      ignore       Ignore rules of the directory, from
+ *                              ignore_set_create().
+ * @param[in]      sink         Callbacks, on_chunk() is needed, the others
+ *                              may be NULL.
+ * @param[in]      max_size     Most bytes of file contents handed over,
+ *                              INGESTIFY_MAX_SIZE_AUTO or
+ *                              INGESTIFY_MAX_SIZE_NONE.
+ * @param[in]      thread_count Number of threads that read the tree.
+ * 
+ * @return false if the directory could not be opened, or a callback failed
+ * a chunk. A walk stopped by on_file_begin() or on_file_end() is not a
+ * failure.
+ */
+bool libingestify_ingest(ingestify_t *ingestify, const char *dir_path, ignore_set_t *ignore, const ingestify_sink_t *sink,
+                         off_t max_size, unsigned int thread_count);
+
+#endif // LIBINGESTIFY_H_
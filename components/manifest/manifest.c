@@ -0,0 +1,581 @@
+/**
+ * @file      manifest.c
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Record of what an output holds, kept next to it. For every
+ *            file it has the status the file had when it was read, and
+ *            where the file is in the output, so that a later run can
+ *            take unchanged files from the previous output.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#include "manifest.h"
+#include "common.h"
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define MANIFEST_MAGIC "INGMAN04" /**< Changed whenever the records change */
+
+/**
+ * @brief A file changed this soon before a run started may change again
+ * without its status showing it, timestamps being coarse, so it is read again
+ * on the next run.
+ */
+#define MANIFEST_RACY_NS 1000000000LL
+
+/**
+ * @brief Start of a manifest file, followed by the records.
+ */
+typedef struct
+{
+    char magic[8];
+    int64_t started_ns;      /**< When the run that wrote it started */
+    int64_t output_size;     /**< Status of the output it describes */
+    int64_t output_mtime_ns;
+    uint64_t output_ino;
+    uint64_t count;          /**< Number of records */
+} manifest_header_t;
+
+/**
+ * @brief An entry in a manifest file, followed by its path, without a '\0'.
+ */
+typedef struct
+{
+    manifest_key_t key;
+    int64_t offset;
+    int64_t length;
+    int64_t content;
+    uint64_t entries;
+    uint64_t hash;
+    uint64_t tokens;
+    uint32_t path_len;
+    uint32_t flags;          /**< MANIFEST_RECORD_* */
+} manifest_record_t;
+
+#define MANIFEST_RECORD_DIR    1u
+#define MANIFEST_RECORD_HASHED 2u
+#define MANIFEST_RECORD_TEXT   4u
+#define MANIFEST_RECORD_BINARY 8u
+#define MANIFEST_RECORD_TOKENS 16u
+
+struct manifest
+{
+    arena_t arena;              /**< Paths */
+    manifest_entry_t *entries;  /**< In output order */
+    size_t count;
+    size_t capacity;
+    uint32_t *slots;            /**< Entry index + 1 by path hash, 0 for a free slot. Only when loaded */
+    size_t slot_mask;
+    int64_t started_ns;         /**< When the run started */
+};
+
+/**
+ * @brief Takes the parts of a file status that tell whether it changed.
+ * 
+ * @param[in]  file_stat Status of the file.
+ * @param[out] key       The key.
+ */
+void manifest_key_from_stat(const struct stat *file_stat, manifest_key_t *key)
+{
+    key->size = (int64_t)file_stat->st_size;
+    key->ino  = (uint64_t)file_stat->st_ino;
+#if defined(_WIN32)
+    key->mtime_ns = (int64_t)file_stat->st_mtime * 1000000000LL;
+    key->ctime_ns = (int64_t)file_stat->st_ctime * 1000000000LL;
+#else
+    key->mtime_ns = (int64_t)file_stat->st_mtim.tv_sec * 1000000000LL + file_stat->st_mtim.tv_nsec;
+    key->ctime_ns = (int64_t)file_stat->st_ctim.tv_sec * 1000000000LL + file_stat->st_ctim.tv_nsec;
+#endif
+}
+
+/**
+ * @brief Path of the output with a suffix added.
+ * 
+ * @return char* The path, to be freed, NULL if memory ran out.
+ */
+static char *sidecar_path(const char *output_path, const char *suffix)
+{
+    size_t output_len = strlen(output_path);
+    size_t suffix_len = strlen(suffix);
+    char *path = malloc(output_len + suffix_len + 1);
+    if (EXISTS(path))
+    {
+        memcpy(path, output_path, output_len);
+        memcpy(&path[output_len], suffix, suffix_len + 1);
+    }
+    return path;
+}
+
+/**
+ * @brief Creates an empty manifest, for the output being written.
+ * 
+ * @return manifest_t* The manifest, NULL if memory ran out.
+ */
+manifest_t *manifest_create(void)
+{
+    manifest_t *manifest = calloc(1, sizeof(manifest_t));
+    if (IS_NULL(manifest))
+        return NULL;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    manifest->started_ns = (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+    return manifest;
+}
+
+/**
+ * @brief Adds an entry, with a copy of its path.
+ * 
+ * @return false if memory ran out.
+ */
+static bool add_entry(manifest_t *manifest, const manifest_entry_t *entry)
+{
+    if (manifest->count == manifest->capacity)
+    {
+        size_t capacity = (manifest->capacity > 0) ? (manifest->capacity * 2) : 1024;
+        manifest_entry_t *entries = realloc(manifest->entries, capacity * sizeof(manifest_entry_t));
+        if (IS_NULL(entries))
+            return false;
+        manifest->entries = entries;
+        manifest->capacity = capacity;
+    }
+
+    char *copy = arena_strndup(&manifest->arena, entry->path, strlen(entry->path));
+    if (IS_NULL(copy))
+        return false;
+
+    manifest->entries[manifest->count] = *entry;
+    manifest->entries[manifest->count].path = copy;
+    manifest->count++;
+    return true;
+}
+
+/**
+ * @brief Adds a file that was written to the output. Files are added in
+ * the order they are written.
+ * 
+ * @param[in, out] manifest The manifest.
+ * @param[in]      path     Path of the file.
+ * @param[in]      key      What the file looked like before it was read.
+ * @param[in]      offset   Where its header starts in the output.
+ * @param[in]      length   Bytes it takes in the output.
+ * @param[in]      content  Bytes of contents.
+ * @param[in]      kind     What the file was found to be.
+ * @param[in]      hash     Hash of the contents, for deduplication, NULL if
+ *                          it was not hashed.
+ * @param[in]      tokens   Tokens of the contents, NULL if they were not counted.
+ * 
+ * @return false if memory ran out, the file is left out then.
+ */
+bool manifest_add(manifest_t *manifest, const char *path, const manifest_key_t *key, int64_t offset, int64_t length, int64_t content, manifest_kind_t kind,
+                  const uint64_t *hash, const uint64_t *tokens)
+{
+    manifest_entry_t entry =
+    {
+        .path    = path,
+        .key     = *key,
+        .offset  = offset,
+        .length  = length,
+        .content = content,
+        .kind    = kind,
+        .hashed  = EXISTS(hash),
+        .hash    = EXISTS(hash) ? *hash : 0,
+        .counted = EXISTS(tokens),
+        .tokens  = EXISTS(tokens) ? *tokens : 0,
+    };
+    return add_entry(manifest, &entry);
+}
+
+/**
+ * @brief Adds a directory whose files were written to the output, after the
+ * entries under it.
+ * 
+ * @param[in, out] manifest The manifest.
+ * @param[in]      path     Path of the directory.
+ * @param[in]      offset   Where its first file starts in the output.
+ * @param[in]      length   Bytes its files take in the output.
+ * @param[in]      content  Bytes of contents of its files.
+ * @param[in]      found    Size of its files.
+ * @param[in]      entries  Entries added since the directory was started.
+ * @param[in]      tokens   Tokens of the contents of its files.
+ * 
+ * @return false if memory ran out, the directory is left out then.
+ */
+bool manifest_add_dir(manifest_t *manifest, const char *path, int64_t offset, int64_t length, int64_t content, int64_t found, uint64_t entries, uint64_t tokens)
+{
+    manifest_entry_t entry =
+    {
+        .path     = path,
+        .key      = { .size = found },
+        .offset   = offset,
+        .length   = length,
+        .content  = content,
+        .is_dir   = true,
+        .entries  = entries,
+        .tokens   = tokens,
+    };
+    return add_entry(manifest, &entry);
+}
+
+/**
+ * @brief Adds a directory of another manifest, with everything under it, for
+ * a directory that was taken from the previous output as a whole.
+ * 
+ * @param[in, out] manifest The manifest.
+ * @param[in]      previous The manifest the directory is in.
+ * @param[in]      dir      The directory, from manifest_find_dir().
+ * @param[in]      offset   Where the directory starts in the new output.
+ * 
+ * @return false if memory ran out, the entries are left out then.
+ */
+bool manifest_add_subtree(manifest_t *manifest, const manifest_t *previous, const manifest_entry_t *dir, int64_t offset)
+{
+    size_t last = (size_t)(dir - previous->entries);
+    int64_t shift = offset - dir->offset;
+    for (size_t i = last - (size_t)dir->entries; i <= last; i++)
+    {
+        manifest_entry_t entry = previous->entries[i];
+        entry.offset += shift;
+        if (!add_entry(manifest, &entry))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Number of entries added so far.
+ * 
+ * @param[in] manifest The manifest.
+ * 
+ * @return size_t The number of entries.
+ */
+size_t manifest_count(const manifest_t *manifest)
+{
+    return manifest->count;
+}
+
+/**
+ * @brief Makes a filled manifest the previous one of the next output, like
+ * manifest_load() would, without writing and reading it. Files that changed
+ * too close to the start of the run to be trusted are left out.
+ * 
+ * @param[in, out] manifest The manifest.
+ * 
+ * @return false if memory ran out, nothing can be found in it then.
+ */
+bool manifest_index(manifest_t *manifest)
+{
+    free(manifest->slots);
+
+    size_t slot_count = 16;
+    while (slot_count < (manifest->count * 2)) slot_count *= 2;
+
+    manifest->slots = calloc(slot_count, sizeof(uint32_t));
+    if (IS_NULL(manifest->slots))
+        return false;
+    manifest->slot_mask = slot_count - 1;
+
+    int64_t trusted_before = manifest->started_ns - MANIFEST_RACY_NS;
+    for (size_t i = 0; i < manifest->count; i++)
+    {
+        const manifest_entry_t *entry = &manifest->entries[i];
+        if ((entry->key.ctime_ns >= trusted_before) || (entry->key.mtime_ns >= trusted_before))
+            continue;
+
+        size_t slot = hash_bytes(HASH_SEED, entry->path, strlen(entry->path)) & manifest->slot_mask;
+        while (manifest->slots[slot] != 0)
+            slot = (slot + 1) & manifest->slot_mask;
+        manifest->slots[slot] = (uint32_t)(i + 1);
+    }
+    return true;
+}
+
+/**
+ * @brief Reads the records of a manifest file into a manifest.
+ * 
+ * @param[in, out] manifest    The manifest.
+ * @param[in]      data        Contents of the file, after the header.
+ * @param[in]      size        Size of the contents.
+ * @param[in]      header      Header of the file.
+ * 
+ * @return false if the records do not fit the header or the output.
+ */
+static bool parse_records(manifest_t *manifest, const char *data, size_t size, const manifest_header_t *header)
+{
+    if (header->count > (size / sizeof(manifest_record_t)))
+        return false;
+
+    manifest->entries = malloc((header->count > 0 ? header->count : 1) * sizeof(manifest_entry_t));
+    if (IS_NULL(manifest->entries))
+        return false;
+    manifest->capacity = header->count;
+
+    int64_t end = 0;
+    size_t position = 0;
+    for (uint64_t i = 0; i < header->count; i++)
+    {
+        manifest_record_t record;
+        if ((size - position) < sizeof(record))
+            return false;
+        memcpy(&record, &data[position], sizeof(record));
+        position += sizeof(record);
+
+        // Everything is within the output, files in output order, and
+        // directories after the entries under them
+        bool valid = (record.path_len > 0) && (record.path_len <= (size - position)) &&
+                     (record.offset >= 0) && (record.length >= 0) &&
+                     (record.content >= 0) && (record.content <= record.length) &&
+                     (record.length <= (header->output_size - record.offset));
+        bool is_dir = ((record.flags & MANIFEST_RECORD_DIR) != 0);
+        if (is_dir)
+            valid = valid && (record.entries <= i);
+        else
+            valid = valid && (record.offset >= end) && (record.length > 0);
+        if (!valid)
+            return false;
+        if (!is_dir)
+            end = record.offset + record.length;
+
+        char *path = arena_strndup(&manifest->arena, &data[position], (size_t)record.path_len);
+        if (IS_NULL(path))
+            return false;
+        position += (size_t)record.path_len;
+
+        manifest_entry_t *entry = &manifest->entries[manifest->count++];
+        entry->path    = path;
+        entry->key     = record.key;
+        entry->offset  = record.offset;
+        entry->length  = record.length;
+        entry->content = record.content;
+        entry->is_dir  = is_dir;
+        entry->entries = record.entries;
+        entry->kind    = (record.flags & MANIFEST_RECORD_BINARY) ? MANIFEST_KIND_BINARY :
+                         (record.flags & MANIFEST_RECORD_TEXT)   ? MANIFEST_KIND_TEXT : MANIFEST_KIND_UNCHECKED;
+        entry->hashed  = ((record.flags & MANIFEST_RECORD_HASHED) != 0);
+        entry->hash    = record.hash;
+        entry->counted = ((record.flags & MANIFEST_RECORD_TOKENS) != 0);
+        entry->tokens  = record.tokens;
+    }
+    return (position == size);
+}
+
+/**
+ * @brief Reads the manifest of an output. It is only used if the output is
+ * still exactly as the run that wrote the manifest left it.
+ * 
+ * @param[in] output_path Path to the output file.
+ * 
+ * @return manifest_t* The manifest, NULL if there is none or it is out of date.
+ */
+manifest_t *manifest_load(const char *output_path)
+{
+    char *path = sidecar_path(output_path, MANIFEST_SUFFIX);
+    if (IS_NULL(path))
+        return NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        free(path);
+        return NULL; // The first run
+    }
+
+    manifest_t *manifest = calloc(1, sizeof(manifest_t));
+    char *data = NULL;
+    bool valid = false;
+
+    struct stat manifest_stat;
+    struct stat output_stat;
+    manifest_header_t header;
+    bool readable = EXISTS(manifest) && (fstat(fd, &manifest_stat) == 0) &&
+                    (manifest_stat.st_size >= (off_t)sizeof(header)) &&
+                    (stat(output_path, &output_stat) == 0) && S_ISREG(output_stat.st_mode);
+    if (readable)
+    {
+        data = malloc((size_t)manifest_stat.st_size);
+        readable = EXISTS(data) && (read_full(fd, data, (size_t)manifest_stat.st_size) == (size_t)manifest_stat.st_size);
+    }
+    if (readable)
+    {
+        manifest_key_t output_key;
+        manifest_key_from_stat(&output_stat, &output_key);
+        memcpy(&header, data, sizeof(header));
+
+        valid = (memcmp(header.magic, MANIFEST_MAGIC, sizeof(header.magic)) == 0) &&
+                (header.output_size     == output_key.size) &&
+                (header.output_mtime_ns == output_key.mtime_ns) &&
+                (header.output_ino      == output_key.ino);
+        if (valid)
+        {
+            manifest->started_ns = header.started_ns;
+            valid = parse_records(manifest, &data[sizeof(header)], (size_t)manifest_stat.st_size - sizeof(header), &header) &&
+                    manifest_index(manifest);
+        }
+    }
+    close(fd);
+    free(data);
+
+    if (!valid)
+    {
+        fprintf(stderr, "%s does not match the output, writing everything again.\n", path);
+        manifest_free(manifest);
+        manifest = NULL;
+    }
+    free(path);
+    return manifest;
+}
+
+/**
+ * @brief Finds the entry of a path.
+ */
+static const manifest_entry_t *find_path(const manifest_t *manifest, const char *path)
+{
+    if (IS_NULL(manifest) || IS_NULL(manifest->slots))
+        return NULL;
+
+    size_t slot = hash_bytes(HASH_SEED, path, strlen(path)) & manifest->slot_mask;
+    for (; manifest->slots[slot] != 0; slot = (slot + 1) & manifest->slot_mask)
+    {
+        const manifest_entry_t *entry = &manifest->entries[manifest->slots[slot] - 1];
+        if (strcmp(entry->path, path) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Finds a file that has not changed since the manifest was written.
+ * Safe to call from many threads at once.
+ * 
+ * @param[in] manifest The manifest, may be NULL.
+ * @param[in] path     Path of the file.
+ * @param[in] key      What the file looks like now.
+ * 
+ * @return const manifest_entry_t* The entry, NULL if the file is not in the
+ * manifest or changed.
+ */
+const manifest_entry_t *manifest_find(const manifest_t *manifest, const char *path, const manifest_key_t *key)
+{
+    const manifest_entry_t *entry = find_path(manifest, path);
+    bool unchanged = EXISTS(entry) && !entry->is_dir &&
+                     (entry->key.size     == key->size) &&
+                     (entry->key.mtime_ns == key->mtime_ns) &&
+                     (entry->key.ctime_ns == key->ctime_ns) &&
+                     (entry->key.ino      == key->ino);
+    return unchanged ? entry : NULL;
+}
+
+/**
+ * @brief Finds a directory of the previous output. Whether it changed is for
+ * the caller to know.
+ * 
+ * @param[in] manifest The manifest, may be NULL.
+ * @param[in] path     Path of the directory.
+ * 
+ * @return const manifest_entry_t* The entry, NULL if it is not in the manifest.
+ */
+const manifest_entry_t *manifest_find_dir(const manifest_t *manifest, const char *path)
+{
+    const manifest_entry_t *entry = find_path(manifest, path);
+    return (EXISTS(entry) && entry->is_dir) ? entry : NULL;
+}
+
+/**
+ * @brief Writes the manifest next to the output, once the output is closed.
+ * 
+ * @param[in] manifest    The manifest.
+ * @param[in] output_path Path to the output file.
+ * 
+ * @return false if it could not be written, a later run reads everything then.
+ */
+bool manifest_save(const manifest_t *manifest, const char *output_path)
+{
+    struct stat output_stat;
+    if ((stat(output_path, &output_stat) != 0) || !S_ISREG(output_stat.st_mode))
+        return false;
+
+    char *path = sidecar_path(output_path, MANIFEST_SUFFIX);
+    char *temp_path = sidecar_path(output_path, MANIFEST_TEMP_SUFFIX);
+    FILE *file = (EXISTS(path) && EXISTS(temp_path)) ? fopen(temp_path, "wb") : NULL;
+    if (IS_NULL(file))
+    {
+        fprintf(stderr, "Could not write the manifest of: %s\n", output_path);
+        free(path);
+        free(temp_path);
+        return false;
+    }
+
+    manifest_key_t output_key;
+    manifest_key_from_stat(&output_stat, &output_key);
+
+    manifest_header_t header = { 0 };
+    memcpy(header.magic, MANIFEST_MAGIC, sizeof(header.magic));
+    header.started_ns      = manifest->started_ns;
+    header.output_size     = output_key.size;
+    header.output_mtime_ns = output_key.mtime_ns;
+    header.output_ino      = output_key.ino;
+    header.count           = manifest->count;
+    bool ok = (fwrite(&header, sizeof(header), 1, file) == 1);
+
+    for (size_t i = 0; ok && (i < manifest->count); i++)
+    {
+        const manifest_entry_t *entry = &manifest->entries[i];
+        manifest_record_t record =
+        {
+            .key      = entry->key,
+            .offset   = entry->offset,
+            .length   = entry->length,
+            .content  = entry->content,
+            .entries  = entry->entries,
+            .hash     = entry->hash,
+            .tokens   = entry->tokens,
+            .path_len = (uint32_t)strlen(entry->path),
+            .flags    = (entry->is_dir ? MANIFEST_RECORD_DIR : 0u) | (entry->hashed ? MANIFEST_RECORD_HASHED : 0u) |
+                        ((entry->kind == MANIFEST_KIND_TEXT) ? MANIFEST_RECORD_TEXT : 0u) |
+                        ((entry->kind == MANIFEST_KIND_BINARY) ? MANIFEST_RECORD_BINARY : 0u) |
+                        (entry->counted ? MANIFEST_RECORD_TOKENS : 0u),
+        };
+        ok = (fwrite(&record, sizeof(record), 1, file) == 1) &&
+             (fwrite(entry->path, 1, record.path_len, file) == record.path_len);
+    }
+
+    ok = (fclose(file) == 0) && ok;
+#if defined(_WIN32)
+    remove(path);
+#endif
+    ok = ok && (rename(temp_path, path) == 0);
+    if (!ok)
+    {
+        fprintf(stderr, "Could not write the manifest of: %s\n", output_path);
+        remove(temp_path);
+    }
+
+    free(path);
+    free(temp_path);
+    return ok;
+}
+
+/**
+ * @brief Frees a manifest.
+ * 
+ * @param[in] manifest The manifest, may be NULL.
+ */
+void manifest_free(manifest_t *manifest)
+{
+    if (IS_NULL(manifest))
+        return;
+
+    arena_free(&manifest->arena);
+    free(manifest->entries);
+    free(manifest->slots);
+    free(manifest);
+}
+
+// end of file manifest.c
@@ -0,0 +1,203 @@
+/**
+ * @file      manifest.h
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Record of what an output holds, kept next to it. For every
+ *            file it has the status the file had when it was read, and
+ *            where the file is in the output, so that a later run can
+ *            take unchanged files from the previous output.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#ifndef MANIFEST_H_
+#define MANIFEST_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define MANIFEST_SUFFIX      ".manifest"     /**< Added to the path of the output */
+#define MANIFEST_TEMP_SUFFIX ".manifest.tmp" /**< Written first, then renamed */
+
+/**
+ * @brief What a file looked like before it was read. If any of it differs on
+ * a later run, the file is read again.
+ */
+typedef struct
+{
+    int64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    uint64_t ino;
+} manifest_key_t;
+
+/**
+ * @brief What a file was found to be when it was written.
+ */
+typedef enum
+{
+    MANIFEST_KIND_UNCHECKED,   /**< Written whole without being looked at */
+    MANIFEST_KIND_TEXT,
+    MANIFEST_KIND_BINARY,      /**< Only its size was written */
+} manifest_kind_t;
+
+/**
+ * @brief A file in the output, or a directory, whose files are one run of
+ * the output. A directory comes right after the entries under it.
+ */
+typedef struct
+{
+    const char *path;   /**< Path as written in its header */
+    manifest_key_t key; /**< Directory: only size, the size of the files under it */
+    int64_t offset;     /**< Where its header starts in the output */
+    int64_t length;     /**< Header, contents and the newline after them */
+    int64_t content;    /**< Bytes of contents, counted against the size limit */
+    bool is_dir;
+    uint64_t entries;   /**< Directory: number of entries under it, right before it */
+    manifest_kind_t kind;
+    bool hashed;        /**< File: the contents were hashed, for deduplication */
+    uint64_t hash;
+    bool counted;       /**< File: its tokens were counted, and are in its header */
+    uint64_t tokens;    /**< Tokens of its contents, of a directory those of its files */
+} manifest_entry_t;
+
+typedef struct manifest manifest_t;
+
+/**
+ * @brief Takes the parts of a file status that tell whether it changed.
+ * 
+ * @param[in]  file_stat Status of the file.
+ * @param[out] key       The key.
+ */
+void manifest_key_from_stat(const struct stat *file_stat, manifest_key_t *key);
+
+/**
+ * @brief Creates an empty manifest, for the output being written.
+ * 
+ * @return manifest_t* The manifest, NULL if memory ran out.
+ */
+manifest_t *manifest_create(void);
+
+/**
+ * @brief Reads the manifest of an output. It is only used if the output is
+ * still exactly as the run that wrote the manifest left it.
+ * 
+ * @param[in] output_path Path to the output file.
+ * 
+ * @return manifest_t* The manifest, NULL if there is none or it is out of date.
+ */
+manifest_t *manifest_load(const char *output_path);
+
+/**
+ * @brief Finds a file that has not changed since the manifest was written.
+ * Safe to call from many threads at once.
+ * 
+ * @param[in] manifest The manifest, may be NULL.
+ * @param[in] path     Path of the file.
+ * @param[in] key      What the file looks like now.
+ * 
+ * @return const manifest_entry_t* The entry, NULL if the file is not in the
+ * manifest or changed.
+ */
+const manifest_entry_t *manifest_find(const manifest_t *manifest, const char *path, const manifest_key_t *key);
+
+/**
+ * @brief Finds a directory of the previous output. Whether it changed is for
+ * the caller to know.
+ * 
+ * @param[in] manifest The manifest, may be NULL.
+ * @param[in] path     Path of the directory.
+ * 
+ * @return const manifest_entry_t* The entry, NULL if it is not in the manifest.
+ */
+const manifest_entry_t *manifest_find_dir(const manifest_t *manifest, const char *path);
+
+/**
+ * @brief Number of entries added so far.
+ * 
+ * @param[in] manifest The manifest.
+ * 
+ * @return size_t The number of entries.
+ */
+size_t manifest_count(const manifest_t *manifest);
+
+/**
+ * @brief Adds a file that was written to the output. Files are added in
+ * the order they are written.
+ * 
+ * @param[in, out] manifest The manifest.
+ * @param[in]      path     Path of the file.
+ * @param[in]      key      What the file looked like before it was read.
+ * @param[in]      offset   Where its header starts in the output.
+ * @param[in]      length   Bytes it takes in the output.
+ * @param[in]      content  Bytes of contents.
+ * @param[in]      kind     What the file was found to be.
+ * @param[in]      hash     Hash of the contents, for deduplication, NULL if
+ *                          it was not hashed.
+ * @param[in]      tokens   Tokens of the contents, NULL if they were not counted.
+ * 
+ * @return false if memory ran out, the file is left out then.
+ */
+bool manifest_add(manifest_t *manifest, const char *path, const manifest_key_t *key, int64_t offset, int64_t length, int64_t content, manifest_kind_t kind,
+                  const uint64_t *hash, const uint64_t *tokens);
+
+/**
+ * @brief Adds a directory whose files were written to the output, after the
+ * entries under it.
+ * 
+ * @param[in, out] manifest The manifest.
+ * @param[in]      path     Path of the directory.
+ * @param[in]      offset   Where its first file starts in the output.
+ * @param[in]      length   Bytes its files take in the output.
+ * @param[in]      content  Bytes of contents of its files.
+ * @param[in]      found    Size of its files.
+ * @param[in]      entries  Entries added since the directory was started.
+ * @param[in]      tokens   Tokens of the contents of its files.
+ * 
+ * @return false if memory ran out, the directory is left out then.
+ */
+bool manifest_add_dir(manifest_t *manifest, const char *path, int64_t offset, int64_t length, int64_t content, int64_t found, uint64_t entries, uint64_t tokens);
+
+/**
+ * @brief Adds a directory of another manifest, with everything under it, for
+ * a directory that was taken from the previous output as a whole.
+ * 
+ * @param[in, out] manifest The manifest.
+ * @param[in]      previous The manifest the directory is in.
+ * @param[in]      dir      The directory, from manifest_find_dir().
+ * @param[in]      offset   Where the directory starts in the new output.
+ * 
+ * @return false if memory ran out, the entries are left out then.
+ */
+bool manifest_add_subtree(manifest_t *manifest, const manifest_t *previous, const manifest_entry_t *dir, int64_t offset);
+
+/**
+ * @brief Makes a filled manifest the previous one of the next output, like
+ * manifest_load() would, without writing and reading it.
+ * 
+ * @param[in, out] manifest The manifest.
+ * 
+ * @return false if memory ran out, nothing can be found in it then.
+ */
+bool manifest_index(manifest_t *manifest);
+
+/**
+ * @brief Writes the manifest next to the output, once the output is closed.
+ * 
+ * @param[in] manifest    The manifest.
+ * @param[in] output_path Path to the output file.
+ * 
+ * @return false if it could not be written, a later run reads everything then.
+ */
+bool manifest_save(const manifest_t *manifest, const char *output_path);
+
+/**
+ * @brief Frees a manifest.
+ * 
+ * @param[in] manifest The manifest, may be NULL.
+ */
+void manifest_free(manifest_t *manifest);
+
+#endif // MANIFEST_H_
@@ -0,0 +1,235 @@
+/**
+ * @file      progress.c
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     What the walk tells the user. Either a line per entry, nothing,
+ *            or counters that a reporter thread prints a few times a second.
+ *            Every ingest has its own, so ingests in one process neither
+ *            share counters nor print for each other.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#include "progress.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PROGRESS_INTERVAL_TTY_MS 250  /**< Refresh of the line on a terminal */
+#define PROGRESS_INTERVAL_LOG_MS 2000 /**< New line in a log, which cannot be redrawn */
+
+struct progress
+{
+    progress_mode_t mode;
+
+    /**
+     * @brief Counters, only added to by the walk and only read by the reporter,
+     * so relaxed atomics are enough and the walk never waits.
+     */
+    atomic_size_t seen;
+    atomic_size_t written;
+    atomic_size_t ignored;
+    atomic_size_t bytes;
+
+    pthread_t reporter;
+    bool reporter_running;
+    pthread_mutex_t reporter_lock;
+    pthread_cond_t reporter_cond;
+    bool reporter_stop;
+    bool on_terminal;
+};
+
+/**
+ * @brief Creates the progress of an ingest, with its counters at zero.
+ * 
+ * @param[in] mode What to print.
+ * 
+ * @return progress_t* The progress, NULL if memory ran out.
+ */
+progress_t *progress_create(progress_mode_t mode)
+{
+    progress_t *progress = calloc(1, sizeof(progress_t));
+    if (IS_NULL(progress))
+        return NULL;
+
+    progress->mode = mode;
+    atomic_init(&progress->seen, 0);
+    atomic_init(&progress->written, 0);
+    atomic_init(&progress->ignored, 0);
+    atomic_init(&progress->bytes, 0);
+    pthread_mutex_init(&progress->reporter_lock, NULL);
+    pthread_cond_init(&progress->reporter_cond, NULL);
+    return progress;
+}
+
+/**
+ * @brief Chooses what is printed, before the walk starts.
+ * 
+ * @param[in, out] progress The progress.
+ * @param[in]      mode     What to print.
+ */
+void progress_set_mode(progress_t *progress, progress_mode_t mode)
+{
+    progress->mode = mode;
+}
+
+/**
+ * @brief Reads the counters, as the reporter prints them.
+ * 
+ * @param[in]  progress   The progress.
+ * @param[out] counts_out The counts.
+ */
+void progress_counts(progress_t *progress, progress_counts_t *counts_out)
+{
+    counts_out->seen    = atomic_load_explicit(&progress->seen, memory_order_relaxed);
+    counts_out->written = atomic_load_explicit(&progress->written, memory_order_relaxed);
+    counts_out->ignored = atomic_load_explicit(&progress->ignored, memory_order_relaxed);
+    counts_out->bytes   = atomic_load_explicit(&progress->bytes, memory_order_relaxed);
+}
+
+/**
+ * @brief Prints the counters on one line.
+ */
+static void print_counts(progress_t *progress, const char *end)
+{
+    progress_counts_t counts;
+    progress_counts(progress, &counts);
+    double mib = (double)counts.bytes / (1024.0 * 1024.0);
+    fprintf(stderr, "%s%zu seen, %zu written, %zu ignored, %.1f MiB%s",
+            progress->on_terminal ? "\r" : "", counts.seen, counts.written, counts.ignored, mib, end);
+    fflush(stderr);
+}
+
+/**
+ * @brief Prints the counters until it is told to stop.
+ */
+static void *reporter_main(void *arg)
+{
+    progress_t *progress = arg;
+    long interval_ms = progress->on_terminal ? PROGRESS_INTERVAL_TTY_MS : PROGRESS_INTERVAL_LOG_MS;
+
+    pthread_mutex_lock(&progress->reporter_lock);
+    while (!progress->reporter_stop)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (interval_ms % 1000) * 1000000L;
+        deadline.tv_sec  += interval_ms / 1000 + deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+
+        pthread_cond_timedwait(&progress->reporter_cond, &progress->reporter_lock, &deadline);
+        if (!progress->reporter_stop)
+            print_counts(progress, progress->on_terminal ? "" : "\n");
+    }
+    pthread_mutex_unlock(&progress->reporter_lock);
+    return NULL;
+}
+
+/**
+ * @brief Starts the reporter thread, in PROGRESS_REPORT mode.
+ * 
+ * @param[in, out] progress The progress.
+ * 
+ * @return false if the thread could not be started, the walk goes on without it.
+ */
+bool progress_start(progress_t *progress)
+{
+    if (progress->mode != PROGRESS_REPORT)
+        return true;
+
+    progress->on_terminal = isatty(STDERR_FILENO);
+    progress->reporter_stop = false;
+    progress->reporter_running = (pthread_create(&progress->reporter, NULL, reporter_main, progress) == 0);
+    return progress->reporter_running;
+}
+
+/**
+ * @brief Stops the reporter thread, and prints the final counts.
+ * 
+ * @param[in, out] progress The progress.
+ */
+void progress_stop(progress_t *progress)
+{
+    if (progress->mode != PROGRESS_REPORT)
+        return;
+
+    if (progress->reporter_running)
+    {
+        pthread_mutex_lock(&progress->reporter_lock);
+        progress->reporter_stop = true;
+        pthread_cond_signal(&progress->reporter_cond);
+        pthread_mutex_unlock(&progress->reporter_lock);
+        pthread_join(progress->reporter, NULL);
+        progress->reporter_running = false;
+    }
+    print_counts(progress, "\n");
+}
+
+/**
+ * @brief Counts an entry the walk looked at.
+ * 
+ * @param[in, out] progress The progress.
+ */
+void progress_seen(progress_t *progress)
+{
+    atomic_fetch_add_explicit(&progress->seen, 1, memory_order_relaxed);
+}
+
+/**
+ * @brief Counts an ignored entry.
+ * 
+ * @param[in, out] progress The progress.
+ * @param[in]      path     Path of the entry.
+ */
+void progress_ignored(progress_t *progress, const char *path)
+{
+    atomic_fetch_add_explicit(&progress->ignored, 1, memory_order_relaxed);
+    if (progress->mode == PROGRESS_VERBOSE)
+        fprintf(stdout, "Ignoring: \"%s\"\n", path);
+}
+
+/**
+ * @brief Counts a file that is being written.
+ * 
+ * @param[in, out] progress The progress.
+ * @param[in]      path     Path of the file.
+ */
+void progress_writing(progress_t *progress, const char *path)
+{
+    atomic_fetch_add_explicit(&progress->written, 1, memory_order_relaxed);
+    if (progress->mode == PROGRESS_VERBOSE)
+        fprintf(stdout, "Writing:  \"%s\"\n", path);
+}
+
+/**
+ * @brief Counts bytes of file contents written.
+ * 
+ * @param[in, out] progress The progress.
+ * @param[in]      size     Number of bytes.
+ */
+void progress_bytes(progress_t *progress, size_t size)
+{
+    atomic_fetch_add_explicit(&progress->bytes, size, memory_order_relaxed);
+}
+
+/**
+ * @brief Frees a progress, once its reporter is stopped.
+ * 
+ * @param[in] progress The progress, may be NULL.
+ */
+void progress_free(progress_t *progress)
+{
+    if (IS_NULL(progress))
+        return;
+
+    pthread_mutex_destroy(&progress->reporter_lock);
+    pthread_cond_destroy(&progress->reporter_cond);
+    free(progress);
+}
+
+// end of file progress.c
@@ -0,0 +1,118 @@
+/**
+ * @file      progress.h
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     What the walk tells the user. Either a line per entry, nothing,
+ *            or counters that a reporter thread prints a few times a second.
+ *            Every ingest has its own, so ingests in one process neither
+ *            share counters nor print for each other.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#ifndef PROGRESS_H_
+#define PROGRESS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum
+{
+    PROGRESS_VERBOSE, /**< A line on stdout for every file written or entry ignored */
+    PROGRESS_QUIET,   /**< Only errors */
+    PROGRESS_REPORT,  /**< Counters on stderr, refreshed by a reporter thread */
+} progress_mode_t;
+
+typedef struct progress progress_t;
+
+/**
+ * @brief Counts of the walk so far, across all the outputs of an ingest.
+ */
+typedef struct
+{
+    size_t seen;    /**< Entries looked at */
+    size_t written; /**< Files written */
+    size_t ignored; /**< Entries ignored */
+    size_t bytes;   /**< Bytes of file contents written */
+} progress_counts_t;
+
+/**
+ * @brief Creates the progress of an ingest, with its counters at zero.
+ * 
+ * @param[in] mode What to print.
+ * 
+ * @return progress_t* The progress, NULL if memory ran out.
+ */
+progress_t *progress_create(progress_mode_t mode);
+
+/**
+ * @brief Chooses what is printed, before the walk starts.
+ * 
+ * @param[in, out] progress The progress.
+ * @param[in]      mode     What to print.
+ */
+void progress_set_mode(progress_t *progress, progress_mode_t mode);
+
+/**
+ * @brief Starts the reporter thread, in PROGRESS_REPORT mode.
+ * 
+ * @param[in, out] progress The progress.
+ * 
+ * @return false if the thread could not be started, the walk goes on without it.
+ */
+bool progress_start(progress_t *progress);
+
+/**
+ * @brief Stops the reporter thread, and prints the final counts.
+ * 
+ * @param[in, out] progress The progress.
+ */
+void progress_stop(progress_t *progress);
+
+/**
+ * @brief Reads the counters, as the reporter prints them.
+ * 
+ * @param[in]  progress   The progress.
+ * @param[out] counts_out The counts.
+ */
+void progress_counts(progress_t *progress, progress_counts_t *counts_out);
+
+/**
+ * @brief Counts an entry the walk looked at.
+ * 
+ * @param[in, out] progress The progress.
+ */
+void progress_seen(progress_t *progress);
+
+/**
+ * @brief Counts an ignored entry.
+ * 
+ * @param[in, out] progress The progress.
+ * @param[in]      path     Path of the entry.
+ */
+void progress_ignored(progress_t *progress, const char *path);
+
+/**
+ * @brief Counts a file that is being written.
+ * 
+ * @param[in, out] progress The progress.
+ * @param[in]      path     Path of the file.
+ */
+void progress_writing(progress_t *progress, const char *path);
+
+/**
+ * @brief Counts bytes of file contents written.
+ * 
+ * @param[in, out] progress The progress.
+ * @param[in]      size     Number of bytes.
+ */
+void progress_bytes(progress_t *progress, size_t size);
+
+/**
+ * @brief Frees a progress, once its reporter is stopped.
+ * 
+ * @param[in] progress The progress, may be NULL.
+ */
+void progress_free(progress_t *progress);
+
+#endif // PROGRESS_H_
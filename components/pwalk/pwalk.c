@@ -0,0 +1,595 @@
+/**
+ * @file      pwalk.c
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Multi-threaded directory traversal. Worker threads scan
+ *            directories and read small files ahead, while the calling
+ *            thread writes the output in the same order as a serial walk.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#include "pwalk.h"
+#include "common.h"
+#include "arena.h"
+#include "deque.h"
+#include "ingestify.h"
+#include "progress.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PWALK_PREFETCH_FILE_MAX  (256 * 1024)       /**< Files up to this size are read by the workers */
+#define PWALK_PREFETCH_TOTAL_MAX (64 * 1024 * 1024) /**< Bytes read ahead, but not written yet */
+
+typedef enum
+{
+    PWALK_ENTRY_IGNORED,   /**< Matched the ignore list, or is the output file */
+    PWALK_ENTRY_NO_STATUS, /**< fstatat() failed */
+    PWALK_ENTRY_DIR,
+    PWALK_ENTRY_FILE,
+} pwalk_entry_type_t;
+
+typedef enum
+{
+    PWALK_DIR_PENDING,
+    PWALK_DIR_SCANNED,
+    PWALK_DIR_FAILED,      /**< opendir() failed */
+    PWALK_DIR_LOOP,        /**< Reached again through a symbolic link */
+} pwalk_dir_state_t;
+
+typedef struct pwalk_dir pwalk_dir_t;
+
+typedef struct
+{
+    pwalk_entry_type_t type;
+    char *path;            /**< Full path, as the serial walk prints it */
+    pwalk_dir_t *dir;      /**< DIR: the subdirectory */
+    off_t file_size;       /**< FILE: size when a worker read it ahead */
+    char *data;            /**< FILE: contents read ahead by a worker, NULL if they were not */
+    size_t size;           /**< FILE: size of the contents read ahead */
+    size_t reserved;       /**< FILE: bytes of the read ahead budget held by data */
+    bool open_failed;      /**< FILE: a worker could not open it */
+    bool has_key;          /**< FILE: stat-ed before it was read, in incremental mode */
+    bool unchanged;        /**< FILE: the previous output has it, so it is not read */
+    bool has_digest;       /**< FILE: contents hashed by the worker, for deduplication */
+    manifest_key_t key;
+    dedup_digest_t digest;
+} pwalk_entry_t;
+
+struct pwalk_dir
+{
+    char *path;
+    pwalk_dir_t *parent;    /**< NULL for the root */
+    dir_id_t id;            /**< Set once scanned, to notice symbolic link loops */
+    bool has_id;
+    ignore_set_t *ignore;   /**< Set once scanned, ignore rules of the directory */
+    pwalk_entry_t *entries; /**< In readdir order */
+    size_t count;
+    pwalk_dir_state_t state; /**< Guarded by the lock of the walk */
+};
+
+typedef struct pwalk pwalk_t;
+
+typedef struct
+{
+    pwalk_t *walk;
+    unsigned int index;
+    deque_t deque;          /**< Directories to scan */
+    arena_t arena;          /**< Entries, paths and directories it scanned, freed with the walk */
+    pthread_t thread;
+} pwalk_worker_t;
+
+struct pwalk
+{
+    ingestify_t *ingestify;
+    ignore_set_t *ignore;        /**< Ignore rules of the root */
+    const char *output_file_path;
+    pwalk_worker_t *workers;
+    unsigned int worker_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;    /**< Signalled when work is queued, or there is none left */
+    pthread_cond_t scanned_cond; /**< Signalled when a directory is scanned */
+    size_t queued;               /**< Directories sitting in the deques */
+    size_t pending;              /**< Directories not scanned yet */
+
+    atomic_bool stop;            /**< The writer is done, remaining directories are skipped */
+    atomic_size_t prefetched;    /**< Bytes read ahead, but not written yet */
+};
+
+static void scan_directory(pwalk_worker_t *self, pwalk_dir_t *dir);
+
+/**
+ * @brief Queues a directory on the deque of a worker.
+ */
+static void push_work(pwalk_worker_t *self, pwalk_dir_t *dir)
+{
+    pwalk_t *walk = self->walk;
+
+    pthread_mutex_lock(&walk->lock);
+    walk->pending++;
+    walk->queued++;
+    pthread_mutex_unlock(&walk->lock);
+
+    if (!deque_push(&self->deque, dir))
+    {
+        pthread_mutex_lock(&walk->lock);
+        walk->queued--;
+        pthread_mutex_unlock(&walk->lock);
+        scan_directory(self, dir); // No memory to queue it, so it is scanned right away
+        return;
+    }
+
+    pthread_mutex_lock(&walk->lock);
+    pthread_cond_signal(&walk->work_cond);
+    pthread_mutex_unlock(&walk->lock);
+}
+
+/**
+ * @brief Takes the next directory to scan, from the own deque first, and
+ * from the other workers after that.
+ * 
+ * @return pwalk_dir_t* The directory, NULL if no deque had work.
+ */
+static pwalk_dir_t *take_work(pwalk_worker_t *self)
+{
+    pwalk_t *walk = self->walk;
+
+    pwalk_dir_t *dir = deque_pop(&self->deque);
+    for (unsigned int i = 1; IS_NULL(dir) && (i < walk->worker_count); i++)
+    {
+        pwalk_worker_t *victim = &walk->workers[(self->index + i) % walk->worker_count];
+        dir = deque_steal(&victim->deque);
+    }
+
+    if (EXISTS(dir))
+    {
+        pthread_mutex_lock(&walk->lock);
+        walk->queued--;
+        pthread_mutex_unlock(&walk->lock);
+    }
+    return dir;
+}
+
+/**
+ * @brief Reads a small file into memory, so that the writer does not have to
+ * wait for it. Files that are too large, or that do not fit in the read ahead
+ * budget, are left to the writer. The file is opened relative to its open
+ * directory, and the size comes from the open file, the same size the writer
+ * would have found. In incremental mode, files that the previous output has
+ * unchanged are not opened at all. With deduplication, the contents are
+ * hashed here too, while the writer is busy with files before them.
+ */
+static void prefetch_file(pwalk_t *walk, pwalk_entry_t *entry, DIR *d, const char *name)
+{
+    entry->has_key = ingestify_stat_file(walk->ingestify, d, name, entry->path, &entry->key);
+    if (entry->has_key && ingestify_is_unchanged(walk->ingestify, entry->path, &entry->key))
+    {
+        entry->unchanged = true;
+        return;
+    }
+
+    uint64_t started = stats_begin();
+    int fd = dir_open_file(d, name, entry->path);
+    stats_end(STATS_OPEN, started, 0);
+    if (fd < 0)
+    {
+        entry->open_failed = true;
+        return;
+    }
+
+    struct stat file_stat;
+    started = stats_begin();
+    bool has_status = (fstat(fd, &file_stat) == 0);
+    stats_end(STATS_STAT, started, 0);
+    if (!has_status)
+    {
+        close(fd);
+        return;
+    }
+
+    if (file_stat.st_size > PWALK_PREFETCH_FILE_MAX)
+    {
+        // Too large to hold, but it can still be hashed here instead of in the writer
+        entry->has_digest = ingestify_hash_file(walk->ingestify, fd, file_stat.st_size, &entry->digest);
+        close(fd);
+        return;
+    }
+
+    size_t reserved = (size_t)file_stat.st_size;
+    if (atomic_fetch_add(&walk->prefetched, reserved) + reserved > PWALK_PREFETCH_TOTAL_MAX)
+    {
+        atomic_fetch_sub(&walk->prefetched, reserved);
+        close(fd);
+        return;
+    }
+
+    char *data = malloc((reserved > 0) ? reserved : 1);
+    if (IS_NULL(data))
+    {
+        atomic_fetch_sub(&walk->prefetched, reserved);
+        close(fd);
+        return;
+    }
+
+    entry->data = data;
+    started = stats_begin();
+    entry->size = read_full(fd, data, reserved);
+    stats_end(STATS_READ, started, entry->size);
+    entry->file_size = file_stat.st_size;
+    entry->reserved = reserved;
+    entry->has_digest = ingestify_hash_buffer(walk->ingestify, data, entry->size, &entry->digest);
+    close(fd);
+}
+
+/**
+ * @brief Checks whether an open directory is one of the directories above it.
+ * The ancestors are scanned before their subdirectories are queued, so their
+ * identities are already set.
+ */
+static bool is_loop(pwalk_dir_t *dir, DIR *d)
+{
+    dir->has_id = dir_get_id(d, &dir->id);
+    if (!dir->has_id)
+        return false;
+
+    for (pwalk_dir_t *ancestor = dir->parent; EXISTS(ancestor); ancestor = ancestor->parent)
+    {
+        if (ancestor->has_id && (ancestor->id.dev == dir->id.dev) && (ancestor->id.ino == dir->id.ino))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Reads a directory into entries, in readdir order, makes the same
+ * decisions as the serial walk, and queues the subdirectories.
+ */
+static void scan_directory(pwalk_worker_t *self, pwalk_dir_t *dir)
+{
+    pwalk_t *walk = self->walk;
+    pwalk_dir_state_t state = PWALK_DIR_FAILED;
+    size_t capacity = 0;
+
+    // With --stats, a directory is timed by how long it took to scan, the workers scan its subdirectories later
+    uint64_t started = stats_begin();
+    DIR *d = atomic_load(&walk->stop) ? NULL : dir_open(dir->path);
+    stats_end(STATS_OPEN, started, 0);
+    if (EXISTS(d) && is_loop(dir, d))
+    {
+        state = PWALK_DIR_LOOP;
+        closedir(d);
+    }
+    else if (EXISTS(d))
+    {
+        state = PWALK_DIR_SCANNED;
+        size_t dir_len = strlen(dir->path);
+        ingestify_watch_dir(walk->ingestify, d, dir->path);
+        dir->ignore = ignore_set_enter(EXISTS(dir->parent) ? dir->parent->ignore : walk->ignore, d, dir->path);
+
+        struct dirent *dirent;
+        while (EXISTS((dirent = ingestify_read_dir(d))))
+        {
+            if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0)
+                continue;
+
+            if (dir->count == capacity)
+            {
+                // The old array stays in the arena, at most as large as the new one
+                size_t new_capacity = (capacity == 0) ? 16 : capacity * 2;
+                pwalk_entry_t *entries = arena_alloc(&self->arena, new_capacity * sizeof(pwalk_entry_t));
+                if (IS_NULL(entries))
+                {
+                    perror("Memory allocation failed");
+                    break;
+                }
+                if (dir->count > 0)
+                    memcpy(entries, dir->entries, dir->count * sizeof(pwalk_entry_t));
+                dir->entries = entries;
+                capacity = new_capacity;
+            }
+
+            pwalk_entry_t *entry = &dir->entries[dir->count];
+            memset(entry, 0, sizeof(*entry));
+            size_t name_len = strlen(dirent->d_name);
+            entry->path = arena_alloc(&self->arena, dir_len + 1 + name_len + 1);
+            if (IS_NULL(entry->path))
+            {
+                perror("Memory allocation failed");
+                break;
+            }
+            memcpy(entry->path, dir->path, dir_len);
+            entry->path[dir_len] = '/';
+            memcpy(&entry->path[dir_len + 1], dirent->d_name, name_len + 1);
+
+            const char *relative_path = skip_dot_slash(entry->path);
+            // Typed before it is matched, a pattern like "build/" only ignores a directory
+            entry_type_t type = dir_entry_type(d, dirent, entry->path);
+            if (ingestify_is_output(walk->ingestify, relative_path, walk->output_file_path) || ignore_set_is_entry_match(dir->ignore, relative_path, type))
+            {
+                entry->type = PWALK_ENTRY_IGNORED;
+            }
+            else if (type == ENTRY_TYPE_NO_STATUS)
+            {
+                entry->type = PWALK_ENTRY_NO_STATUS;
+            }
+            else if ((type == ENTRY_TYPE_DIR) && ignore_set_is_dir_match(dir->ignore, relative_path))
+            {
+                entry->type = PWALK_ENTRY_IGNORED;
+            }
+            else if (type == ENTRY_TYPE_DIR)
+            {
+                entry->type = PWALK_ENTRY_DIR;
+                entry->dir = arena_calloc(&self->arena, 1, sizeof(pwalk_dir_t));
+                if (IS_NULL(entry->dir))
+                {
+                    perror("Memory allocation failed");
+                    break;
+                }
+                entry->dir->path = entry->path;
+                entry->dir->parent = dir;
+            }
+            else if (type == ENTRY_TYPE_FILE)
+            {
+                entry->type = PWALK_ENTRY_FILE;
+                prefetch_file(walk, entry, d, dirent->d_name);
+            }
+            else
+            {
+                continue; // Neither a file nor a directory, the serial walk skips these silently
+            }
+            dir->count++;
+        }
+        closedir(d);
+        stats_dir(dir->path, started, 0);
+    }
+
+    // Pushed backwards, so the owner pops them in the order the writer needs them
+    for (size_t i = dir->count; i-- > 0;)
+    {
+        if (dir->entries[i].type == PWALK_ENTRY_DIR)
+            push_work(self, dir->entries[i].dir);
+    }
+
+    pthread_mutex_lock(&walk->lock);
+    dir->state = state;
+    walk->pending--;
+    if (walk->pending == 0)
+        pthread_cond_broadcast(&walk->work_cond);
+    pthread_cond_broadcast(&walk->scanned_cond);
+    pthread_mutex_unlock(&walk->lock);
+}
+
+/**
+ * @brief Scans directories until there are none left.
+ */
+static void *worker_main(void *arg)
+{
+    pwalk_worker_t *self = arg;
+    pwalk_t *walk = self->walk;
+
+    for (;;)
+    {
+        pwalk_dir_t *dir = take_work(self);
+        if (EXISTS(dir))
+        {
+            scan_directory(self, dir);
+            continue;
+        }
+
+        pthread_mutex_lock(&walk->lock);
+        while ((walk->queued == 0) && (walk->pending > 0))
+            pthread_cond_wait(&walk->work_cond, &walk->lock);
+        bool done = (walk->pending == 0);
+        pthread_mutex_unlock(&walk->lock);
+
+        if (done) break;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Writes a scanned directory in order, waiting for the workers to scan
+ * each subdirectory before it is written. Prints and stops exactly where the
+ * serial walk would.
+ */
+static void write_directory(pwalk_t *walk, pwalk_dir_t *dir, writer_t *output, const off_t max_output_size)
+{
+    pthread_mutex_lock(&walk->lock);
+    while (dir->state == PWALK_DIR_PENDING)
+        pthread_cond_wait(&walk->scanned_cond, &walk->lock);
+    pthread_mutex_unlock(&walk->lock);
+
+    if (dir->state == PWALK_DIR_FAILED)
+    {
+        fprintf(stderr, "Could not open directory: %s\n", dir->path);
+        return;
+    }
+
+    if (dir->state == PWALK_DIR_LOOP)
+    {
+        fprintf(stderr, "Skipping symbolic link loop: %s\n", dir->path);
+        return;
+    }
+
+    ingestify_dir_mark_t mark;
+    ingestify_dir_begin(walk->ingestify, &mark, output);
+    for (size_t i = 0; i < dir->count; i++)
+    {
+        pwalk_entry_t *entry = &dir->entries[i];
+        bool within_limit = true;
+
+        progress_seen(ingestify_progress(walk->ingestify));
+        switch (entry->type)
+        {
+            case PWALK_ENTRY_IGNORED:
+                progress_ignored(ingestify_progress(walk->ingestify), entry->path);
+                break;
+
+            case PWALK_ENTRY_NO_STATUS:
+                fprintf(stderr, "Could not retrieve status for: %s\n", entry->path);
+                break;
+
+            case PWALK_ENTRY_DIR:
+                write_directory(walk, entry->dir, output, max_output_size);
+                break;
+
+            case PWALK_ENTRY_FILE:
+                if (entry->unchanged && ingestify_reuse_file(walk->ingestify, entry->path, &entry->key, output, max_output_size))
+                    break; // Taken from the previous output
+
+                if (EXISTS(entry->data))
+                {
+                    progress_writing(ingestify_progress(walk->ingestify), entry->path);
+                    within_limit = ingestify_write_buffer(walk->ingestify, entry->path, entry->file_size, entry->data, entry->size, entry->has_key ? &entry->key : NULL,
+                                                          entry->has_digest ? &entry->digest : NULL, output, max_output_size);
+                    free(entry->data);
+                    entry->data = NULL;
+                    atomic_fetch_sub(&walk->prefetched, entry->reserved);
+                }
+                else if (entry->open_failed)
+                {
+                    fprintf(stderr, "Could not open file: %s\n", entry->path);
+                }
+                else
+                {
+                    within_limit = ingestify_write_file(walk->ingestify, entry->path, entry->has_digest ? &entry->digest : NULL, output, max_output_size);
+                }
+                break;
+        }
+
+        if (!within_limit) return;
+    }
+    ingestify_dir_end(walk->ingestify, dir->path, &mark, output, max_output_size);
+}
+
+/**
+ * @brief Frees what a directory and everything under it holds outside the
+ * arenas of the workers, which are freed whole after the walk.
+ */
+static void free_directory(pwalk_dir_t *dir)
+{
+    for (size_t i = 0; i < dir->count; i++)
+    {
+        pwalk_entry_t *entry = &dir->entries[i];
+        if (entry->type == PWALK_ENTRY_DIR) free_directory(entry->dir);
+        free(entry->data);
+    }
+    ignore_set_release(dir->ignore);
+}
+
+/**
+ * @brief Traverses a directory with a pool of worker threads and writes the
+ * contents to an output file. The output is byte for byte the same as
+ * ingestify_traverse_and_write() on the same tree.
+ * 
+ * @param[in, out] ingestify        The output being written, and its options.
+ * @param[in]      dir_path         Path to the directory.
+ * @param[in]      ignore           Ignore rules of the directory.
+ * @param[in, out] output           Output file.
+ * @param[in]      output_file_path Path to the output file, NULL if the
+ *                                  output only goes to a sink.
+ * @param[in]      max_output_size  Maximum allowed size for the output file,
+ *                                  or INGESTIFY_MAX_SIZE_AUTO.
+ * @param[in]      thread_count     Number of worker threads.
+ * 
+ * @return false if the directory could not be opened.
+ */
+bool pwalk_traverse_and_write(ingestify_t *ingestify, const char *dir_path, ignore_set_t *ignore, writer_t *output, const char *output_file_path, const off_t max_output_size, unsigned int thread_count)
+{
+    pwalk_t walk =
+    {
+        .ingestify        = ingestify,
+        .ignore           = ignore,
+        .output_file_path = output_file_path,
+        .worker_count     = (thread_count > 0) ? thread_count : 1,
+    };
+    atomic_init(&walk.stop, false);
+    atomic_init(&walk.prefetched, 0);
+
+    pwalk_dir_t *root = calloc(1, sizeof(pwalk_dir_t));
+    char *root_path   = strdup(dir_path);
+    walk.workers      = calloc(walk.worker_count, sizeof(pwalk_worker_t));
+    if (IS_NULL(root) || IS_NULL(root_path) || IS_NULL(walk.workers))
+    {
+        perror("Memory allocation failed");
+        free(root);
+        free(root_path);
+        free(walk.workers);
+        return false;
+    }
+    root->path = root_path;
+
+    pthread_mutex_init(&walk.lock, NULL);
+    pthread_cond_init(&walk.work_cond, NULL);
+    pthread_cond_init(&walk.scanned_cond, NULL);
+
+    unsigned int started = 0;
+    for (unsigned int i = 0; i < walk.worker_count; i++)
+    {
+        walk.workers[i].walk  = &walk;
+        walk.workers[i].index = i;
+        if (!deque_init(&walk.workers[i].deque, 64))
+        {
+            perror("Memory allocation failed");
+            walk.worker_count = i;
+            break;
+        }
+    }
+
+    if (walk.worker_count > 0)
+    {
+        push_work(&walk.workers[0], root);
+        for (; started < walk.worker_count; started++)
+        {
+            if (pthread_create(&walk.workers[started].thread, NULL, worker_main, &walk.workers[started]) != 0)
+                break;
+        }
+    }
+
+    bool opened;
+    if (started > 0)
+    {
+        write_directory(&walk, root, output, max_output_size);
+        opened = (root->state == PWALK_DIR_SCANNED);
+    }
+    else
+    {
+        fprintf(stderr, "Could not start worker threads, walking on one thread.\n");
+        opened = ingestify_traverse_and_write(ingestify, dir_path, ignore, output, output_file_path, max_output_size);
+        if (walk.worker_count > 0) deque_pop(&walk.workers[0].deque);
+    }
+
+    // Workers skip what the writer did not need, and leave once everything is scanned
+    atomic_store(&walk.stop, true);
+    for (unsigned int i = 0; i < started; i++)
+    {
+        pthread_join(walk.workers[i].thread, NULL);
+    }
+
+    free_directory(root);
+    for (unsigned int i = 0; i < walk.worker_count; i++)
+    {
+        deque_free(&walk.workers[i].deque);
+        arena_free(&walk.workers[i].arena);
+    }
+    free(walk.workers);
+    free(root);
+    free(root_path);
+
+    pthread_cond_destroy(&walk.scanned_cond);
+    pthread_cond_destroy(&walk.work_cond);
+    pthread_mutex_destroy(&walk.lock);
+
+    return opened;
+}
+
+// end of file pwalk.c
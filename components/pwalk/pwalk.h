@@ -0,0 +1,48 @@
+/**
+ * @file      pwalk.h
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Multi-threaded directory traversal. Worker threads scan
+ *            directories and read small files ahead, while the calling
+ *            thread writes the output in the same order as a serial walk.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#ifndef PWALK_H_
+#define PWALK_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "ignore.h"
+#include "writer.h"
+#include "ingestify.h"
+
+/**
+ * @brief Traverses a directory with a pool of worker threads and writes the
+ * contents to an output file. The output is byte for byte the same as
+ * ingestify_traverse_and_write() on the same tree.
+ * 
+ * Every worker owns a deque of directories to scan. It pops its own newest
+ * directory, and when it runs out, it steals the oldest directory of another
+ * worker. Scanned directories keep their entries in readdir order, and files
+ * up to a small size are read into memory by the workers, so the writer only
+ * has to walk the scanned tree in order.
+ * 
+ * @param[in, out] ingestify        The output being written, and its options.
+ * @param[in]      dir_path         Path to the directory.
+ * @param[in]      ignore           Ignore rules of the directory, from
+ *                                  ignore_set_create().
+ * @param[in, out] output           Output file.
+ * @param[in]      output_file_path Path to the output file, NULL if the
+ *                                  output only goes to a sink.
+ * @param[in]      max_output_size  Maximum allowed size for the output file,
+ *                                  or INGESTIFY_MAX_SIZE_AUTO.
+ * @param[in]      thread_count     Number of worker threads.
+ * 
+ * @return false if the directory could not be opened.
+ */
+bool pwalk_traverse_and_write(ingestify_t *ingestify, const char *dir_path, ignore_set_t *ignore, writer_t *output, const char *output_file_path, const off_t max_output_size, unsigned int thread_count);
+
+#endif // PWALK_H_
@@ -0,0 +1,747 @@
+/**
+ * @file      shard.c
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Splits an output into several smaller ones, cut only between
+ *            files, for readers that cannot take one large file. The files
+ *            are kept in their order, and a cut is moved back to where a
+ *            directory starts when that leaves the shard nearly full, so
+ *            that a directory is not spread over two shards without need.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#include "shard.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <errno.h>
+
+/**
+ * @brief A file of the output.
+ */
+typedef struct
+{
+    uint64_t offset;        /**< Of its header, 0 for the first file so that
+                                 nothing before it is left out */
+    uint64_t tokens_before; /**< Of the files before it */
+    bool new_dir;           /**< Its directory is not the one of the file before */
+} shard_file_t;
+
+struct shard
+{
+    shard_file_t *files;
+    size_t count;
+    size_t capacity;
+    uint64_t tokens;       /**< Of every file added */
+    uint32_t dir_hash;     /**< Of the directory of the last file added */
+    uint64_t total_size;
+    shard_range_t *ranges;
+    size_t range_count;
+    size_t range_capacity;
+
+    // Written while the walk goes on, see shard_open()
+    const char *output_path;
+    shard_limits_t limits;
+    int fd;                /**< Shard being written */
+    uint64_t start;        /**< Where it starts in the output */
+    uint64_t received;     /**< Bytes of the output written to the shards */
+    size_t first;          /**< First file of the shard being written */
+    size_t checked;        /**< Next file to check whether it still fits in it */
+    bool failed;
+};
+
+/**
+ * @brief Creates an empty list of the files in an output.
+ * 
+ * @return shard_t* The list, NULL if memory ran out.
+ */
+shard_t *shard_create(void)
+{
+    return calloc(1, sizeof(shard_t));
+}
+
+/**
+ * @brief Adds a file where its header starts in the output. Files are
+ * added in the order they were written.
+ * 
+ * @param[in, out] shard  The list.
+ * @param[in]      path   Path of the file, only its directory is kept.
+ * @param[in]      offset Size of the output before the header of the file.
+ * @param[in]      tokens Tokens of the contents, 0 if they were not counted.
+ * 
+ * @return false if memory ran out.
+ */
+bool shard_add(shard_t *shard, const char *path, uint64_t offset, uint64_t tokens)
+{
+    if (shard->count == shard->capacity)
+    {
+        size_t capacity = (shard->capacity == 0) ? 256 : shard->capacity * 2;
+        shard_file_t *files = realloc(shard->files, capacity * sizeof(shard_file_t));
+        if (IS_NULL(files))
+            return false;
+        shard->files = files;
+        shard->capacity = capacity;
+    }
+
+    const char *slash = strrchr(path, '/');
+    uint32_t dir_hash = hash_bytes(HASH_SEED, path, EXISTS(slash) ? (size_t)(slash - path) : 0);
+
+    shard_file_t *file = &shard->files[shard->count];
+    file->offset = (shard->count == 0) ? 0 : offset;
+    file->tokens_before = shard->tokens;
+    file->new_dir = (shard->count == 0) || (dir_hash != shard->dir_hash);
+
+    shard->count++;
+    shard->tokens += tokens;
+    shard->dir_hash = dir_hash;
+    return true;
+}
+
+/**
+ * @brief Where a file starts in the output, the end of the output for the
+ * one after the last file.
+ */
+static inline uint64_t start_of(const shard_t *shard, size_t file)
+{
+    return (file < shard->count) ? shard->files[file].offset : shard->total_size;
+}
+
+/**
+ * @brief Tokens of the files before one, all of them for the one after the
+ * last file.
+ */
+static inline uint64_t tokens_before(const shard_t *shard, size_t file)
+{
+    return (file < shard->count) ? shard->files[file].tokens_before : shard->tokens;
+}
+
+/**
+ * @brief Whether the files from first up to before end go over a limit.
+ */
+static bool too_large(const shard_t *shard, size_t first, size_t end, const shard_limits_t *limits)
+{
+    uint64_t bytes = start_of(shard, end) - start_of(shard, first);
+    uint64_t tokens = tokens_before(shard, end) - tokens_before(shard, first);
+    return ((limits->max_bytes > 0) && (bytes > limits->max_bytes)) ||
+           ((limits->max_tokens > 0) && (tokens > limits->max_tokens));
+}
+
+/**
+ * @brief Whether the files from first up to before end fill three quarters
+ * of a limit, enough to end a shard early where a directory starts.
+ */
+static bool nearly_full(const shard_t *shard, size_t first, size_t end, const shard_limits_t *limits)
+{
+    uint64_t bytes = start_of(shard, end) - start_of(shard, first);
+    uint64_t tokens = tokens_before(shard, end) - tokens_before(shard, first);
+    return ((limits->max_bytes > 0) && (bytes >= limits->max_bytes / 4 * 3)) ||
+           ((limits->max_tokens > 0) && (tokens >= limits->max_tokens / 4 * 3));
+}
+
+/**
+ * @brief Finds where the shard that starts with a file ends, filled in
+ * order until the next file would go over a limit.
+ * 
+ * @param[in]      shard  The list.
+ * @param[in]      first  First file of the shard.
+ * @param[in, out] next   File to go on checking from, the ones before it
+ *                        were found to fit.
+ * @param[in]      known  Number of files whose end is known.
+ * @param[in]      limits How large a shard may be.
+ * 
+ * @return size_t File the next shard starts with, 0 if the shard does not
+ * end within the known files.
+ */
+static size_t find_cut(const shard_t *shard, size_t first, size_t *next, size_t known, const shard_limits_t *limits)
+{
+    for (size_t end = (*next > first + 1) ? *next : first + 1; end < known; end++)
+    {
+        *next = end;
+        if (!too_large(shard, first, end + 1, limits))
+            continue;
+
+        // Back to the latest directory that starts while the shard is nearly full
+        for (size_t at = end; (at > first + 1) && nearly_full(shard, first, at, limits); at--)
+        {
+            if (shard->files[at].new_dir)
+                return at;
+        }
+        return end;
+    }
+    return 0;
+}
+
+/**
+ * @brief Keeps a shard that was decided on.
+ * 
+ * @return false if memory ran out.
+ */
+static bool keep_range(shard_t *shard, size_t first, size_t cut, uint64_t start, uint64_t end)
+{
+    if (shard->range_count == shard->range_capacity)
+    {
+        size_t capacity = (shard->range_capacity == 0) ? 16 : shard->range_capacity * 2;
+        shard_range_t *ranges = realloc(shard->ranges, capacity * sizeof(shard_range_t));
+        if (IS_NULL(ranges))
+            return false;
+        shard->ranges = ranges;
+        shard->range_capacity = capacity;
+    }
+
+    shard_range_t *range = &shard->ranges[shard->range_count++];
+    range->start = start;
+    range->end = end;
+    range->tokens = tokens_before(shard, cut) - tokens_before(shard, first);
+    range->first_file = first;
+    range->files = cut - first;
+    return true;
+}
+
+/**
+ * @brief Splits the files into shards, each filled in order until the next
+ * file would go over a limit.
+ * 
+ * @param[in, out] shard  The list.
+ * @param[in]      limits How large a shard may be.
+ * @param[in]      keep   Whether to keep the shards in the list, or only
+ *                        count them.
+ * 
+ * @return size_t Number of shards, 0 if memory ran out.
+ */
+static size_t pack(shard_t *shard, const shard_limits_t *limits, bool keep)
+{
+    size_t count = 0;
+    size_t first = 0;
+    while (first < shard->count)
+    {
+        size_t next = first + 1;
+        size_t cut = find_cut(shard, first, &next, shard->count, limits);
+        if (cut == 0)
+            cut = shard->count;
+
+        if (keep && !keep_range(shard, first, cut, start_of(shard, first), start_of(shard, cut)))
+            return 0;
+        count++;
+        first = cut;
+    }
+    return count;
+}
+
+/**
+ * @brief Decides where the output is cut, see shard_get() for the shards.
+ * 
+ * @param[in, out] shard      The list, with every file added.
+ * @param[in]      total_size Size of the whole output.
+ * @param[in]      limits     How large a shard may be.
+ * 
+ * @return size_t Number of shards, 0 if memory ran out.
+ */
+size_t shard_plan(shard_t *shard, uint64_t total_size, const shard_limits_t *limits)
+{
+    shard->total_size = total_size;
+    shard->range_count = 0;
+
+    // An output without files is still one shard, empty or not
+    if (shard->count == 0)
+        return keep_range(shard, 0, 0, 0, total_size) ? 1 : 0;
+
+    shard_limits_t packed = *limits;
+    if (limits->count > 0)
+    {
+        // The smallest limit that needs no more shards than asked for
+        uint64_t low = 1;
+        uint64_t high = (total_size > 0) ? total_size : 1;
+        while (low < high)
+        {
+            packed.max_bytes = low + (high - low) / 2;
+            if (pack(shard, &packed, false) <= limits->count)
+                high = packed.max_bytes;
+            else
+                low = packed.max_bytes + 1;
+        }
+        packed.max_bytes = low;
+    }
+
+    return pack(shard, &packed, true);
+}
+
+/**
+ * @brief Gets a shard that shard_plan() decided on.
+ * 
+ * @param[in] shard The list.
+ * @param[in] index Of the shard, from 0.
+ * 
+ * @return const shard_range_t* The shard.
+ */
+const shard_range_t *shard_get(const shard_t *shard, size_t index)
+{
+    return &shard->ranges[index];
+}
+
+/**
+ * @brief Number of shards that shard_plan() decided on, or that were
+ * written since shard_open().
+ * 
+ * @param[in] shard The list.
+ * 
+ * @return size_t Number of shards.
+ */
+size_t shard_count(const shard_t *shard)
+{
+    return shard->range_count;
+}
+
+/**
+ * @brief Length of the path of the output without its extension, where the
+ * number of a shard goes.
+ */
+static size_t stem_length(const char *output_path)
+{
+    const char *name = strrchr(output_path, '/');
+    name = EXISTS(name) ? name + 1 : output_path;
+    const char *dot = strrchr(name, '.');
+    return (EXISTS(dot) && (dot != name)) ? (size_t)(dot - output_path) : strlen(output_path);
+}
+
+/**
+ * @brief Makes the path of a shard from the path of the output, with its
+ * number before the extension: "out.txt" becomes "out.1.txt", or "out.01.txt"
+ * when there are ten shards or more.
+ * 
+ * @param[in] output_path Path of the output.
+ * @param[in] index       Of the shard, from 0.
+ * @param[in] count       Number of shards.
+ * 
+ * @return char* The path, to be freed, NULL if memory ran out.
+ */
+char *shard_path(const char *output_path, size_t index, size_t count)
+{
+    size_t stem_len = stem_length(output_path);
+
+    int digits = snprintf(NULL, 0, "%zu", count);
+    size_t size = strlen(output_path) + (size_t)digits + 2;
+    char *path = malloc(size);
+    if (IS_NULL(path))
+        return NULL;
+    snprintf(path, size, "%.*s.%0*zu%s", (int)stem_len, output_path, digits, index + 1, &output_path[stem_len]);
+    return path;
+}
+
+/**
+ * @brief Tells whether a path is named like a shard of the output, of this
+ * or an earlier run.
+ * 
+ * @param[in] path        The path.
+ * @param[in] output_path Path of the output.
+ * 
+ * @return true if it is.
+ */
+bool shard_is_path(const char *path, const char *output_path)
+{
+    size_t stem_len = stem_length(output_path);
+    if ((strncmp(path, output_path, stem_len) != 0) || (path[stem_len] != '.'))
+        return false;
+
+    const char *digits = &path[stem_len + 1];
+    size_t digit_count = strspn(digits, "0123456789");
+    return (digit_count > 0) && (strcmp(&digits[digit_count], &output_path[stem_len]) == 0);
+}
+
+/**
+ * @brief Removes every file named like a shard of the output, so that none
+ * is left over from an earlier run that made more shards, or numbered them
+ * with another width.
+ * 
+ * @param[in] output_path Path of the output.
+ * 
+ * @return false if one could not be removed.
+ */
+bool shard_remove_all(const char *output_path)
+{
+    const char *slash = strrchr(output_path, '/');
+    size_t dir_len = EXISTS(slash) ? (size_t)(slash - output_path) + 1 : 0;
+    char *dir_path = EXISTS(slash) ? strndup(output_path, dir_len) : strdup(".");
+    DIR *dir = EXISTS(dir_path) ? opendir(dir_path) : NULL;
+    free(dir_path);
+    if (IS_NULL(dir))
+        return true; // Nothing to remove, the output cannot be written there either
+
+    bool removed = true;
+    for (struct dirent *entry = readdir(dir); EXISTS(entry); entry = readdir(dir))
+    {
+        size_t size = dir_len + strlen(entry->d_name) + 1;
+        char *path = malloc(size);
+        if (IS_NULL(path))
+        {
+            perror("Memory allocation failed");
+            removed = false;
+            break;
+        }
+        snprintf(path, size, "%.*s%s", (int)dir_len, output_path, entry->d_name);
+        if (shard_is_path(path, output_path) && (unlink(path) != 0))
+        {
+            perror("Error removing shard of an earlier run");
+            removed = false;
+        }
+        free(path);
+    }
+    closedir(dir);
+    return removed;
+}
+
+/**
+ * @brief What the threads copying shards share.
+ */
+typedef struct
+{
+    const shard_t *shard;
+    const char *whole_path;
+    const char *output_path;
+    pthread_mutex_t lock;
+    size_t next;          /**< Next shard to copy */
+    bool failed;
+} shard_job_t;
+
+/**
+ * @brief Copies one shard out of the whole output, with a file of the
+ * whole output of its own so that the offsets of the threads do not mix.
+ * 
+ * @return true on success.
+ */
+static bool write_one(const shard_job_t *job, size_t index)
+{
+    const shard_range_t *range = &job->shard->ranges[index];
+    char *path = shard_path(job->output_path, index, job->shard->range_count);
+    if (IS_NULL(path))
+    {
+        perror("Memory allocation failed");
+        return false;
+    }
+
+    bool ok = false;
+    int in_fd = open(job->whole_path, O_RDONLY | O_CLOEXEC);
+    int out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if ((in_fd < 0) || (out_fd < 0))
+        perror("Error opening shard");
+    else if ((lseek(in_fd, (off_t)range->start, SEEK_SET) != (off_t)range->start) ||
+             !fd_copy(out_fd, in_fd, range->end - range->start))
+        perror("Error writing shard");
+    else
+        ok = true;
+
+    if ((out_fd >= 0) && (close(out_fd) != 0) && ok)
+    {
+        perror("Error writing shard");
+        ok = false;
+    }
+    if (in_fd >= 0)
+        close(in_fd);
+    free(path);
+    return ok;
+}
+
+/**
+ * @brief Thread that copies shards until none are left.
+ */
+static void *write_shards(void *arg)
+{
+    shard_job_t *job = arg;
+    for (;;)
+    {
+        pthread_mutex_lock(&job->lock);
+        size_t index = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (index >= job->shard->range_count)
+            return NULL;
+
+        if (!write_one(job, index))
+        {
+            pthread_mutex_lock(&job->lock);
+            job->failed = true;
+            pthread_mutex_unlock(&job->lock);
+        }
+    }
+}
+
+/**
+ * @brief Copies every shard out of the whole output into its own file,
+ * several at a time, see shard_path() for their names.
+ * 
+ * @param[in] shard       The list, planned with shard_plan().
+ * @param[in] whole_path  The whole output.
+ * @param[in] output_path Path the shards are named after.
+ * 
+ * @return true if every shard was written.
+ */
+bool shard_write(const shard_t *shard, const char *whole_path, const char *output_path)
+{
+    shard_job_t job = {
+        .shard = shard,
+        .whole_path = whole_path,
+        .output_path = output_path,
+    };
+    pthread_mutex_init(&job.lock, NULL);
+
+    pthread_t threads[SHARD_THREADS_MAX];
+    size_t thread_count = (shard->range_count < SHARD_THREADS_MAX) ? shard->range_count : SHARD_THREADS_MAX;
+    size_t started = 0;
+    for (; started < thread_count; started++)
+    {
+        if (pthread_create(&threads[started], NULL, write_shards, &job) != 0)
+            break;
+    }
+
+    // Without any thread, this one copies them all
+    if (started == 0)
+        write_shards(&job);
+    for (size_t i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&job.lock);
+    return !job.failed;
+}
+
+/**
+ * @brief Writes bytes to a file.
+ * 
+ * @return false if not all of them could be written.
+ */
+static bool write_block(int fd, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = write(fd, data, size);
+        if ((n < 0) && (errno == EINTR))
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+/**
+ * @brief Opens the file of the next shard. Shards are numbered without
+ * zeros while they are written, since their count is not known yet.
+ * 
+ * @return int The file, -1 if it could not be made.
+ */
+static int open_next(const shard_t *shard)
+{
+    char *path = shard_path(shard->output_path, shard->range_count, 1);
+    int fd = EXISTS(path) ? open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : -1;
+    if (fd < 0)
+        perror("Error opening shard");
+    free(path);
+    return fd;
+}
+
+/**
+ * @brief Ends the shard being written before a file, and starts the next
+ * with it. Whatever of the next shard was already written to this one is
+ * moved over, at most the files since the cut.
+ * 
+ * @param[in, out] shard The list.
+ * @param[in]      cut   File the next shard starts with.
+ * 
+ * @return false if a shard could not be written.
+ */
+static bool end_shard(shard_t *shard, size_t cut)
+{
+    uint64_t end = start_of(shard, cut);
+    if (!keep_range(shard, shard->first, cut, shard->start, end))
+    {
+        perror("Memory allocation failed");
+        return false;
+    }
+
+    int fd = open_next(shard);
+    if (fd < 0)
+        return false;
+
+    off_t kept = (off_t)(end - shard->start);
+    bool moved = (shard->received == end) ||
+                 ((lseek(shard->fd, kept, SEEK_SET) == kept) && fd_copy(fd, shard->fd, shard->received - end) &&
+                  (ftruncate(shard->fd, kept) == 0));
+    if (!moved)
+        perror("Error writing shard");
+    if ((close(shard->fd) != 0) && moved)
+    {
+        perror("Error writing shard");
+        moved = false;
+    }
+
+    shard->fd = fd;
+    shard->start = end;
+    shard->first = cut;
+    shard->checked = cut + 1;
+    return moved;
+}
+
+/**
+ * @brief Takes bytes of the output, and ends shards where files were added
+ * that no longer fit in them, see writer_sink_t.
+ */
+static bool stream_part(shard_t *shard, const char *data, size_t size)
+{
+    // The end of the file added last is not known until the next one is added
+    size_t known = (shard->count > 0) ? shard->count - 1 : 0;
+    for (;;)
+    {
+        size_t cut = find_cut(shard, shard->first, &shard->checked, known, &shard->limits);
+        if (cut == 0)
+            break;
+
+        uint64_t at = start_of(shard, cut);
+        if (at > shard->received + size)
+            break; // Not reached yet, decided again with the bytes that reach it
+        if (at > shard->received)
+        {
+            size_t before = (size_t)(at - shard->received);
+            if (!write_block(shard->fd, data, before))
+            {
+                perror("Error writing shard");
+                return false;
+            }
+            data += before;
+            size -= before;
+            shard->received = at;
+        }
+        if (!end_shard(shard, cut))
+            return false;
+    }
+
+    if (!write_block(shard->fd, data, size))
+    {
+        perror("Error writing shard");
+        return false;
+    }
+    shard->received += size;
+    return true;
+}
+
+/**
+ * @brief Takes bytes of the output, see writer_sink_t.
+ */
+static bool stream_write(void *context, const void **bases, const size_t *lengths, int count)
+{
+    shard_t *shard = context;
+    for (int i = 0; (i < count) && !shard->failed; i++)
+        shard->failed = !stream_part(shard, bases[i], lengths[i]);
+    return !shard->failed;
+}
+
+/**
+ * @brief Ends the last shards once the whole output was written, and names
+ * them with as many digits as the last one has, see writer_sink_t.
+ */
+static bool stream_close(void *context)
+{
+    shard_t *shard = context;
+    shard->total_size = shard->received;
+    for (size_t cut; !shard->failed && ((cut = find_cut(shard, shard->first, &shard->checked, shard->count, &shard->limits)) != 0);)
+        shard->failed = !end_shard(shard, cut);
+
+    if (!shard->failed && !keep_range(shard, shard->first, shard->count, shard->start, shard->received))
+    {
+        perror("Memory allocation failed");
+        shard->failed = true;
+    }
+    if ((close(shard->fd) != 0) && !shard->failed)
+    {
+        perror("Error writing shard");
+        shard->failed = true;
+    }
+    shard->fd = -1;
+
+    for (size_t i = 0; !shard->failed && (i < shard->range_count); i++)
+    {
+        char *from = shard_path(shard->output_path, i, 1);
+        char *to = shard_path(shard->output_path, i, shard->range_count);
+        if (IS_NULL(from) || IS_NULL(to))
+        {
+            perror("Memory allocation failed");
+            shard->failed = true;
+        }
+        else if ((strcmp(from, to) != 0) && (rename(from, to) != 0))
+        {
+            perror("Error naming shard");
+            shard->failed = true;
+        }
+        free(from);
+        free(to);
+    }
+    return !shard->failed;
+}
+
+/**
+ * @brief Writes the output straight into shards as it is made, for limits
+ * that fill them in order. Shards of an earlier run are removed first. Once
+ * the writer is closed, shard_get() gives the shards that were written.
+ * 
+ * @param[in, out] shard       The list, that the walk adds the files to.
+ * @param[in]      output_path Path the shards are named after, kept.
+ * @param[in]      limits      How large a shard may be, without a count.
+ * @param[out]     sink_out    Sink to open the writer with.
+ * 
+ * @return false if the first shard could not be made.
+ */
+bool shard_open(shard_t *shard, const char *output_path, const shard_limits_t *limits, writer_sink_t *sink_out)
+{
+    if (!shard_remove_all(output_path))
+        return false;
+
+    shard_clear(shard);
+    shard->output_path = output_path;
+    shard->limits = *limits;
+    shard->fd = open_next(shard);
+    if (shard->fd < 0)
+        return false;
+
+    sink_out->write = stream_write;
+    sink_out->close = stream_close;
+    sink_out->context = shard;
+    return true;
+}
+
+/**
+ * @brief Forgets the files added, to start another output.
+ * 
+ * @param[in, out] shard The list.
+ */
+void shard_clear(shard_t *shard)
+{
+    shard->count = 0;
+    shard->tokens = 0;
+    shard->range_count = 0;
+    shard->start = 0;
+    shard->received = 0;
+    shard->first = 0;
+    shard->checked = 1;
+    shard->failed = false;
+}
+
+/**
+ * @brief Frees a list.
+ * 
+ * @param[in] shard The list, may be NULL.
+ */
+void shard_free(shard_t *shard)
+{
+    if (IS_NULL(shard))
+        return;
+
+    free(shard->files);
+    free(shard->ranges);
+    free(shard);
+}
+
+// end of file shard.c
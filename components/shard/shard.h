@@ -0,0 +1,176 @@
+/**
+ * @file      shard.h
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Splits an output into several smaller ones, cut only between
+ *            files, for readers that cannot take one large file. The files
+ *            are kept in their order, and a cut is moved back to where a
+ *            directory starts when that leaves the shard nearly full, so
+ *            that a directory is not spread over two shards without need.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#ifndef SHARD_H_
+#define SHARD_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "writer.h"
+
+#define SHARD_THREADS_MAX 8 /**< Shards copied at the same time */
+
+typedef struct shard shard_t;
+
+/**
+ * @brief How large a shard may be. A file larger than a limit gets a shard
+ * of its own.
+ */
+typedef struct
+{
+    uint64_t max_bytes;  /**< Of the output in a shard, 0 for no limit */
+    uint64_t max_tokens; /**< Of the files in a shard, 0 for no limit */
+    unsigned int count;  /**< Shards to split into, as even as the files
+                              allow, 0 to fill them up to the limits instead */
+} shard_limits_t;
+
+/**
+ * @brief A part of the output that becomes one shard.
+ */
+typedef struct
+{
+    uint64_t start;    /**< Offset in the output */
+    uint64_t end;      /**< Offset in the output, after the last byte */
+    uint64_t tokens;   /**< Of the files in it, if they were counted */
+    size_t first_file; /**< In the order they were added */
+    size_t files;
+} shard_range_t;
+
+/**
+ * @brief Creates an empty list of the files in an output.
+ * 
+ * @return shard_t* The list, NULL if memory ran out.
+ */
+shard_t *shard_create(void);
+
+/**
+ * @brief Adds a file where its header starts in the output. Files are
+ * added in the order they were written.
+ * 
+ * @param[in, out] shard  The list.
+ * @param[in]      path   Path of the file, only its directory is kept.
+ * @param[in]      offset Size of the output before the header of the file.
+ * @param[in]      tokens Tokens of the contents, 0 if they were not counted.
+ * 
+ * @return false if memory ran out.
+ */
+bool shard_add(shard_t *shard, const char *path, uint64_t offset, uint64_t tokens);
+
+/**
+ * @brief Decides where the output is cut, see shard_get() for the shards.
+ * 
+ * @param[in, out] shard      The list, with every file added.
+ * @param[in]      total_size Size of the whole output.
+ * @param[in]      limits     How large a shard may be.
+ * 
+ * @return size_t Number of shards, 0 if memory ran out.
+ */
+size_t shard_plan(shard_t *shard, uint64_t total_size, const shard_limits_t *limits);
+
+/**
+ * @brief Gets a shard that shard_plan() decided on.
+ * 
+ * @param[in] shard The list.
+ * @param[in] index Of the shard, from 0.
+ * 
+ * @return const shard_range_t* The shard.
+ */
+const shard_range_t *shard_get(const shard_t *shard, size_t index);
+
+/**
+ * @brief Number of shards that shard_plan() decided on, or that were
+ * written since shard_open().
+ * 
+ * @param[in] shard The list.
+ * 
+ * @return size_t Number of shards.
+ */
+size_t shard_count(const shard_t *shard);
+
+/**
+ * @brief Makes the path of a shard from the path of the output, with its
+ * number before the extension: "out.txt" becomes "out.1.txt", or "out.01.txt"
+ * when there are ten shards or more.
+ * 
+ * @param[in] output_path Path of the output.
+ * @param[in] index       Of the shard, from 0.
+ * @param[in] count       Number of shards.
+ * 
+ * @return char* The path, to be freed, NULL if memory ran out.
+ */
+char *shard_path(const char *output_path, size_t index, size_t count);
+
+/**
+ * @brief Tells whether a path is named like a shard of the output, of this
+ * or an earlier run.
+ * 
+ * @param[in] path        The path.
+ * @param[in] output_path Path of the output.
+ * 
+ * @return true if it is.
+ */
+bool shard_is_path(const char *path, const char *output_path);
+
+/**
+ * @brief Removes every file named like a shard of the output, so that none
+ * is left over from an earlier run that made more shards, or numbered them
+ * with another width.
+ * 
+ * @param[in] output_path Path of the output.
+ * 
+ * @return false if one could not be removed.
+ */
+bool shard_remove_all(const char *output_path);
+
+/**
+ * @brief Copies every shard out of the whole output into its own file,
+ * several at a time, see shard_path() for their names.
+ * 
+ * @param[in] shard       The list, planned with shard_plan().
+ * @param[in] whole_path  The whole output.
+ * @param[in] output_path Path the shards are named after.
+ * 
+ * @return true if every shard was written.
+ */
+bool shard_write(const shard_t *shard, const char *whole_path, const char *output_path);
+
+/**
+ * @brief Writes the output straight into shards as it is made, for limits
+ * that fill them in order. Shards of an earlier run are removed first. Once
+ * the writer is closed, shard_get() gives the shards that were written.
+ * 
+ * @param[in, out] shard       The list, that the walk adds the files to.
+ * @param[in]      output_path Path the shards are named after, kept.
+ * @param[in]      limits      How large a shard may be, without a count.
+ * @param[out]     sink_out    Sink to open the writer with.
+ * 
+ * @return false if the first shard could not be made.
+ */
+bool shard_open(shard_t *shard, const char *output_path, const shard_limits_t *limits, writer_sink_t *sink_out);
+
+/**
+ * @brief Forgets the files added, to start another output.
+ * 
+ * @param[in, out] shard The list.
+ */
+void shard_clear(shard_t *shard);
+
+/**
+ * @brief Frees a list.
+ * 
+ * @param[in] shard The list, may be NULL.
+ */
+void shard_free(shard_t *shard);
+
+#endif // SHARD_H_
@@ -0,0 +1,616 @@
+/**
+ * @file      stats.c
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Where the time of a walk goes, for --stats. Every thread times
+ *            its own phases into counters of its own, which are only added
+ *            up for the report, so threads never wait on each other for it.
+ *            The same timings are what --trace records, see trace.h.
+ *            Builds without INGESTIFY_STATS, the release builds, have none
+ *            of it, and the calls in the walk compile to nothing.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#include "stats.h"
+
+#if defined(INGESTIFY_STATS)
+
+#include "common.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#define STATS_RULES_MIN 64 /**< Slots of a table of rules, it doubles from there */
+
+/**
+ * @brief A file or folder among the slowest.
+ */
+typedef struct
+{
+    uint64_t ns;
+    char *path;
+} stats_slow_t;
+
+/**
+ * @brief The slowest files or folders a thread has seen, the fastest of
+ * them first, so that it is the one replaced.
+ */
+typedef struct
+{
+    stats_slow_t *heap;
+    size_t count;
+} stats_top_t;
+
+/**
+ * @brief A rule and the paths it decided on.
+ */
+typedef struct
+{
+    char *base;    /**< NULL for a free slot */
+    char *pattern;
+    uint32_t hash;
+    uint64_t hits;
+} stats_rule_t;
+
+/**
+ * @brief Rules by their folder and pattern.
+ */
+typedef struct
+{
+    stats_rule_t *slots;
+    size_t mask;
+    size_t count;
+} stats_rules_t;
+
+/**
+ * @brief What one thread collected. Only that thread writes it, and it is
+ * only read once the walk is over.
+ */
+typedef struct stats_thread
+{
+    struct stats_thread *next;
+    stats_total_t phases[STATS_PHASE_COUNT];
+    stats_top_t files;
+    stats_top_t dirs;
+    stats_rules_t rules;
+} stats_thread_t;
+
+static const char *const phase_names[STATS_PHASE_COUNT] =
+{
+    [STATS_READDIR] = "readdir",
+    [STATS_STAT]    = "stat",
+    [STATS_MATCH]   = "match",
+    [STATS_OPEN]    = "open",
+    [STATS_READ]    = "read",
+    [STATS_WRITE]   = "write",
+};
+
+#define COLLECT_COUNTS 1u /**< For --stats */
+#define COLLECT_TRACE  2u /**< For --trace */
+
+static atomic_uint collecting;
+static size_t top_count = STATS_TOP_DEFAULT;
+
+/**
+ * @brief Every thread that collected anything. A thread adds itself the
+ * first time, later it only touches its own counters.
+ */
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static stats_thread_t *threads = NULL;
+
+/**
+ * @brief Changed whenever the threads are freed, so that a thread that
+ * lives on makes itself new counters instead of using the freed ones.
+ */
+static atomic_uint generation;
+static _Thread_local stats_thread_t *local = NULL;
+static _Thread_local unsigned int local_generation = 0;
+
+/**
+ * @brief Monotonic time in nanoseconds.
+ */
+static inline uint64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000ULL) + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * @brief Finds the counters of the calling thread, and makes them the first
+ * time.
+ * 
+ * @return stats_thread_t* The counters, NULL if memory ran out, nothing of
+ * the thread is collected then.
+ */
+static stats_thread_t *get_local(void)
+{
+    unsigned int current = atomic_load_explicit(&generation, memory_order_acquire);
+    if (EXISTS(local) && (local_generation == current))
+        return local;
+
+    stats_thread_t *thread = calloc(1, sizeof(stats_thread_t));
+    if (IS_NULL(thread))
+        return NULL;
+    thread->files.heap = calloc(top_count, sizeof(stats_slow_t));
+    thread->dirs.heap  = calloc(top_count, sizeof(stats_slow_t));
+    if (IS_NULL(thread->files.heap) || IS_NULL(thread->dirs.heap))
+    {
+        free(thread->files.heap);
+        free(thread->dirs.heap);
+        free(thread);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&threads_lock);
+    thread->next = threads;
+    threads = thread;
+    pthread_mutex_unlock(&threads_lock);
+
+    local = thread;
+    local_generation = current;
+    return thread;
+}
+
+/**
+ * @brief Frees the counters of every thread.
+ */
+static void free_threads(void)
+{
+    pthread_mutex_lock(&threads_lock);
+    while (EXISTS(threads))
+    {
+        stats_thread_t *thread = threads;
+        threads = thread->next;
+        for (size_t i = 0; i < thread->files.count; i++) free(thread->files.heap[i].path);
+        for (size_t i = 0; i < thread->dirs.count; i++)  free(thread->dirs.heap[i].path);
+        for (size_t i = 0; i <= thread->rules.mask && EXISTS(thread->rules.slots); i++)
+        {
+            free(thread->rules.slots[i].base);
+            free(thread->rules.slots[i].pattern);
+        }
+        free(thread->files.heap);
+        free(thread->dirs.heap);
+        free(thread->rules.slots);
+        free(thread);
+    }
+    atomic_fetch_add_explicit(&generation, 1, memory_order_release);
+    pthread_mutex_unlock(&threads_lock);
+}
+
+/**
+ * @brief Starts collecting, from zero, before the walk starts.
+ * 
+ * @param[in] count Slowest files and folders to keep, at most STATS_TOP_MAX.
+ */
+void stats_enable(size_t count)
+{
+    free_threads();
+    top_count = ((count > 0) && (count <= STATS_TOP_MAX)) ? count : STATS_TOP_DEFAULT;
+    atomic_fetch_or(&collecting, COLLECT_COUNTS);
+}
+
+/**
+ * @brief Stops collecting, and frees what was collected.
+ */
+void stats_disable(void)
+{
+    atomic_fetch_and(&collecting, ~COLLECT_COUNTS);
+    free_threads();
+}
+
+/**
+ * @brief Sends what is timed to trace_event() too, or stops sending it.
+ * 
+ * @param[in] on Whether to send it.
+ */
+void stats_trace(bool on)
+{
+    if (on)
+        atomic_fetch_or(&collecting, COLLECT_TRACE);
+    else
+        atomic_fetch_and(&collecting, ~COLLECT_TRACE);
+}
+
+/**
+ * @brief Starts timing something.
+ * 
+ * @return uint64_t The time now, 0 if nothing is collected.
+ */
+uint64_t stats_begin(void)
+{
+    return (atomic_load_explicit(&collecting, memory_order_relaxed) != 0) ? now_ns() : 0;
+}
+
+/**
+ * @brief Finds the counters of the calling thread if they are collected, and
+ * sends an event to the trace if it is recorded.
+ * 
+ * @param[in]  name   Name of the event.
+ * @param[in]  start  From stats_begin(), 0 if nothing was collected then.
+ * @param[in]  detail Path of the event, NULL if none.
+ * @param[out] now    The time now.
+ * 
+ * @return stats_thread_t* The counters, NULL if they are not collected.
+ */
+static stats_thread_t *end_timing(const char *name, uint64_t start, const char *detail, uint64_t *now)
+{
+    if (start == 0)
+        return NULL;
+
+    *now = now_ns();
+    unsigned int what = atomic_load_explicit(&collecting, memory_order_relaxed);
+    if ((what & COLLECT_TRACE) != 0)
+        trace_event(name, start, *now, detail);
+    return ((what & COLLECT_COUNTS) != 0) ? get_local() : NULL;
+}
+
+/**
+ * @brief Ends timing a phase.
+ * 
+ * @param[in] phase What was timed.
+ * @param[in] start From stats_begin().
+ * @param[in] bytes Read or written, 0 for the other phases.
+ */
+void stats_end(stats_phase_t phase, uint64_t start, uint64_t bytes)
+{
+    uint64_t now;
+    stats_thread_t *thread = end_timing(phase_names[phase], start, NULL, &now);
+    if (IS_NULL(thread))
+        return;
+
+    thread->phases[phase].calls++;
+    thread->phases[phase].ns += now - start;
+    thread->phases[phase].bytes += bytes;
+}
+
+/**
+ * @brief Keeps a file or folder if it is slower than the fastest one kept.
+ */
+static void top_add(stats_top_t *top, const char *path, uint64_t ns)
+{
+    if ((top->count == top_count) && (ns <= top->heap[0].ns))
+        return;
+
+    char *copy = strdup(path);
+    if (IS_NULL(copy))
+        return;
+
+    size_t i;
+    if (top->count < top_count)
+    {
+        // Sifted up from the end
+        i = top->count++;
+        while ((i > 0) && (top->heap[(i - 1) / 2].ns > ns))
+        {
+            top->heap[i] = top->heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+    }
+    else
+    {
+        // Takes the place of the fastest, sifted down from the top
+        free(top->heap[0].path);
+        i = 0;
+        for (;;)
+        {
+            size_t child = (2 * i) + 1;
+            if (child >= top->count)
+                break;
+            if (((child + 1) < top->count) && (top->heap[child + 1].ns < top->heap[child].ns))
+                child++;
+            if (top->heap[child].ns >= ns)
+                break;
+            top->heap[i] = top->heap[child];
+            i = child;
+        }
+    }
+    top->heap[i].ns = ns;
+    top->heap[i].path = copy;
+}
+
+/**
+ * @brief Ends timing a file, from before it was opened until it was written.
+ * 
+ * @param[in] path  Path of the file.
+ * @param[in] start From stats_begin().
+ */
+void stats_file(const char *path, uint64_t start)
+{
+    uint64_t now;
+    stats_thread_t *thread = end_timing("file", start, path, &now);
+    if (EXISTS(thread))
+        top_add(&thread->files, path, now - start);
+}
+
+/**
+ * @brief Ends timing a folder.
+ * 
+ * @param[in] path     Path of the folder.
+ * @param[in] start    From stats_begin().
+ * @param[in] excluded Time in the folder that belongs to its subfolders.
+ * 
+ * @return uint64_t Time since start, 0 if nothing is collected.
+ */
+uint64_t stats_dir(const char *path, uint64_t start, uint64_t excluded)
+{
+    uint64_t now;
+    stats_thread_t *thread = end_timing("dir", start, path, &now);
+    if (IS_NULL(thread))
+        return 0;
+
+    uint64_t ns = now - start;
+    top_add(&thread->dirs, path, (ns > excluded) ? (ns - excluded) : 0);
+    return ns;
+}
+
+/**
+ * @brief Hash of a rule by its folder and pattern.
+ */
+static uint32_t rule_hash(const char *base, size_t base_len, const char *pattern)
+{
+    uint32_t hash = hash_bytes(HASH_SEED, base, base_len);
+    hash = hash_bytes(hash, "", 1);
+    return hash_bytes(hash, pattern, strlen(pattern));
+}
+
+/**
+ * @brief Finds the slot of a rule, or the free slot where it goes.
+ */
+static stats_rule_t *rule_slot(const stats_rules_t *rules, uint32_t hash, const char *base, size_t base_len, const char *pattern)
+{
+    for (size_t i = hash & rules->mask;; i = (i + 1) & rules->mask)
+    {
+        stats_rule_t *slot = &rules->slots[i];
+        if (IS_NULL(slot->base))
+            return slot;
+        if ((slot->hash == hash) && (strncmp(slot->base, base, base_len) == 0) && (slot->base[base_len] == '\0') &&
+            (strcmp(slot->pattern, pattern) == 0))
+            return slot;
+    }
+}
+
+/**
+ * @brief Adds paths that a rule decided on to a table, and the rule, the
+ * first time.
+ * 
+ * @return false if memory ran out, they are not counted then.
+ */
+static bool rules_add(stats_rules_t *rules, const char *base, size_t base_len, const char *pattern, uint64_t hits)
+{
+    if ((rules->count + 1) * 2 > rules->mask)
+    {
+        // Grown while at most half full, so probes stay short and always end
+        size_t capacity = EXISTS(rules->slots) ? (2 * (rules->mask + 1)) : STATS_RULES_MIN;
+        stats_rule_t *slots = calloc(capacity, sizeof(stats_rule_t));
+        if (IS_NULL(slots))
+            return false;
+
+        stats_rules_t grown = { .slots = slots, .mask = capacity - 1, .count = rules->count };
+        for (size_t i = 0; EXISTS(rules->slots) && (i <= rules->mask); i++)
+        {
+            stats_rule_t *old = &rules->slots[i];
+            if (EXISTS(old->base))
+                *rule_slot(&grown, old->hash, old->base, strlen(old->base), old->pattern) = *old;
+        }
+        free(rules->slots);
+        *rules = grown;
+    }
+
+    uint32_t hash = rule_hash(base, base_len, pattern);
+    stats_rule_t *slot = rule_slot(rules, hash, base, base_len, pattern);
+    if (IS_NULL(slot->base))
+    {
+        slot->base = strndup(base, base_len);
+        slot->pattern = strdup(pattern);
+        if (IS_NULL(slot->base) || IS_NULL(slot->pattern))
+        {
+            free(slot->base);
+            free(slot->pattern);
+            slot->base = NULL;
+            return false;
+        }
+        slot->hash = hash;
+        rules->count++;
+    }
+    slot->hits += hits;
+    return true;
+}
+
+/**
+ * @brief Counts a path that an ignore rule decided on.
+ * 
+ * @param[in] base     Folder of the ignore file of the rule, relative to the
+ *                     walk, not NULL terminated.
+ * @param[in] base_len Length of the folder, 0 for the ignore file of the walk.
+ * @param[in] pattern  The rule, as written in the ignore file.
+ */
+void stats_rule_hit(const char *base, size_t base_len, const char *pattern)
+{
+    bool counted = (atomic_load_explicit(&collecting, memory_order_relaxed) & COLLECT_COUNTS) != 0;
+    stats_thread_t *thread = counted ? get_local() : NULL;
+    if (EXISTS(thread))
+        rules_add(&thread->rules, EXISTS(base) ? base : "", base_len, pattern, 1);
+}
+
+/**
+ * @brief Adds up the phases of every thread.
+ * 
+ * @param[out] totals_out One total per phase.
+ */
+void stats_totals(stats_total_t totals_out[STATS_PHASE_COUNT])
+{
+    memset(totals_out, 0, STATS_PHASE_COUNT * sizeof(stats_total_t));
+    pthread_mutex_lock(&threads_lock);
+    for (const stats_thread_t *thread = threads; EXISTS(thread); thread = thread->next)
+    {
+        for (int phase = 0; phase < STATS_PHASE_COUNT; phase++)
+        {
+            totals_out[phase].calls += thread->phases[phase].calls;
+            totals_out[phase].ns    += thread->phases[phase].ns;
+            totals_out[phase].bytes += thread->phases[phase].bytes;
+        }
+    }
+    pthread_mutex_unlock(&threads_lock);
+}
+
+/**
+ * @brief Adds up the paths a rule decided on, over every thread.
+ * 
+ * @param[in] base    Folder of the ignore file of the rule, "" for the
+ *                    ignore file of the walk.
+ * @param[in] pattern The rule.
+ * 
+ * @return uint64_t Number of paths.
+ */
+uint64_t stats_rule_hits(const char *base, const char *pattern)
+{
+    uint64_t hits = 0;
+    size_t base_len = strlen(base);
+    uint32_t hash = rule_hash(base, base_len, pattern);
+    pthread_mutex_lock(&threads_lock);
+    for (const stats_thread_t *thread = threads; EXISTS(thread); thread = thread->next)
+    {
+        if (EXISTS(thread->rules.slots))
+            hits += rule_slot(&thread->rules, hash, base, base_len, pattern)->hits;
+    }
+    pthread_mutex_unlock(&threads_lock);
+    return hits;
+}
+
+static int compare_slow(const void *a, const void *b)
+{
+    uint64_t ns_a = ((const stats_slow_t *)a)->ns;
+    uint64_t ns_b = ((const stats_slow_t *)b)->ns;
+    return (ns_a < ns_b) - (ns_a > ns_b);
+}
+
+static int compare_rules(const void *a, const void *b)
+{
+    const stats_rule_t *rule_a = a;
+    const stats_rule_t *rule_b = b;
+    if (rule_a->hits != rule_b->hits)
+        return (rule_a->hits < rule_b->hits) - (rule_a->hits > rule_b->hits);
+    int order = strcmp(rule_a->base, rule_b->base);
+    return (order != 0) ? order : strcmp(rule_a->pattern, rule_b->pattern);
+}
+
+/**
+ * @brief Prints the slowest files or folders of every thread.
+ */
+static void print_top(FILE *out, const char *title, bool dirs)
+{
+    size_t count = 0;
+    for (const stats_thread_t *thread = threads; EXISTS(thread); thread = thread->next)
+        count += dirs ? thread->dirs.count : thread->files.count;
+    if (count == 0)
+        return;
+
+    stats_slow_t *all = malloc(count * sizeof(stats_slow_t));
+    if (IS_NULL(all))
+    {
+        perror("Memory allocation failed");
+        return;
+    }
+    count = 0;
+    for (const stats_thread_t *thread = threads; EXISTS(thread); thread = thread->next)
+    {
+        const stats_top_t *top = dirs ? &thread->dirs : &thread->files;
+        memcpy(&all[count], top->heap, top->count * sizeof(stats_slow_t));
+        count += top->count;
+    }
+    qsort(all, count, sizeof(stats_slow_t), compare_slow);
+
+    fprintf(out, "\n%s:\n", title);
+    for (size_t i = 0; (i < count) && (i < top_count); i++)
+        fprintf(out, "  %10.3f ms  %s\n", (double)all[i].ns / 1e6, all[i].path);
+    free(all);
+}
+
+/**
+ * @brief Prints the rules of every thread by the paths they decided on.
+ */
+static void print_rules(FILE *out)
+{
+    stats_rules_t merged = { 0 };
+    for (const stats_thread_t *thread = threads; EXISTS(thread); thread = thread->next)
+    {
+        for (size_t i = 0; EXISTS(thread->rules.slots) && (i <= thread->rules.mask); i++)
+        {
+            const stats_rule_t *rule = &thread->rules.slots[i];
+            if (EXISTS(rule->base) && !rules_add(&merged, rule->base, strlen(rule->base), rule->pattern, rule->hits))
+                perror("Memory allocation failed");
+        }
+    }
+    if (merged.count == 0)
+        return;
+
+    // Packed to the front, past the free slots, to be sorted
+    size_t count = 0;
+    for (size_t i = 0; i <= merged.mask; i++)
+    {
+        if (EXISTS(merged.slots[i].base))
+            merged.slots[count++] = merged.slots[i];
+    }
+    qsort(merged.slots, count, sizeof(stats_rule_t), compare_rules);
+
+    fprintf(out, "\nIgnore rules, by the paths they decided on:\n");
+    for (size_t i = 0; i < count; i++)
+    {
+        stats_rule_t *rule = &merged.slots[i];
+        if (rule->base[0] == '\0')
+            fprintf(out, "  %10llu  %s\n", (unsigned long long)rule->hits, rule->pattern);
+        else
+            fprintf(out, "  %10llu  %s  (in %s/)\n", (unsigned long long)rule->hits, rule->pattern, rule->base);
+        free(rule->base);
+        free(rule->pattern);
+    }
+    free(merged.slots);
+}
+
+/**
+ * @brief Prints the phases, the rules by the paths they decided on, and the
+ * slowest files and folders.
+ * 
+ * @param[in] out     Where to print.
+ * @param[in] wall_ns Time the whole walk took.
+ */
+void stats_print(FILE *out, uint64_t wall_ns)
+{
+    stats_total_t totals[STATS_PHASE_COUNT];
+    stats_totals(totals);
+
+    size_t thread_count = 0;
+    pthread_mutex_lock(&threads_lock);
+    for (const stats_thread_t *thread = threads; EXISTS(thread); thread = thread->next)
+        thread_count++;
+
+    // Threads work at the same time, so their phases can add up to more than the walk
+    fprintf(out, "\nWalk took %.3f ms, %zu thread%s timed:\n", (double)wall_ns / 1e6, thread_count, (thread_count == 1) ? "" : "s");
+    fprintf(out, "  %-8s %12s %12s %8s %12s %14s\n", "phase", "calls", "ms", "% walk", "us per call", "bytes");
+    for (int phase = 0; phase < STATS_PHASE_COUNT; phase++)
+    {
+        const stats_total_t *total = &totals[phase];
+        double ms = (double)total->ns / 1e6;
+        double share = (wall_ns > 0) ? (100.0 * (double)total->ns / (double)wall_ns) : 0.0;
+        double per_call = (total->calls > 0) ? ((double)total->ns / 1e3 / (double)total->calls) : 0.0;
+        fprintf(out, "  %-8s %12llu %12.3f %8.1f %12.3f", phase_names[phase], (unsigned long long)total->calls, ms, share, per_call);
+        if ((phase == STATS_READ) || (phase == STATS_WRITE))
+            fprintf(out, " %14llu", (unsigned long long)total->bytes);
+        fprintf(out, "\n");
+    }
+
+    print_rules(out);
+    print_top(out, "Slowest files", false);
+    print_top(out, "Slowest folders, without their subfolders", true);
+    pthread_mutex_unlock(&threads_lock);
+}
+
+#endif // INGESTIFY_STATS
+
+// end of file stats.c
@@ -0,0 +1,153 @@
+/**
+ * @file      stats.h
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Where the time of a walk goes, for --stats. Every thread times
+ *            its own phases into counters of its own, which are only added
+ *            up for the report, so threads never wait on each other for it.
+ *            The same timings are what --trace records, see trace.h.
+ *            Builds without INGESTIFY_STATS, the release builds, have none
+ *            of it, and the calls in the walk compile to nothing.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define STATS_TOP_DEFAULT 10  /**< Slowest files and folders reported */
+#define STATS_TOP_MAX     1000
+
+/**
+ * @brief What a thread is doing while it is timed.
+ */
+typedef enum
+{
+    STATS_READDIR, /**< Reading the entries of a folder */
+    STATS_STAT,    /**< Getting the status of an entry the folder did not type */
+    STATS_MATCH,   /**< Matching a path against the ignore rules */
+    STATS_OPEN,    /**< Opening a file or folder */
+    STATS_READ,    /**< Reading the contents of files */
+    STATS_WRITE,   /**< Writing the output, or moving files into it */
+    STATS_PHASE_COUNT,
+} stats_phase_t;
+
+/**
+ * @brief Totals of a phase, over every thread.
+ */
+typedef struct
+{
+    uint64_t calls;
+    uint64_t ns;
+    uint64_t bytes; /**< READ and WRITE only */
+} stats_total_t;
+
+#if defined(INGESTIFY_STATS)
+
+/**
+ * @brief Starts collecting, from zero, before the walk starts.
+ * 
+ * @param[in] top_count Slowest files and folders to keep, at most STATS_TOP_MAX.
+ */
+void stats_enable(size_t top_count);
+
+/**
+ * @brief Stops collecting, and frees what was collected.
+ */
+void stats_disable(void);
+
+/**
+ * @brief Sends what is timed to trace_event() too, or stops sending it.
+ * 
+ * @param[in] on Whether to send it.
+ */
+void stats_trace(bool on);
+
+/**
+ * @brief Starts timing something.
+ * 
+ * @return uint64_t The time now, 0 if nothing is collected.
+ */
+uint64_t stats_begin(void);
+
+/**
+ * @brief Ends timing a phase.
+ * 
+ * @param[in] phase What was timed.
+ * @param[in] start From stats_begin().
+ * @param[in] bytes Read or written, 0 for the other phases.
+ */
+void stats_end(stats_phase_t phase, uint64_t start, uint64_t bytes);
+
+/**
+ * @brief Ends timing a file, from before it was opened until it was written.
+ * 
+ * @param[in] path  Path of the file.
+ * @param[in] start From stats_begin().
+ */
+void stats_file(const char *path, uint64_t start);
+
+/**
+ * @brief Ends timing a folder.
+ * 
+ * @param[in] path     Path of the folder.
+ * @param[in] start    From stats_begin().
+ * @param[in] excluded Time in the folder that belongs to its subfolders.
+ * 
+ * @return uint64_t Time since start, 0 if nothing is collected.
+ */
+uint64_t stats_dir(const char *path, uint64_t start, uint64_t excluded);
+
+/**
+ * @brief Counts a path that an ignore rule decided on.
+ * 
+ * @param[in] base     Folder of the ignore file of the rule, relative to the
+ *                     walk, not NULL terminated.
+ * @param[in] base_len Length of the folder, 0 for the ignore file of the walk.
+ * @param[in] pattern  The rule, as written in the ignore file.
+ */
+void stats_rule_hit(const char *base, size_t base_len, const char *pattern);
+
+/**
+ * @brief Adds up the phases of every thread.
+ * 
+ * @param[out] totals_out One total per phase.
+ */
+void stats_totals(stats_total_t totals_out[STATS_PHASE_COUNT]);
+
+/**
+ * @brief Adds up the paths a rule decided on, over every thread.
+ * 
+ * @param[in] base     Folder of the ignore file of the rule, "" for the
+ *                     ignore file of the walk.
+ * @param[in] pattern  The rule.
+ * 
+ * @return uint64_t Number of paths.
+ */
+uint64_t stats_rule_hits(const char *base, const char *pattern);
+
+/**
+ * @brief Prints the phases, the rules by the paths they decided on, and the
+ * slowest files and folders.
+ * 
+ * @param[in] out     Where to print.
+ * @param[in] wall_ns Time the whole walk took.
+ */
+void stats_print(FILE *out, uint64_t wall_ns);
+
+#else
+
+static inline uint64_t stats_begin(void) { return 0; }
+static inline void stats_end(stats_phase_t phase, uint64_t start, uint64_t bytes) { (void)phase, (void)start, (void)bytes; }
+static inline void stats_file(const char *path, uint64_t start) { (void)path, (void)start; }
+static inline uint64_t stats_dir(const char *path, uint64_t start, uint64_t excluded) { (void)path, (void)start, (void)excluded; return 0; }
+static inline void stats_rule_hit(const char *base, size_t base_len, const char *pattern) { (void)base, (void)base_len, (void)pattern; }
+
+#endif // INGESTIFY_STATS
+
+#endif // STATS_H_
@@ -0,0 +1,345 @@
+/**
+ * @file      toc.c
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Table of contents at the end of an output, with where the
+ *            contents of every file are in it, so that a reader can go
+ *            straight to one file instead of scanning the whole output.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#include "toc.h"
+#include "common.h"
+#include "arena.h"
+#include "dedup.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(_WIN32)
+#define INPUT_FLAGS (O_RDONLY | O_BINARY)
+#else
+#define INPUT_FLAGS (O_RDONLY | O_CLOEXEC)
+#endif
+
+struct toc
+{
+    toc_entry_t *entries;
+    size_t count;
+    size_t capacity;
+    size_t *slots;    /**< Index of an entry plus one, by the hash of its path, 0 for a free slot */
+    size_t mask;
+    arena_t arena;    /**< The paths */
+    int fd;           /**< Output the table was read from, -1 for one being written */
+};
+
+/**
+ * @brief Creates an empty table, to be filled while an output is written.
+ * 
+ * @return toc_t* The table, NULL if memory ran out.
+ */
+toc_t *toc_create(void)
+{
+    toc_t *toc = calloc(1, sizeof(toc_t));
+    if (EXISTS(toc))
+    {
+        toc->fd = -1;
+        toc->mask = 1023;
+        toc->slots = calloc(toc->mask + 1, sizeof(size_t));
+    }
+    if (IS_NULL(toc) || IS_NULL(toc->slots))
+    {
+        free(toc);
+        return NULL;
+    }
+    return toc;
+}
+
+/**
+ * @brief Finds the slot of a path, the free slot it would go in if it is not there.
+ */
+static size_t *find_slot(const toc_t *toc, size_t *slots, size_t mask, const char *path)
+{
+    size_t index = hash_bytes(HASH_SEED, path, strlen(path)) & mask;
+    while ((slots[index] != 0) && (strcmp(toc->entries[slots[index] - 1].path, path) != 0))
+        index = (index + 1) & mask;
+    return &slots[index];
+}
+
+/**
+ * @brief Adds a file whose contents were written.
+ * 
+ * @param[in, out] toc    The table.
+ * @param[in]      path   Path of the file, as in its header.
+ * @param[in]      offset Where the contents start in the output.
+ * @param[in]      length Size of the contents.
+ * @param[in]      hash   dedup_hash() of the contents, NULL if they were not
+ *                        written whole.
+ * 
+ * @return false if memory ran out.
+ */
+bool toc_add(toc_t *toc, const char *path, uint64_t offset, uint64_t length, const uint64_t *hash)
+{
+    // Taken before the entries grow, the hash may be that of another entry
+    bool hashed = EXISTS(hash);
+    uint64_t hash_value = hashed ? *hash : 0;
+
+    if (toc->count == toc->capacity)
+    {
+        size_t capacity = (toc->capacity > 0) ? (2 * toc->capacity) : 256;
+        toc_entry_t *entries = realloc(toc->entries, capacity * sizeof(toc_entry_t));
+        if (IS_NULL(entries))
+            return false;
+        toc->entries = entries;
+        toc->capacity = capacity;
+    }
+
+    if (((toc->count + 1) * 2) > (toc->mask + 1))
+    {
+        size_t mask = (toc->mask * 2) + 1;
+        size_t *slots = calloc(mask + 1, sizeof(size_t));
+        if (IS_NULL(slots))
+            return false;
+        for (size_t i = 0; i < toc->count; i++)
+            *find_slot(toc, slots, mask, toc->entries[i].path) = i + 1;
+        free(toc->slots);
+        toc->slots = slots;
+        toc->mask = mask;
+    }
+
+    toc_entry_t *entry = &toc->entries[toc->count];
+    entry->path = arena_strndup(&toc->arena, path, strlen(path));
+    if (IS_NULL(entry->path))
+        return false;
+    entry->offset = offset;
+    entry->length = length;
+    entry->hashed = hashed;
+    entry->hash = hash_value;
+
+    size_t *slot = find_slot(toc, toc->slots, toc->mask, path);
+    if (*slot == 0)
+        *slot = toc->count + 1; // A path written twice is found at its first entry
+    toc->count++;
+    return true;
+}
+
+/**
+ * @brief Finds a file by its path.
+ * 
+ * @param[in] toc  The table.
+ * @param[in] path Path of the file, as in its header.
+ * 
+ * @return const toc_entry_t* The file, NULL if it is not in the table.
+ */
+const toc_entry_t *toc_find(const toc_t *toc, const char *path)
+{
+    size_t slot = *find_slot(toc, toc->slots, toc->mask, path);
+    return (slot == 0) ? NULL : &toc->entries[slot - 1];
+}
+
+/**
+ * @brief Number of files in the table.
+ * 
+ * @param[in] toc The table.
+ * 
+ * @return size_t The number of files.
+ */
+size_t toc_count(const toc_t *toc)
+{
+    return toc->count;
+}
+
+/**
+ * @brief A file of the table, in the order they were added.
+ * 
+ * @param[in] toc   The table.
+ * @param[in] index Index of the file, less than toc_count().
+ * 
+ * @return const toc_entry_t* The file.
+ */
+const toc_entry_t *toc_entry(const toc_t *toc, size_t index)
+{
+    return &toc->entries[index];
+}
+
+/**
+ * @brief Writes the table to the end of the output.
+ * 
+ * @param[in]      toc    The table.
+ * @param[in, out] output Output file, after the last file.
+ */
+void toc_write(const toc_t *toc, writer_t *output)
+{
+    size_t start = writer_size(output);
+    writer_printf(output, "\nINDEX, %zu files ==========================================================:\n", toc->count);
+    for (size_t i = 0; i < toc->count; i++)
+    {
+        const toc_entry_t *entry = &toc->entries[i];
+        if (entry->hashed)
+            writer_printf(output, "%llu %llu %016llx %s\n", (unsigned long long)entry->offset, (unsigned long long)entry->length,
+                          (unsigned long long)entry->hash, entry->path);
+        else
+            writer_printf(output, "%llu %llu - %s\n", (unsigned long long)entry->offset, (unsigned long long)entry->length, entry->path);
+    }
+    writer_printf(output, "INDEX AT %020llu\n", (unsigned long long)start);
+}
+
+/**
+ * @brief Forgets every file, for a new output.
+ * 
+ * @param[in, out] toc The table.
+ */
+void toc_clear(toc_t *toc)
+{
+    memset(toc->slots, 0, (toc->mask + 1) * sizeof(size_t));
+    toc->count = 0;
+    arena_free(&toc->arena);
+}
+
+/**
+ * @brief Parses the lines of the table, between its header and its last line.
+ * 
+ * @return false if a line is not an entry, or points past the table.
+ */
+static bool parse_entries(toc_t *toc, char *text, uint64_t index_offset)
+{
+    char *line = strchr(&text[1], '\n'); // Past the header
+    while (EXISTS(line) && (*++line != '\0'))
+    {
+        char *end = strchr(line, '\n');
+        if (IS_NULL(end))
+            return false;
+        *end = '\0';
+
+        char *p = line;
+        uint64_t offset = strtoull(p, &p, 10);
+        uint64_t length = strtoull(p, &p, 10);
+        if ((*p++ != ' ') || (offset > index_offset) || (length > (index_offset - offset)))
+            return false;
+
+        uint64_t hash = 0;
+        bool hashed = (*p != '-');
+        if (hashed)
+            hash = strtoull(p, &p, 16);
+        else
+            p++;
+        if ((*p++ != ' ') || !toc_add(toc, p, offset, length, hashed ? &hash : NULL))
+            return false;
+        line = end;
+    }
+    return true;
+}
+
+/**
+ * @brief Reads the table at the end of an output, found from its last line.
+ * 
+ * @param[in] path Path to the output.
+ * 
+ * @return toc_t* The table, kept with the output open for toc_extract(),
+ * NULL if the output has no index or could not be read.
+ */
+toc_t *toc_open(const char *path)
+{
+    int fd = open(path, INPUT_FLAGS);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Could not open file: %s\n", path);
+        return NULL;
+    }
+
+    char trailer[TOC_TRAILER_SIZE + 1] = { 0 };
+    off_t size = lseek(fd, 0, SEEK_END);
+    bool found = (size >= TOC_TRAILER_SIZE) && (lseek(fd, size - TOC_TRAILER_SIZE, SEEK_SET) >= 0) &&
+                 (read_full(fd, trailer, TOC_TRAILER_SIZE) == TOC_TRAILER_SIZE) &&
+                 (strncmp(trailer, "INDEX AT ", 9) == 0) && (trailer[TOC_TRAILER_SIZE - 1] == '\n');
+    uint64_t index_offset = found ? strtoull(&trailer[9], NULL, 10) : 0;
+    size_t index_size = found ? (size_t)(size - TOC_TRAILER_SIZE - (off_t)index_offset) : 0;
+    if (!found || (index_offset > (uint64_t)(size - TOC_TRAILER_SIZE)))
+    {
+        fprintf(stderr, "No index at the end of %s, it was not written with --index\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    // The whole table is read at once, from where the last line says it starts
+    toc_t *toc = toc_create();
+    char *text = malloc(index_size + 1);
+    bool ok = EXISTS(toc) && EXISTS(text) && (lseek(fd, (off_t)index_offset, SEEK_SET) >= 0) &&
+              (read_full(fd, text, index_size) == index_size);
+    if (ok)
+    {
+        text[index_size] = '\0';
+        ok = (strncmp(text, "\nINDEX, ", 8) == 0) && parse_entries(toc, text, index_offset);
+        if (!ok)
+            fprintf(stderr, "The index at the end of %s is damaged\n", path);
+    }
+    else
+    {
+        perror("Error reading index");
+    }
+    free(text);
+
+    if (!ok)
+    {
+        toc_free(toc);
+        close(fd);
+        return NULL;
+    }
+    toc->fd = fd;
+    return toc;
+}
+
+/**
+ * @brief Copies the contents of a file out of the output the table was
+ * read from, once they are checked against their hash.
+ * 
+ * @param[in] toc    The table, from toc_open().
+ * @param[in] entry  The file.
+ * @param[in] out_fd Where the contents go, a file or a pipe.
+ * 
+ * @return false if the contents do not match, or could not be copied.
+ */
+bool toc_extract(const toc_t *toc, const toc_entry_t *entry, int out_fd)
+{
+    if (lseek(toc->fd, (off_t)entry->offset, SEEK_SET) != (off_t)entry->offset)
+        return false;
+
+    uint64_t hash;
+    if (entry->hashed && (!dedup_hash_fd(toc->fd, (off_t)entry->length, &hash) || (hash != entry->hash)))
+    {
+        fprintf(stderr, "Contents of \"%s\" do not match the index\n", entry->path);
+        return false;
+    }
+
+    if (!fd_copy(out_fd, toc->fd, entry->length))
+    {
+        perror("Error writing contents");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Frees a table, and closes the output it was read from.
+ * 
+ * @param[in] toc The table, may be NULL.
+ */
+void toc_free(toc_t *toc)
+{
+    if (IS_NULL(toc))
+        return;
+
+    if (toc->fd >= 0)
+        close(toc->fd);
+    free(toc->entries);
+    free(toc->slots);
+    arena_free(&toc->arena);
+    free(toc);
+}
+
+// end of file toc.c
@@ -0,0 +1,139 @@
+/**
+ * @file      toc.h
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Table of contents at the end of an output, with where the
+ *            contents of every file are in it, so that a reader can go
+ *            straight to one file instead of scanning the whole output.
+ *            It is text like the rest of the output:
+ * 
+ *                INDEX, 2 files ========...:
+ *                <offset> <length> <hash> <path>
+ *                ...
+ *                INDEX AT <offset of the index, 20 digits>
+ * 
+ *            The hash is dedup_hash() of the contents, 16 hex digits, or
+ *            "-" for a file that was not written whole.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#ifndef TOC_H_
+#define TOC_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "writer.h"
+
+#define TOC_TRAILER_SIZE 30 /**< The "INDEX AT" line, the last bytes of an output with an index */
+
+/**
+ * @brief Where the contents of a file are in the output.
+ */
+typedef struct
+{
+    const char *path;  /**< As in the header of the file */
+    uint64_t offset;   /**< Of the contents, after the header */
+    uint64_t length;
+    uint64_t hash;
+    bool hashed;
+} toc_entry_t;
+
+typedef struct toc toc_t;
+
+/**
+ * @brief Creates an empty table, to be filled while an output is written.
+ * 
+ * @return toc_t* The table, NULL if memory ran out.
+ */
+toc_t *toc_create(void);
+
+/**
+ * @brief Adds a file whose contents were written.
+ * 
+ * @param[in, out] toc    The table.
+ * @param[in]      path   Path of the file, as in its header.
+ * @param[in]      offset Where the contents start in the output.
+ * @param[in]      length Size of the contents.
+ * @param[in]      hash   dedup_hash() of the contents, NULL if they were not
+ *                        written whole.
+ * 
+ * @return false if memory ran out.
+ */
+bool toc_add(toc_t *toc, const char *path, uint64_t offset, uint64_t length, const uint64_t *hash);
+
+/**
+ * @brief Finds a file by its path.
+ * 
+ * @param[in] toc  The table.
+ * @param[in] path Path of the file, as in its header.
+ * 
+ * @return const toc_entry_t* The file, NULL if it is not in the table.
+ */
+const toc_entry_t *toc_find(const toc_t *toc, const char *path);
+
+/**
+ * @brief Number of files in the table.
+ * 
+ * @param[in] toc The table.
+ * 
+ * @return size_t The number of files.
+ */
+size_t toc_count(const toc_t *toc);
+
+/**
+ * @brief A file of the table, in the order they were added.
+ * 
+ * @param[in] toc   The table.
+ * @param[in] index Index of the file, less than toc_count().
+ * 
+ * @return const toc_entry_t* The file.
+ */
+const toc_entry_t *toc_entry(const toc_t *toc, size_t index);
+
+/**
+ * @brief Writes the table to the end of the output.
+ * 
+ * @param[in]      toc    The table.
+ * @param[in, out] output Output file, after the last file.
+ */
+void toc_write(const toc_t *toc, writer_t *output);
+
+/**
+ * @brief Forgets every file, for a new output.
+ * 
+ * @param[in, out] toc The table.
+ */
+void toc_clear(toc_t *toc);
+
+/**
+ * @brief Reads the table at the end of an output, found from its last line.
+ * 
+ * @param[in] path Path to the output.
+ * 
+ * @return toc_t* The table, kept with the output open for toc_extract(),
+ * NULL if the output has no index or could not be read.
+ */
+toc_t *toc_open(const char *path);
+
+/**
+ * @brief Copies the contents of a file out of the output the table was
+ * read from, once they are checked against their hash.
+ * 
+ * @param[in] toc    The table, from toc_open().
+ * @param[in] entry  The file.
+ * @param[in] out_fd Where the contents go, a file or a pipe.
+ * 
+ * @return false if the contents do not match, or could not be copied.
+ */
+bool toc_extract(const toc_t *toc, const toc_entry_t *entry, int out_fd);
+
+/**
+ * @brief Frees a table, and closes the output it was read from.
+ * 
+ * @param[in] toc The table, may be NULL.
+ */
+void toc_free(toc_t *toc);
+
+#endif // TOC_H_
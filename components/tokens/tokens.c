@@ -0,0 +1,318 @@
+/**
+ * @file      tokens.c
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Estimates how many tokens a language model would split text
+ *            into, in one pass over the bytes as they are copied, without
+ *            a vocabulary. Runs of letters, digits, punctuation and spaces
+ *            are split the way byte-pair tokenizers tend to split them.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#include "tokens.h"
+
+#include <stdbool.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define TOKENS_BLOCK 256 /**< Bytes counted between checks of the limit */
+
+/**
+ * @brief Classes of bytes, a run of bytes of one class is split into tokens
+ * on its own.
+ */
+enum
+{
+    CLASS_NONE,       /**< Before the first byte */
+    CLASS_WORD,       /**< Letters and '_', identifiers are words too */
+    CLASS_DIGIT,
+    CLASS_PUNCT,
+    CLASS_SPACE,      /**< ' ', a single one is part of the word after it */
+    CLASS_BLANK,      /**< Other white space, newlines and tabs */
+    CLASS_LEAD,       /**< First byte of a UTF-8 character */
+    CLASS_CONT,       /**< Other bytes of a UTF-8 character */
+    CLASS_COUNT,
+};
+
+#define PHASES 48 /**< Offsets in the text that tell where long runs are split */
+
+/**
+ * @brief Offsets, modulo PHASES, at which a run that goes on starts another
+ * token, one bit for each. A run is a token from its first byte, and one
+ * more about every so many bytes: byte-pair vocabularies hold most words
+ * whole, numbers of up to three digits, and runs of symbols like "->" or
+ * "();". Runs of white space are one token however long.
+ */
+static const uint64_t run_splits[CLASS_COUNT] =
+{
+    [CLASS_WORD]  = 0x000100010001ULL, // Every 16 bytes
+    [CLASS_DIGIT] = 0x249249249249ULL, // Every 3 bytes
+    [CLASS_PUNCT] = 0x111111111111ULL, // Every 4 bytes
+    [CLASS_LEAD]  = 0xFFFFFFFFFFFFULL, // Every character outside ASCII is about a token
+};
+
+#define W CLASS_WORD
+#define D CLASS_DIGIT
+#define P CLASS_PUNCT
+#define S CLASS_SPACE
+#define B CLASS_BLANK
+#define L CLASS_LEAD
+#define C CLASS_CONT
+
+/**
+ * @brief Class of every byte. Control characters are as rare as punctuation,
+ * and split like it.
+ */
+static const uint8_t byte_class[256] =
+{
+    P, P, P, P, P, P, P, P, P, B, B, B, B, B, P, P, // 0x00
+    P, P, P, P, P, P, P, P, P, P, P, P, P, P, P, P, // 0x10
+    S, P, P, P, P, P, P, P, P, P, P, P, P, P, P, P, // 0x20
+    D, D, D, D, D, D, D, D, D, D, P, P, P, P, P, P, // 0x30
+    P, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, // 0x40
+    W, W, W, W, W, W, W, W, W, W, W, P, P, P, P, W, // 0x50
+    P, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, // 0x60
+    W, W, W, W, W, W, W, W, W, W, W, P, P, P, P, P, // 0x70
+    C, C, C, C, C, C, C, C, C, C, C, C, C, C, C, C, // 0x80
+    C, C, C, C, C, C, C, C, C, C, C, C, C, C, C, C, // 0x90
+    C, C, C, C, C, C, C, C, C, C, C, C, C, C, C, C, // 0xA0
+    C, C, C, C, C, C, C, C, C, C, C, C, C, C, C, C, // 0xB0
+    L, L, L, L, L, L, L, L, L, L, L, L, L, L, L, L, // 0xC0
+    L, L, L, L, L, L, L, L, L, L, L, L, L, L, L, L, // 0xD0
+    L, L, L, L, L, L, L, L, L, L, L, L, L, L, L, L, // 0xE0
+    L, L, L, L, L, L, L, L, L, L, L, L, L, L, L, L, // 0xF0
+};
+
+#undef W
+#undef D
+#undef P
+#undef S
+#undef B
+#undef L
+#undef C
+
+/**
+ * @brief Tells whether a byte starts a token. Only the two bytes before it
+ * and its place in the text decide, so bytes are counted without a chain of
+ * branches from one to the next.
+ * 
+ * @param[in] class  Class of the byte.
+ * @param[in] prev   Class of the byte before it.
+ * @param[in] prev2  Class of the byte before that.
+ * @param[in] phase  Offset of the byte in the text, modulo PHASES.
+ * 
+ * @return unsigned 1 if it starts a token, 0 if it does not.
+ */
+static inline unsigned starts_token(uint8_t class, uint8_t prev, uint8_t prev2, unsigned phase)
+{
+    unsigned blank = (class == CLASS_SPACE) | (class == CLASS_BLANK);
+    unsigned prev_blank = (prev == CLASS_SPACE) | (prev == CLASS_BLANK);
+    unsigned first = (class != prev) & (class != CLASS_CONT) & !(blank & prev_blank);
+    unsigned again = (class == prev) & (unsigned)(run_splits[class] >> phase) & 1u;
+
+    // The last space of white space goes with the word or symbols after it
+    unsigned merged = ((class == CLASS_WORD) | (class == CLASS_PUNCT)) & (prev == CLASS_SPACE) &
+                      (prev2 != CLASS_SPACE) & (prev2 != CLASS_BLANK);
+    return first + again - merged;
+}
+
+#if defined(__SSE2__)
+
+#define SPLIT_3  0xFF, 0, 0
+#define SPLIT_4  0xFF, 0, 0, 0
+#define SPLIT_16 0xFF, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+
+/**
+ * @brief run_splits of numbers, symbols and words as bytes, 0xFF at the
+ * offsets that split, so that 16 bytes from any phase can be loaded.
+ */
+static const uint8_t digit_splits[18] = { SPLIT_3, SPLIT_3, SPLIT_3, SPLIT_3, SPLIT_3, SPLIT_3 };
+static const uint8_t punct_splits[20] = { SPLIT_4, SPLIT_4, SPLIT_4, SPLIT_4, SPLIT_4 };
+static const uint8_t word_splits[32]  = { SPLIT_16, SPLIT_16 };
+
+/**
+ * @brief Whether every byte is in [first, first + n), with one signed
+ * compare, the only kind SSE2 has for bytes.
+ */
+static inline __m128i in_range(__m128i bytes, uint8_t first, uint8_t n)
+{
+    __m128i biased = _mm_add_epi8(bytes, _mm_set1_epi8((char)(uint8_t)(0x80 - first)));
+    return _mm_cmplt_epi8(biased, _mm_set1_epi8((char)(uint8_t)(n ^ 0x80)));
+}
+
+/**
+ * @brief Whether the classes of 16 bytes are white space.
+ */
+static inline __m128i is_blank(__m128i class)
+{
+    return _mm_or_si128(_mm_cmpeq_epi8(class, _mm_set1_epi8(CLASS_SPACE)), _mm_cmpeq_epi8(class, _mm_set1_epi8(CLASS_BLANK)));
+}
+
+/**
+ * @brief Counts the tokens of 16 bytes at a time, the same as
+ * starts_token() would one by one, with no limit.
+ * 
+ * @param[in]      p     The bytes.
+ * @param[in]      size  Number of bytes, only whole 16 bytes are counted.
+ * @param[in, out] state Count, classes of the last two bytes, and phase.
+ * 
+ * @return size_t Bytes counted.
+ */
+static size_t count_blocks(const uint8_t *p, size_t size, tokens_t *state)
+{
+    const __m128i ones = _mm_set1_epi8((char)0xFF);
+    const __m128i punct_class = _mm_set1_epi8(CLASS_PUNCT);
+    __m128i last = _mm_set_epi8((char)state->prev_class, (char)state->prev2_class, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    unsigned phase = state->phase;
+
+    // 16 is a whole number of word and symbol periods, only numbers move on
+    __m128i word_split  = _mm_loadu_si128((const __m128i *)&word_splits[phase % 16]);
+    __m128i punct_split = _mm_loadu_si128((const __m128i *)&punct_splits[phase % 4]);
+    __m128i digit_split = _mm_loadu_si128((const __m128i *)&digit_splits[phase % 3]);
+    __m128i digit_next  = _mm_loadu_si128((const __m128i *)&digit_splits[(phase + 16) % 3]);
+    __m128i digit_after = _mm_loadu_si128((const __m128i *)&digit_splits[(phase + 32) % 3]);
+
+    size_t i = 0;
+    while ((size - i) >= 16)
+    {
+        // Byte counts of each lane, emptied before they can wrap
+        __m128i sum = _mm_setzero_si128();
+        size_t end = i + (((size - i) / 16 < 255) ? ((size - i) & ~(size_t)15) : (255 * 16));
+        for (; i < end; i += 16)
+        {
+            __m128i bytes = _mm_loadu_si128((const __m128i *)&p[i]);
+            __m128i lower = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+            __m128i word  = _mm_or_si128(in_range(lower, 'a', 26), _mm_cmpeq_epi8(bytes, _mm_set1_epi8('_')));
+            __m128i digit = in_range(bytes, '0', 10);
+            __m128i space = _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '));
+            __m128i blank = in_range(bytes, '\t', 5);
+            __m128i lead  = in_range(bytes, 0xC0, 0x40);
+            __m128i cont  = _mm_cmpeq_epi8(_mm_and_si128(bytes, _mm_set1_epi8((char)0xC0)), _mm_set1_epi8((char)0x80));
+
+            // The same classes as byte_class, everything else is punctuation
+            __m128i class = punct_class;
+            class = _mm_xor_si128(class, _mm_and_si128(word,  _mm_set1_epi8(CLASS_WORD  ^ CLASS_PUNCT)));
+            class = _mm_xor_si128(class, _mm_and_si128(digit, _mm_set1_epi8(CLASS_DIGIT ^ CLASS_PUNCT)));
+            class = _mm_xor_si128(class, _mm_and_si128(space, _mm_set1_epi8(CLASS_SPACE ^ CLASS_PUNCT)));
+            class = _mm_xor_si128(class, _mm_and_si128(blank, _mm_set1_epi8(CLASS_BLANK ^ CLASS_PUNCT)));
+            class = _mm_xor_si128(class, _mm_and_si128(lead,  _mm_set1_epi8(CLASS_LEAD  ^ CLASS_PUNCT)));
+            class = _mm_xor_si128(class, _mm_and_si128(cont,  _mm_set1_epi8(CLASS_CONT  ^ CLASS_PUNCT)));
+            __m128i punct = _mm_cmpeq_epi8(class, punct_class);
+
+            __m128i prev  = _mm_or_si128(_mm_slli_si128(class, 1), _mm_srli_si128(last, 15));
+            __m128i prev2 = _mm_or_si128(_mm_slli_si128(class, 2), _mm_srli_si128(last, 14));
+            __m128i same  = _mm_cmpeq_epi8(class, prev);
+            __m128i split = _mm_or_si128(_mm_or_si128(_mm_and_si128(word, word_split), _mm_and_si128(punct, punct_split)),
+                                         _mm_or_si128(_mm_and_si128(digit, digit_split), lead));
+
+            __m128i not_first = _mm_or_si128(_mm_or_si128(same, cont), _mm_and_si128(_mm_or_si128(space, blank), is_blank(prev)));
+            __m128i starts = _mm_or_si128(_mm_andnot_si128(not_first, ones), _mm_and_si128(same, split));
+
+            // The last space of white space goes with the word or symbols after it
+            __m128i merged = _mm_and_si128(_mm_or_si128(word, punct), _mm_andnot_si128(is_blank(prev2), _mm_cmpeq_epi8(prev, _mm_set1_epi8(CLASS_SPACE))));
+            sum = _mm_sub_epi8(sum, _mm_andnot_si128(merged, starts));
+
+            last = class;
+            __m128i digit_first = digit_split;
+            digit_split = digit_next;
+            digit_next = digit_after;
+            digit_after = digit_first;
+        }
+
+        __m128i total = _mm_sad_epu8(sum, _mm_setzero_si128());
+        state->count += (uint64_t)_mm_cvtsi128_si32(total) + (uint64_t)_mm_cvtsi128_si32(_mm_srli_si128(total, 8));
+    }
+
+    if (i > 0)
+    {
+        unsigned lasts = (unsigned)_mm_extract_epi16(last, 7);
+        state->prev2_class = (uint8_t)(lasts & 0xFF);
+        state->prev_class = (uint8_t)(lasts >> 8);
+        state->phase = (uint8_t)((phase + i) % PHASES);
+    }
+    return i;
+}
+
+#endif // __SSE2__
+
+/**
+ * @brief Counts the tokens of the next piece of a text, up to a limit. A
+ * token is counted as soon as its first byte is seen, so the count of the
+ * bytes taken is never above the limit.
+ * 
+ * @param[in, out] tokens Count of the text before the piece.
+ * @param[in]      data   The piece.
+ * @param[in]      size   Size of the piece.
+ * @param[in]      limit  Most tokens the text may have, TOKENS_NO_LIMIT for no limit.
+ * 
+ * @return size_t Bytes of the piece taken, less than size if the byte
+ * after them would have started a token past the limit.
+ */
+size_t tokens_feed(tokens_t *tokens, const void *data, size_t size, uint64_t limit)
+{
+    const uint8_t *p = data;
+    uint64_t count = tokens->count;
+    uint8_t prev = tokens->prev_class;
+    uint8_t prev2 = tokens->prev2_class;
+    unsigned phase = tokens->phase;
+
+    size_t i = 0;
+    while (i < size)
+    {
+        // A byte starts at most one token, so a block that cannot reach the limit is not checked
+        size_t end = ((size - i) < TOKENS_BLOCK) ? size : (i + TOKENS_BLOCK);
+        bool checked = ((limit - count) < (end - i));
+#if defined(__SSE2__)
+        if (!checked)
+        {
+            // As far as the limit cannot be reached, in one go
+            end = ((limit - count) < (size - i)) ? (i + (size_t)(limit - count)) : size;
+            tokens_t state = { .count = count, .prev_class = prev, .prev2_class = prev2, .phase = (uint8_t)phase };
+            i += count_blocks(&p[i], end - i, &state);
+            count = state.count;
+            prev = state.prev_class;
+            prev2 = state.prev2_class;
+            phase = state.phase;
+        }
+#endif
+        for (; i < end; i++)
+        {
+            uint8_t class = byte_class[p[i]];
+            unsigned starts = starts_token(class, prev, prev2, phase);
+            if (checked && (starts > 0) && (count >= limit))
+                break;
+            count += starts;
+            prev2 = prev;
+            prev = class;
+            phase = (phase == (PHASES - 1)) ? 0 : (phase + 1);
+        }
+        if (i < end)
+            break;
+    }
+
+    tokens->count = count;
+    tokens->prev_class = prev;
+    tokens->prev2_class = prev2;
+    tokens->phase = (uint8_t)phase;
+    return i;
+}
+
+/**
+ * @brief Counts the tokens of a whole text.
+ * 
+ * @param[in] data The text.
+ * @param[in] size Size of the text.
+ * 
+ * @return uint64_t The estimated number of tokens.
+ */
+uint64_t tokens_count(const void *data, size_t size)
+{
+    tokens_t tokens = { 0 };
+    tokens_feed(&tokens, data, size, TOKENS_NO_LIMIT);
+    return tokens.count;
+}
+
+// end of file tokens.c
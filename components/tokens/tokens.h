@@ -0,0 +1,58 @@
+/**
+ * @file      tokens.h
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Estimates how many tokens a language model would split text
+ *            into, in one pass over the bytes as they are copied, without
+ *            a vocabulary. Runs of letters, digits, punctuation and spaces
+ *            are split the way byte-pair tokenizers tend to split them.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#ifndef TOKENS_H_
+#define TOKENS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TOKENS_NO_LIMIT UINT64_MAX /**< Limit of tokens_feed() that is never reached */
+
+/**
+ * @brief Count of a text that is fed in pieces. Zeroed, it is the count of
+ * an empty text.
+ */
+typedef struct
+{
+    uint64_t count;      /**< Tokens so far */
+    uint8_t prev_class;  /**< Classes of the last two bytes, they decide on the next */
+    uint8_t prev2_class;
+    uint8_t phase;       /**< Bytes so far, modulo the lengths of the runs split */
+} tokens_t;
+
+/**
+ * @brief Counts the tokens of the next piece of a text, up to a limit. A
+ * token is counted as soon as its first byte is seen, so the count of the
+ * bytes taken is never above the limit.
+ * 
+ * @param[in, out] tokens Count of the text before the piece.
+ * @param[in]      data   The piece.
+ * @param[in]      size   Size of the piece.
+ * @param[in]      limit  Most tokens the text may have, TOKENS_NO_LIMIT for no limit.
+ * 
+ * @return size_t Bytes of the piece taken, less than size if the byte
+ * after them would have started a token past the limit.
+ */
+size_t tokens_feed(tokens_t *tokens, const void *data, size_t size, uint64_t limit);
+
+/**
+ * @brief Counts the tokens of a whole text.
+ * 
+ * @param[in] data The text.
+ * @param[in] size Size of the text.
+ * 
+ * @return uint64_t The estimated number of tokens.
+ */
+uint64_t tokens_count(const void *data, size_t size);
+
+#endif // TOKENS_H_
@@ -0,0 +1,355 @@
+/**
+ * @file      trace.c
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Events of a walk over time, for --trace, written as Chrome
+ *            trace events that Perfetto and chrome://tracing open. Every
+ *            thread puts its events in a ring of its own, that only it
+ *            writes and only the flusher thread reads, so recording one
+ *            takes no lock and no system call. The flusher writes them out
+ *            while the walk goes on, so a trace can be as long as the walk.
+ *            Like stats.c, which feeds it, it is only built with
+ *            INGESTIFY_STATS.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#include "trace.h"
+
+#if defined(INGESTIFY_STATS)
+
+#include "common.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#define TRACE_RING_MASK ((size_t)TRACE_RING_SIZE - 1)
+#define TRACE_LINE      64 /**< Bytes of a cache line, that the two ends of a ring are kept apart by */
+
+/**
+ * @brief An event, as the thread recorded it.
+ */
+typedef struct
+{
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+    char detail[TRACE_DETAIL_MAX]; /**< Empty if the event has no path */
+} trace_record_t;
+
+/**
+ * @brief Events of one thread. Only the thread moves the head and only the
+ * flusher moves the tail, so neither waits for the other, and each end has
+ * a cache line of its own so that they do not slow each other down either.
+ */
+typedef struct trace_ring
+{
+    struct trace_ring *next;
+    unsigned int tid;
+    atomic_size_t dropped;
+    _Alignas(TRACE_LINE) atomic_size_t head; /**< Next slot the thread writes */
+    _Alignas(TRACE_LINE) atomic_size_t tail; /**< Next slot the flusher reads */
+    trace_record_t records[TRACE_RING_SIZE];
+} trace_ring_t;
+
+static FILE *trace_file = NULL;
+static uint64_t origin = 0;     /**< When recording started, the 0 of the trace */
+static bool first_record = true;
+static bool recording = false;
+
+/**
+ * @brief Every thread that recorded anything. A thread adds itself the
+ * first time, and rings are only taken off once recording has stopped, so
+ * the flusher only needs the lock to find the first one.
+ */
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_ring_t *rings = NULL;
+static unsigned int ring_count = 0;
+
+/**
+ * @brief Changed whenever the rings are freed, so that a thread that lives
+ * on makes itself a new ring instead of using the freed one.
+ */
+static atomic_uint generation;
+static _Thread_local trace_ring_t *local = NULL;
+static _Thread_local unsigned int local_generation = 0;
+
+static pthread_t flusher;
+static bool flusher_running = false;
+static pthread_mutex_t flusher_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flusher_cond = PTHREAD_COND_INITIALIZER;
+static bool flusher_stop = false;
+
+/**
+ * @brief Monotonic time in nanoseconds.
+ */
+static inline uint64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000ULL) + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * @brief Finds the ring of the calling thread, and makes it the first time.
+ * 
+ * @return trace_ring_t* The ring, NULL if memory ran out, nothing of the
+ * thread is recorded then.
+ */
+static trace_ring_t *get_local(void)
+{
+    unsigned int current = atomic_load_explicit(&generation, memory_order_acquire);
+    if (EXISTS(local) && (local_generation == current))
+        return local;
+
+    trace_ring_t *ring = aligned_alloc(_Alignof(trace_ring_t), sizeof(trace_ring_t));
+    if (IS_NULL(ring))
+        return NULL;
+    atomic_init(&ring->dropped, 0);
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+
+    pthread_mutex_lock(&rings_lock);
+    ring->tid = ring_count++;
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&rings_lock);
+
+    local = ring;
+    local_generation = current;
+    return ring;
+}
+
+/**
+ * @brief Keeps the path of an event, or its end if it is too long, cut at
+ * the start of a character so that the trace stays valid UTF-8.
+ */
+static void copy_detail(char *to, const char *detail)
+{
+    if (IS_NULL(detail))
+    {
+        to[0] = '\0';
+        return;
+    }
+
+    size_t length = strlen(detail);
+    if (length < TRACE_DETAIL_MAX)
+    {
+        memcpy(to, detail, length + 1);
+        return;
+    }
+
+    const char *tail = detail + length - (TRACE_DETAIL_MAX - 4);
+    while (((unsigned char)*tail & 0xC0) == 0x80)
+        tail++;
+    memcpy(to, "...", 3);
+    strcpy(to + 3, tail);
+}
+
+/**
+ * @brief Records an event of the calling thread. If its ring is full, the
+ * event is dropped and counted, the thread never waits for the flusher.
+ * 
+ * @param[in] name   What happened, a string that is never freed.
+ * @param[in] start  When it started, in nanoseconds of CLOCK_MONOTONIC.
+ * @param[in] end    When it ended.
+ * @param[in] detail Path it happened to, NULL if none. Only its end is kept
+ *                   if it is long.
+ */
+void trace_event(const char *name, uint64_t start, uint64_t end, const char *detail)
+{
+    trace_ring_t *ring = get_local();
+    if (IS_NULL(ring))
+        return;
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if ((head - atomic_load_explicit(&ring->tail, memory_order_acquire)) == TRACE_RING_SIZE)
+    {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    trace_record_t *record = &ring->records[head & TRACE_RING_MASK];
+    record->name = name;
+    record->start = start;
+    record->end = end;
+    copy_detail(record->detail, detail);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * @brief Writes a string inside the quotes of a JSON string.
+ */
+static void write_escaped(const char *text)
+{
+    for (const unsigned char *c = (const unsigned char *)text; *c != '\0'; c++)
+    {
+        if ((*c == '"') || (*c == '\\'))
+            fprintf(trace_file, "\\%c", *c);
+        else if (*c < 0x20)
+            fprintf(trace_file, "\\u%04x", *c);
+        else
+            fputc(*c, trace_file);
+    }
+}
+
+/**
+ * @brief Writes an event as a complete event, in microseconds from the
+ * start of recording.
+ */
+static void write_record(unsigned int tid, const trace_record_t *record)
+{
+    uint64_t start = (record->start > origin) ? (record->start - origin) : 0;
+    uint64_t duration = (record->end > record->start) ? (record->end - record->start) : 0;
+
+    fprintf(trace_file, "%s\n{\"name\":\"%s\",\"cat\":\"walk\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+            first_record ? "" : ",", record->name, tid, (double)start / 1e3, (double)duration / 1e3);
+    if (record->detail[0] != '\0')
+    {
+        fprintf(trace_file, ",\"args\":{\"path\":\"");
+        write_escaped(record->detail);
+        fprintf(trace_file, "\"}");
+    }
+    fputc('}', trace_file);
+    first_record = false;
+}
+
+/**
+ * @brief Writes out the events of every ring, and frees their slots.
+ */
+static void drain(void)
+{
+    pthread_mutex_lock(&rings_lock);
+    trace_ring_t *first = rings;
+    pthread_mutex_unlock(&rings_lock);
+
+    for (trace_ring_t *ring = first; EXISTS(ring); ring = ring->next)
+    {
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        for (; tail != head; tail++)
+            write_record(ring->tid, &ring->records[tail & TRACE_RING_MASK]);
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+}
+
+/**
+ * @brief Writes out the rings every TRACE_FLUSH_MS until it is told to stop.
+ */
+static void *flusher_main(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&flusher_lock);
+    while (!flusher_stop)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (TRACE_FLUSH_MS % 1000) * 1000000L;
+        deadline.tv_sec  += TRACE_FLUSH_MS / 1000 + deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+
+        pthread_cond_timedwait(&flusher_cond, &flusher_lock, &deadline);
+        pthread_mutex_unlock(&flusher_lock);
+        drain();
+        pthread_mutex_lock(&flusher_lock);
+    }
+    pthread_mutex_unlock(&flusher_lock);
+    return NULL;
+}
+
+/**
+ * @brief Starts recording, into a file that is written until trace_stop().
+ * 
+ * @param[in] path Path of the trace file.
+ * 
+ * @return false if the file could not be made, nothing is recorded then.
+ */
+bool trace_start(const char *path)
+{
+    trace_file = fopen(path, "w");
+    if (IS_NULL(trace_file))
+    {
+        perror("Error opening trace file");
+        return false;
+    }
+    fprintf(trace_file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    first_record = true;
+    origin = now_ns();
+
+    flusher_stop = false;
+    flusher_running = (pthread_create(&flusher, NULL, flusher_main, NULL) == 0);
+    if (!flusher_running)
+    {
+        perror("Error starting trace thread");
+        fclose(trace_file);
+        trace_file = NULL;
+        return false;
+    }
+
+    recording = true;
+    stats_trace(true);
+    return true;
+}
+
+/**
+ * @brief Stops recording, once the walk is over, and writes out what is
+ * left and the end of the file.
+ * 
+ * @return false if the file could not be written whole.
+ */
+bool trace_stop(void)
+{
+    if (!recording)
+        return true;
+
+    stats_trace(false);
+    recording = false;
+
+    pthread_mutex_lock(&flusher_lock);
+    flusher_stop = true;
+    pthread_cond_signal(&flusher_cond);
+    pthread_mutex_unlock(&flusher_lock);
+    pthread_join(flusher, NULL);
+    flusher_running = false;
+    drain();
+
+    // Threads are named by the order they started recording in
+    size_t dropped = 0;
+    pthread_mutex_lock(&rings_lock);
+    while (EXISTS(rings))
+    {
+        trace_ring_t *ring = rings;
+        rings = ring->next;
+        fprintf(trace_file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+                first_record ? "" : ",", ring->tid, ring->tid);
+        first_record = false;
+        dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+        free(ring);
+    }
+    ring_count = 0;
+    atomic_fetch_add_explicit(&generation, 1, memory_order_release);
+    pthread_mutex_unlock(&rings_lock);
+
+    fprintf(trace_file, "\n]}\n");
+    bool written = (ferror(trace_file) == 0);
+    if ((fclose(trace_file) != 0) || !written)
+    {
+        perror("Error writing trace file");
+        written = false;
+    }
+    trace_file = NULL;
+
+    if (dropped > 0)
+        fprintf(stderr, "Trace dropped %zu events, the walk made them faster than they could be written\n", dropped);
+    return written;
+}
+
+#endif // INGESTIFY_STATS
+
+// end of file trace.c
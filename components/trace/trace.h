@@ -0,0 +1,61 @@
+/**
+ * @file      trace.h
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Events of a walk over time, for --trace, written as Chrome
+ *            trace events that Perfetto and chrome://tracing open. Every
+ *            thread puts its events in a ring of its own, that only it
+ *            writes and only the flusher thread reads, so recording one
+ *            takes no lock and no system call. The flusher writes them out
+ *            while the walk goes on, so a trace can be as long as the walk.
+ *            Like stats.h, which feeds it, it is only built with
+ *            INGESTIFY_STATS.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_RING_SIZE  (32 * 1024) /**< Events a thread can hold, a power of two */
+#define TRACE_DETAIL_MAX 40          /**< Bytes of the path of an event kept, with the NUL */
+#define TRACE_FLUSH_MS   10          /**< How often the rings are written out */
+
+#if defined(INGESTIFY_STATS)
+
+/**
+ * @brief Starts recording, into a file that is written until trace_stop().
+ * 
+ * @param[in] path Path of the trace file.
+ * 
+ * @return false if the file could not be made, nothing is recorded then.
+ */
+bool trace_start(const char *path);
+
+/**
+ * @brief Stops recording, once the walk is over, and writes out what is
+ * left and the end of the file.
+ * 
+ * @return false if the file could not be written whole.
+ */
+bool trace_stop(void);
+
+/**
+ * @brief Records an event of the calling thread. If its ring is full, the
+ * event is dropped and counted, the thread never waits for the flusher.
+ * 
+ * @param[in] name   What happened, a string that is never freed.
+ * @param[in] start  When it started, in nanoseconds of CLOCK_MONOTONIC.
+ * @param[in] end    When it ended.
+ * @param[in] detail Path it happened to, NULL if none. Only its end is kept
+ *                   if it is long.
+ */
+void trace_event(const char *name, uint64_t start, uint64_t end, const char *detail);
+
+#endif // INGESTIFY_STATS
+
+#endif // TRACE_H_
@@ -0,0 +1,564 @@
+/**
+ * @file      uring.c
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Batched reading of small files. On Linux the opens, stats,
+ *            reads and closes of a whole batch go through io_uring in two
+ *            system calls, elsewhere they are plain system calls.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#include "uring.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if defined(__linux__) && defined(INGESTIFY_IO_URING)
+#define URING_KERNEL 1
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#else
+#define URING_KERNEL 0
+#endif
+
+#define URING_ENTRIES (2 * URING_BATCH_MAX) /**< A read and a close per file */
+
+#if URING_KERNEL
+
+/**
+ * @brief Submission and completion rings shared with the kernel, set up
+ * without liburing so that there is nothing extra to install.
+ */
+typedef struct
+{
+    int fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    unsigned int to_submit;               /**< Queued, but not submitted yet */
+} kernel_ring_t;
+
+typedef enum
+{
+    URING_OP_OPEN,
+    URING_OP_READ,
+    URING_OP_CLOSE,
+} uring_op_t;
+
+#endif
+
+struct uring
+{
+    size_t max_read;
+    char *buffer;           /**< Contents of the current batch */
+    size_t buffer_capacity;
+#if URING_KERNEL
+    kernel_ring_t *kernel;  /**< NULL if io_uring is not used */
+#endif
+};
+
+#if URING_KERNEL
+
+static void ring_unmap(kernel_ring_t *k)
+{
+    if (EXISTS(k->sqes))
+        munmap(k->sqes, k->sqes_size);
+    if (EXISTS(k->cq_ring) && (k->cq_ring != k->sq_ring))
+        munmap(k->cq_ring, k->cq_ring_size);
+    if (EXISTS(k->sq_ring))
+        munmap(k->sq_ring, k->sq_ring_size);
+    if (k->fd >= 0)
+        close(k->fd);
+}
+
+/**
+ * @brief Checks that the kernel knows every operation a batch needs, they
+ * came in different kernel versions.
+ */
+static bool ring_probe(int fd)
+{
+    size_t size = sizeof(struct io_uring_probe) + (256 * sizeof(struct io_uring_probe_op));
+    struct io_uring_probe *probe = calloc(1, size);
+    if (IS_NULL(probe))
+        return false;
+
+    bool supported = false;
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) >= 0)
+    {
+        const int needed[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE };
+        supported = true;
+        for (size_t i = 0; i < sizeof(needed) / sizeof(needed[0]); i++)
+        {
+            if ((needed[i] > probe->last_op) || !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED))
+                supported = false;
+        }
+    }
+    free(probe);
+    return supported;
+}
+
+/**
+ * @brief Sets up a ring, NULL if the kernel has none or does not allow it.
+ */
+static kernel_ring_t *ring_create(void)
+{
+    kernel_ring_t *k = calloc(1, sizeof(kernel_ring_t));
+    if (IS_NULL(k))
+        return NULL;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    k->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if ((k->fd < 0) || !ring_probe(k->fd))
+    {
+        ring_unmap(k);
+        free(k);
+        return NULL;
+    }
+
+    k->sq_ring_size = params.sq_off.array + (params.sq_entries * sizeof(unsigned int));
+    k->cq_ring_size = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (k->cq_ring_size > k->sq_ring_size) k->sq_ring_size = k->cq_ring_size;
+        k->cq_ring_size = k->sq_ring_size;
+    }
+
+    k->sq_ring = mmap(NULL, k->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, k->fd, IORING_OFF_SQ_RING);
+    if (k->sq_ring == MAP_FAILED)
+        k->sq_ring = NULL;
+    else if (params.features & IORING_FEAT_SINGLE_MMAP)
+        k->cq_ring = k->sq_ring;
+    else
+        k->cq_ring = mmap(NULL, k->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, k->fd, IORING_OFF_CQ_RING);
+    if (k->cq_ring == MAP_FAILED)
+        k->cq_ring = NULL;
+
+    k->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    k->sqes = mmap(NULL, k->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, k->fd, IORING_OFF_SQES);
+    if (k->sqes == MAP_FAILED)
+        k->sqes = NULL;
+
+    if (IS_NULL(k->sq_ring) || IS_NULL(k->cq_ring) || IS_NULL(k->sqes))
+    {
+        ring_unmap(k);
+        free(k);
+        return NULL;
+    }
+
+    char *sq = k->sq_ring;
+    char *cq = k->cq_ring;
+    k->sq_head  = (unsigned int *)(sq + params.sq_off.head);
+    k->sq_tail  = (unsigned int *)(sq + params.sq_off.tail);
+    k->sq_mask  = (unsigned int *)(sq + params.sq_off.ring_mask);
+    k->sq_array = (unsigned int *)(sq + params.sq_off.array);
+    k->cq_head  = (unsigned int *)(cq + params.cq_off.head);
+    k->cq_tail  = (unsigned int *)(cq + params.cq_off.tail);
+    k->cq_mask  = (unsigned int *)(cq + params.cq_off.ring_mask);
+    k->cqes     = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return k;
+}
+
+/**
+ * @brief Takes the next free submission entry. A batch never queues more
+ * than URING_ENTRIES, so there always is one.
+ */
+static struct io_uring_sqe *ring_get_sqe(kernel_ring_t *k, uring_op_t op, size_t index)
+{
+    unsigned int tail = *k->sq_tail;
+    unsigned int slot = tail & *k->sq_mask;
+    struct io_uring_sqe *sqe = &k->sqes[slot];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = ((uint64_t)index << 2) | (uint64_t)op;
+    k->sq_array[slot] = slot;
+    __atomic_store_n(k->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    k->to_submit++;
+    return sqe;
+}
+
+/**
+ * @brief Submits what was queued, and waits until that many operations
+ * completed.
+ * 
+ * @return false if the kernel did not accept the submission.
+ */
+static bool ring_submit_and_wait(kernel_ring_t *k)
+{
+    // The completion ring is empty between batches, so all it holds is ours
+    unsigned int wait = k->to_submit;
+    unsigned int ready = 0;
+    while ((k->to_submit > 0) || (ready < wait))
+    {
+        int n = (int)syscall(__NR_io_uring_enter, k->fd, k->to_submit, wait, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        k->to_submit -= (unsigned int)n;
+        ready = __atomic_load_n(k->cq_tail, __ATOMIC_ACQUIRE) - *k->cq_head;
+    }
+    return true;
+}
+
+/**
+ * @brief Takes the next completion.
+ * 
+ * @return false if there is none.
+ */
+static bool ring_get_cqe(kernel_ring_t *k, uring_op_t *op_out, size_t *index_out, int *res_out)
+{
+    unsigned int head = *k->cq_head;
+    if (head == __atomic_load_n(k->cq_tail, __ATOMIC_ACQUIRE))
+        return false;
+
+    struct io_uring_cqe *cqe = &k->cqes[head & *k->cq_mask];
+    *op_out    = (uring_op_t)(cqe->user_data & 3);
+    *index_out = (size_t)(cqe->user_data >> 2);
+    *res_out   = cqe->res;
+    __atomic_store_n(k->cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+#endif
+
+/**
+ * @brief Creates a batch reader.
+ * 
+ * @param[in] max_read  Files up to this size are read, larger ones are only
+ *                      opened and left to the caller.
+ * @param[in] use_ring  Try io_uring. Without it, or without kernel support,
+ *                      plain system calls are used.
+ * 
+ * @return uring_t* The reader, NULL if memory ran out.
+ */
+uring_t *uring_create(size_t max_read, bool use_ring)
+{
+    uring_t *ring = calloc(1, sizeof(uring_t));
+    if (IS_NULL(ring))
+        return NULL;
+
+    ring->max_read = max_read;
+#if URING_KERNEL
+    ring->kernel = use_ring ? ring_create() : NULL;
+#else
+    (void)use_ring;
+#endif
+    return ring;
+}
+
+/**
+ * @brief Frees a batch reader.
+ * 
+ * @param[in] ring The reader, may be NULL.
+ */
+void uring_destroy(uring_t *ring)
+{
+    if (IS_NULL(ring))
+        return;
+
+#if URING_KERNEL
+    if (EXISTS(ring->kernel))
+    {
+        ring_unmap(ring->kernel);
+        free(ring->kernel);
+    }
+#endif
+    free(ring->buffer);
+    free(ring);
+}
+
+/**
+ * @brief Tells whether the reader goes through io_uring.
+ * 
+ * @param[in] ring The reader.
+ * 
+ * @return true if it does.
+ */
+bool uring_has_ring(const uring_t *ring)
+{
+#if URING_KERNEL
+    return EXISTS(ring->kernel);
+#else
+    (void)ring;
+    return false;
+#endif
+}
+
+/**
+ * @brief Makes room for the contents of the files small enough to read, and
+ * points each of them at its place.
+ * 
+ * @return false if memory ran out, nothing is read then.
+ */
+static bool layout_buffer(uring_t *ring, uring_file_t *files, size_t count)
+{
+    size_t total = 1;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (files[i].opened && ((size_t)files[i].size <= ring->max_read))
+            total += (size_t)files[i].size;
+    }
+
+    if (total > ring->buffer_capacity)
+    {
+        char *buffer = realloc(ring->buffer, total);
+        if (IS_NULL(buffer))
+            return false;
+        ring->buffer = buffer;
+        ring->buffer_capacity = total;
+    }
+
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (files[i].opened && ((size_t)files[i].size <= ring->max_read))
+        {
+            files[i].data = &ring->buffer[offset];
+            offset += (size_t)files[i].size;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Opens, stats, reads and closes files one at a time.
+ */
+static void read_files_plain(uring_t *ring, DIR *dir, uring_file_t *files, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        uring_file_t *file = &files[i];
+        if (!file->opened) // Unless a ring that failed halfway opened it
+        {
+            file->fd = dir_open_file(dir, file->name, file->path);
+            file->opened = (file->fd >= 0);
+        }
+
+        struct stat file_stat;
+        if (file->opened)
+            file->size = (fstat(file->fd, &file_stat) == 0) ? file_stat.st_size : 0;
+    }
+
+    if (!layout_buffer(ring, files, count))
+        return;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        uring_file_t *file = &files[i];
+        if (IS_NULL(file->data))
+            continue;
+
+        file->length = read_full(file->fd, (char *)file->data, (size_t)file->size);
+        close(file->fd);
+        file->fd = -1;
+    }
+}
+
+#if URING_KERNEL
+
+/**
+ * @brief Opens every file with one system call, then reads and closes them
+ * all with another. The size is not asked for, asking the kernel for it
+ * through the ring is slower than the read itself. Every file gets one byte
+ * more than max_read of room instead, a file that fills it is large, and is
+ * opened again for the caller.
+ * 
+ * @return false if the kernel refused the ring, the files it did open and
+ * still leaves to us are marked, and the rest is left to the plain system
+ * calls.
+ */
+static bool read_files_ring(uring_t *ring, DIR *dir, uring_file_t *files, size_t count)
+{
+    kernel_ring_t *k = ring->kernel;
+    int dir_fd = dirfd(dir);
+
+    size_t slot_size = ring->max_read + 1;
+    if ((count * slot_size) > ring->buffer_capacity)
+    {
+        char *buffer = realloc(ring->buffer, URING_BATCH_MAX * slot_size);
+        if (IS_NULL(buffer))
+            return false;
+        ring->buffer = buffer;
+        ring->buffer_capacity = URING_BATCH_MAX * slot_size;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        struct io_uring_sqe *sqe = ring_get_sqe(k, URING_OP_OPEN, i);
+        sqe->opcode     = IORING_OP_OPENAT;
+        sqe->fd         = dir_fd;
+        sqe->addr       = (uint64_t)(uintptr_t)files[i].name;
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    }
+
+    bool submitted = ring_submit_and_wait(k);
+
+    uring_op_t op;
+    size_t index;
+    int res;
+    while (ring_get_cqe(k, &op, &index, &res))
+    {
+        if ((op == URING_OP_OPEN) && (res >= 0))
+        {
+            files[index].fd = res;
+            files[index].opened = true;
+        }
+    }
+    if (!submitted)
+        return false;
+
+    int read_res[URING_BATCH_MAX];
+    for (size_t i = 0; i < count; i++)
+    {
+        read_res[i] = -1;
+        if (!files[i].opened)
+            continue;
+
+        // Read at offset 0, so a large file is still at its start for the caller.
+        // A hard link closes the file even after a short read.
+        struct io_uring_sqe *sqe = ring_get_sqe(k, URING_OP_READ, i);
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd     = files[i].fd;
+        sqe->addr   = (uint64_t)(uintptr_t)&ring->buffer[i * slot_size];
+        sqe->len    = (unsigned int)slot_size;
+        sqe->off    = 0;
+        sqe->flags  = IOSQE_IO_HARDLINK;
+
+        sqe = ring_get_sqe(k, URING_OP_CLOSE, i);
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd     = files[i].fd;
+    }
+
+    unsigned int queued = k->to_submit;
+    submitted = ring_submit_and_wait(k);
+
+    bool closed[URING_BATCH_MAX] = { false };
+    while (ring_get_cqe(k, &op, &index, &res))
+    {
+        if (op == URING_OP_READ)
+            read_res[index] = res;
+        else if ((op == URING_OP_CLOSE) && (res != -ECANCELED))
+            closed[index] = true;
+    }
+
+    if (!submitted)
+    {
+        // The kernel took the reads and closes queued first, and may still
+        // close those files after their numbers were given out again, so they
+        // are opened again by name. The files it never took are ours to read.
+        unsigned int taken = queued - k->to_submit;
+        for (size_t i = 0; (i < count) && (taken > 0); i++)
+        {
+            if (!files[i].opened)
+                continue;
+
+            taken = (taken > 2) ? (taken - 2) : 0;
+            files[i].fd = -1;
+            files[i].opened = false;
+        }
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        uring_file_t *file = &files[i];
+        if (!file->opened)
+            continue;
+
+        if (!closed[i])
+        {
+            // The reads never ran, so the file is read like without a ring
+            struct stat file_stat;
+            file->size = (fstat(file->fd, &file_stat) == 0) ? file_stat.st_size : 0;
+            if ((size_t)file->size <= ring->max_read)
+            {
+                file->data = &ring->buffer[i * slot_size];
+                file->length = read_full(file->fd, (char *)file->data, (size_t)file->size);
+                close(file->fd);
+                file->fd = -1;
+            }
+            continue;
+        }
+
+        file->fd = -1;
+        if ((read_res[i] >= 0) && ((size_t)read_res[i] <= ring->max_read))
+        {
+            file->data = &ring->buffer[i * slot_size];
+            file->size = read_res[i];
+            file->length = (size_t)read_res[i];
+        }
+        else
+        {
+            file->fd = dir_open_file(dir, file->name, file->path);
+            file->opened = (file->fd >= 0);
+
+            struct stat file_stat;
+            if (file->opened)
+                file->size = (fstat(file->fd, &file_stat) == 0) ? file_stat.st_size : 0;
+        }
+    }
+    return true;
+}
+
+#endif
+
+/**
+ * @brief Opens and reads a batch of files in one directory. The contents
+ * stay valid until the next batch.
+ * 
+ * @param[in, out] ring  The reader.
+ * @param[in]      dir   Open directory of the files.
+ * @param[in, out] files Files of the batch.
+ * @param[in]      count Number of files, at most URING_BATCH_MAX.
+ */
+void uring_read_files(uring_t *ring, DIR *dir, uring_file_t *files, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        files[i].fd = -1;
+        files[i].opened = false;
+        files[i].size = 0;
+        files[i].data = NULL;
+        files[i].length = 0;
+    }
+
+#if URING_KERNEL
+    if (EXISTS(ring->kernel))
+    {
+        if (read_files_ring(ring, dir, files, count))
+            return;
+
+        // The kernel refused, so the ring is not used again
+        ring_unmap(ring->kernel);
+        free(ring->kernel);
+        ring->kernel = NULL;
+    }
+#endif
+
+    read_files_plain(ring, dir, files, count);
+}
+
+// end of file uring.c
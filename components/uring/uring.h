@@ -0,0 +1,77 @@
+/**
+ * @file      uring.h
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Batched reading of small files. On Linux the opens, stats,
+ *            reads and closes of a whole batch go through io_uring in two
+ *            system calls, elsewhere they are plain system calls.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#ifndef URING_H_
+#define URING_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <dirent.h>
+#include <sys/types.h>
+
+#define URING_BATCH_MAX 64 /**< Most files read in one batch */
+
+typedef struct uring uring_t;
+
+/**
+ * @brief A file of a batch.
+ */
+typedef struct
+{
+    const char *name; /**< In: name relative to the directory */
+    const char *path; /**< In: full path, used where there is no openat() */
+    int fd;           /**< Out: file left open because it is too large to read, -1 otherwise */
+    bool opened;      /**< Out: false if the file could not be opened */
+    off_t size;       /**< Out: size when it was opened */
+    const char *data; /**< Out: contents, NULL if the file was too large to read */
+    size_t length;    /**< Out: bytes read, less than size if it was truncated */
+} uring_file_t;
+
+/**
+ * @brief Creates a batch reader.
+ * 
+ * @param[in] max_read  Files up to this size are read, larger ones are only
+ *                      opened and left to the caller.
+ * @param[in] use_ring  Try io_uring. Without it, or without kernel support,
+ *                      plain system calls are used.
+ * 
+ * @return uring_t* The reader, NULL if memory ran out.
+ */
+uring_t *uring_create(size_t max_read, bool use_ring);
+
+/**
+ * @brief Frees a batch reader.
+ * 
+ * @param[in] ring The reader, may be NULL.
+ */
+void uring_destroy(uring_t *ring);
+
+/**
+ * @brief Tells whether the reader goes through io_uring.
+ * 
+ * @param[in] ring The reader.
+ * 
+ * @return true if it does.
+ */
+bool uring_has_ring(const uring_t *ring);
+
+/**
+ * @brief Opens and reads a batch of files in one directory. The contents
+ * stay valid until the next batch.
+ * 
+ * @param[in, out] ring  The reader.
+ * @param[in]      dir   Open directory of the files.
+ * @param[in, out] files Files of the batch.
+ * @param[in]      count Number of files, at most URING_BATCH_MAX.
+ */
+void uring_read_files(uring_t *ring, DIR *dir, uring_file_t *files, size_t count);
+
+#endif // URING_H_
@@ -0,0 +1,481 @@
+/**
+ * @file      watch.c
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Watches the directories a walk opened for changes, through
+ *            inotify, and tells the next walk which of them it can take
+ *            from the previous output as they were.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#include "watch.h"
+#include "common.h"
+#include "arena.h"
+#include "ingestify.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+
+/**
+ * @brief Set of paths, only ever added to until it is cleared.
+ */
+typedef struct
+{
+    const char **slots;
+    size_t mask;
+    size_t count;
+    arena_t arena;      /**< The paths */
+} path_set_t;
+
+struct watch
+{
+    int fd;                       /**< inotify instance */
+    const ingestify_t *ingestify;
+    const char *output_file_path;
+    const char *nested_name;
+    pthread_mutex_t lock;         /**< Guards paths, walks may add watches from many threads */
+    char **paths;                 /**< Path of the directory of each watch descriptor */
+    size_t path_count;
+
+    path_set_t changed;           /**< Directories with a change in or under them */
+    path_set_t subtrees;          /**< Directories whose whole subtree has to be walked */
+    path_set_t unwatched;         /**< Directories that could not be watched, always walked */
+    bool everything;              /**< Events were lost, or directories moved */
+    bool warned;                  /**< The watch limit was reported */
+};
+
+static volatile sig_atomic_t stop_requested = 0;
+
+/**
+ * @brief Asks watch_wait() to stop.
+ */
+static void request_stop(int signal_number)
+{
+    (void)signal_number;
+    stop_requested = 1;
+}
+
+/**
+ * @brief Finds the slot of a path in a set, the free slot it would go in if
+ * it is not there.
+ */
+static size_t set_slot(const path_set_t *set, const char *path, size_t len)
+{
+    size_t slot = hash_bytes(HASH_SEED, path, len) & set->mask;
+    while (EXISTS(set->slots[slot]) && ((strncmp(set->slots[slot], path, len) != 0) || (set->slots[slot][len] != '\0')))
+        slot = (slot + 1) & set->mask;
+    return slot;
+}
+
+/**
+ * @brief Tells whether the first len characters of a path are in a set.
+ */
+static bool set_contains(const path_set_t *set, const char *path, size_t len)
+{
+    return (set->count > 0) && EXISTS(set->slots[set_slot(set, path, len)]);
+}
+
+/**
+ * @brief Adds the first len characters of a path to a set.
+ * 
+ * @return false if memory ran out.
+ */
+static bool set_add(path_set_t *set, const char *path, size_t len)
+{
+    if (((set->count + 1) * 2) > (set->mask + 1))
+    {
+        size_t slot_count = (set->mask > 0) ? ((set->mask + 1) * 2) : 64;
+        const char **slots = calloc(slot_count, sizeof(char *));
+        if (IS_NULL(slots))
+            return false;
+
+        path_set_t grown = { .slots = slots, .mask = slot_count - 1 };
+        for (size_t i = 0; EXISTS(set->slots) && (i <= set->mask); i++)
+        {
+            if (EXISTS(set->slots[i]))
+                slots[set_slot(&grown, set->slots[i], strlen(set->slots[i]))] = set->slots[i];
+        }
+        free(set->slots);
+        set->slots = slots;
+        set->mask = slot_count - 1;
+    }
+
+    size_t slot = set_slot(set, path, len);
+    if (EXISTS(set->slots[slot]))
+        return true;
+
+    const char *copy = arena_strndup(&set->arena, path, len);
+    if (IS_NULL(copy))
+        return false;
+    set->slots[slot] = copy;
+    set->count++;
+    return true;
+}
+
+/**
+ * @brief Empties a set.
+ */
+static void set_clear(path_set_t *set)
+{
+    if (set->count == 0)
+        return;
+    memset(set->slots, 0, (set->mask + 1) * sizeof(char *));
+    set->count = 0;
+    arena_free(&set->arena);
+}
+
+/**
+ * @brief Frees a set.
+ */
+static void set_free(path_set_t *set)
+{
+    free(set->slots);
+    arena_free(&set->arena);
+}
+
+/**
+ * @brief Marks a directory, and every directory above it, as changed.
+ */
+static void mark_changed(watch_t *watch, const char *path)
+{
+    size_t len = strlen(path);
+    for (;;)
+    {
+        if (!set_add(&watch->changed, path, len))
+        {
+            watch->everything = true; // Cannot tell what changed, so all of it did
+            return;
+        }
+
+        while ((len > 0) && (path[len - 1] != '/')) len--;
+        if (len <= 1)
+            return;
+        len--; // The '/' itself
+    }
+}
+
+/**
+ * @brief Creates a watch. SIGINT and SIGTERM make watch_wait() return
+ * false from then on, so the caller can finish cleanly.
+ * 
+ * @param[in] ingestify        The output being written, kept to tell which
+ *                             files belong to it.
+ * @param[in] output_file_path Path to the output file, changes to it and the
+ *                             files next to it are not changes of the tree.
+ * @param[in] nested_name      Name of nested ignore files, NULL if there are
+ *                             none. A change to one changes everything under
+ *                             its directory.
+ * 
+ * @return watch_t* The watch, NULL if the system has no inotify or memory ran out.
+ */
+watch_t *watch_create(const ingestify_t *ingestify, const char *output_file_path, const char *nested_name)
+{
+    watch_t *watch = calloc(1, sizeof(watch_t));
+    if (IS_NULL(watch))
+    {
+        perror("Memory allocation failed");
+        return NULL;
+    }
+
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd < 0)
+    {
+        perror("Could not start watching");
+        free(watch);
+        return NULL;
+    }
+    watch->ingestify = ingestify;
+    watch->output_file_path = output_file_path;
+    watch->nested_name = nested_name;
+    pthread_mutex_init(&watch->lock, NULL);
+
+    struct sigaction action = { 0 };
+    action.sa_handler = request_stop; // Without SA_RESTART, so the wait is interrupted
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    return watch;
+}
+
+/**
+ * @brief Frees a watch.
+ * 
+ * @param[in] watch The watch, may be NULL.
+ */
+void watch_destroy(watch_t *watch)
+{
+    if (IS_NULL(watch))
+        return;
+
+    close(watch->fd);
+    for (size_t i = 0; i < watch->path_count; i++)
+        free(watch->paths[i]);
+    free(watch->paths);
+    set_free(&watch->changed);
+    set_free(&watch->subtrees);
+    set_free(&watch->unwatched);
+    pthread_mutex_destroy(&watch->lock);
+    free(watch);
+}
+
+/**
+ * @brief Watches a directory that a walk opened, before it reads it, so that
+ * no change after the read goes unseen. Safe to call from many threads at once.
+ * 
+ * @param[in, out] watch The watch.
+ * @param[in]      dir   Open directory.
+ * @param[in]      path  Path of the directory, as the walk has it.
+ */
+void watch_add(watch_t *watch, DIR *dir, const char *path)
+{
+    // Through the open directory, so the path never has to be resolved again
+    char fd_path[64];
+    snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", dirfd(dir));
+    int wd = inotify_add_watch(watch->fd, fd_path, WATCH_EVENTS);
+    char *copy = (wd >= 0) ? strdup(path) : NULL;
+
+    pthread_mutex_lock(&watch->lock);
+    if (IS_NULL(copy))
+    {
+        if ((wd < 0) && !watch->warned)
+        {
+            perror("Could not watch every directory, the ones left out are read again on every change");
+            watch->warned = true;
+        }
+        if (!set_add(&watch->unwatched, path, strlen(path)))
+            watch->everything = true;
+        if (wd >= 0) inotify_rm_watch(watch->fd, wd);
+    }
+    else
+    {
+        if ((size_t)wd >= watch->path_count)
+        {
+            size_t count = (watch->path_count > 0) ? watch->path_count : 1024;
+            while (count <= (size_t)wd) count *= 2;
+            char **paths = realloc(watch->paths, count * sizeof(char *));
+            if (IS_NULL(paths))
+            {
+                free(copy);
+                copy = NULL;
+                watch->everything = true;
+            }
+            else
+            {
+                memset(&paths[watch->path_count], 0, (count - watch->path_count) * sizeof(char *));
+                watch->paths = paths;
+                watch->path_count = count;
+            }
+        }
+
+        // The same directory gives the same descriptor, under its newest path
+        if (EXISTS(copy))
+        {
+            free(watch->paths[wd]);
+            watch->paths[wd] = copy;
+        }
+    }
+    pthread_mutex_unlock(&watch->lock);
+}
+
+/**
+ * @brief Takes in the events that are waiting.
+ * 
+ * @return true if any of them changed the tree.
+ */
+static bool read_events(watch_t *watch)
+{
+    _Alignas(struct inotify_event) char buffer[64 * 1024];
+    bool changed = false;
+
+    pthread_mutex_lock(&watch->lock);
+    for (;;)
+    {
+        ssize_t n = read(watch->fd, buffer, sizeof(buffer));
+        if (n <= 0)
+            break;
+
+        for (ssize_t position = 0; position < n;)
+        {
+            const struct inotify_event *event = (const struct inotify_event *)&buffer[position];
+            position += (ssize_t)(sizeof(struct inotify_event) + event->len);
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                watch->everything = true;
+                changed = true;
+                continue;
+            }
+
+            const char *dir_path = ((event->wd >= 0) && ((size_t)event->wd < watch->path_count)) ? watch->paths[event->wd] : NULL;
+            if (IS_NULL(dir_path))
+                continue;
+
+            if (event->mask & IN_IGNORED)
+            {
+                // The directory is gone, its parent saw that happen
+                free(watch->paths[event->wd]);
+                watch->paths[event->wd] = NULL;
+                continue;
+            }
+
+            if (event->len == 0)
+                continue;
+
+            // The output and the files next to it change on every update
+            char path[PATH_MAX];
+            int len = snprintf(path, sizeof(path), "%s/%s", dir_path, event->name);
+            if ((len > 0) && ((size_t)len < sizeof(path)) && ingestify_is_output(watch->ingestify, skip_dot_slash(path), watch->output_file_path))
+                continue;
+
+            if ((event->mask & IN_ISDIR) && (event->mask & (IN_MOVED_FROM | IN_MOVED_TO)))
+                watch->everything = true; // The paths under it are not what they were
+            else if (EXISTS(watch->nested_name) && (strcmp(event->name, watch->nested_name) == 0) &&
+                     !set_add(&watch->subtrees, dir_path, strlen(dir_path)))
+                watch->everything = true;
+            mark_changed(watch, dir_path);
+            changed = true;
+        }
+    }
+    pthread_mutex_unlock(&watch->lock);
+    return changed;
+}
+
+/**
+ * @brief Milliseconds on a clock that only goes forward.
+ */
+static long long now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Waits for changes, and gathers them until they settle.
+ * 
+ * @param[in, out] watch The watch.
+ * 
+ * @return false if the wait was stopped by a signal or failed.
+ */
+bool watch_wait(watch_t *watch)
+{
+    // What the last walk needed to know is done with
+    pthread_mutex_lock(&watch->lock);
+    set_clear(&watch->changed);
+    set_clear(&watch->subtrees);
+    watch->everything = false;
+    for (size_t i = 0; i <= watch->unwatched.mask && (watch->unwatched.count > 0); i++)
+    {
+        if (EXISTS(watch->unwatched.slots[i]))
+            mark_changed(watch, watch->unwatched.slots[i]);
+    }
+    pthread_mutex_unlock(&watch->lock);
+
+    struct pollfd poll_fd = { .fd = watch->fd, .events = POLLIN };
+    long long first_change = -1;
+    while (!stop_requested)
+    {
+        int timeout = -1;
+        if (first_change >= 0)
+        {
+            long long left = (first_change + WATCH_DEBOUNCE_MAX_MS) - now_ms();
+            if (left <= 0)
+                return true;
+            timeout = (left < WATCH_DEBOUNCE_MS) ? (int)left : WATCH_DEBOUNCE_MS;
+        }
+
+        int ready = poll(&poll_fd, 1, timeout);
+        if (ready < 0)
+        {
+            if (errno == EINTR) continue;
+            perror("Could not wait for changes");
+            return false;
+        }
+        if (ready == 0)
+            return true; // Quiet for long enough
+
+        if (read_events(watch) && (first_change < 0))
+            first_change = now_ms();
+    }
+    return false;
+}
+
+/**
+ * @brief Tells whether nothing in or under a directory changed during the
+ * last watch_wait(), so that it can be taken from the previous output.
+ * 
+ * @param[in] watch The watch.
+ * @param[in] path  Path of the directory, as the walk has it.
+ * 
+ * @return true if it did not change.
+ */
+bool watch_is_clean(const watch_t *watch, const char *path)
+{
+    size_t len = strlen(path);
+    if (watch->everything || set_contains(&watch->changed, path, len))
+        return false;
+
+    // A nested ignore file above it may have changed what is ignored in it
+    while (watch->subtrees.count > 0)
+    {
+        if (set_contains(&watch->subtrees, path, len))
+            return false;
+
+        while ((len > 0) && (path[len - 1] != '/')) len--;
+        if (len <= 1)
+            break;
+        len--;
+    }
+    return true;
+}
+
+#else
+
+// Without inotify there is nothing to wait on
+
+watch_t *watch_create(const ingestify_t *ingestify, const char *output_file_path, const char *nested_name)
+{
+    (void)ingestify, (void)output_file_path, (void)nested_name;
+    fprintf(stderr, "Watching needs inotify, which this system does not have.\n");
+    return NULL;
+}
+
+void watch_destroy(watch_t *watch)
+{
+    (void)watch;
+}
+
+void watch_add(watch_t *watch, DIR *dir, const char *path)
+{
+    (void)watch, (void)dir, (void)path;
+}
+
+bool watch_wait(watch_t *watch)
+{
+    (void)watch;
+    return false;
+}
+
+bool watch_is_clean(const watch_t *watch, const char *path)
+{
+    (void)watch, (void)path;
+    return false;
+}
+
+#endif
+
+// end of file watch.c
@@ -0,0 +1,77 @@
+/**
+ * @file      watch.h
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Watches the directories a walk opened for changes, through
+ *            inotify, and tells the next walk which of them it can take
+ *            from the previous output as they were.
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#ifndef WATCH_H_
+#define WATCH_H_
+
+#include <stdbool.h>
+#include <dirent.h>
+
+#define WATCH_DEBOUNCE_MS     10  /**< Changes are gathered until none came for this long */
+#define WATCH_DEBOUNCE_MAX_MS 250 /**< but no longer than this after the first one */
+
+typedef struct watch watch_t;
+typedef struct ingestify ingestify_t;
+
+/**
+ * @brief Creates a watch. SIGINT and SIGTERM make watch_wait() return
+ * false from then on, so the caller can finish cleanly.
+ * 
+ * @param[in] ingestify        The output being written, kept to tell which
+ *                             files belong to it.
+ * @param[in] output_file_path Path to the output file, changes to it and the
+ *                             files next to it are not changes of the tree.
+ * @param[in] nested_name      Name of nested ignore files, NULL if there are
+ *                             none. A change to one changes everything under
+ *                             its directory.
+ * 
+ * @return watch_t* The watch, NULL if the system has no inotify or memory ran out.
+ */
+watch_t *watch_create(const ingestify_t *ingestify, const char *output_file_path, const char *nested_name);
+
+/**
+ * @brief Frees a watch.
+ * 
+ * @param[in] watch The watch, may be NULL.
+ */
+void watch_destroy(watch_t *watch);
+
+/**
+ * @brief Watches a directory that a walk opened, before it reads it, so that
+ * no change after the read goes unseen. Safe to call from many threads at once.
+ * 
+ * @param[in, out] watch The watch.
+ * @param[in]      dir   Open directory.
+ * @param[in]      path  Path of the directory, as the walk has it.
+ */
+void watch_add(watch_t *watch, DIR *dir, const char *path);
+
+/**
+ * @brief Waits for changes, and gathers them until they settle.
+ * 
+ * @param[in, out] watch The watch.
+ * 
+ * @return false if the wait was stopped by a signal or failed.
+ */
+bool watch_wait(watch_t *watch);
+
+/**
+ * @brief Tells whether nothing in or under a directory changed during the
+ * last watch_wait(), so that it can be taken from the previous output.
+ * 
+ * @param[in] watch The watch.
+ * @param[in] path  Path of the directory, as the walk has it.
+ * 
+ * @return true if it did not change.
+ */
+bool watch_is_clean(const watch_t *watch, const char *path);
+
+#endif // WATCH_H_
@@ -0,0 +1,697 @@
+/**
+ * @file      writer.c
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Buffered output file. Small writes are gathered in a large
+ *            buffer, a write that does not fit goes out together with the
+ *            buffer in one writev().
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#include "writer.h"
+#include "common.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if !defined(_WIN32)
+#include <sys/uio.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(_WIN32) && !defined(O_CLOEXEC)
+#define O_CLOEXEC 0 /**< Nothing is exec-ed there, and files are not replaced */
+#endif
+
+struct writer
+{
+    int fd;             /**< -1 while the previous output is still the same */
+    char *buffer;
+    size_t capacity;
+    size_t used;        /**< Bytes in the buffer */
+    size_t written;     /**< Bytes written to the file, or given to it */
+    bool failed;        /**< Something could not be written */
+
+    int old_fd;         /**< Previous output, -1 without one */
+    size_t old_size;
+    size_t copy_offset; /**< Part of the previous output that goes after the buffer, */
+    size_t copy_size;   /**< copied once the next part does not follow on from it */
+    char *path;         /**< Path of the output, with room for WRITER_TEMP_SUFFIX */
+    writer_sink_t sink; /**< Takes the buffer instead of the file, if it has a write */
+    transfer_method_t transfer; /**< How the kernel moves bytes into the file */
+};
+
+/**
+ * @brief Allocates a writer and its buffer.
+ * 
+ * @return writer_t* The writer, NULL if memory ran out, with errno set.
+ */
+static writer_t *writer_alloc(size_t buffer_size)
+{
+    if (buffer_size < BUFSIZ)
+        buffer_size = BUFSIZ;
+
+    writer_t *writer = calloc(1, sizeof(writer_t));
+    char *buffer = malloc(buffer_size);
+    if (IS_NULL(writer) || IS_NULL(buffer))
+    {
+        free(writer);
+        free(buffer);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    writer->fd = -1;
+    writer->old_fd = -1;
+    writer->transfer = TRANSFER_NONE;
+    writer->buffer = buffer;
+    writer->capacity = buffer_size;
+    return writer;
+}
+
+/**
+ * @brief Creates or truncates an output file.
+ * 
+ * @param[in] path        Path to the output file.
+ * @param[in] buffer_size Size of the buffer, at least BUFSIZ is used.
+ * 
+ * @return writer_t* The writer, NULL on failure, with errno set.
+ */
+writer_t *writer_open(const char *path, size_t buffer_size)
+{
+    writer_t *writer = writer_alloc(buffer_size);
+    if (IS_NULL(writer))
+        return NULL;
+
+#if defined(_WIN32)
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_TEXT, 0666); // Same newlines as fopen(path, "w")
+#else
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+#endif
+    if (fd < 0)
+    {
+        free(writer->buffer);
+        free(writer);
+        return NULL;
+    }
+
+    writer->fd = fd;
+    writer->transfer = fd_transfer_method(fd);
+    return writer;
+}
+
+/**
+ * @brief Creates a writer that sends its buffer to a sink. Parts of a
+ * previous output cannot be taken into it, and writer_fd() has no file.
+ * 
+ * @param[in] sink        The sink, closed with the writer, or right away
+ *                        if the writer could not be created.
+ * @param[in] buffer_size Size of the buffer, at least BUFSIZ is used.
+ * 
+ * @return writer_t* The writer, NULL if memory ran out, with errno set.
+ */
+writer_t *writer_open_sink(const writer_sink_t *sink, size_t buffer_size)
+{
+    writer_t *writer = writer_alloc(buffer_size);
+    if (IS_NULL(writer))
+    {
+        sink->close(sink->context);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    writer->sink = *sink;
+    return writer;
+}
+
+/**
+ * @brief Opens an output file for a run that takes parts of the previous
+ * output. The previous output is left as it is for as long as the bytes
+ * written match it, and is replaced once they differ, so an unchanged output
+ * is not written at all.
+ * 
+ * @param[in] path        Path to the output file.
+ * @param[in] buffer_size Size of the buffer, at least BUFSIZ is used.
+ * 
+ * @return writer_t* The writer, NULL on failure, with errno set.
+ */
+writer_t *writer_open_over(const char *path, size_t buffer_size)
+{
+#if defined(_WIN32)
+    return writer_open(path, buffer_size); // Newlines are translated, so offsets do not match
+#else
+    int old_fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat old_stat;
+    if ((old_fd < 0) || (fstat(old_fd, &old_stat) != 0) || !S_ISREG(old_stat.st_mode))
+    {
+        if (old_fd >= 0) close(old_fd);
+        return writer_open(path, buffer_size);
+    }
+
+    size_t path_len = strlen(path);
+    writer_t *writer = writer_alloc(buffer_size);
+    char *path_copy = malloc(path_len + sizeof(WRITER_TEMP_SUFFIX));
+    if (IS_NULL(writer) || IS_NULL(path_copy))
+    {
+        if (EXISTS(writer)) free(writer->buffer);
+        free(writer);
+        free(path_copy);
+        close(old_fd);
+        errno = ENOMEM;
+        return NULL;
+    }
+    memcpy(path_copy, path, path_len + 1);
+
+    writer->old_fd = old_fd;
+    writer->old_size = (size_t)old_stat.st_size;
+    writer->path = path_copy;
+    return writer;
+#endif
+}
+
+/**
+ * @brief Writes a list of byte ranges, continuing after short writes.
+ * 
+ * @return false if the file did not take them.
+ */
+static bool write_all(int fd, const void **bases, size_t *lengths, int count)
+{
+#if defined(_WIN32)
+    for (int i = 0; i < count; i++)
+    {
+        const char *data = bases[i];
+        size_t left = lengths[i];
+        while (left > 0)
+        {
+            int n = write(fd, data, (unsigned int)left);
+            if (n <= 0) return false;
+            data += n;
+            left -= (size_t)n;
+        }
+    }
+    return true;
+#else
+    struct iovec iov[2];
+    int first = 0;
+    for (int i = 0; i < count; i++)
+    {
+        iov[i].iov_base = (void *)bases[i];
+        iov[i].iov_len = lengths[i];
+    }
+
+    while (first < count)
+    {
+        ssize_t n = writev(fd, &iov[first], count - first);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            return false;
+        }
+
+        // Skip what went out, the rest of a range that went out partly stays
+        size_t done = (size_t)n;
+        while ((first < count) && (done >= iov[first].iov_len))
+        {
+            done -= iov[first].iov_len;
+            first++;
+        }
+        if (first < count)
+        {
+            iov[first].iov_base = (char *)iov[first].iov_base + done;
+            iov[first].iov_len -= done;
+        }
+    }
+    return true;
+#endif
+}
+
+/**
+ * @brief Copies part of the previous output to the end of the file, inside
+ * the kernel where it can.
+ * 
+ * @return false if not all of it could be copied.
+ */
+static bool copy_old(writer_t *writer, size_t offset, size_t size)
+{
+    if (lseek(writer->old_fd, (off_t)offset, SEEK_SET) != (off_t)offset)
+        return false;
+
+    bool refused;
+    int error;
+    size_t done = fd_transfer(writer->fd, writer->old_fd, size, writer->transfer, &refused, &error);
+    while (refused && (done < size))
+    {
+        char chunk[BUFSIZ];
+        size_t wanted = ((size - done) < sizeof(chunk)) ? (size - done) : sizeof(chunk);
+        size_t n = read_full(writer->old_fd, chunk, wanted);
+        const void *bases[1] = { chunk };
+        size_t lengths[1] = { n };
+        if ((n == 0) || !write_all(writer->fd, bases, lengths, 1))
+            break;
+        done += n;
+    }
+    return (done == size);
+}
+
+/**
+ * @brief Copies the part of the previous output that writer_reuse() held back.
+ */
+static void flush_copy(writer_t *writer)
+{
+    uint64_t started = stats_begin();
+    if (!writer->failed && !copy_old(writer, writer->copy_offset, writer->copy_size))
+    {
+        perror("Error writing output file");
+        writer->failed = true;
+    }
+    stats_end(STATS_WRITE, started, writer->copy_size);
+    writer->copy_size = 0;
+}
+
+/**
+ * @brief Starts the file that replaces the previous output, once what is
+ * written differs from it, with the part of it that did not differ.
+ * 
+ * @return false if it could not be started.
+ */
+static bool start_file(writer_t *writer)
+{
+    size_t path_len = strlen(writer->path);
+    memcpy(&writer->path[path_len], WRITER_TEMP_SUFFIX, sizeof(WRITER_TEMP_SUFFIX));
+    writer->fd = open(writer->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    writer->path[path_len] = '\0';
+    if (writer->fd >= 0)
+        writer->transfer = fd_transfer_method(writer->fd);
+
+    if ((writer->fd < 0) || !copy_old(writer, 0, writer->written - writer->used))
+    {
+        perror("Error writing output file");
+        writer->failed = true;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Writes out the buffer, together with the bytes that did not fit.
+ */
+static void flush_with(writer_t *writer, const void *data, size_t size)
+{
+    const void *bases[2];
+    size_t lengths[2];
+    int count = 0;
+
+    if (writer->used > 0) { bases[count] = writer->buffer; lengths[count++] = writer->used; }
+    if (size > 0)         { bases[count] = data;           lengths[count++] = size; }
+    uint64_t started = (count > 0) ? stats_begin() : 0;
+
+    if ((count > 0) && EXISTS(writer->sink.write) && !writer->failed)
+    {
+        writer->failed = !writer->sink.write(writer->sink.context, bases, lengths, count);
+        stats_end(STATS_WRITE, started, writer->used + size);
+        writer->used = 0;
+        return;
+    }
+
+    if ((count > 0) && (writer->fd < 0) && !writer->failed)
+        start_file(writer);
+
+    if ((count > 0) && !writer->failed && !write_all(writer->fd, bases, lengths, count))
+    {
+        perror("Error writing output file");
+        writer->failed = true;
+    }
+    stats_end(STATS_WRITE, started, writer->used + size);
+    writer->used = 0;
+}
+
+/**
+ * @brief Puts the new output in place of the previous one, or, if it never
+ * differed, cuts the previous one to the new size.
+ * 
+ * @return false if the output could not be put in place.
+ */
+static bool finish_over(writer_t *writer, bool ok)
+{
+    size_t path_len = strlen(writer->path);
+    memcpy(&writer->path[path_len], WRITER_TEMP_SUFFIX, sizeof(WRITER_TEMP_SUFFIX));
+    char *temp_path = strdup(writer->path);
+    writer->path[path_len] = '\0';
+    if (IS_NULL(temp_path))
+    {
+        perror("Memory allocation failed");
+        return false;
+    }
+
+    if (writer->fd < 0)
+    {
+        if (ok && (writer->written < writer->old_size))
+        {
+            int fd = open(writer->path, O_WRONLY | O_CLOEXEC);
+            if ((fd < 0) || (ftruncate(fd, (off_t)writer->written) != 0))
+            {
+                perror("Error writing output file");
+                ok = false;
+            }
+            if (fd >= 0) close(fd);
+        }
+    }
+    else if (!ok)
+    {
+        remove(temp_path); // The previous output stays, untouched
+    }
+    else if (rename(temp_path, writer->path) != 0)
+    {
+        perror("Error replacing output file");
+        remove(temp_path);
+        ok = false;
+    }
+
+    free(temp_path);
+    return ok;
+}
+
+/**
+ * @brief Writes what is left in the buffer, closes the file and frees the writer.
+ * 
+ * @param[in] writer The writer, may be NULL.
+ * 
+ * @return false if anything could not be written.
+ */
+bool writer_close(writer_t *writer)
+{
+    if (IS_NULL(writer))
+        return true;
+
+    if (writer->copy_size > 0) flush_copy(writer);
+    flush_with(writer, NULL, 0);
+    bool ok = !writer->failed;
+    if ((writer->fd >= 0) && (close(writer->fd) != 0))
+    {
+        perror("Error closing output file");
+        ok = false;
+    }
+    if (EXISTS(writer->sink.close) && !writer->sink.close(writer->sink.context))
+        ok = false;
+
+    if (writer->old_fd >= 0)
+    {
+        close(writer->old_fd);
+        ok = finish_over(writer, ok);
+    }
+
+    free(writer->path);
+    free(writer->buffer);
+    free(writer);
+    return ok;
+}
+
+/**
+ * @brief Writes bytes, through the buffer if they fit in it.
+ * 
+ * @param[in, out] writer The writer.
+ * @param[in]      data   Bytes to write.
+ * @param[in]      size   Number of bytes.
+ */
+void writer_write(writer_t *writer, const void *data, size_t size)
+{
+    if (writer->copy_size > 0) flush_copy(writer);
+    writer->written += size;
+    if (size <= (writer->capacity - writer->used))
+    {
+        memcpy(&writer->buffer[writer->used], data, size);
+        writer->used += size;
+        return;
+    }
+
+    // Too large for what is left, so it goes out with the buffer, without being copied
+    flush_with(writer, data, size);
+}
+
+/**
+ * @brief Writes formatted text, like fprintf().
+ * 
+ * @param[in, out] writer The writer.
+ * @param[in]      format Format string.
+ */
+void writer_printf(writer_t *writer, const char *format, ...)
+{
+    if (writer->copy_size > 0) flush_copy(writer);
+    va_list args;
+    va_start(args, format);
+    size_t room = writer->capacity - writer->used;
+    int n = vsnprintf(&writer->buffer[writer->used], room, format, args);
+    va_end(args);
+    if (n < 0)
+        return;
+
+    if ((size_t)n < room)
+    {
+        writer->used += (size_t)n;
+        writer->written += (size_t)n;
+        return;
+    }
+
+    // Did not fit, so it is formatted on its own, and written like any other bytes
+    char *text = malloc((size_t)n + 1);
+    if (IS_NULL(text))
+    {
+        perror("Memory allocation failed");
+        writer->failed = true;
+        return;
+    }
+    va_start(args, format);
+    vsnprintf(text, (size_t)n + 1, format, args);
+    va_end(args);
+    writer_write(writer, text, (size_t)n);
+    free(text);
+}
+
+/**
+ * @brief Makes room for bytes at the end of the buffer, so that they can be
+ * read straight into it. They are only written after writer_commit().
+ * 
+ * @param[in, out] writer The writer.
+ * @param[in]      size   Number of bytes, at most BUFSIZ.
+ * 
+ * @return char* Where the bytes go.
+ */
+char *writer_reserve(writer_t *writer, size_t size)
+{
+    if (writer->copy_size > 0) flush_copy(writer);
+    if (size > (writer->capacity - writer->used))
+        flush_with(writer, NULL, 0);
+    return &writer->buffer[writer->used];
+}
+
+/**
+ * @brief Adds bytes put at writer_reserve() to the output.
+ * 
+ * @param[in, out] writer The writer.
+ * @param[in]      size   Number of bytes, at most what was reserved.
+ */
+void writer_commit(writer_t *writer, size_t size)
+{
+    writer->used += size;
+    writer->written += size;
+}
+
+/**
+ * @brief Writes out the buffer, and gives the file so that something else,
+ * like the kernel, can write to it directly.
+ * 
+ * @param[in, out] writer The writer.
+ * 
+ * @return int The file descriptor, -1 if the buffer could not be written,
+ * or the writer sends it to a sink.
+ */
+int writer_fd(writer_t *writer)
+{
+    if (EXISTS(writer->sink.write))
+        return -1; // The bytes have to go through the sink
+    if ((writer->fd < 0) && !writer->failed)
+        start_file(writer);
+    flush_with(writer, NULL, 0);
+    if (writer->copy_size > 0) flush_copy(writer);
+    return writer->failed ? -1 : writer->fd;
+}
+
+/**
+ * @brief Gives how fd_transfer() moves bytes into writer_fd(), decided once
+ * when the file was opened.
+ * 
+ * @param[in] writer The writer.
+ * 
+ * @return transfer_method_t The method to start with.
+ */
+transfer_method_t writer_transfer_method(const writer_t *writer)
+{
+    return writer->transfer;
+}
+
+/**
+ * @brief Writes out the buffer, so that everything written so far has
+ * reached the file or the sink. While an output from writer_open_over()
+ * still matches the previous one, nothing is written.
+ * 
+ * @param[in, out] writer The writer.
+ * 
+ * @return false if the output failed.
+ */
+bool writer_flush(writer_t *writer)
+{
+    if (EXISTS(writer->sink.write) || (writer->fd >= 0))
+    {
+        flush_with(writer, NULL, 0);
+        if (writer->copy_size > 0) flush_copy(writer);
+    }
+    return !writer->failed;
+}
+
+/**
+ * @brief Accounts for bytes written to writer_fd() directly.
+ * 
+ * @param[in, out] writer The writer.
+ * @param[in]      size   Number of bytes.
+ */
+void writer_wrote(writer_t *writer, size_t size)
+{
+    writer->written += size;
+}
+
+/**
+ * @brief Writes a part of the previous output again, from writer_open_over().
+ * While everything so far matches the previous output, and the part is
+ * where it was, nothing is written at all. Otherwise the part is copied
+ * inside the kernel, together with the parts after it that followed it in
+ * the previous output, once something else is written.
+ * 
+ * @param[in, out] writer The writer.
+ * @param[in]      offset Where the part starts in the previous output.
+ * @param[in]      size   Number of bytes.
+ * 
+ * @return false if the part is not in the previous output, or the output
+ * failed. Nothing was written then, the bytes have to come from elsewhere.
+ */
+bool writer_reuse(writer_t *writer, size_t offset, size_t size)
+{
+    if ((writer->old_fd < 0) || writer->failed || (offset > writer->old_size) || (size > (writer->old_size - offset)))
+        return false;
+
+    if ((writer->fd < 0) && (writer->used == 0) && (offset == writer->written))
+    {
+        writer->written += size;
+        return true;
+    }
+
+    // Parts that follow each other in the previous output are copied together
+    if ((writer->copy_size > 0) && ((writer->copy_offset + writer->copy_size) == offset))
+    {
+        writer->copy_size += size;
+        writer->written += size;
+        return true;
+    }
+
+    if (writer_fd(writer) < 0)
+        return false;
+
+    writer->copy_offset = offset;
+    writer->copy_size = size;
+    writer->written += size;
+    return true;
+}
+
+/**
+ * @brief Writes bytes again over bytes written before, like a header whose
+ * contents are only known once what follows it was written.
+ * 
+ * @param[in, out] writer The writer.
+ * @param[in]      offset Where the bytes start in the output.
+ * @param[in]      data   Bytes to write.
+ * @param[in]      size   Number of bytes.
+ * 
+ * @return false if the bytes there were not written through the buffer,
+ * but taken from the previous output, or the output failed.
+ */
+bool writer_patch(writer_t *writer, size_t offset, const void *data, size_t size)
+{
+    // The file, then either the part of the previous output held back or the buffer
+    size_t file_end = writer->written - writer->used - writer->copy_size;
+    if (writer->failed || (offset > writer->written) || (size > (writer->written - offset)))
+        return false;
+    if ((writer->copy_size > 0) && ((offset + size) > file_end))
+        return false;
+    if ((offset < file_end) && (writer->fd < 0))
+        return false; // Still the previous output, or already in the sink
+
+    if ((offset + size) > file_end)
+    {
+        size_t start = (offset > file_end) ? offset : file_end;
+        memcpy(&writer->buffer[start - file_end], &((const char *)data)[start - offset], offset + size - start);
+        size = start - offset;
+    }
+    if (size == 0)
+        return true;
+
+#if defined(_WIN32)
+    return false; // Newlines are translated, so offsets in the file do not match
+#else
+    const char *bytes = data;
+    while (size > 0)
+    {
+        ssize_t n = pwrite(writer->fd, bytes, size, (off_t)offset);
+        if ((n < 0) && (errno == EINTR))
+            continue;
+        if (n <= 0)
+        {
+            perror("Error writing output file");
+            writer->failed = true;
+            return false;
+        }
+        bytes += n;
+        offset += (size_t)n;
+        size -= (size_t)n;
+    }
+    return true;
+#endif
+}
+
+/**
+ * @brief Tells whether writer_patch() can reach bytes that already left the
+ * buffer, which it cannot once they went to a sink or through newline
+ * translation.
+ * 
+ * @param[in] writer The writer.
+ * 
+ * @return true if only bytes taken from the previous output are out of reach.
+ */
+bool writer_can_patch(const writer_t *writer)
+{
+#if defined(_WIN32)
+    (void)writer;
+    return false;
+#else
+    return IS_NULL(writer->sink.write);
+#endif
+}
+
+/**
+ * @brief Number of bytes written so far, buffered or not.
+ * 
+ * @param[in] writer The writer.
+ * 
+ * @return size_t Bytes written.
+ */
+size_t writer_size(const writer_t *writer)
+{
+    return writer->written;
+}
+
+// end of file writer.c
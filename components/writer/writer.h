@@ -0,0 +1,205 @@
+/**
+ * @file      writer.h
+ * @author    Usman Mehmood (usmanmehmood55@gmail.com)
+ * @brief     Buffered output file. Small writes are gathered in a large
+ *            buffer, a write that does not fit goes out together with the
+ *            buffer in one writev().
+ * @version   0.1
+ * @date      2024-07-24
+ * @copyright Usman Mehmood 2024
+ */
+
+#ifndef WRITER_H_
+#define WRITER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "common.h"
+
+#define WRITER_BUFFER_DEFAULT (1024 * 1024) /**< Buffer size without --out-buffer */
+#define WRITER_TEMP_SUFFIX    ".tmp"          /**< Added to the path of an output that replaces another */
+
+typedef struct writer writer_t;
+
+/**
+ * @brief Where a writer can send its buffer instead of to a file, like a
+ * compressor. Every byte is handed over once, in order.
+ */
+typedef struct
+{
+    bool (*write)(void *context, const void **bases, const size_t *lengths, int count); /**< false if the output failed */
+    bool (*close)(void *context);                                                      /**< Writes what is held back, and frees the sink */
+    void *context;
+} writer_sink_t;
+
+/**
+ * @brief Creates or truncates an output file.
+ * 
+ * @param[in] path        Path to the output file.
+ * @param[in] buffer_size Size of the buffer, at least BUFSIZ is used.
+ * 
+ * @return writer_t* The writer, NULL on failure, with errno set.
+ */
+writer_t *writer_open(const char *path, size_t buffer_size);
+
+/**
+ * @brief Creates a writer that sends its buffer to a sink. Parts of a
+ * previous output cannot be taken into it, and writer_fd() has no file.
+ * 
+ * @param[in] sink        The sink, closed with the writer, or right away
+ *                        if the writer could not be created.
+ * @param[in] buffer_size Size of the buffer, at least BUFSIZ is used.
+ * 
+ * @return writer_t* The writer, NULL if memory ran out, with errno set.
+ */
+writer_t *writer_open_sink(const writer_sink_t *sink, size_t buffer_size);
+
+/**
+ * @brief Opens an output file for a run that takes parts of the previous
+ * output. The previous output is left as it is for as long as the bytes
+ * written match it, and is replaced once they differ, so an unchanged output
+ * is not written at all.
+ * 
+ * @param[in] path        Path to the output file.
+ * @param[in] buffer_size Size of the buffer, at least BUFSIZ is used.
+ * 
+ * @return writer_t* The writer, NULL on failure, with errno set.
+ */
+writer_t *writer_open_over(const char *path, size_t buffer_size);
+
+/**
+ * @brief Writes what is left in the buffer, closes the file and frees the writer.
+ * 
+ * @param[in] writer The writer, may be NULL.
+ * 
+ * @return false if anything could not be written.
+ */
+bool writer_close(writer_t *writer);
+
+/**
+ * @brief Writes bytes, through the buffer if they fit in it.
+ * 
+ * @param[in, out] writer The writer.
+ * @param[in]      data   Bytes to write.
+ * @param[in]      size   Number of bytes.
+ */
+void writer_write(writer_t *writer, const void *data, size_t size);
+
+/**
+ * @brief Writes formatted text, like fprintf().
+ * 
+ * @param[in, out] writer The writer.
+ * @param[in]      format Format string.
+ */
+void writer_printf(writer_t *writer, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Makes room for bytes at the end of the buffer, so that they can be
+ * read straight into it. They are only written after writer_commit().
+ * 
+ * @param[in, out] writer The writer.
+ * @param[in]      size   Number of bytes, at most BUFSIZ.
+ * 
+ * @return char* Where the bytes go.
+ */
+char *writer_reserve(writer_t *writer, size_t size);
+
+/**
+ * @brief Adds bytes put at writer_reserve() to the output.
+ * 
+ * @param[in, out] writer The writer.
+ * @param[in]      size   Number of bytes, at most what was reserved.
+ */
+void writer_commit(writer_t *writer, size_t size);
+
+/**
+ * @brief Writes out the buffer, and gives the file so that something else,
+ * like the kernel, can write to it directly.
+ * 
+ * @param[in, out] writer The writer.
+ * 
+ * @return int The file descriptor, -1 if the buffer could not be written,
+ * or the writer sends it to a sink.
+ */
+int writer_fd(writer_t *writer);
+
+/**
+ * @brief Gives how fd_transfer() moves bytes into writer_fd(), decided once
+ * when the file was opened.
+ * 
+ * @param[in] writer The writer.
+ * 
+ * @return transfer_method_t The method to start with.
+ */
+transfer_method_t writer_transfer_method(const writer_t *writer);
+
+/**
+ * @brief Writes out the buffer, so that everything written so far has
+ * reached the file or the sink. While an output from writer_open_over()
+ * still matches the previous one, nothing is written.
+ * 
+ * @param[in, out] writer The writer.
+ * 
+ * @return false if the output failed.
+ */
+bool writer_flush(writer_t *writer);
+
+/**
+ * @brief Accounts for bytes written to writer_fd() directly.
+ * 
+ * @param[in, out] writer The writer.
+ * @param[in]      size   Number of bytes.
+ */
+void writer_wrote(writer_t *writer, size_t size);
+
+/**
+ * @brief Writes a part of the previous output again, from writer_open_over().
+ * While everything so far matches the previous output, and the part is
+ * where it was, nothing is written at all. Otherwise the part is copied
+ * inside the kernel, together with the parts after it that followed it in
+ * the previous output, once something else is written.
+ * 
+ * @param[in, out] writer The writer.
+ * @param[in]      offset Where the part starts in the previous output.
+ * @param[in]      size   Number of bytes.
+ * 
+ * @return false if the part is not in the previous output, or the output
+ * failed. Nothing was written then, the bytes have to come from elsewhere.
+ */
+bool writer_reuse(writer_t *writer, size_t offset, size_t size);
+
+/**
+ * @brief Writes bytes again over bytes written before, like a header whose
+ * contents are only known once what follows it was written.
+ * 
+ * @param[in, out] writer The writer.
+ * @param[in]      offset Where the bytes start in the output.
+ * @param[in]      data   Bytes to write.
+ * @param[in]      size   Number of bytes.
+ * 
+ * @return false if the bytes there were not written through the buffer,
+ * but taken from the previous output, or the output failed.
+ */
+bool writer_patch(writer_t *writer, size_t offset, const void *data, size_t size);
+
+/**
+ * @brief Tells whether writer_patch() can reach bytes that already left the
+ * buffer, which it cannot once they went to a sink or through newline
+ * translation.
+ * 
+ * @param[in] writer The writer.
+ * 
+ * @return true if only bytes taken from the previous output are out of reach.
+ */
+bool writer_can_patch(const writer_t *writer);
+
+/**
+ * @brief Number of bytes written so far, buffered or not.
+ * 
+ * @param[in] writer The writer.
+ * 
+ * @return size_t Bytes written.
+ */
+size_t writer_size(const writer_t *writer);
+
+#endif // WRITER_H_
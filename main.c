@@ -9,10 +9,277 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "common.h"
+#include "dedup.h"
+#include "compress.h"
+#include "toc.h"
+#include "shard.h"
+#include "stats.h"
+#include "trace.h"
 #include "ignore.h"
 #include "ingestify.h"
+#include "manifest.h"
+#include "progress.h"
+#include "pwalk.h"
+#include "watch.h"
+#include "writer.h"
+
+/**
+ * @brief Prints how the program is used.
+ * 
+ * @param[in] program Name of the program, argv[0].
+ */
+static void print_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [options] <directory> <output_file> [ignore_file]\n", program);
+    fprintf(stderr, "       %s --list <output_file>\n", program);
+    fprintf(stderr, "       %s --extract <path> <output_file>\n", program);
+    fprintf(stderr, "  -j <threads>         Walk with this many worker threads\n");
+    fprintf(stderr, "  --max-bytes <size>   Stop once the output has this many bytes of file contents,\n");
+    fprintf(stderr, "                       K, M and G suffixes are allowed. Twice the input by default\n");
+    fprintf(stderr, "  --out-buffer <size>  Gather this much output before writing it, 1M by default\n");
+    fprintf(stderr, "  --mmap-min <size>    Map files from this size on and write the mapping\n");
+    fprintf(stderr, "  --no-uring           Read files with plain system calls, not io_uring\n");
+    fprintf(stderr, "  --nested-ignore <name>\n");
+    fprintf(stderr, "                       Also read ignore files of this name, like .gitignore,\n");
+    fprintf(stderr, "                       in every folder, for what is under that folder\n");
+    fprintf(stderr, "  --quiet              Do not list the files written and ignored\n");
+    fprintf(stderr, "  --progress           Show running counts instead of listing files\n");
+    fprintf(stderr, "  --incremental        Keep a manifest next to the output, and take files that did\n");
+    fprintf(stderr, "                       not change since the last run from the previous output\n");
+    fprintf(stderr, "  --keep-binary        Write binary files whole, not only their size\n");
+    fprintf(stderr, "  --dedup              Write files whose contents were written before as a\n");
+    fprintf(stderr, "                       reference to the first file that had them\n");
+    fprintf(stderr, "  --tokens             Estimate the tokens of every file, and write them in its header\n");
+    fprintf(stderr, "  --max-tokens <count> Stop once the output has this many tokens of file contents\n");
+    fprintf(stderr, "  --file-max-tokens <count>\n");
+    fprintf(stderr, "                       Cut every file at this many tokens\n");
+    fprintf(stderr, "  --compress <format>  Compress the output as it is written, gzip or zstd\n");
+    fprintf(stderr, "  --index              Write an index at the end of the output, of where every file is\n");
+    fprintf(stderr, "  --shard-size <size>  Split the output into files of at most this size, named\n");
+    fprintf(stderr, "                       like out.1.txt, cut between files\n");
+    fprintf(stderr, "  --shard-tokens <count>\n");
+    fprintf(stderr, "                       Split the output into files of at most this many tokens\n");
+    fprintf(stderr, "  --shards <count>     Split the output into this many files of about the same size\n");
+    fprintf(stderr, "  --stats              Print where the time of the walk went, the ignore rules by the\n");
+    fprintf(stderr, "                       paths they decided on, and the slowest files and folders\n");
+    fprintf(stderr, "  --stats-top <count>  Print this many of the slowest files and folders, 10 by default\n");
+    fprintf(stderr, "  --trace <path>       Record every folder, file, open, read and write of the walk\n");
+    fprintf(stderr, "                       as Chrome trace events, for Perfetto or chrome://tracing\n");
+    fprintf(stderr, "  --watch              Stay running and update the output when the folder changes,\n");
+    fprintf(stderr, "                       taking the folders that did not from the previous output\n");
+}
+
+/**
+ * @brief Parses a positive count, like the number of threads.
+ * 
+ * @param[in]  str       String to parse.
+ * @param[out] count_out Parsed count.
+ * 
+ * @return true on success.
+ */
+static bool parse_count(const char *str, unsigned int *count_out)
+{
+    char *end = NULL;
+    unsigned long count = strtoul(str, &end, 10);
+    if ((end == str) || (*end != '\0') || (count == 0) || (count > 1024))
+    {
+        return false;
+    }
+    *count_out = (unsigned int)count;
+    return true;
+}
+
+/**
+ * @brief Parses a size in bytes, with an optional K, M or G suffix.
+ * 
+ * @param[in]  str      String to parse.
+ * @param[out] size_out Parsed size.
+ * 
+ * @return true on success.
+ */
+static bool parse_size(const char *str, off_t *size_out)
+{
+    char *end = NULL;
+    unsigned long long size = strtoull(str, &end, 10);
+    if ((end == str) || (str[0] == '-'))
+    {
+        return false;
+    }
+
+    unsigned int shift = 0;
+    switch (*end)
+    {
+        case 'K': case 'k': shift = 10; end++; break;
+        case 'M': case 'm': shift = 20; end++; break;
+        case 'G': case 'g': shift = 30; end++; break;
+        default: break;
+    }
+    if ((*end != '\0') || (size == 0) || (size > (0x7FFFFFFFFFFFFFFFULL >> shift)))
+    {
+        return false;
+    }
+
+    *size_out = (off_t)(size << shift);
+    return true;
+}
+
+/**
+ * @brief Milliseconds on a clock that only goes forward.
+ */
+static double now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1000.0 + (double)now.tv_nsec / 1000000.0;
+}
+
+/**
+ * @brief Writes the output again after every change, until a signal stops
+ * it. The output just written is the previous one of the next, so only what
+ * changed is read.
+ * 
+ * @param[in, out] ingestify        The output being written, and its options.
+ * @param[in]      directory        Path to the directory.
+ * @param[in]      ignore           Ignore rules of the directory.
+ * @param[in]      output_file_path Path to the output file.
+ * @param[in]      out_buffer_size  Size of the output buffer.
+ * @param[in]      max_output_size  Maximum allowed size for the output file.
+ * @param[in, out] watch            The watch, filled by the first walk.
+ * @param[in, out] previous         Manifest of the output before the last one.
+ * @param[in, out] next             Manifest of the last output.
+ * 
+ * @return false if an update could not be written.
+ */
+static bool watch_and_update(ingestify_t *ingestify, const char *directory, ignore_set_t *ignore, const char *output_file_path, off_t out_buffer_size,
+                             off_t max_output_size, watch_t *watch, manifest_t **previous, manifest_t **next)
+{
+    fprintf(stderr, "Watching %s, stop with Ctrl+C.\n", directory);
+    while (watch_wait(watch))
+    {
+        double started = now_ms();
+        manifest_free(*previous);
+        *previous = *next;
+        *next = manifest_create();
+        if (IS_NULL(*next) || !manifest_index(*previous))
+        {
+            perror("Memory allocation failed");
+            return false;
+        }
+
+        writer_t *output = writer_open_over(output_file_path, (size_t)out_buffer_size);
+        if (IS_NULL(output))
+        {
+            perror("Error opening output file");
+            return false;
+        }
+        ingestify_set_manifests(ingestify, *previous, *next);
+        ingestify_start_output(ingestify);
+
+        bool opened = ingestify_traverse_and_write(ingestify, directory, ignore, output, output_file_path, max_output_size);
+        ingestify_finish_output(ingestify, output);
+        if (!writer_close(output) || !opened)
+            return false;
+        fprintf(stderr, "Updated %s in %.1f ms\n", output_file_path, now_ms() - started);
+    }
+    return true;
+}
+
+/**
+ * @brief Reads the index at the end of an output written with --index, and
+ * lists the files in it, or writes the contents of one of them to stdout.
+ * 
+ * @param[in] output_file_path Path to the output file.
+ * @param[in] file_path        Path of the file to write, as in its header,
+ *                             NULL to list them all.
+ * 
+ * @return int Exit status.
+ */
+static int read_index(const char *output_file_path, const char *file_path)
+{
+    toc_t *toc = toc_open(output_file_path);
+    if (IS_NULL(toc))
+        return EXIT_FAILURE;
+
+    bool done = true;
+    if (IS_NULL(file_path))
+    {
+        for (size_t i = 0; i < toc_count(toc); i++)
+        {
+            const toc_entry_t *entry = toc_entry(toc, i);
+            printf("%10llu  %s\n", (unsigned long long)entry->length, entry->path);
+        }
+    }
+    else
+    {
+        const toc_entry_t *entry = toc_find(toc, file_path);
+        if (IS_NULL(entry))
+            fprintf(stderr, "No file \"%s\" in the index of %s\n", file_path, output_file_path);
+        done = EXISTS(entry) && toc_extract(toc, entry, fileno(stdout));
+    }
+    toc_free(toc);
+    return done ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * @brief Lists the shards that were written.
+ * 
+ * @param[in] shards           Files of the output, with their shards.
+ * @param[in] output_file_path Path to the output file.
+ * @param[in] count            Number of shards.
+ */
+static void report_shards(const shard_t *shards, const char *output_file_path, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        const shard_range_t *range = shard_get(shards, i);
+        char *path = shard_path(output_file_path, i, count);
+        if (EXISTS(path))
+            fprintf(stderr, "Wrote %s, %zu files, %llu bytes\n", path, range->files, (unsigned long long)(range->end - range->start));
+        free(path);
+    }
+}
+
+/**
+ * @brief Splits the output that was written into shards next to it, and
+ * removes it once they are written. Only --shards needs this, it has to
+ * know the size of the whole output first, the limits of a shard are written
+ * straight into shards by shard_open().
+ * 
+ * @param[in, out] shards           Files of the output, as it was written.
+ * @param[in]      output_file_path Path to the output file.
+ * @param[in]      limits           How large a shard may be.
+ * 
+ * @return true if every shard was written.
+ */
+static bool split_output(shard_t *shards, const char *output_file_path, const shard_limits_t *limits)
+{
+    struct stat output_stat;
+    if (stat(output_file_path, &output_stat) != 0)
+    {
+        perror("Error reading output file");
+        return false;
+    }
+
+    size_t count = shard_plan(shards, (uint64_t)output_stat.st_size, limits);
+    if (count == 0)
+    {
+        perror("Memory allocation failed");
+        return false;
+    }
+    if (!shard_remove_all(output_file_path) || !shard_write(shards, output_file_path, output_file_path))
+        return false;
+    report_shards(shards, output_file_path, count);
+
+    if (unlink(output_file_path) != 0)
+        perror("Error removing output file");
+    return true;
+}
 
 /**
  * @brief Main function of the program.
@@ -24,38 +291,391 @@
  */
 int main(int argc, char *argv[])
 {
-    if (argc < 3)
+    unsigned int thread_count = 1;
+    off_t max_output_size = INGESTIFY_MAX_SIZE_AUTO;
+    off_t out_buffer_size = WRITER_BUFFER_DEFAULT;
+    const char *nested_ignore = NULL;
+    progress_mode_t progress_mode = PROGRESS_VERBOSE;
+    bool incremental = false;
+    bool watching = false;
+    bool deduplicate = false;
+    bool count_tokens = false;
+    off_t max_tokens = 0;
+    off_t file_max_tokens = 0;
+    bool compressing = false;
+    compress_format_t compress_format = COMPRESS_GZIP;
+    bool indexing = false;
+    shard_limits_t shard_limits = { 0 };
+    off_t mmap_min = 0;
+    bool use_io_uring = true;
+    bool skip_binary = true;
+#if defined(INGESTIFY_STATS)
+    unsigned int stats_top = 0;
+    const char *trace_path = NULL;
+#endif
+    char *positional[3] = { NULL };
+    int positional_count = 0;
+
+    // Reading an output back is a mode of its own, without the other options
+    if ((argc == 3) && (strcmp(argv[1], "--list") == 0))
+        return read_index(argv[2], NULL);
+    if ((argc == 4) && (strcmp(argv[1], "--extract") == 0))
+        return read_index(argv[3], argv[2]);
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0)
+        {
+            if ((i + 1 >= argc) || !parse_count(argv[++i], &thread_count))
+            {
+                fprintf(stderr, "-j needs a thread count between 1 and 1024\n");
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], "--max-bytes") == 0)
+        {
+            if ((i + 1 >= argc) || !parse_size(argv[++i], &max_output_size))
+            {
+                fprintf(stderr, "--max-bytes needs a size like 4096, 512K or 2G\n");
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], "--out-buffer") == 0)
+        {
+            if ((i + 1 >= argc) || !parse_size(argv[++i], &out_buffer_size) || (out_buffer_size > (1LL << 30)))
+            {
+                fprintf(stderr, "--out-buffer needs a size like 8M, at most 1G\n");
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], "--mmap-min") == 0)
+        {
+            if ((i + 1 >= argc) || !parse_size(argv[++i], &mmap_min))
+            {
+                fprintf(stderr, "--mmap-min needs a size like 1M\n");
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], "--no-uring") == 0)
+        {
+            use_io_uring = false;
+        }
+        else if (strcmp(argv[i], "--nested-ignore") == 0)
+        {
+            if ((i + 1 >= argc) || (argv[i + 1][0] == '\0') || (strchr(argv[i + 1], '/') != NULL))
+            {
+                fprintf(stderr, "--nested-ignore needs a file name like .gitignore\n");
+                return EXIT_FAILURE;
+            }
+            nested_ignore = argv[++i];
+        }
+        else if (strcmp(argv[i], "--quiet") == 0)
+        {
+            progress_mode = PROGRESS_QUIET;
+        }
+        else if (strcmp(argv[i], "--progress") == 0)
+        {
+            progress_mode = PROGRESS_REPORT;
+        }
+        else if (strcmp(argv[i], "--incremental") == 0)
+        {
+            incremental = true;
+        }
+        else if (strcmp(argv[i], "--keep-binary") == 0)
+        {
+            skip_binary = false;
+        }
+        else if (strcmp(argv[i], "--dedup") == 0)
+        {
+            deduplicate = true;
+        }
+        else if (strcmp(argv[i], "--tokens") == 0)
+        {
+            count_tokens = true;
+        }
+        else if (strcmp(argv[i], "--max-tokens") == 0)
+        {
+            if ((i + 1 >= argc) || !parse_size(argv[++i], &max_tokens))
+            {
+                fprintf(stderr, "--max-tokens needs a count like 8000 or 128K\n");
+                return EXIT_FAILURE;
+            }
+            count_tokens = true;
+        }
+        else if (strcmp(argv[i], "--file-max-tokens") == 0)
+        {
+            if ((i + 1 >= argc) || !parse_size(argv[++i], &file_max_tokens))
+            {
+                fprintf(stderr, "--file-max-tokens needs a count like 8000 or 128K\n");
+                return EXIT_FAILURE;
+            }
+            count_tokens = true;
+        }
+        else if (strcmp(argv[i], "--compress") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "--compress needs gzip or zstd\n");
+                return EXIT_FAILURE;
+            }
+            if (!compress_parse(argv[++i], &compress_format))
+                return EXIT_FAILURE;
+            compressing = true;
+        }
+        else if (strcmp(argv[i], "--index") == 0)
+        {
+            indexing = true;
+        }
+        else if (strcmp(argv[i], "--shard-size") == 0)
+        {
+            off_t limit;
+            if ((i + 1 >= argc) || !parse_size(argv[++i], &limit))
+            {
+                fprintf(stderr, "--shard-size needs a size like 512K or 2G\n");
+                return EXIT_FAILURE;
+            }
+            shard_limits.max_bytes = (uint64_t)limit;
+        }
+        else if (strcmp(argv[i], "--shard-tokens") == 0)
+        {
+            off_t limit;
+            if ((i + 1 >= argc) || !parse_size(argv[++i], &limit))
+            {
+                fprintf(stderr, "--shard-tokens needs a count like 8000 or 128K\n");
+                return EXIT_FAILURE;
+            }
+            shard_limits.max_tokens = (uint64_t)limit;
+            count_tokens = true;
+        }
+        else if (strcmp(argv[i], "--shards") == 0)
+        {
+            if ((i + 1 >= argc) || !parse_count(argv[++i], &shard_limits.count))
+            {
+                fprintf(stderr, "--shards needs a count between 1 and 1024\n");
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], "--stats") == 0)
+        {
+#if defined(INGESTIFY_STATS)
+            stats_top = (stats_top > 0) ? stats_top : STATS_TOP_DEFAULT;
+#else
+            fprintf(stderr, "--stats is not available, release builds are made without it\n");
+            return EXIT_FAILURE;
+#endif
+        }
+        else if (strcmp(argv[i], "--stats-top") == 0)
+        {
+#if defined(INGESTIFY_STATS)
+            if ((i + 1 >= argc) || !parse_count(argv[++i], &stats_top) || (stats_top > STATS_TOP_MAX))
+            {
+                fprintf(stderr, "--stats-top needs a count between 1 and %d\n", STATS_TOP_MAX);
+                return EXIT_FAILURE;
+            }
+#else
+            fprintf(stderr, "--stats-top is not available, release builds are made without it\n");
+            return EXIT_FAILURE;
+#endif
+        }
+        else if (strcmp(argv[i], "--trace") == 0)
+        {
+#if defined(INGESTIFY_STATS)
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "--trace needs the path of the trace file\n");
+                return EXIT_FAILURE;
+            }
+            trace_path = sanitize_path(argv[++i]);
+#else
+            fprintf(stderr, "%s is not available, release builds are made without it\n", argv[i]);
+            return EXIT_FAILURE;
+#endif
+        }
+        else if (strcmp(argv[i], "--watch") == 0)
+        {
+            watching = true;
+            incremental = true; // Every update is one
+        }
+        else if ((argv[i][0] == '-') || (positional_count == 3))
+        {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        else
+        {
+            positional[positional_count++] = argv[i];
+        }
+    }
+
+    if (positional_count < 2)
+    {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (compressing && incremental)
+    {
+        fprintf(stderr, "--compress cannot be used with --incremental or --watch, parts of a compressed output cannot be taken\n");
+        return EXIT_FAILURE;
+    }
+    if (compressing && indexing)
     {
-        fprintf(stderr, "Usage: %s <directory> <output_file> [ignore_file]\n", argv[0]);
+        fprintf(stderr, "--compress cannot be used with --index, offsets into a compressed output cannot be read\n");
         return EXIT_FAILURE;
     }
 
-    const char *directory        = sanitize_path(argv[1]);
-    const char *output_file_path = sanitize_path(argv[2]);
-    const char *ignore_file_path = (argc > 3) ? sanitize_path(argv[3]) : NULL;
+    bool sharding = (shard_limits.max_bytes > 0) || (shard_limits.max_tokens > 0) || (shard_limits.count > 0);
+    if (sharding && (compressing || indexing || incremental || deduplicate))
+    {
+        fprintf(stderr, "Sharding cannot be used with --compress, --index, --dedup, --incremental or --watch, they need the whole output\n");
+        return EXIT_FAILURE;
+    }
+    if ((shard_limits.count > 0) && ((shard_limits.max_bytes > 0) || (shard_limits.max_tokens > 0)))
+    {
+        fprintf(stderr, "--shards cannot be used with --shard-size or --shard-tokens\n");
+        return EXIT_FAILURE;
+    }
+
+    const char *directory        = sanitize_path(positional[0]);
+    const char *output_file_path = sanitize_path(positional[1]);
+    const char *ignore_file_path = (positional_count > 2) ? sanitize_path(positional[2]) : NULL;
 
     ignore_list_t *ignore_list = (ignore_file_path) ? ignore_read_list(ignore_file_path) : NULL;
+    ignore_set_t *ignore = ignore_set_create(ignore_list, nested_ignore);
+    if (IS_NULL(ignore))
+    {
+        ignore_free_list(ignore_list);
+        return EXIT_FAILURE;
+    }
 
-    FILE *output_file = fopen(output_file_path, "w");
-    if (IS_NULL(output_file))
+    ingestify_t *ingestify = ingestify_create();
+    if (IS_NULL(ingestify))
     {
-        perror("Error opening output file");
+        perror("Memory allocation failed");
+        ignore_set_release(ignore);
+        ignore_free_list(ignore_list);
+        return EXIT_FAILURE;
+    }
+    progress_set_mode(ingestify_progress(ingestify), progress_mode);
+    ingestify_set_mmap_min(ingestify, mmap_min);
+    ingestify_use_io_uring(ingestify, use_io_uring);
+    ingestify_skip_binary(ingestify, skip_binary);
+    ingestify_set_tokens(ingestify, count_tokens, (uint64_t)max_tokens, (uint64_t)file_max_tokens);
+
+    dedup_t *dedup = deduplicate ? dedup_create() : NULL;
+    if (deduplicate && IS_NULL(dedup))
+        perror("Memory allocation failed, writing every file whole");
+    ingestify_set_dedup(ingestify, dedup);
+
+    toc_t *toc = indexing ? toc_create() : NULL;
+    if (indexing && IS_NULL(toc))
+        perror("Memory allocation failed, writing without an index");
+    ingestify_set_toc(ingestify, toc);
+
+    shard_t *shards = sharding ? shard_create() : NULL;
+    if (sharding && IS_NULL(shards))
+        perror("Memory allocation failed, writing one output");
+    ingestify_set_shards(ingestify, shards);
+
+    watch_t *watch = watching ? watch_create(ingestify, output_file_path, nested_ignore) : NULL;
+    if (watching && IS_NULL(watch))
+    {
+        shard_free(shards);
+        toc_free(toc);
+        dedup_free(dedup);
+        ingestify_destroy(ingestify);
+        ignore_set_release(ignore);
+        ignore_free_list(ignore_list);
         return EXIT_FAILURE;
     }
 
-    off_t input_directory_size = ingestify_calculate_directory_size(directory);
-    if (input_directory_size == -1)
+    // The previous output is only trusted if the manifest still describes it
+    manifest_t *next_manifest = incremental ? manifest_create() : NULL;
+    manifest_t *previous_manifest = EXISTS(next_manifest) ? manifest_load(output_file_path) : NULL;
+    if (incremental && IS_NULL(next_manifest))
+        perror("Memory allocation failed, writing without a manifest");
+
+    // Only a count of shards needs the whole output first, limits are filled as it is written
+    bool streaming_shards = EXISTS(shards) && (shard_limits.count == 0);
+    writer_sink_t sink;
+    writer_t *output;
+    if (compressing)
+        output = compress_open(output_file_path, compress_format, 0, &sink) ? writer_open_sink(&sink, (size_t)out_buffer_size) : NULL;
+    else if (streaming_shards)
+        output = shard_open(shards, output_file_path, &shard_limits, &sink) ? writer_open_sink(&sink, (size_t)out_buffer_size) : NULL;
+    else if (EXISTS(previous_manifest))
+        output = writer_open_over(output_file_path, (size_t)out_buffer_size);
+    else
+        output = writer_open(output_file_path, (size_t)out_buffer_size);
+    if (IS_NULL(output))
     {
-        fclose(output_file);
+        perror("Error opening output file");
+        manifest_free(previous_manifest);
+        manifest_free(next_manifest);
+        watch_destroy(watch);
+        shard_free(shards);
+        toc_free(toc);
+        dedup_free(dedup);
+        ingestify_destroy(ingestify);
+        ignore_set_release(ignore);
+        ignore_free_list(ignore_list);
         return EXIT_FAILURE;
     }
-    off_t max_output_size = 2 * input_directory_size;
+    ingestify_set_manifests(ingestify, previous_manifest, next_manifest);
+    ingestify_set_watch(ingestify, watch);
+
+    if (!progress_start(ingestify_progress(ingestify)))
+        fprintf(stderr, "Could not start the progress reporter.\n");
+
+#if defined(INGESTIFY_STATS)
+    double started = now_ms();
+    if (stats_top > 0)
+        stats_enable(stats_top);
+    ingestify_set_trace(ingestify, trace_path);
+    if (EXISTS(trace_path) && !trace_start(trace_path))
+        fprintf(stderr, "Could not start the trace, the walk goes on without it.\n");
+#endif
+
+    bool opened;
+    if (thread_count > 1)
+        opened = pwalk_traverse_and_write(ingestify, directory, ignore, output, output_file_path, max_output_size, thread_count);
+    else
+        opened = ingestify_traverse_and_write(ingestify, directory, ignore, output, output_file_path, max_output_size);
+
+    ingestify_finish_output(ingestify, output);
+    bool written = writer_close(output);
+    progress_stop(ingestify_progress(ingestify));
+
+#if defined(INGESTIFY_STATS)
+    trace_stop();
+    if (stats_top > 0)
+    {
+        stats_print(stderr, (uint64_t)((now_ms() - started) * 1e6));
+        stats_disable();
+    }
+#endif
+
+    if (streaming_shards && written)
+        report_shards(shards, output_file_path, shard_count(shards));
+    else if (EXISTS(shards) && opened && written)
+        written = split_output(shards, output_file_path, &shard_limits);
 
-    ingestify_traverse_and_write(directory, ignore_list, output_file, output_file_path, max_output_size);
+    // Updates are serial, most of each is taken from the previous output
+    if (EXISTS(watch) && EXISTS(next_manifest) && opened && written)
+        written = watch_and_update(ingestify, directory, ignore, output_file_path, out_buffer_size, max_output_size, watch, &previous_manifest, &next_manifest);
 
-    fclose(output_file);
+    // Once, at the end, since updates come faster than a large manifest is written
+    if (EXISTS(next_manifest) && written)
+        manifest_save(next_manifest, output_file_path);
+    ingestify_destroy(ingestify);
+    watch_destroy(watch);
+    dedup_free(dedup);
+    toc_free(toc);
+    shard_free(shards);
+    manifest_free(previous_manifest);
+    manifest_free(next_manifest);
 
+    ignore_set_release(ignore);
     ignore_free_list(ignore_list);
 
-    return EXIT_SUCCESS;
+    return (opened && written) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
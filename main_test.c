@@ -1,9 +1,40 @@
 #include "common.h"
+#include "arena.h"
+#include "binary.h"
+#include "compress.h"
+#include "dedup.h"
 #include "ignore.h"
 #include "ingestify.h"
+#include "libingestify.h"
+#include "manifest.h"
+#include "progress.h"
+#include "pwalk.h"
+#include "shard.h"
+#include "stats.h"
+#include "trace.h"
+#include "tokens.h"
+#include "toc.h"
+#include "uring.h"
+#include "writer.h"
 
 #include "c_asserts.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#if defined(INGESTIFY_ZLIB)
+#include <zlib.h>
+#endif
+#if defined(INGESTIFY_ZSTD)
+#include <zstd.h>
+#endif
+
 bool test__ignore_is_match__empty_list(void)
 {
     ignore_list_t ignore_list = {.entries = NULL, .count = 0};
@@ -433,6 +464,1622 @@ bool test__ignore_read_list__generic(void)
     return true;
 }
 
+bool test__ignore_compile__skips_blank_and_comments(void)
+{
+    char entry_0[] = "# comment";
+    char entry_1[] = "";
+    char entry_2[] = "build/";
+    char entry_3[] = "*.o  ";
+    char *entries[] = { entry_0, entry_1, entry_2, entry_3 };
+    ignore_list_t ignore_list = { .entries = entries, .count = 4 };
+
+    ASSERT_TEST(ignore_compile(&ignore_list) == true);
+    ASSERT_TEST(ignore_list.rule_count == 2);
+
+    ASSERT_TEST(ignore_is_match(&ignore_list, "# comment")       == false);
+    ASSERT_TEST(ignore_is_match(&ignore_list, "build/main.o")    == true);
+    ASSERT_TEST(ignore_is_match(&ignore_list, "src/build/app")   == true);
+    ASSERT_TEST(ignore_is_match(&ignore_list, "src/main.o")      == true);
+    ASSERT_TEST(ignore_is_match(&ignore_list, "src/main.c")      == false);
+    ASSERT_TEST(ignore_is_match(&ignore_list, "builds/main.c")   == false);
+
+    ignore_free_rules(&ignore_list);
+    return true;
+}
+
+bool test__ignore_compile__same_as_uncompiled(void)
+{
+    char entry_0[] = "logs";
+    char entry_1[] = "*.log";
+    char entry_2[] = "!important.log";
+    char entry_3[] = "logs/**/debug[0-9].log";
+    char entry_4[] = "/src/*day/file?.c";
+    char entry_5[] = "**/tmp/";
+    char *entries[] = { entry_0, entry_1, entry_2, entry_3, entry_4, entry_5 };
+    ignore_list_t raw      = { .entries = entries, .count = 6 };
+    ignore_list_t compiled = { .entries = entries, .count = 6 };
+    ASSERT_TEST(ignore_compile(&compiled) == true);
+
+    const char *paths[] =
+    {
+        "logs", "logs/a.txt", "a/logs/b.txt", "a/logs", "debug.log", "a/important.log",
+        "logs/x/y/debug7.log", "logs/debug7.log", "logs/debug77.log", "src/monday/file1.c",
+        "src/monday/file12.c", "a/src/monday/file1.c", "tmp/a", "a/b/tmp/c", "tmpfile",
+    };
+    const bool expected[] =
+    {
+        true, true, true, false, true, false,
+        true, true, true, true,
+        false, false, true, true, false,
+    };
+
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++)
+    {
+        ASSERT_TEST(ignore_is_match(&raw, paths[i])      == expected[i]);
+        ASSERT_TEST(ignore_is_match(&compiled, paths[i]) == expected[i]);
+    }
+
+    ignore_free_rules(&compiled);
+    return true;
+}
+
+bool test__ignore_is_dir_match__only_whole_subtrees(void)
+{
+    char entry_0[] = "!keep.txt";
+    char entry_1[] = "node_modules";
+    char entry_2[] = "**/build/";
+    char entry_3[] = "src/*.c";
+    char entry_4[] = "!build/keep.txt";
+    char *entries[] = { entry_0, entry_1, entry_2, entry_3, entry_4 };
+
+    // An exception after the rules could bring back something under any directory they ignore
+    for (size_t count = 4; count <= 5; count++)
+    {
+        ignore_list_t raw      = { .entries = entries, .count = count };
+        ignore_list_t compiled = { .entries = entries, .count = count };
+        ASSERT_TEST(ignore_compile(&compiled) == true);
+
+        const char *paths[] = { "node_modules", "a/b/node_modules", "build", "a/build", "src", "src/x.c", "a/node_modules_x" };
+        const bool prunes = (count == 4);
+        const bool expected[] = { prunes, prunes, prunes, prunes, false, prunes, false };
+
+        for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++)
+        {
+            ASSERT_TEST(ignore_is_dir_match(&raw, paths[i])      == expected[i]);
+            ASSERT_TEST(ignore_is_dir_match(&compiled, paths[i]) == expected[i]);
+        }
+        ignore_free_rules(&compiled);
+    }
+    return true;
+}
+
+bool test__ignore_is_entry_match__directory_pattern_skips_files(void)
+{
+    char entry_0[] = "build/";
+    char entry_1[] = "**/out/";
+    char entry_2[] = "*.o";
+    char *entries[] = { entry_0, entry_1, entry_2 };
+
+    ignore_list_t raw      = { .entries = entries, .count = 3 };
+    ignore_list_t compiled = { .entries = entries, .count = 3 };
+    ASSERT_TEST(ignore_compile(&compiled) == true);
+
+    // A file and a directory of the same name, only the directory is ignored
+    ignore_list_t *lists[] = { &raw, &compiled };
+    for (size_t i = 0; i < 2; i++)
+    {
+        ASSERT_TEST(ignore_is_entry_match(lists[i], "build", ENTRY_TYPE_DIR)      == true);
+        ASSERT_TEST(ignore_is_entry_match(lists[i], "build", ENTRY_TYPE_FILE)     == false);
+        ASSERT_TEST(ignore_is_entry_match(lists[i], "a/b/out", ENTRY_TYPE_DIR)    == true);
+        ASSERT_TEST(ignore_is_entry_match(lists[i], "a/b/out", ENTRY_TYPE_FILE)   == false);
+        ASSERT_TEST(ignore_is_entry_match(lists[i], "build/x.c", ENTRY_TYPE_FILE) == true);
+        ASSERT_TEST(ignore_is_entry_match(lists[i], "x.o", ENTRY_TYPE_FILE)       == true);
+        ASSERT_TEST(ignore_is_entry_match(lists[i], "x.o", ENTRY_TYPE_DIR)        == true);
+
+        // Without a type, as before
+        ASSERT_TEST(ignore_is_entry_match(lists[i], "build", ENTRY_TYPE_OTHER)    == true);
+        ASSERT_TEST(ignore_is_match(lists[i], "build")                            == true);
+    }
+
+    ignore_set_t *set = ignore_set_create(&compiled, NULL);
+    ASSERT_TEST(EXISTS(set));
+    ASSERT_TEST(ignore_set_is_entry_match(set, "build", ENTRY_TYPE_DIR)    == true);
+    ASSERT_TEST(ignore_set_is_entry_match(set, "build", ENTRY_TYPE_FILE)   == false);
+    ASSERT_TEST(ignore_set_is_entry_match(set, "./build", ENTRY_TYPE_FILE) == false);
+    ASSERT_TEST(ignore_set_is_entry_match(set, "src/out", ENTRY_TYPE_DIR)  == true);
+    ignore_set_release(set);
+
+    ignore_free_rules(&compiled);
+    return true;
+}
+
+bool test__ignore_set_enter__nested_file_wins(void)
+{
+    char entry_0[] = "!file_b.txt";
+    char entry_1[] = "*_a.txt";
+    char *entries[] = { entry_0, entry_1 };
+    ignore_list_t ignore_list = { .entries = entries, .count = 2 };
+
+    // test/ingestify_ignore.txt is read as the ignore file of test/, relative to it
+    ignore_set_t *root = ignore_set_create(&ignore_list, "ingestify_ignore.txt");
+    ASSERT_TEST(EXISTS(root));
+    DIR *dir = dir_open("test");
+    ASSERT_TEST(EXISTS(dir));
+    ignore_set_t *nested = ignore_set_enter(root, dir, "test");
+    closedir(dir);
+    ASSERT_TEST(EXISTS(nested));
+
+    ASSERT_TEST(ignore_set_is_match(root,   "test/file_b.txt")           == false);
+    ASSERT_TEST(ignore_set_is_match(nested, "test/file_b.txt")           == true);
+    ASSERT_TEST(ignore_set_is_match(nested, "./test/file_a.txt")         == true);
+    ASSERT_TEST(ignore_set_is_match(nested, "test/file_c.hex")           == true);
+    ASSERT_TEST(ignore_set_is_match(nested, "test/ingestify_ignore.txt") == false);
+    ASSERT_TEST(ignore_set_is_dir_match(nested, "test/build")            == true);
+    ASSERT_TEST(ignore_set_is_dir_match(nested, "test/src")              == false);
+
+    // The nested set holds the root, so they can be released in any order
+    ignore_set_release(root);
+    ASSERT_TEST(ignore_set_is_match(nested, "test/file_a.txt") == true);
+    ignore_set_release(nested);
+    return true;
+}
+
+bool test__uring_read_files__same_with_and_without_ring(void)
+{
+    for (int use_ring = 0; use_ring < 2; use_ring++)
+    {
+        uring_t *ring = uring_create(64, use_ring);
+        DIR *dir = dir_open("test");
+        ASSERT_TEST(EXISTS(ring));
+        ASSERT_TEST(EXISTS(dir));
+
+        uring_file_t files[] =
+        {
+            { .name = "file_a.txt",           .path = "test/file_a.txt" },
+            { .name = "missing.txt",          .path = "test/missing.txt" },
+            { .name = "ingestify_ignore.txt", .path = "test/ingestify_ignore.txt" },
+            { .name = "file_b.txt",           .path = "test/file_b.txt" },
+        };
+        uring_read_files(ring, dir, files, 4);
+
+        ASSERT_TEST(files[0].opened == true);
+        ASSERT_TEST(files[0].size   == 38);
+        ASSERT_TEST(files[0].length == 38);
+        ASSERT_TEST(files[0].fd     == -1);
+        ASSERT_TEST(EXISTS(files[0].data));
+
+        ASSERT_TEST(files[1].opened == false);
+        ASSERT_TEST(IS_NULL(files[1].data));
+
+        // Larger than 64 bytes, so it is only opened
+        ASSERT_TEST(files[2].opened == true);
+        ASSERT_TEST(files[2].size   == 192);
+        ASSERT_TEST(files[2].fd     >= 0);
+        ASSERT_TEST(IS_NULL(files[2].data));
+        close(files[2].fd);
+
+        ASSERT_TEST(files[3].length == 45);
+
+        FILE *file_a = fopen("test/file_a.txt", "r");
+        char expected[64] = { 0 };
+        ASSERT_TEST(fread(expected, 1, sizeof(expected), file_a) == 38);
+        fclose(file_a);
+        ASSERT_TEST(memcmp(files[0].data, expected, 38) == 0);
+
+        closedir(dir);
+        uring_destroy(ring);
+    }
+
+    return true;
+}
+
+bool test__writer__same_bytes_as_written(void)
+{
+    const char *path = "writer_test_output.txt";
+    writer_t *writer = writer_open(path, 0);
+    ASSERT_TEST(EXISTS(writer));
+
+    // Larger than the smallest buffer, so it goes out next to the buffer
+    static char large[3 * BUFSIZ];
+    for (size_t i = 0; i < sizeof(large); i++) large[i] = (char)('a' + (i % 26));
+
+    writer_printf(writer, "\nFILE \"%s\" ===:\n", "dir/file.c");
+    writer_write(writer, "body", 4);
+    writer_write(writer, large, sizeof(large));
+    char *reserved = writer_reserve(writer, 3);
+    memcpy(reserved, "xyz", 3);
+    writer_commit(writer, 2);
+    writer_write(writer, "\n", 1);
+
+    size_t expected_size = 24 + 4 + sizeof(large) + 2 + 1;
+    ASSERT_TEST(writer_size(writer) == expected_size);
+    ASSERT_TEST(writer_close(writer) == true);
+
+    static char contents[4 * BUFSIZ];
+    FILE *file = fopen(path, "rb");
+    ASSERT_TEST(EXISTS(file));
+    size_t size = fread(contents, 1, sizeof(contents), file);
+    fclose(file);
+    remove(path);
+
+    ASSERT_TEST(size == expected_size);
+    ASSERT_TEST(memcmp(contents, "\nFILE \"dir/file.c\" ===:\nbody", 28) == 0);
+    ASSERT_TEST(memcmp(&contents[28], large, sizeof(large)) == 0);
+    ASSERT_TEST(memcmp(&contents[28 + sizeof(large)], "xy\n", 3) == 0);
+
+    return true;
+}
+
+bool test__writer_reuse__same_bytes_as_written(void)
+{
+    const char *path = "writer_reuse_test_output.txt";
+    writer_t *writer = writer_open(path, 0);
+    ASSERT_TEST(EXISTS(writer));
+    writer_write(writer, "aaaabbbbcccc", 12);
+    ASSERT_TEST(writer_close(writer) == true);
+
+    struct stat before;
+    ASSERT_TEST(stat(path, &before) == 0);
+
+    // Only parts of the previous output, where they were, leave it untouched
+    writer = writer_open_over(path, 0);
+    ASSERT_TEST(EXISTS(writer));
+    ASSERT_TEST(writer_reuse(writer, 0, 4) == true);
+    ASSERT_TEST(writer_reuse(writer, 4, 8) == true);
+    ASSERT_TEST(writer_reuse(writer, 8, 8) == false);
+    ASSERT_TEST(writer_close(writer) == true);
+
+    struct stat after;
+    ASSERT_TEST(stat(path, &after) == 0);
+    ASSERT_TEST(after.st_ino == before.st_ino);
+    ASSERT_TEST(after.st_size == 12);
+
+    // Once something differs, the parts are copied into a new output
+    writer = writer_open_over(path, 0);
+    ASSERT_TEST(EXISTS(writer));
+    ASSERT_TEST(writer_reuse(writer, 0, 4) == true);
+    writer_write(writer, "XY", 2);
+    ASSERT_TEST(writer_reuse(writer, 8, 2) == true);
+    ASSERT_TEST(writer_reuse(writer, 10, 2) == true);
+    ASSERT_TEST(writer_reuse(writer, 4, 4) == true);
+    ASSERT_TEST(writer_size(writer) == 14);
+    ASSERT_TEST(writer_close(writer) == true);
+
+    char contents[32] = { 0 };
+    FILE *file = fopen(path, "rb");
+    ASSERT_TEST(EXISTS(file));
+    size_t size = fread(contents, 1, sizeof(contents), file);
+    fclose(file);
+    remove(path);
+
+    ASSERT_TEST(size == 14);
+    ASSERT_TEST(memcmp(contents, "aaaaXYccccbbbb", 14) == 0);
+
+    return true;
+}
+
+bool test__manifest_add_subtree__moves_whole_directory(void)
+{
+    manifest_key_t key = { .size = 4, .mtime_ns = 1, .ctime_ns = 1, .ino = 7 };
+    manifest_t *previous = manifest_create();
+    ASSERT_TEST(EXISTS(previous));
+    ASSERT_TEST(manifest_add(previous, "./a/x", &key, 0, 10, 4, MANIFEST_KIND_TEXT, NULL, NULL) == true);
+    ASSERT_TEST(manifest_add(previous, "./a/y", &key, 10, 10, 4, MANIFEST_KIND_TEXT, NULL, NULL) == true);
+    ASSERT_TEST(manifest_add_dir(previous, "./a", 0, 20, 8, 8, 2, 0) == true);
+    ASSERT_TEST(manifest_add(previous, "./b", &key, 20, 10, 4, MANIFEST_KIND_TEXT, NULL, NULL) == true);
+    ASSERT_TEST(manifest_index(previous) == true);
+
+    // A directory is only found as one
+    const manifest_entry_t *dir = manifest_find_dir(previous, "./a");
+    ASSERT_TEST(EXISTS(dir));
+    ASSERT_TEST(manifest_find(previous, "./a", &key) == NULL);
+    ASSERT_TEST(manifest_find_dir(previous, "./a/x") == NULL);
+
+    // Taken whole to a new place, the entries under it follow
+    manifest_t *next = manifest_create();
+    ASSERT_TEST(EXISTS(next));
+    ASSERT_TEST(manifest_add(next, "./0", &key, 0, 6, 4, MANIFEST_KIND_TEXT, NULL, NULL) == true);
+    ASSERT_TEST(manifest_add_subtree(next, previous, dir, 6) == true);
+    ASSERT_TEST(manifest_count(next) == 4);
+    ASSERT_TEST(manifest_index(next) == true);
+
+    const manifest_entry_t *y = manifest_find(next, "./a/y", &key);
+    ASSERT_TEST(EXISTS(y));
+    ASSERT_TEST(y->offset == 16);
+    dir = manifest_find_dir(next, "./a");
+    ASSERT_TEST(EXISTS(dir));
+    ASSERT_TEST((dir->offset == 6) && (dir->length == 20) && (dir->entries == 2));
+    ASSERT_TEST(manifest_find(next, "./b", &key) == NULL);
+
+    manifest_free(previous);
+    manifest_free(next);
+    return true;
+}
+
+bool test__dedup_find__same_contents_same_file(void)
+{
+    // Across a chunk boundary, a file hashes the same read whole or from disk
+    size_t size = DEDUP_CHUNK + 1000;
+    char *data = malloc(size);
+    ASSERT_TEST(EXISTS(data));
+    for (size_t i = 0; i < size; i++)
+        data[i] = (char)((i * 7) ^ (i >> 11));
+
+    const char *path = "dedup_test_input.bin";
+    FILE *file = fopen(path, "wb");
+    ASSERT_TEST(EXISTS(file));
+    ASSERT_TEST(fwrite(data, 1, size, file) == size);
+    fclose(file);
+
+    uint64_t from_disk = 0;
+    int fd = open(path, O_RDONLY);
+    ASSERT_TEST(fd >= 0);
+    ASSERT_TEST(dedup_hash_fd(fd, (off_t)size, &from_disk) == true);
+    ASSERT_TEST(lseek(fd, 0, SEEK_CUR) == 0);
+    close(fd);
+    remove(path);
+
+    dedup_digest_t whole = { .hash = dedup_hash(data, size), .size = size };
+    ASSERT_TEST(whole.hash == from_disk);
+
+    // One byte off is other contents
+    data[size - 1] ^= 1;
+    dedup_digest_t changed = { .hash = dedup_hash(data, size), .size = size };
+    ASSERT_TEST(changed.hash != whole.hash);
+    free(data);
+
+    dedup_t *dedup = dedup_create();
+    ASSERT_TEST(EXISTS(dedup));
+    ASSERT_TEST(dedup_find(dedup, &whole) == NULL);
+    dedup_add(dedup, &whole, "a");
+    dedup_add(dedup, &changed, "b");
+    ASSERT_TEST(strcmp(dedup_find(dedup, &whole), "a") == 0);
+    ASSERT_TEST(strcmp(dedup_find(dedup, &changed), "b") == 0);
+
+    // The first file with the contents stays the one referred to
+    dedup_add(dedup, &whole, "c");
+    ASSERT_TEST(strcmp(dedup_find(dedup, &whole), "a") == 0);
+
+    // The same hash with another size is not the same file
+    dedup_digest_t shorter = { .hash = whole.hash, .size = size - 1 };
+    ASSERT_TEST(dedup_find(dedup, &shorter) == NULL);
+
+    dedup_clear(dedup);
+    ASSERT_TEST(dedup_find(dedup, &whole) == NULL);
+    dedup_free(dedup);
+    return true;
+}
+
+bool test__binary_detect__nul_or_invalid_utf8(void)
+{
+    // Past the first 16 bytes, so the scan of whole blocks is gone through too
+    char text[64] = "A file of plain ASCII text, long enough for a few blocks.\n";
+    ASSERT_TEST(binary_detect(text, strlen(text)) == false);
+    ASSERT_TEST(binary_detect("", 0) == false);
+
+    const char *utf8 = "na\xc3\xafve \xe2\x9c\x93 \xf0\x9f\x98\x80 text after the characters";
+    ASSERT_TEST(binary_detect(utf8, strlen(utf8)) == false);
+
+    // A character cut off at the end of the block is not held against it
+    ASSERT_TEST(binary_detect(utf8, 9) == false);
+
+    text[40] = '\0';
+    ASSERT_TEST(binary_detect(text, 50) == true);
+
+    // Latin-1, an overlong NUL, a surrogate and a code point past U+10FFFF
+    ASSERT_TEST(binary_detect("caf\xe9 au lait", 13) == true);
+    ASSERT_TEST(binary_detect("a\xc0\x80z", 4) == true);
+    ASSERT_TEST(binary_detect("a\xed\xa0\x80z", 5) == true);
+    ASSERT_TEST(binary_detect("a\xf4\x90\x80\x80z", 6) == true);
+    return true;
+}
+
+bool test__tokens_feed__pieces_and_limit(void)
+{
+    const char *text = "int main(void)\n{\n    return 42; // Answer\n}\nSome plain English words, and a URL: https://example.com/path\n";
+    size_t size = strlen(text);
+    uint64_t whole = tokens_count(text, size);
+    ASSERT_TEST(whole > (size / 8));
+    ASSERT_TEST(whole < (size / 2));
+    ASSERT_TEST(tokens_count("", 0) == 0);
+
+    // Fed in pieces of any size, the count is that of the whole text
+    for (size_t piece = 1; piece < 40; piece += 3)
+    {
+        tokens_t tokens = { 0 };
+        for (size_t offset = 0; offset < size; offset += piece)
+        {
+            size_t n = ((size - offset) < piece) ? (size - offset) : piece;
+            ASSERT_TEST(tokens_feed(&tokens, &text[offset], n, TOKENS_NO_LIMIT) == n);
+        }
+        ASSERT_TEST(tokens.count == whole);
+    }
+
+    // Cut where the next token would go past the limit, and the bytes taken count exactly that
+    for (uint64_t limit = 0; limit < whole; limit++)
+    {
+        tokens_t tokens = { 0 };
+        size_t taken = tokens_feed(&tokens, text, size, limit);
+        ASSERT_TEST(taken < size);
+        ASSERT_TEST(tokens.count == limit);
+        ASSERT_TEST(tokens_count(text, taken) == limit);
+        ASSERT_TEST(tokens_count(text, taken + 1) == (limit + 1));
+    }
+    return true;
+}
+
+#if defined(INGESTIFY_ZLIB) || defined(INGESTIFY_ZSTD)
+/**
+ * @brief Writes test data through a compressing writer, and reads back
+ * what it wrote.
+ */
+static unsigned char *write_compressed(compress_format_t format, const char *data, size_t size, size_t *compressed_size)
+{
+    const char *path = "compress_test.out";
+
+    // Through a small buffer, so the sink gets pieces that cross the blocks
+    writer_sink_t sink;
+    if (!compress_open(path, format, 2, &sink))
+        return NULL;
+    writer_t *writer = writer_open_sink(&sink, BUFSIZ);
+    if (IS_NULL(writer) || (writer_fd(writer) != -1))
+        return NULL;
+    for (size_t offset = 0; offset < size; offset += 1000)
+        writer_write(writer, &data[offset], ((size - offset) < 1000) ? (size - offset) : 1000);
+    if (!writer_close(writer))
+        return NULL;
+
+    int fd = open(path, O_RDONLY);
+    off_t file_size = lseek(fd, 0, SEEK_END);
+    unsigned char *compressed = malloc((file_size > 0) ? (size_t)file_size : 1);
+    bool read = EXISTS(compressed) && (pread(fd, compressed, (size_t)file_size, 0) == file_size);
+    close(fd);
+    remove(path);
+    if (!read)
+    {
+        free(compressed);
+        return NULL;
+    }
+    *compressed_size = (size_t)file_size;
+    return compressed;
+}
+
+/**
+ * @brief Data for the compression tests, three blocks long.
+ */
+static char *compress_test_data(size_t *size)
+{
+    *size = (2 * COMPRESS_BLOCK) + 12345;
+    char *data = malloc(*size);
+    for (size_t i = 0; EXISTS(data) && (i < *size); i++)
+        data[i] = (char)('a' + ((i * 7) % 26));
+    return data;
+}
+#endif
+
+#if defined(INGESTIFY_ZLIB)
+bool test__compress_open__gzip_blocks_read_as_one_stream(void)
+{
+    size_t size;
+    size_t compressed_size;
+    char *data = compress_test_data(&size);
+    char *read_back = malloc(size + 1);
+    ASSERT_TEST(EXISTS(data) && EXISTS(read_back));
+    unsigned char *compressed = write_compressed(COMPRESS_GZIP, data, size, &compressed_size);
+    ASSERT_TEST(EXISTS(compressed));
+
+    // One member a block, gzip -d reads them one after another
+    z_stream stream = { 0 };
+    ASSERT_TEST(inflateInit2(&stream, 15 + 16) == Z_OK);
+    stream.next_in = compressed;
+    stream.avail_in = (uInt)compressed_size;
+    stream.next_out = (Bytef *)read_back;
+    stream.avail_out = (uInt)(size + 1);
+    int members = 0;
+    while (stream.avail_in > 0)
+    {
+        ASSERT_TEST(inflate(&stream, Z_NO_FLUSH) == Z_STREAM_END);
+        inflateReset(&stream);
+        members++;
+    }
+    size_t read_size = size + 1 - stream.avail_out;
+    inflateEnd(&stream);
+
+    ASSERT_TEST(members == 3);
+    ASSERT_TEST(read_size == size);
+    ASSERT_TEST(memcmp(read_back, data, size) == 0);
+    free(compressed);
+    free(read_back);
+    free(data);
+    return true;
+}
+#endif
+
+#if defined(INGESTIFY_ZSTD)
+bool test__compress_open__zstd_frames_read_as_one_stream(void)
+{
+    size_t size;
+    size_t compressed_size;
+    char *data = compress_test_data(&size);
+    char *read_back = malloc(size + 1);
+    ASSERT_TEST(EXISTS(data) && EXISTS(read_back));
+    unsigned char *compressed = write_compressed(COMPRESS_ZSTD, data, size, &compressed_size);
+    ASSERT_TEST(EXISTS(compressed));
+
+    // One frame a block
+    int frames = 0;
+    for (size_t offset = 0; offset < compressed_size; frames++)
+    {
+        size_t frame_size = ZSTD_findFrameCompressedSize(&compressed[offset], compressed_size - offset);
+        ASSERT_TEST(!ZSTD_isError(frame_size));
+        offset += frame_size;
+    }
+    ASSERT_TEST(frames == 3);
+
+    // zstd -d reads them one after another
+    size_t read_size = ZSTD_decompress(read_back, size + 1, compressed, compressed_size);
+    ASSERT_TEST(!ZSTD_isError(read_size));
+    ASSERT_TEST(read_size == size);
+    ASSERT_TEST(memcmp(read_back, data, size) == 0);
+    free(compressed);
+    free(read_back);
+    free(data);
+    return true;
+}
+#endif
+
+/**
+ * @brief Reads a whole small file into a buffer, for comparing it.
+ */
+static size_t read_test_file(const char *path, char *buffer, size_t size)
+{
+    FILE *file = fopen(path, "rb");
+    if (IS_NULL(file))
+        return 0;
+    size_t read_size = fread(buffer, 1, size, file);
+    fclose(file);
+    return read_size;
+}
+
+/**
+ * @brief Writes an output with two files, one of them a reference to the
+ * other, and more references than the index first has room for.
+ */
+static bool write_toc_test_output(const char *path)
+{
+    const char *contents = "int main(void) { return 0; }\n";
+    uint64_t hash = dedup_hash(contents, strlen(contents));
+
+    toc_t *toc = toc_create();
+    writer_t *writer = writer_open(path, 0);
+    if (IS_NULL(toc) || IS_NULL(writer))
+        return false;
+
+    writer_printf(writer, "\nFILE \"%s\" ===:\n", "main.c");
+    size_t offset = writer_size(writer);
+    writer_write(writer, contents, strlen(contents));
+    bool added = toc_add(toc, "main.c", offset, strlen(contents), &hash);
+
+    // Every reference takes the hash of the first entry, while the entries grow
+    char name[32];
+    for (int i = 0; added && (i < 300); i++)
+    {
+        const toc_entry_t *first = toc_find(toc, "main.c");
+        snprintf(name, sizeof(name), "copy_%d.c", i);
+        writer_printf(writer, "\nFILE \"%s\" SAME AS \"main.c\" ===:\n\n", name);
+        added = EXISTS(first) && toc_add(toc, name, first->offset, first->length, first->hashed ? &first->hash : NULL);
+    }
+    toc_write(toc, writer);
+    toc_free(toc);
+    return writer_close(writer) && added;
+}
+
+bool test__toc_open__finds_and_extracts_files(void)
+{
+    const char *path = "toc_test_output.txt";
+    const char *extracted = "toc_test_extracted.txt";
+    ASSERT_TEST(write_toc_test_output(path));
+
+    toc_t *toc = toc_open(path);
+    ASSERT_TEST(EXISTS(toc));
+    ASSERT_TEST(toc_count(toc) == 301);
+    ASSERT_TEST(IS_NULL(toc_find(toc, "missing.c")));
+
+    const toc_entry_t *first = toc_find(toc, "main.c");
+    const toc_entry_t *copy = toc_find(toc, "copy_299.c");
+    ASSERT_TEST(EXISTS(first) && EXISTS(copy));
+    ASSERT_TEST(first->hashed && copy->hashed);
+    ASSERT_TEST((copy->offset == first->offset) && (copy->length == first->length) && (copy->hash == first->hash));
+    off_t first_offset = (off_t)first->offset;
+
+    // A reference is extracted with the contents of the file it refers to
+    char contents[64] = { 0 };
+    int fd = open(extracted, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_TEST(fd >= 0);
+    ASSERT_TEST(toc_extract(toc, copy, fd));
+    close(fd);
+    toc_free(toc);
+    ASSERT_TEST(read_test_file(extracted, contents, sizeof(contents)) == 29);
+    ASSERT_TEST(memcmp(contents, "int main(void) { return 0; }\n", 29) == 0);
+
+    // Contents changed after the index was written are not handed out
+    fd = open(path, O_WRONLY);
+    ASSERT_TEST(fd >= 0);
+    ASSERT_TEST(pwrite(fd, "I", 1, first_offset) == 1);
+    close(fd);
+    toc = toc_open(path);
+    ASSERT_TEST(EXISTS(toc));
+    fd = open(extracted, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_TEST(toc_extract(toc, toc_find(toc, "main.c"), fd) == false);
+    close(fd);
+    toc_free(toc);
+
+    remove(extracted);
+    remove(path);
+    return true;
+}
+
+bool test__toc_open__rejects_damaged_trailer(void)
+{
+    const char *path = "toc_test_output.txt";
+    ASSERT_TEST(write_toc_test_output(path));
+    struct stat status;
+    ASSERT_TEST(stat(path, &status) == 0);
+
+    // Cut short, the last line is not the trailer any more
+    ASSERT_TEST(truncate(path, status.st_size - 1) == 0);
+    ASSERT_TEST(IS_NULL(toc_open(path)));
+
+    // A trailer that points past itself, or not at an index
+    int fd = open(path, O_WRONLY | O_APPEND);
+    ASSERT_TEST(fd >= 0);
+    ASSERT_TEST(write(fd, "\n", 1) == 1);
+    close(fd);
+    fd = open(path, O_WRONLY);
+    ASSERT_TEST(fd >= 0);
+    ASSERT_TEST(pwrite(fd, "99999999999999999999", 20, status.st_size - 21) == 20);
+    ASSERT_TEST(IS_NULL(toc_open(path)));
+    ASSERT_TEST(pwrite(fd, "00000000000000000000", 20, status.st_size - 21) == 20);
+    ASSERT_TEST(IS_NULL(toc_open(path)));
+    close(fd);
+
+    // Without an index at all
+    ASSERT_TEST(IS_NULL(toc_open("test/file_a.txt")));
+
+    remove(path);
+    return true;
+}
+
+#define TEST_TREE         "walk_test_tree" /**< Made and removed by the walk tests */
+#define TEST_TREE_DIRS    4
+#define TEST_TREE_SUBDIRS 3
+#define TEST_TREE_FILES   5
+
+/**
+ * @brief Writes a test file of text, every byte known from its offset.
+ */
+static bool write_test_file(const char *path, size_t size)
+{
+    FILE *file = fopen(path, "wb");
+    if (IS_NULL(file))
+        return false;
+    for (size_t i = 0; i < size; i++)
+        fputc(((i % 61) == 60) ? '\n' : ('a' + (int)(i % 26)), file);
+    return (fclose(file) == 0);
+}
+
+/**
+ * @brief Makes a small tree with files of many sizes, one of them empty and
+ * some large enough for the kernel to move them, and in every directory a
+ * file that "*.skip" ignores.
+ * 
+ * @param[out] bytes_out Size of the files that are not ignored.
+ * 
+ * @return false if the tree could not be made.
+ */
+static bool make_test_tree(size_t *bytes_out)
+{
+    char path[128];
+    *bytes_out = 0;
+    bool made = (mkdir(TEST_TREE, 0755) == 0);
+    for (int d = 0; made && (d < TEST_TREE_DIRS); d++)
+    {
+        snprintf(path, sizeof(path), TEST_TREE "/d%d", d);
+        made = (mkdir(path, 0755) == 0);
+        snprintf(path, sizeof(path), TEST_TREE "/d%d/x.skip", d);
+        made = made && write_test_file(path, 10);
+        for (int s = 0; made && (s < TEST_TREE_SUBDIRS); s++)
+        {
+            snprintf(path, sizeof(path), TEST_TREE "/d%d/s%d", d, s);
+            made = (mkdir(path, 0755) == 0);
+            for (int f = 0; made && (f < TEST_TREE_FILES); f++)
+            {
+                size_t size = ((size_t)(((d * 15) + (s * 5) + f) * 7919) % 6000) + 1;
+                if ((s == 0) && (f == 4))
+                    size = 100000;
+                if ((d == 0) && (s == 0) && (f == 3))
+                    size = 0;
+                snprintf(path, sizeof(path), TEST_TREE "/d%d/s%d/f%d.c", d, s, f);
+                made = write_test_file(path, size);
+                *bytes_out += size;
+            }
+        }
+    }
+    return made;
+}
+
+/**
+ * @brief Removes what make_test_tree() made.
+ */
+static void remove_test_tree(void)
+{
+    char path[128];
+    for (int d = 0; d < TEST_TREE_DIRS; d++)
+    {
+        for (int s = 0; s < TEST_TREE_SUBDIRS; s++)
+        {
+            for (int f = 0; f < TEST_TREE_FILES; f++)
+            {
+                snprintf(path, sizeof(path), TEST_TREE "/d%d/s%d/f%d.c", d, s, f);
+                remove(path);
+            }
+            snprintf(path, sizeof(path), TEST_TREE "/d%d/s%d", d, s);
+            rmdir(path);
+        }
+        snprintf(path, sizeof(path), TEST_TREE "/d%d/x.skip", d);
+        remove(path);
+        snprintf(path, sizeof(path), TEST_TREE "/d%d", d);
+        rmdir(path);
+    }
+    rmdir(TEST_TREE);
+}
+
+/**
+ * @brief Walks the test tree into an output, with one thread or many, and
+ * the options of an ingest.
+ */
+static bool walk_test_tree_with(ingestify_t *ingestify, ignore_set_t *ignore, const char *output_path, unsigned int thread_count)
+{
+    writer_t *output = writer_open(output_path, WRITER_BUFFER_DEFAULT);
+    if (IS_NULL(output))
+        return false;
+    ingestify_start_output(ingestify);
+    bool opened = (thread_count > 1) ? pwalk_traverse_and_write(ingestify, TEST_TREE, ignore, output, output_path, INGESTIFY_MAX_SIZE_AUTO, thread_count)
+                                     : ingestify_traverse_and_write(ingestify, TEST_TREE, ignore, output, output_path, INGESTIFY_MAX_SIZE_AUTO);
+    return writer_close(output) && opened;
+}
+
+/**
+ * @brief Walks the test tree into an output, with one thread or many.
+ */
+static bool walk_test_tree(ignore_set_t *ignore, const char *output_path, unsigned int thread_count)
+{
+    ingestify_t *ingestify = ingestify_create();
+    bool walked = EXISTS(ingestify) && walk_test_tree_with(ingestify, ignore, output_path, thread_count);
+    ingestify_destroy(ingestify);
+    return walked;
+}
+
+/**
+ * @brief Reads a whole file into memory.
+ */
+static char *read_whole_file(const char *path, size_t *size_out)
+{
+    int fd = open(path, O_RDONLY);
+    off_t size = (fd >= 0) ? lseek(fd, 0, SEEK_END) : -1;
+    char *data = (size >= 0) ? malloc((size_t)size + 1) : NULL;
+    bool read = EXISTS(data) && (pread(fd, data, (size_t)size, 0) == size);
+    if (fd >= 0)
+        close(fd);
+    if (!read)
+    {
+        free(data);
+        return NULL;
+    }
+    *size_out = (size_t)size;
+    return data;
+}
+
+bool test__pwalk_traverse_and_write__same_as_one_thread(void)
+{
+    size_t bytes;
+    remove_test_tree();
+    ASSERT_TEST(make_test_tree(&bytes));
+
+    char entry_0[] = "*.skip";
+    char *entries[] = { entry_0 };
+    ignore_list_t ignore_list = { .entries = entries, .count = 1 };
+    ASSERT_TEST(ignore_compile(&ignore_list) == true);
+    ignore_set_t *ignore = ignore_set_create(&ignore_list, NULL);
+    ASSERT_TEST(EXISTS(ignore));
+
+    // Workers scan directories in any order, the output comes out in the order of one thread
+    ASSERT_TEST(walk_test_tree(ignore, "walk_test_1.txt", 1));
+    ASSERT_TEST(walk_test_tree(ignore, "walk_test_4.txt", 4));
+    ignore_set_release(ignore);
+    ignore_free_rules(&ignore_list);
+    remove_test_tree();
+
+    size_t size_1 = 0;
+    size_t size_4 = 0;
+    char *output_1 = read_whole_file("walk_test_1.txt", &size_1);
+    char *output_4 = read_whole_file("walk_test_4.txt", &size_4);
+    remove("walk_test_1.txt");
+    remove("walk_test_4.txt");
+    ASSERT_TEST(EXISTS(output_1) && EXISTS(output_4));
+    ASSERT_TEST(size_1 > bytes);
+    ASSERT_TEST(size_1 == size_4);
+    ASSERT_TEST(memcmp(output_1, output_4, size_1) == 0);
+
+    output_1[size_1] = '\0';
+    ASSERT_TEST(IS_NULL(strstr(output_1, ".skip")));
+    free(output_1);
+    free(output_4);
+    return true;
+}
+
+bool test__progress_counts__match_what_was_written(void)
+{
+    size_t bytes;
+    remove_test_tree();
+    ASSERT_TEST(make_test_tree(&bytes));
+
+    char entry_0[] = "*.skip";
+    char *entries[] = { entry_0 };
+    ignore_list_t ignore_list = { .entries = entries, .count = 1 };
+    ignore_set_t *ignore = ignore_set_create(&ignore_list, NULL);
+    ASSERT_TEST(EXISTS(ignore));
+
+    // Counted by the workers of both walks, the totals are what the output holds, and each ingest counts its own
+    for (unsigned int thread_count = 1; thread_count <= 4; thread_count += 3)
+    {
+        ingestify_t *ingestify = ingestify_create();
+        ASSERT_TEST(EXISTS(ingestify));
+        progress_counts_t counts;
+        bool walked = walk_test_tree_with(ingestify, ignore, "walk_test_1.txt", thread_count);
+        progress_counts(ingestify_progress(ingestify), &counts);
+        ingestify_destroy(ingestify);
+        ASSERT_TEST(walked);
+
+        size_t files = TEST_TREE_DIRS * TEST_TREE_SUBDIRS * TEST_TREE_FILES;
+        size_t dirs = TEST_TREE_DIRS + (TEST_TREE_DIRS * TEST_TREE_SUBDIRS);
+        ASSERT_TEST(counts.written == files);
+        ASSERT_TEST(counts.ignored == TEST_TREE_DIRS);
+        ASSERT_TEST(counts.seen == (files + dirs + TEST_TREE_DIRS));
+        ASSERT_TEST(counts.bytes == bytes);
+    }
+    ignore_set_release(ignore);
+    remove_test_tree();
+    remove("walk_test_1.txt");
+    return true;
+}
+
+/**
+ * @brief Walks the test tree like --incremental does, taking what it can from
+ * the previous output and its manifest, and writing the manifest for the next.
+ * 
+ * @param[out] read_out Bytes of files read, 0 without INGESTIFY_STATS.
+ */
+static bool walk_test_tree_incremental(ingestify_t *ingestify, ignore_set_t *ignore, const char *output_path, uint64_t *read_out)
+{
+    manifest_t *next = manifest_create();
+    manifest_t *previous = manifest_load(output_path);
+    writer_t *output = EXISTS(previous) ? writer_open_over(output_path, WRITER_BUFFER_DEFAULT) : writer_open(output_path, WRITER_BUFFER_DEFAULT);
+    bool walked = EXISTS(next) && EXISTS(output);
+    *read_out = 0;
+#if defined(INGESTIFY_STATS)
+    stats_enable(0);
+#endif
+    if (walked)
+    {
+        ingestify_set_manifests(ingestify, previous, next);
+        ingestify_start_output(ingestify);
+        walked = ingestify_traverse_and_write(ingestify, TEST_TREE, ignore, output, output_path, INGESTIFY_MAX_SIZE_AUTO);
+        ingestify_finish_output(ingestify, output);
+        ingestify_set_manifests(ingestify, NULL, NULL);
+    }
+#if defined(INGESTIFY_STATS)
+    stats_total_t totals[STATS_PHASE_COUNT];
+    stats_totals(totals);
+    *read_out = totals[STATS_READ].bytes;
+    stats_disable();
+#endif
+    walked = EXISTS(output) && writer_close(output) && walked && manifest_save(next, output_path);
+    manifest_free(previous);
+    manifest_free(next);
+    return walked;
+}
+
+/**
+ * @brief Tells whether two outputs have the same bytes.
+ */
+static bool same_output(const char *path, const char *other_path)
+{
+    size_t size = 0;
+    size_t other_size = 0;
+    char *data = read_whole_file(path, &size);
+    char *other = read_whole_file(other_path, &other_size);
+    bool same = EXISTS(data) && EXISTS(other) && (size == other_size) && (memcmp(data, other, size) == 0);
+    free(data);
+    free(other);
+    return same;
+}
+
+bool test__ingestify_reuse_file__incremental_same_as_fresh_run(void)
+{
+    size_t bytes;
+    remove_test_tree();
+    ASSERT_TEST(make_test_tree(&bytes));
+    ignore_set_t *ignore = ignore_set_create(NULL, NULL);
+    ingestify_t *ingestify = ingestify_create();
+    ASSERT_TEST(EXISTS(ignore) && EXISTS(ingestify));
+
+    // Files changed in the second before a run are not trusted by the next one
+    usleep(1100 * 1000);
+    uint64_t read;
+    ASSERT_TEST(walk_test_tree_incremental(ingestify, ignore, "walk_test_1.txt", &read));
+
+    // Only the changed file is read again, the rest is taken from the previous output
+    const char *changed = TEST_TREE "/d1/s1/f1.c";
+    struct stat changed_stat;
+    ASSERT_TEST(stat(changed, &changed_stat) == 0);
+    ASSERT_TEST(write_test_file(changed, 777));
+    ASSERT_TEST(walk_test_tree_incremental(ingestify, ignore, "walk_test_1.txt", &read));
+    ASSERT_TEST(walk_test_tree(ignore, "walk_test_2.txt", 1));
+    ASSERT_TEST(same_output("walk_test_1.txt", "walk_test_2.txt"));
+#if defined(INGESTIFY_STATS)
+    ASSERT_TEST(read == 777);
+#endif
+
+    // Unchanged, but with counted tokens in every header, so every file is read again
+    ingestify_set_tokens(ingestify, true, 0, 0);
+    ASSERT_TEST(walk_test_tree_incremental(ingestify, ignore, "walk_test_1.txt", &read));
+    ASSERT_TEST(walk_test_tree_with(ingestify, ignore, "walk_test_2.txt", 1));
+    ASSERT_TEST(same_output("walk_test_1.txt", "walk_test_2.txt"));
+#if defined(INGESTIFY_STATS)
+    ASSERT_TEST(read >= ((bytes - (size_t)changed_stat.st_size) + 777 + (TEST_TREE_DIRS * 10)));
+#endif
+
+    ingestify_destroy(ingestify);
+    ignore_set_release(ignore);
+    remove_test_tree();
+    remove("walk_test_1.txt");
+    remove("walk_test_1.txt" MANIFEST_SUFFIX);
+    remove("walk_test_2.txt");
+    return true;
+}
+
+bool test__shard_plan__cuts_where_a_directory_starts(void)
+{
+    shard_t *shard = shard_create();
+    ASSERT_TEST(EXISTS(shard));
+
+    // Three files of 100 bytes in each of two directories
+    const char *paths[] = { "a/0.c", "a/1.c", "a/2.c", "b/0.c", "b/1.c", "b/2.c" };
+    for (size_t i = 0; i < 6; i++)
+        ASSERT_TEST(shard_add(shard, paths[i], i * 100, 10));
+
+    // Filled in order, "b/0.c" would join the first shard, which is full enough without it
+    shard_limits_t limits = { .max_bytes = 400 };
+    ASSERT_TEST(shard_plan(shard, 600, &limits) == 2);
+    ASSERT_TEST(shard_get(shard, 0)->start == 0);
+    ASSERT_TEST(shard_get(shard, 0)->end == 300);
+    ASSERT_TEST(shard_get(shard, 0)->files == 3);
+    ASSERT_TEST(shard_get(shard, 0)->tokens == 30);
+    ASSERT_TEST(shard_get(shard, 1)->start == 300);
+    ASSERT_TEST(shard_get(shard, 1)->end == 600);
+
+    // Too far back to be worth it, the directory is split
+    limits.max_bytes = 500;
+    ASSERT_TEST(shard_plan(shard, 600, &limits) == 2);
+    ASSERT_TEST(shard_get(shard, 0)->files == 5);
+
+    limits = (shard_limits_t){ .max_tokens = 20 };
+    ASSERT_TEST(shard_plan(shard, 600, &limits) == 3);
+    ASSERT_TEST(shard_get(shard, 1)->first_file == 2);
+
+    // A file over the limit is a shard of its own
+    limits = (shard_limits_t){ .max_bytes = 50 };
+    ASSERT_TEST(shard_plan(shard, 600, &limits) == 6);
+
+    limits = (shard_limits_t){ .count = 4 };
+    ASSERT_TEST(shard_plan(shard, 600, &limits) <= 4);
+    limits = (shard_limits_t){ .count = 1 };
+    ASSERT_TEST(shard_plan(shard, 600, &limits) == 1);
+    ASSERT_TEST(shard_get(shard, 0)->end == 600);
+    shard_free(shard);
+
+    ASSERT_TEST(shard_is_path("out.2.txt", "out.txt")     == true);
+    ASSERT_TEST(shard_is_path("out.17.txt", "out.txt")    == true);
+    ASSERT_TEST(shard_is_path("out.txt", "out.txt")       == false);
+    ASSERT_TEST(shard_is_path("out.x.txt", "out.txt")     == false);
+    ASSERT_TEST(shard_is_path("out.2.md", "out.txt")      == false);
+    ASSERT_TEST(shard_is_path("dir/out.3", "dir/out")     == true);
+    ASSERT_TEST(shard_is_path("dir.d/out.3", "dir.d/out") == true);
+
+    char *path = shard_path("dir.d/out", 2, 12);
+    ASSERT_TEST(EXISTS(path) && (strcmp(path, "dir.d/out.03") == 0));
+    free(path);
+    return true;
+}
+
+bool test__shard_write__shards_add_up_to_the_output(void)
+{
+    size_t bytes;
+    remove_test_tree();
+    ASSERT_TEST(make_test_tree(&bytes));
+    ignore_set_t *ignore = ignore_set_create(NULL, NULL);
+    shard_t *shards = shard_create();
+    ingestify_t *ingestify = ingestify_create();
+    ASSERT_TEST(EXISTS(ignore) && EXISTS(shards) && EXISTS(ingestify));
+
+    ingestify_set_shards(ingestify, shards);
+    bool walked = walk_test_tree_with(ingestify, ignore, "shard_test.txt", 4);
+    ingestify_destroy(ingestify);
+    ignore_set_release(ignore);
+    remove_test_tree();
+    ASSERT_TEST(walked);
+
+    size_t size = 0;
+    char *output = read_whole_file("shard_test.txt", &size);
+    ASSERT_TEST(EXISTS(output));
+
+    shard_limits_t limits = { .max_bytes = 40000 };
+    size_t count = shard_plan(shards, size, &limits);
+    ASSERT_TEST(count > 3);
+
+    // Shards of an earlier run go, whatever their number or its width
+    ASSERT_TEST(write_test_file("shard_test.007.txt", 16) && write_test_file("shard_test.99.txt", 16));
+    ASSERT_TEST(shard_remove_all("shard_test.txt"));
+    ASSERT_TEST((access("shard_test.007.txt", F_OK) != 0) && (access("shard_test.99.txt", F_OK) != 0));
+    ASSERT_TEST(access("shard_test.txt", F_OK) == 0);
+    ASSERT_TEST(shard_write(shards, "shard_test.txt", "shard_test.txt"));
+
+    // In order and whole, every shard within the limit unless one file is larger
+    size_t files = 0;
+    uint64_t end = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const shard_range_t *range = shard_get(shards, i);
+        ASSERT_TEST(range->start == end);
+        ASSERT_TEST(((range->end - range->start) <= limits.max_bytes) || (range->files == 1));
+        ASSERT_TEST(memcmp(&output[range->start], "\nFILE \"", 7) == 0);
+
+        char *path = shard_path("shard_test.txt", i, count);
+        size_t shard_size = 0;
+        char *contents = EXISTS(path) ? read_whole_file(path, &shard_size) : NULL;
+        if (EXISTS(path))
+            remove(path);
+        free(path);
+        ASSERT_TEST(EXISTS(contents));
+        ASSERT_TEST(shard_size == (range->end - range->start));
+        ASSERT_TEST(memcmp(contents, &output[range->start], shard_size) == 0);
+        free(contents);
+
+        files += range->files;
+        end = range->end;
+    }
+    ASSERT_TEST(end == size);
+    ASSERT_TEST(files == (TEST_TREE_DIRS * TEST_TREE_SUBDIRS * TEST_TREE_FILES) + TEST_TREE_DIRS);
+
+    free(output);
+    shard_free(shards);
+    remove("shard_test.txt");
+    return true;
+}
+
+bool test__shard_open__streamed_shards_match_the_plan(void)
+{
+    size_t bytes;
+    remove_test_tree();
+    ASSERT_TEST(make_test_tree(&bytes));
+    ignore_set_t *ignore = ignore_set_create(NULL, NULL);
+    ASSERT_TEST(EXISTS(ignore));
+    bool walked = walk_test_tree(ignore, "walk_test_1.txt", 1);
+    size_t size = 0;
+    char *whole = walked ? read_whole_file("walk_test_1.txt", &size) : NULL;
+    remove("walk_test_1.txt");
+    ASSERT_TEST(EXISTS(whole));
+
+    // By size, and by tokens with the counts in the headers, where cuts move back to a directory
+    shard_limits_t cases[] = { { .max_bytes = 40000 }, { .max_bytes = 5000 }, { .max_tokens = 4000 } };
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        ASSERT_TEST(write_test_file("shard_test.0042.txt", 16)); // Left by an earlier run
+        shard_t *shards = shard_create();
+        ingestify_t *ingestify = ingestify_create();
+        ASSERT_TEST(EXISTS(shards) && EXISTS(ingestify));
+        ingestify_set_shards(ingestify, shards);
+        ingestify_set_tokens(ingestify, cases[c].max_tokens > 0, 0, 0);
+
+        writer_sink_t sink;
+        ASSERT_TEST(shard_open(shards, "shard_test.txt", &cases[c], &sink));
+        writer_t *output = writer_open_sink(&sink, WRITER_BUFFER_DEFAULT);
+        ASSERT_TEST(EXISTS(output));
+        bool opened = ingestify_traverse_and_write(ingestify, TEST_TREE, ignore, output, "shard_test.txt", INGESTIFY_MAX_SIZE_AUTO);
+        ASSERT_TEST(writer_close(output) && opened);
+        ingestify_destroy(ingestify);
+        ASSERT_TEST(access("shard_test.txt", F_OK) != 0);
+        ASSERT_TEST(access("shard_test.0042.txt", F_OK) != 0);
+
+        size_t count = shard_count(shards);
+        ASSERT_TEST(count > 1);
+        shard_range_t *streamed = malloc(count * sizeof(shard_range_t));
+        ASSERT_TEST(EXISTS(streamed));
+        memcpy(streamed, shard_get(shards, 0), count * sizeof(shard_range_t));
+
+        // Cut where the plan of the whole output cuts, and together they are the whole output
+        uint64_t total = streamed[count - 1].end;
+        ASSERT_TEST(shard_plan(shards, total, &cases[c]) == count);
+        char *joined = malloc(total + 1);
+        ASSERT_TEST(EXISTS(joined));
+        size_t joined_size = 0;
+        bool same = true;
+        for (size_t i = 0; i < count; i++)
+        {
+            same = same && (memcmp(&streamed[i], shard_get(shards, i), sizeof(shard_range_t)) == 0);
+            char *path = shard_path("shard_test.txt", i, count);
+            size_t shard_size = 0;
+            char *contents = EXISTS(path) ? read_whole_file(path, &shard_size) : NULL;
+            if (EXISTS(path))
+                remove(path);
+            free(path);
+            same = same && EXISTS(contents) && (shard_size == (streamed[i].end - streamed[i].start)) &&
+                   ((joined_size + shard_size) <= total);
+            if (same)
+                memcpy(&joined[joined_size], contents, shard_size);
+            joined_size += shard_size;
+            free(contents);
+        }
+        if (cases[c].max_tokens == 0)
+            same = same && (joined_size == size) && (memcmp(joined, whole, size) == 0);
+        free(joined);
+        free(streamed);
+        shard_free(shards);
+        ASSERT_TEST(same);
+    }
+
+    ignore_set_release(ignore);
+    remove_test_tree();
+    free(whole);
+    return true;
+}
+
+/**
+ * @brief Output of an ingest taken through callbacks, and what they saw.
+ */
+typedef struct
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+    size_t file_start;  /**< Where the file being taken starts in data */
+    bool in_file;
+    size_t files;
+    size_t misplaced;   /**< Files that did not start with their header, or callbacks out of order */
+    ignore_set_t *ignore;
+    unsigned int thread_count;
+    bool ingested;
+} sink_test_t;
+
+static bool sink_test_begin(void *context, const char *path)
+{
+    sink_test_t *test = context;
+    (void)path;
+    test->misplaced += test->in_file ? 1 : 0;
+    test->in_file = true;
+    test->file_start = test->size;
+    return true;
+}
+
+static bool sink_test_chunk(void *context, const void *data, size_t size)
+{
+    sink_test_t *test = context;
+    if ((test->size + size) > test->capacity)
+    {
+        size_t capacity = (test->capacity * 2) + size;
+        char *grown = realloc(test->data, capacity);
+        if (IS_NULL(grown))
+            return false;
+        test->data = grown;
+        test->capacity = capacity;
+    }
+    memcpy(&test->data[test->size], data, size);
+    test->size += size;
+    return true;
+}
+
+static bool sink_test_end(void *context, const char *path)
+{
+    sink_test_t *test = context;
+    char header[__PATH_MAX + 16];
+    int length = snprintf(header, sizeof(header), "\nFILE \"%s\"", path);
+    bool placed = test->in_file && ((test->size - test->file_start) > (size_t)length) &&
+                  (memcmp(&test->data[test->file_start], header, (size_t)length) == 0);
+    test->misplaced += placed ? 0 : 1;
+    test->in_file = false;
+    test->files++;
+    return true;
+}
+
+static void *sink_test_ingest(void *arg)
+{
+    sink_test_t *test = arg;
+    ingestify_t *ingestify = ingestify_create();
+    ingestify_sink_t sink =
+    {
+        .on_file_begin = sink_test_begin,
+        .on_chunk      = sink_test_chunk,
+        .on_file_end   = sink_test_end,
+        .context       = test,
+    };
+    test->ingested = EXISTS(ingestify) &&
+                     libingestify_ingest(ingestify, TEST_TREE, test->ignore, &sink, INGESTIFY_MAX_SIZE_NONE, test->thread_count);
+    ingestify_destroy(ingestify);
+    return NULL;
+}
+
+bool test__libingestify_ingest__concurrent_ingests_match_the_file(void)
+{
+    size_t bytes;
+    remove_test_tree();
+    ASSERT_TEST(make_test_tree(&bytes));
+
+    char entry_0[] = "*.skip";
+    char *entries[] = { entry_0 };
+    ignore_list_t ignore_list = { .entries = entries, .count = 1 };
+    ignore_set_t *ignore = ignore_set_create(&ignore_list, NULL);
+    ASSERT_TEST(EXISTS(ignore));
+
+    // Two ingests at once, each with a state of its own, one of them walking on threads of its own
+    sink_test_t tests[2] = { { .ignore = ignore, .thread_count = 1 }, { .ignore = ignore, .thread_count = 4 } };
+    pthread_t threads[2];
+    for (int i = 0; i < 2; i++)
+        ASSERT_TEST(pthread_create(&threads[i], NULL, sink_test_ingest, &tests[i]) == 0);
+    for (int i = 0; i < 2; i++)
+        pthread_join(threads[i], NULL);
+
+    bool walked = walk_test_tree(ignore, "walk_test_1.txt", 1);
+    ignore_set_release(ignore);
+    remove_test_tree();
+
+    size_t size = 0;
+    char *expected = walked ? read_whole_file("walk_test_1.txt", &size) : NULL;
+    remove("walk_test_1.txt");
+    ASSERT_TEST(EXISTS(expected));
+
+    bool matched = true;
+    for (int i = 0; i < 2; i++)
+    {
+        matched = matched && tests[i].ingested && (tests[i].size == size) && (memcmp(tests[i].data, expected, size) == 0) &&
+                  (tests[i].files == (TEST_TREE_DIRS * TEST_TREE_SUBDIRS * TEST_TREE_FILES)) && (tests[i].misplaced == 0) &&
+                  !tests[i].in_file;
+        free(tests[i].data);
+    }
+    free(expected);
+    ASSERT_TEST(matched);
+    return true;
+}
+
+#if defined(INGESTIFY_STATS)
+bool test__stats_totals__count_what_the_walk_did(void)
+{
+    size_t bytes;
+    remove_test_tree();
+    ASSERT_TEST(make_test_tree(&bytes));
+
+    char entry_0[] = "*.skip";
+    char *entries[] = { entry_0 };
+    ignore_list_t ignore_list = { .entries = entries, .count = 1 };
+    ignore_set_t *ignore = ignore_set_create(&ignore_list, NULL);
+    ASSERT_TEST(EXISTS(ignore));
+
+    // Added up over the workers, the same for both walks
+    for (unsigned int thread_count = 1; thread_count <= 4; thread_count += 3)
+    {
+        stats_enable(3);
+        ASSERT_TEST(walk_test_tree(ignore, "walk_test_1.txt", thread_count));
+
+        stats_total_t totals[STATS_PHASE_COUNT];
+        stats_totals(totals);
+        size_t output_size = 0;
+        char *output = read_whole_file("walk_test_1.txt", &output_size);
+        free(output);
+
+        size_t files = TEST_TREE_DIRS * TEST_TREE_SUBDIRS * TEST_TREE_FILES;
+        size_t dirs = 1 + TEST_TREE_DIRS + (TEST_TREE_DIRS * TEST_TREE_SUBDIRS);
+        ASSERT_TEST(EXISTS(output));
+        size_t entries = files + (dirs - 1) + TEST_TREE_DIRS;
+        ASSERT_TEST(totals[STATS_READDIR].calls == (entries + (3 * dirs))); // ".", ".." and the end of every directory
+        ASSERT_TEST(totals[STATS_OPEN].calls >= dirs);
+        ASSERT_TEST(totals[STATS_WRITE].bytes == output_size);
+        ASSERT_TEST(totals[STATS_MATCH].calls > 0);
+        ASSERT_TEST(stats_rule_hits("", "*.skip") == TEST_TREE_DIRS);
+        ASSERT_TEST(stats_rule_hits("", "*.c") == 0);
+        stats_disable();
+
+        stats_totals(totals);
+        ASSERT_TEST((totals[STATS_READDIR].calls == 0) && (totals[STATS_WRITE].bytes == 0));
+    }
+    ignore_set_release(ignore);
+    remove_test_tree();
+    remove("walk_test_1.txt");
+    return true;
+}
+
+/**
+ * @brief Counts the times a string is in another.
+ */
+static size_t count_of(const char *text, const char *what)
+{
+    size_t count = 0;
+    for (const char *found = strstr(text, what); EXISTS(found); found = strstr(found + 1, what))
+        count++;
+    return count;
+}
+
+bool test__trace_stop__records_every_folder_and_file(void)
+{
+    size_t bytes;
+    remove_test_tree();
+    ASSERT_TEST(make_test_tree(&bytes));
+
+    char entry_0[] = "*.skip";
+    char *entries[] = { entry_0 };
+    ignore_list_t ignore_list = { .entries = entries, .count = 1 };
+    ignore_set_t *ignore = ignore_set_create(&ignore_list, NULL);
+    ASSERT_TEST(EXISTS(ignore));
+
+    // One event per folder and per file written, whichever thread made it
+    for (unsigned int thread_count = 1; thread_count <= 4; thread_count += 3)
+    {
+        ASSERT_TEST(trace_start("trace_test.json"));
+        ASSERT_TEST(walk_test_tree(ignore, "walk_test_1.txt", thread_count));
+        ASSERT_TEST(trace_stop());
+
+        size_t size = 0;
+        char *trace = read_whole_file("trace_test.json", &size);
+        ASSERT_TEST(EXISTS(trace));
+        trace[size] = '\0'; // Room is kept for it
+        size_t files = TEST_TREE_DIRS * TEST_TREE_SUBDIRS * TEST_TREE_FILES;
+        size_t dirs = 1 + TEST_TREE_DIRS + (TEST_TREE_DIRS * TEST_TREE_SUBDIRS);
+        const char *header = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        ASSERT_TEST(strncmp(trace, header, strlen(header)) == 0);
+        ASSERT_TEST(strcmp(&trace[size - 4], "\n]}\n") == 0);
+        ASSERT_TEST(count_of(trace, "{\"name\":\"file\"") == files);
+        ASSERT_TEST(count_of(trace, "{\"name\":\"dir\"") == dirs);
+        ASSERT_TEST(count_of(trace, "{\"name\":\"readdir\"") > 0);
+        ASSERT_TEST(count_of(trace, "{\"name\":\"write\"") > 0);
+        ASSERT_TEST(count_of(trace, ".skip") == 0);
+        free(trace);
+    }
+
+    // Stopping again is nothing to do
+    ASSERT_TEST(trace_stop());
+    ignore_set_release(ignore);
+    remove_test_tree();
+    remove("walk_test_1.txt");
+    remove("trace_test.json");
+    return true;
+}
+#endif
+
+#if defined(__linux__)
+/**
+ * @brief Moves bytes with fd_transfer(), and copies what the kernel refused
+ * to move with read and write, as the callers do.
+ * 
+ * @return size_t Bytes moved or copied.
+ */
+static size_t transfer_or_copy(int out_fd, int in_fd, size_t size, bool *refused)
+{
+    int error;
+    size_t done = fd_transfer(out_fd, in_fd, size, fd_transfer_method(out_fd), refused, &error);
+    char chunk[BUFSIZ];
+    while (*refused && (done < size))
+    {
+        size_t wanted = ((size - done) < sizeof(chunk)) ? (size - done) : sizeof(chunk);
+        size_t n = read_full(in_fd, chunk, wanted);
+        if ((n == 0) || (write(out_fd, chunk, n) != (ssize_t)n))
+            break;
+        done += n;
+    }
+    return done;
+}
+
+bool test__fd_transfer__into_files_and_pipes(void)
+{
+    // Less than a pipe holds, so that nothing has to read it meanwhile
+    static char data[48 * 1024];
+    static char read_back[sizeof(data)];
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = (char)((i * 31) >> 3);
+    const char *input_path = "transfer_test_input.bin";
+    const char *output_path = "transfer_test_output.bin";
+    FILE *file = fopen(input_path, "wb");
+    ASSERT_TEST(EXISTS(file));
+    ASSERT_TEST(fwrite(data, 1, sizeof(data), file) == sizeof(data));
+    fclose(file);
+
+    // File to file, copy_file_range()
+    bool refused = true;
+    int in_fd = open(input_path, O_RDONLY);
+    int out_fd = open(output_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ASSERT_TEST((in_fd >= 0) && (out_fd >= 0));
+    ASSERT_TEST(transfer_or_copy(out_fd, in_fd, sizeof(data), &refused) == sizeof(data));
+    ASSERT_TEST(pread(out_fd, read_back, sizeof(read_back), 0) == (ssize_t)sizeof(data));
+    ASSERT_TEST(memcmp(read_back, data, sizeof(data)) == 0);
+
+    // File to pipe, splice()
+    int pipe_fds[2];
+    ASSERT_TEST(pipe(pipe_fds) == 0);
+    ASSERT_TEST(lseek(in_fd, 0, SEEK_SET) == 0);
+    ASSERT_TEST(transfer_or_copy(pipe_fds[1], in_fd, sizeof(data), &refused) == sizeof(data));
+    close(pipe_fds[1]);
+    ASSERT_TEST(read_full(pipe_fds[0], read_back, sizeof(read_back)) == sizeof(data));
+    ASSERT_TEST(memcmp(read_back, data, sizeof(data)) == 0);
+    close(pipe_fds[0]);
+
+    // From a pipe, which copy_file_range() and sendfile() refuse, so splice() takes over
+    ASSERT_TEST(pipe(pipe_fds) == 0);
+    ASSERT_TEST(write(pipe_fds[1], data, sizeof(data)) == (ssize_t)sizeof(data));
+    close(pipe_fds[1]);
+    ASSERT_TEST(ftruncate(out_fd, 0) == 0);
+    ASSERT_TEST(lseek(out_fd, 0, SEEK_SET) == 0);
+    ASSERT_TEST(transfer_or_copy(out_fd, pipe_fds[0], sizeof(data), &refused) == sizeof(data));
+    ASSERT_TEST(refused == false);
+    ASSERT_TEST(pread(out_fd, read_back, sizeof(read_back), 0) == (ssize_t)sizeof(data));
+    ASSERT_TEST(memcmp(read_back, data, sizeof(data)) == 0);
+    close(pipe_fds[0]);
+
+    // From a socket, which no method takes, so the caller copies it
+    int socket_fds[2];
+    ASSERT_TEST(socketpair(AF_UNIX, SOCK_STREAM, 0, socket_fds) == 0);
+    ASSERT_TEST(write(socket_fds[0], data, 4096) == 4096);
+    close(socket_fds[0]);
+    ASSERT_TEST(ftruncate(out_fd, 0) == 0);
+    ASSERT_TEST(lseek(out_fd, 0, SEEK_SET) == 0);
+    ASSERT_TEST(transfer_or_copy(out_fd, socket_fds[1], 4096, &refused) == 4096);
+    ASSERT_TEST(refused == true);
+    ASSERT_TEST(pread(out_fd, read_back, sizeof(read_back), 0) == 4096);
+    ASSERT_TEST(memcmp(read_back, data, 4096) == 0);
+    close(socket_fds[1]);
+
+    // Past the end of the input, it stops without an error
+    int error = -1;
+    ASSERT_TEST((lseek(in_fd, 0, SEEK_SET) == 0) && (ftruncate(out_fd, 0) == 0) && (lseek(out_fd, 0, SEEK_SET) == 0));
+    ASSERT_TEST(fd_transfer(out_fd, in_fd, 2 * sizeof(data), fd_transfer_method(out_fd), &refused, &error) == sizeof(data));
+    ASSERT_TEST((refused == false) && (error == 0));
+
+    // Into an output it cannot write, it stops with the error and leaves the copy to the caller
+    int read_only_fd = open(output_path, O_RDONLY);
+    ASSERT_TEST((read_only_fd >= 0) && (lseek(in_fd, 0, SEEK_SET) == 0));
+    ASSERT_TEST(fd_transfer(read_only_fd, in_fd, 4096, fd_transfer_method(read_only_fd), &refused, &error) == 0);
+    ASSERT_TEST((refused == true) && (error == EBADF));
+    close(read_only_fd);
+
+    close(in_fd);
+    close(out_fd);
+    remove(input_path);
+    remove(output_path);
+    return true;
+}
+#endif
+
+#if !defined(_WIN32)
+#define MMAP_TEST_INPUT  "mmap_test_input.txt"
+#define MMAP_TEST_OUTPUT "mmap_test_output.fifo"
+#define MMAP_TEST_SIZE   (12 * 1024 * 1024) /**< Three slices of INGESTIFY_MMAP_SLICE */
+#define MMAP_TEST_CUT    (6 * 1024 * 1024)
+
+/**
+ * @brief What the reader of the output of the mmap test got.
+ */
+typedef struct
+{
+    char *data;
+    size_t size;
+} mmap_test_reader_t;
+
+/**
+ * @brief Reads the output of the mmap test from its pipe, and cuts the input
+ * short once the first slice of it is being written, so that the file
+ * shrinks under its mapping.
+ */
+static void *mmap_test_reader(void *arg)
+{
+    mmap_test_reader_t *reader = arg;
+    int fd = open(MMAP_TEST_OUTPUT, O_RDONLY);
+    bool cut = false;
+    for (ssize_t n = 1; (fd >= 0) && (n > 0) && (reader->size < (MMAP_TEST_SIZE + 4096));)
+    {
+        n = read(fd, &reader->data[reader->size], MMAP_TEST_SIZE + 4096 - reader->size);
+        reader->size += (n > 0) ? (size_t)n : 0;
+        if (!cut && (reader->size >= (1024 * 1024)))
+            cut = (truncate(MMAP_TEST_INPUT, MMAP_TEST_CUT) == 0);
+    }
+    if (fd >= 0)
+        close(fd);
+    return NULL;
+}
+
+bool test__ingestify_write_file__mapped_file_shrinks(void)
+{
+    ASSERT_TEST(write_test_file(MMAP_TEST_INPUT, MMAP_TEST_SIZE));
+    remove(MMAP_TEST_OUTPUT);
+    ASSERT_TEST(mkfifo(MMAP_TEST_OUTPUT, 0644) == 0);
+
+    // The output is a pipe, so the first slice is still being written when the reader cuts the file
+    mmap_test_reader_t reader = { .data = malloc(MMAP_TEST_SIZE + 4096), .size = 0 };
+    ingestify_t *ingestify = ingestify_create();
+    ASSERT_TEST(EXISTS(reader.data) && EXISTS(ingestify));
+    pthread_t thread;
+    ASSERT_TEST(pthread_create(&thread, NULL, mmap_test_reader, &reader) == 0);
+
+    ingestify_set_mmap_min(ingestify, 1);
+    writer_t *output = writer_open(MMAP_TEST_OUTPUT, 0);
+    bool within_limit = EXISTS(output) && ingestify_write_file(ingestify, MMAP_TEST_INPUT, NULL, output, INGESTIFY_MAX_SIZE_AUTO) &&
+                        ingestify_write_file(ingestify, "test/file_a.txt", NULL, output, INGESTIFY_MAX_SIZE_AUTO);
+    bool closed = EXISTS(output) && writer_close(output);
+    ingestify_destroy(ingestify);
+    pthread_join(thread, NULL);
+    remove(MMAP_TEST_OUTPUT);
+    remove(MMAP_TEST_INPUT);
+    ASSERT_TEST(within_limit && closed);
+
+    // Cut off at the new end, after the header and before the newline that ends the file
+    const char *header_end = memchr(&reader.data[1], '\n', reader.size - 1);
+    ASSERT_TEST(EXISTS(header_end));
+    size_t contents_start = (size_t)(header_end - reader.data) + 1;
+    size_t contents_end = contents_start + MMAP_TEST_CUT;
+    ASSERT_TEST(reader.size > contents_end);
+    ASSERT_TEST(reader.data[contents_end] == '\n');
+    for (size_t i = 0; i < MMAP_TEST_CUT; i += 4093)
+        ASSERT_TEST(reader.data[contents_start + i] == (((i % 61) == 60) ? '\n' : ('a' + (int)(i % 26))));
+
+    // The next file follows right after it, whole
+    const char *next = "\nFILE \"test/file_a.txt\" ";
+    ASSERT_TEST(memcmp(&reader.data[contents_end + 1], next, strlen(next)) == 0);
+    header_end = memchr(&reader.data[contents_end + 2], '\n', reader.size - contents_end - 2);
+    ASSERT_TEST(EXISTS(header_end));
+    ASSERT_TEST(reader.size == ((size_t)(header_end - reader.data) + 1 + 38 + 1));
+    free(reader.data);
+    return true;
+}
+#endif
+
+bool test__arena_alloc__aligned_and_kept_until_free(void)
+{
+    arena_t arena = { .block_size = 256 };
+
+    char *name = arena_strndup(&arena, "component.c", 9);
+    ASSERT_TEST(EXISTS(name));
+    ASSERT_TEST(strcmp(name, "component") == 0);
+
+    // Odd sizes still leave the next allocation aligned for any type
+    for (size_t i = 1; i < 64; i++)
+    {
+        void *p = arena_alloc(&arena, i);
+        ASSERT_TEST(EXISTS(p));
+        ASSERT_TEST(((uintptr_t)p % _Alignof(max_align_t)) == 0);
+        memset(p, 0xAB, i);
+    }
+
+    // Larger than a block, gets its own
+    unsigned char *large = arena_calloc(&arena, 4, 256);
+    ASSERT_TEST(EXISTS(large));
+    for (size_t i = 0; i < 1024; i++) ASSERT_TEST(large[i] == 0);
+
+    ASSERT_TEST(strcmp(name, "component") == 0);
+
+    arena_free(&arena);
+    ASSERT_TEST(IS_NULL(arena.head));
+    ASSERT_TEST(EXISTS(arena_alloc(&arena, 8)));
+    arena_free(&arena);
+
+    return true;
+}
+
 int main(void)
 {
     TEST(test__ignore_is_match__empty_list);
@@ -455,6 +2102,44 @@ int main(void)
 
     TEST(test__ignore_is_match__self_test_generic);
     TEST(test__ignore_read_list__generic);
+    TEST(test__ignore_compile__skips_blank_and_comments);
+    TEST(test__ignore_compile__same_as_uncompiled);
+    TEST(test__ignore_is_dir_match__only_whole_subtrees);
+    TEST(test__ignore_is_entry_match__directory_pattern_skips_files);
+    TEST(test__ignore_set_enter__nested_file_wins);
+    TEST(test__uring_read_files__same_with_and_without_ring);
+    TEST(test__writer__same_bytes_as_written);
+    TEST(test__writer_reuse__same_bytes_as_written);
+    TEST(test__manifest_add_subtree__moves_whole_directory);
+    TEST(test__dedup_find__same_contents_same_file);
+    TEST(test__binary_detect__nul_or_invalid_utf8);
+    TEST(test__tokens_feed__pieces_and_limit);
+#if defined(INGESTIFY_ZLIB)
+    TEST(test__compress_open__gzip_blocks_read_as_one_stream);
+#endif
+#if defined(INGESTIFY_ZSTD)
+    TEST(test__compress_open__zstd_frames_read_as_one_stream);
+#endif
+    TEST(test__toc_open__finds_and_extracts_files);
+    TEST(test__toc_open__rejects_damaged_trailer);
+    TEST(test__pwalk_traverse_and_write__same_as_one_thread);
+    TEST(test__progress_counts__match_what_was_written);
+    TEST(test__ingestify_reuse_file__incremental_same_as_fresh_run);
+    TEST(test__shard_plan__cuts_where_a_directory_starts);
+    TEST(test__shard_write__shards_add_up_to_the_output);
+    TEST(test__shard_open__streamed_shards_match_the_plan);
+    TEST(test__libingestify_ingest__concurrent_ingests_match_the_file);
+#if defined(INGESTIFY_STATS)
+    TEST(test__stats_totals__count_what_the_walk_did);
+    TEST(test__trace_stop__records_every_folder_and_file);
+#endif
+#if defined(__linux__)
+    TEST(test__fd_transfer__into_files_and_pipes);
+#endif
+#if !defined(_WIN32)
+    TEST(test__ingestify_write_file__mapped_file_shrinks);
+#endif
+    TEST(test__arena_alloc__aligned_and_kept_until_free);
 
     return display_test_summary();
 }
\ No newline at end of file